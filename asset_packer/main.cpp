@@ -0,0 +1,160 @@
+// Packs the assets of a program in one archive, offline :
+//   asset_packer archive.pak [mesh options] files...
+// .obj files are indexed, optimized and stored as loadOBJCached would cache
+// them, with the mesh options given before them :
+//   -indexed -tangents -interleaved -lods -meshlets : the MESH_CACHE_* flags
+//   -qtangents : VERTEX_QTANGENTS, with -interleaved and -tangents
+//   -floats    : plain float vertices instead of VERTEX_FORMAT_COMPACT
+// .bmp files are compressed to BC1 with their mipmaps, or to BC5 after
+// -normal (until -color), and stored as DDS files would be : AssetArchive
+// uploads them straight from the archive. .dds files are checked and stored
+// as they are, and any other file (shaders) as text. Assets are named by
+// their path as given, so run it from the folder the program runs from. For
+// instance, in basic_shading :
+//   asset_packer data/assets.pak -interleaved data/suzanne.obj data/uvmap.DDS
+//     shaders/StandardShading.vertexshader shaders/StandardShading.fragmentshader
+
+// Include standard headers
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+// Include GLEW, for the GL enums of the textures : no GL call is made
+#include <GL/glew.h>
+
+#include <common/mappedfile.hpp>
+#include <common/meshcache.hpp>
+#include <common/texture.hpp>
+#include <common/blockcompress.hpp>
+#include <common/assetarchive.hpp>
+
+static double now(){
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool hasExtension(const std::string & path, const char * extension){
+	size_t length = strlen(extension);
+	if (path.size() < length)
+		return false;
+	for (size_t i = 0; i < length; i++){
+		char c = path[path.size() - length + i];
+		if (c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+		if (c != extension[i])
+			return false;
+	}
+	return true;
+}
+
+int main(int argc, char ** argv)
+{
+	if (argc < 3){
+		printf("Usage : asset_packer archive.pak [-indexed] [-tangents] [-interleaved] [-lods] [-meshlets] [-qtangents] [-floats] [-normal] [-color] files...\n");
+		return 1;
+	}
+
+	unsigned int meshFlags = 0;
+	unsigned int vertexFormat = VERTEX_FORMAT_COMPACT;
+	bool normalMaps = false;
+	std::vector<std::string> names;
+	std::vector<AssetType> types;
+	std::vector<MappedFile> files;
+	std::vector<std::vector<unsigned char> > blobs; // what was built from the file, if anything
+	double start = now();
+	for (int i = 2; i < argc; i++){
+		if (argv[i][0] == '-'){
+			if (strcmp(argv[i], "-indexed") == 0) meshFlags |= MESH_CACHE_INDEXED;
+			else if (strcmp(argv[i], "-tangents") == 0) meshFlags |= MESH_CACHE_TANGENTS;
+			else if (strcmp(argv[i], "-interleaved") == 0) meshFlags |= MESH_CACHE_INTERLEAVED;
+			else if (strcmp(argv[i], "-lods") == 0) meshFlags |= MESH_CACHE_LODS;
+			else if (strcmp(argv[i], "-meshlets") == 0) meshFlags |= MESH_CACHE_MESHLETS;
+			else if (strcmp(argv[i], "-qtangents") == 0) vertexFormat |= VERTEX_QTANGENTS;
+			else if (strcmp(argv[i], "-floats") == 0) vertexFormat = 0;
+			else if (strcmp(argv[i], "-normal") == 0) normalMaps = true;
+			else if (strcmp(argv[i], "-color") == 0) normalMaps = false;
+			else{
+				printf("Unknown option %s\n", argv[i]);
+				return 1;
+			}
+			continue;
+		}
+
+		// The name the program will ask for
+		std::string name = argv[i];
+		for (size_t c = 0; c < name.size(); c++){
+			if (name[c] == '\\')
+				name[c] = '/';
+		}
+
+		MappedFile file;
+		if (!file.open(argv[i])){
+			printf("%s could not be opened\n", argv[i]);
+			return 1;
+		}
+		AssetType type = ASSET_SOURCE;
+		std::vector<unsigned char> blob;
+		if (hasExtension(name, ".obj")){
+			type = ASSET_MESH;
+			if (!buildMeshCacheBlob((const char *)file.data(), file.size(), meshFlags, blob, vertexFormat)){
+				printf("%s could not be processed\n", argv[i]);
+				return 1;
+			}
+			file.close();
+		}else if (hasExtension(name, ".bmp")){
+			type = ASSET_TEXTURE;
+			file.close();
+			TextureData image, compressed;
+			if (!readBMP(argv[i], image)
+				|| !compressTexture(image, normalMaps ? BLOCK_BC5 : BLOCK_BC1, normalMaps, compressed)
+				|| !writeDDSToMemory(argv[i], compressed, blob))
+				return 1;
+		}else if (hasExtension(name, ".dds")){
+			type = ASSET_TEXTURE;
+			TextureData texture;
+			if (!readDDSFromMemory(file.data(), file.size(), argv[i], texture))
+				return 1;
+		}
+		names.push_back(name);
+		types.push_back(type);
+		files.push_back(std::move(file));
+		blobs.push_back(std::vector<unsigned char>());
+		blobs.back().swap(blob);
+	}
+
+	std::vector<AssetDescription> assets(names.size());
+	for (size_t i = 0; i < names.size(); i++){
+		assets[i].name = names[i].c_str();
+		assets[i].type = types[i];
+		assets[i].data = files[i].isOpen() ? files[i].data() : blobs[i].data();
+		assets[i].size = files[i].isOpen() ? files[i].size() : blobs[i].size();
+	}
+	if (!writeAssetArchive(argv[1], assets.data(), assets.size()))
+		return 1;
+	double packTime = now() - start;
+
+	// What loading costs now : one file to map, then a lookup per asset
+	start = now();
+	AssetArchive archive;
+	if (!archive.open(argv[1])){
+		printf("%s could not be read back\n", argv[1]);
+		return 1;
+	}
+	for (size_t i = 0; i < assets.size(); i++){
+		if (!archive.find(assets[i].name, assets[i].type)){
+			printf("%s is missing from %s\n", assets[i].name, argv[1]);
+			return 1;
+		}
+	}
+	double openTime = now() - start;
+
+	for (size_t i = 0; i < assets.size(); i++){
+		const char * typeName = assets[i].type == ASSET_MESH ? "mesh" : assets[i].type == ASSET_TEXTURE ? "texture" : "source";
+		printf("  %-8s %10u bytes  %s\n", typeName, (unsigned int)assets[i].size, assets[i].name);
+	}
+	printf("%s : %u assets, %u bytes, packed in %.1f ms, opened and searched in %.3f ms\n",
+		argv[1], archive.assetCount(), (unsigned int)archive.size(), packTime * 1e3, openTime * 1e3);
+	return 0;
+}
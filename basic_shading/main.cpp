@@ -25,6 +25,10 @@ using namespace glm;
 #include <common/controls.hpp>
 #include <common/objloader.hpp>
 #include <common/vboindexer.hpp>
+#include <common/meshcache.hpp>
+#include <common/vertexformat.hpp>
+#include <common/assetarchive.hpp>
+#include <common/texturestreamer.hpp>
 
 int main( void )
 {
@@ -85,47 +89,55 @@ int main( void )
 	glGenVertexArrays(1, &VertexArrayID);
 	glBindVertexArray(VertexArrayID);
 
+	// Everything comes from data/assets.pak if asset_packer made it, from the
+	// separate files otherwise. The mesh points into the archive : keep it open.
+	AssetArchive assets;
+	assets.open("data/assets.pak");
+
 	// Create and compile our GLSL program from the shaders
-	GLuint programID = LoadShaders( "shaders/StandardShading.vertexshader", "shaders/StandardShading.fragmentshader" );
+	GLuint programID = assets.loadShaders( "shaders/StandardShading.vertexshader", "shaders/StandardShading.fragmentshader" );
 
 	// Get a handle for our "MVP" uniform
 	GLuint MatrixID = glGetUniformLocation(programID, "MVP");
 	GLuint ViewMatrixID = glGetUniformLocation(programID, "V");
 	GLuint ModelMatrixID = glGetUniformLocation(programID, "M");
 
-	// Load the texture
-	GLuint Texture = loadDDS("data/uvmap.DDS");
+	// Load the texture : only its small levels at first, the finer ones
+	// once suzanne is close enough to show them
+	TextureStreamer streamer;
+	TextureData textureData;
+	StreamedTexture Texture = 0;
+	if (assets.readTexture("data/uvmap.DDS", textureData))
+		Texture = streamer.add(textureData);
 	
 	// Get a handle for our "myTextureSampler" uniform
 	GLuint TextureID  = glGetUniformLocation(programID, "myTextureSampler");
 
-	// Read our .obj file
-	std::vector<glm::vec3> vertices;
-	std::vector<glm::vec2> uvs;
-	std::vector<glm::vec3> normals;
-	bool res = loadOBJ("data/suzanne.obj", vertices, uvs, normals);
+	// Read our .obj file (or rather, its binary cache), as compact interleaved vertices
+	CachedMesh mesh;
+	bool res = assets.loadMesh("data/suzanne.obj", MESH_CACHE_INTERLEAVED, mesh, VERTEX_FORMAT_COMPACT);
 
 	// Load it into a VBO
 
 	GLuint vertexbuffer;
 	glGenBuffers(1, &vertexbuffer);
 	glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3), &vertices[0], GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, mesh.vertexCount * mesh.layout.stride, mesh.interleaved, GL_STATIC_DRAW);
 
-	GLuint uvbuffer;
-	glGenBuffers(1, &uvbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, uvbuffer);
-	glBufferData(GL_ARRAY_BUFFER, uvs.size() * sizeof(glm::vec2), &uvs[0], GL_STATIC_DRAW);
+	// The VAO remembers where every attribute is in the buffer
+	setupVertexAttributes(mesh.layout);
 
-	GLuint normalbuffer;
-	glGenBuffers(1, &normalbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
-	glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(glm::vec3), &normals[0], GL_STATIC_DRAW);
+	// How much of the texture a unit of suzanne covers, and her bounding sphere
+	float uvDensity = computeUVDensity(mesh);
+	float radius = glm::length(mesh.layout.positionExtent);
 
 	// Get a handle for our "LightPosition" uniform
 	glUseProgram(programID);
 	GLuint LightID = glGetUniformLocation(programID, "LightPosition_worldspace");
 
+	// How the shader decodes positions and UVs
+	setVertexLayoutUniforms(programID, mesh.layout);
+
 	do{
 
 		// Clear the screen
@@ -141,6 +153,14 @@ int main( void )
 		glm::mat4 ModelMatrix = glm::mat4(1.0);
 		glm::mat4 MVP = ProjectionMatrix * ViewMatrix * ModelMatrix;
 
+		// Page in the levels suzanne needs from where the camera is, and out those she doesn't
+		glm::vec3 cameraPosition = glm::vec3(glm::inverse(ViewMatrix)[3]);
+		float distance = glm::length(cameraPosition - mesh.layout.positionCenter);
+		int framebufferWidth, framebufferHeight;
+		glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+		streamer.request(Texture, uvDensity, radius, ProjectionMatrix, distance, (float)framebufferHeight);
+		streamer.update();
+
 		// Send our transformation to the currently bound shader, 
 		// in the "MVP" uniform
 		glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP[0][0]);
@@ -152,52 +172,12 @@ int main( void )
 
 		// Bind our texture in Texture Unit 0
 		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, Texture);
+		glBindTexture(GL_TEXTURE_2D, streamer.texture(Texture));
 		// Set our "myTextureSampler" sampler to use Texture Unit 0
 		glUniform1i(TextureID, 0);
 
-		// 1rst attribute buffer : vertices
-		glEnableVertexAttribArray(0);
-		glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-		glVertexAttribPointer(
-			0,                  // attribute
-			3,                  // size
-			GL_FLOAT,           // type
-			GL_FALSE,           // normalized?
-			0,                  // stride
-			(void*)0            // array buffer offset
-		);
-
-		// 2nd attribute buffer : UVs
-		glEnableVertexAttribArray(1);
-		glBindBuffer(GL_ARRAY_BUFFER, uvbuffer);
-		glVertexAttribPointer(
-			1,                                // attribute
-			2,                                // size
-			GL_FLOAT,                         // type
-			GL_FALSE,                         // normalized?
-			0,                                // stride
-			(void*)0                          // array buffer offset
-		);
-
-		// 3rd attribute buffer : normals
-		glEnableVertexAttribArray(2);
-		glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
-		glVertexAttribPointer(
-			2,                                // attribute
-			3,                                // size
-			GL_FLOAT,                         // type
-			GL_FALSE,                         // normalized?
-			0,                                // stride
-			(void*)0                          // array buffer offset
-		);
-
 		// Draw the triangles !
-		glDrawArrays(GL_TRIANGLES, 0, vertices.size() );
-
-		glDisableVertexAttribArray(0);
-		glDisableVertexAttribArray(1);
-		glDisableVertexAttribArray(2);
+		glDrawArrays(GL_TRIANGLES, 0, mesh.vertexCount );
 
 		// Swap buffers
 		glfwSwapBuffers(window);
@@ -209,10 +189,8 @@ int main( void )
 
 	// Cleanup VBO and shader
 	glDeleteBuffers(1, &vertexbuffer);
-	glDeleteBuffers(1, &uvbuffer);
-	glDeleteBuffers(1, &normalbuffer);
 	glDeleteProgram(programID);
-	glDeleteTextures(1, &Texture);
+	streamer.release();
 	glDeleteVertexArrays(1, &VertexArrayID);
 
 	// Close OpenGL window and terminate GLFW
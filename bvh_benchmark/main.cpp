@@ -0,0 +1,169 @@
+// Measures how fast BVHs are built, and how many rays per second they trace,
+// on the meshes of the tutorials (or on the OBJ files given on the command line).
+
+// Include standard headers
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+#include <chrono>
+#include <random>
+
+// Include GLM
+#include <glm/glm.hpp>
+
+#include <common/objloader.hpp>
+#include <common/threadpool.hpp>
+#include <common/bvh.hpp>
+
+static double now(){
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Pinhole cameras all around the mesh, looking at its center : neighbouring
+// rays are neighbouring pixels, as when picking or rendering
+static void cameraRays(const glm::vec3 & center, float radius, int viewCount, int resolution, std::vector<Ray> & rays){
+	for (int view = 0; view < viewCount; view++){
+		float angle = 6.2831853f * view / viewCount;
+		glm::vec3 eye = center + radius * glm::vec3(cosf(angle), 0.3f, sinf(angle)) * 2.5f;
+		glm::vec3 forward = glm::normalize(center - eye);
+		glm::vec3 right = glm::normalize(glm::cross(forward, glm::vec3(0.0f, 1.0f, 0.0f)));
+		glm::vec3 up = glm::cross(right, forward);
+		for (int y = 0; y < resolution; y++){
+			for (int x = 0; x < resolution; x++){
+				// 45 degrees field of view
+				float px = ((x + 0.5f) / resolution * 2.0f - 1.0f) * 0.414f;
+				float py = ((y + 0.5f) / resolution * 2.0f - 1.0f) * 0.414f;
+				Ray ray = {eye, glm::normalize(forward + right * px + up * py), 1e30f};
+				rays.push_back(ray);
+			}
+		}
+	}
+}
+
+// From random points around the mesh towards random points of its bounds,
+// as when baking light probes : the worst case for packets
+static void randomRays(const glm::vec3 & boundsMin, const glm::vec3 & boundsMax, int count, std::vector<Ray> & rays){
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+	float radius = glm::length(boundsMax - boundsMin);
+	for (int i = 0; i < count; i++){
+		glm::vec3 onSphere = glm::normalize(glm::vec3(unit(random) - 0.5f, unit(random) - 0.5f, unit(random) - 0.5f) + glm::vec3(1e-6f));
+		glm::vec3 target = boundsMin + (boundsMax - boundsMin) * glm::vec3(unit(random), unit(random), unit(random));
+		glm::vec3 origin = center + onSphere * radius;
+		Ray ray = {origin, glm::normalize(target - origin), 1e30f};
+		rays.push_back(ray);
+	}
+}
+
+// Closest hit of the ray with every triangle of the mesh, without the BVH
+static void intersectAll(const std::vector<glm::vec3> & vertices, const Ray & ray, RayHit & hit){
+	hit.distance = ray.maxDistance;
+	hit.triangle = BVH_NO_HIT;
+	for (size_t i = 0; i + 2 < vertices.size(); i += 3){
+		glm::vec3 edge1 = vertices[i + 1] - vertices[i];
+		glm::vec3 edge2 = vertices[i + 2] - vertices[i];
+		glm::vec3 p = glm::cross(ray.direction, edge2);
+		float inverseDeterminant = 1.0f / glm::dot(edge1, p);
+		glm::vec3 s = ray.origin - vertices[i];
+		float u = glm::dot(s, p) * inverseDeterminant;
+		glm::vec3 q = glm::cross(s, edge1);
+		float v = glm::dot(ray.direction, q) * inverseDeterminant;
+		float t = glm::dot(edge2, q) * inverseDeterminant;
+		if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t >= 0.0f && t < hit.distance){
+			hit.distance = t;
+			hit.triangle = (unsigned int)(i / 3);
+		}
+	}
+}
+
+// Both hit the same triangle, or another one at the same distance (on an edge)
+static bool sameHit(const RayHit & a, const RayHit & b){
+	return a.triangle == b.triangle || fabsf(a.distance - b.distance) <= 1e-4f * a.distance;
+}
+
+// One ray in bruteForceStride is checked against every triangle
+static const size_t bruteForceStride = 256;
+
+static void benchmarkRays(const char * name, const BVH & bvh, const std::vector<glm::vec3> & vertices, const std::vector<Ray> & rays){
+	size_t count = rays.size();
+	std::vector<RayHit> single(count), packets(count), threaded(count);
+
+	double start = now();
+	for (size_t i = 0; i < count; i++)
+		intersectBVH(bvh, rays[i], single[i]);
+	double singleTime = now() - start;
+
+	start = now();
+	intersectBVH(bvh, rays.data(), count, packets.data(), 1);
+	double packetTime = now() - start;
+
+	start = now();
+	intersectBVH(bvh, rays.data(), count, threaded.data());
+	double threadedTime = now() - start;
+
+	// Packets, on one thread or more, must find the same hits as single rays,
+	// and single rays the same as testing every triangle
+	size_t hitCount = 0, packetDifferences = 0, threadedDifferences = 0, bruteForceDifferences = 0;
+	for (size_t i = 0; i < count; i++){
+		hitCount += single[i].triangle != BVH_NO_HIT;
+		packetDifferences += !sameHit(single[i], packets[i]);
+		threadedDifferences += !sameHit(single[i], threaded[i]);
+		if (i % bruteForceStride == 0){
+			RayHit hit;
+			intersectAll(vertices, rays[i], hit);
+			bruteForceDifferences += !sameHit(hit, single[i]);
+		}
+	}
+
+	printf("  %s rays : %u rays, %.1f%% hit\n", name, (unsigned int)count, 100.0 * hitCount / count);
+	printf("    single rays        : %7.2f Mrays/s\n", count / singleTime * 1e-6);
+	printf("    packets, 1 thread  : %7.2f Mrays/s\n", count / packetTime * 1e-6);
+	printf("    packets, %u threads : %7.2f Mrays/s\n", ThreadPool::global().size() + 1, count / threadedTime * 1e-6);
+	if (packetDifferences > 0)
+		printf("    %u rays hit something else with packets on 1 thread !\n", (unsigned int)packetDifferences);
+	if (threadedDifferences > 0)
+		printf("    %u rays hit something else with packets on %u threads !\n", (unsigned int)threadedDifferences, ThreadPool::global().size() + 1);
+	if (bruteForceDifferences > 0)
+		printf("    %u of %u rays hit something else than with every triangle tested !\n",
+			(unsigned int)bruteForceDifferences, (unsigned int)((count + bruteForceStride - 1) / bruteForceStride));
+}
+
+int main(int argc, char ** argv)
+{
+	std::vector<const char *> paths;
+	for (int i = 1; i < argc; i++)
+		paths.push_back(argv[i]);
+	if (paths.empty()){
+		paths.push_back("../basic_shading/data/suzanne.obj");
+		paths.push_back("../normal_mapping/data/cylinder.obj");
+	}
+
+	for (size_t p = 0; p < paths.size(); p++){
+		std::vector<glm::vec3> vertices;
+		std::vector<glm::vec2> uvs;
+		std::vector<glm::vec3> normals;
+		if (!loadOBJ(paths[p], vertices, uvs, normals))
+			continue;
+
+		BVH bvh;
+		double start = now();
+		buildBVH(vertices, bvh);
+		double buildTime = now() - start;
+		printf("%s : %u triangles, %u BVH nodes built in %.2f ms\n",
+			paths[p], (unsigned int)(vertices.size() / 3), (unsigned int)bvh.nodes.size(), buildTime * 1e3);
+		if (bvh.nodes.empty())
+			continue;
+
+		glm::vec3 boundsMin = bvh.nodes[0].boundsMin, boundsMax = bvh.nodes[0].boundsMax;
+		std::vector<Ray> rays;
+		cameraRays((boundsMin + boundsMax) * 0.5f, glm::length(boundsMax - boundsMin) * 0.5f, 8, 256, rays);
+		benchmarkRays("Camera", bvh, vertices, rays);
+		rays.clear();
+		randomRays(boundsMin, boundsMax, 8 * 256 * 256, rays);
+		benchmarkRays("Random", bvh, vertices, rays);
+	}
+
+	return 0;
+}
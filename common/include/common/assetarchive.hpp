@@ -0,0 +1,77 @@
+#ifndef ASSETARCHIVE_HPP
+#define ASSETARCHIVE_HPP
+
+#include <cstddef>
+
+#include "mappedfile.hpp"
+#include "meshcache.hpp"
+#include "texture.hpp"
+
+// What an asset of an archive holds
+enum AssetType{
+	ASSET_MESH = 1,    // a processed OBJ file, as loadOBJCached caches it
+	ASSET_TEXTURE = 2, // a DDS file, as is
+	ASSET_SOURCE = 3   // any other file (shader sources...), as is, followed by a 0
+};
+
+struct ArchiveEntry;
+
+// Every asset of a program in one file, made offline by asset_packer.
+// The archive is mapped, and assets are found by name (their path when they
+// were packed) in a sorted table of contents : loading one copies nothing
+// and parses nothing, and the whole startup opens a single file.
+//
+// The load functions fall back to the files themselves when the archive
+// isn't open or doesn't have the asset, so a program can use them whether
+// the archive was built or not.
+class AssetArchive{
+public:
+	AssetArchive();
+
+	// Returns false, quietly, if the file doesn't exist
+	bool open(const char * path);
+	void close();
+	bool isOpen() const { return entries != NULL; }
+
+	// The bytes of an asset, 64-byte aligned, or NULL if it isn't in the archive
+	const unsigned char * find(const char * name, AssetType type, size_t * size = NULL) const;
+
+	// Replacement for loadOBJCached. The mesh points into the archive : keep
+	// the archive open as long as the mesh is used. The asset must have been
+	// packed with the same flags and vertexFormat.
+	bool loadMesh(const char * name, unsigned int flags, CachedMesh & mesh, unsigned int vertexFormat = VERTEX_FORMAT_COMPACT) const;
+
+	// Replacement for readDDS : the pixels stay in the archive
+	bool readTexture(const char * name, TextureData & texture) const;
+	// Replacement for loadDDS
+	GLuint loadTexture(const char * name) const;
+
+	// Replacement for LoadShaders, compiling straight from the archive
+	GLuint loadShaders(const char * vertexName, const char * fragmentName) const;
+
+	size_t size() const { return file.size(); }
+	unsigned int assetCount() const { return count; }
+
+private:
+	AssetArchive(const AssetArchive &) = delete;
+	AssetArchive & operator=(const AssetArchive &) = delete;
+
+	MappedFile file;
+	const ArchiveEntry * entries;
+	const char * names;
+	unsigned int count;
+};
+
+// The description of one asset to pack. data is what find() returns : for
+// ASSET_SOURCE, writeAssetArchive adds the 0.
+struct AssetDescription{
+	const char * name;
+	AssetType type;
+	const unsigned char * data;
+	size_t size;
+};
+
+// Writes assets to path, as AssetArchive reads them. Names must be unique.
+bool writeAssetArchive(const char * path, const AssetDescription * assets, size_t assetCount);
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef BLOCKCOMPRESS_HPP
+#define BLOCKCOMPRESS_HPP
+
+#include <cstddef>
+
+#include "texture.hpp"
+
+// What compressImage turns 4x4 blocks of pixels into
+enum BlockFormat{
+	BLOCK_BC1, // DXT1 : RGB, 8 bytes per block. Alpha is dropped
+	BLOCK_BC3, // DXT5 : RGBA, 16 bytes per block
+	BLOCK_BC5  // RG, 16 bytes per block : for normal maps, Z is rebuilt in the shader from X and Y
+};
+
+// Bytes of a width x height image in format
+size_t compressedImageSize(BlockFormat format, unsigned int width, unsigned int height);
+
+// Compresses an RGBA image (4 bytes per pixel, rows one after the other) in
+// blocks, written to blocks (compressedImageSize bytes). Sizes that aren't a
+// multiple of 4 are padded with the pixels of the edge.
+// Endpoints are fitted along the principal axis of each block and refined by
+// least squares, on SIMD_LANES blocks at once, with up to maxThreads threads
+// (0 means all the cores) for big images.
+// Returns the sum of the squared errors over the channels that format keeps.
+double compressImage(
+	const unsigned char * rgba, unsigned int width, unsigned int height,
+	BlockFormat format, unsigned char * blocks, unsigned int maxThreads = 0
+);
+
+// Compresses an image and all its mip levels into texture, ready for
+// uploadTexture or writeDDS. The mips come from generateMipmaps : as sRGB
+// colors for BC1 and BC3, renormalized with normalMap.
+// psnr, if not NULL, gets the PSNR of level 0 in dB, over the channels the format keeps.
+bool compressTexture(
+	const unsigned char * rgba, unsigned int width, unsigned int height,
+	BlockFormat format, bool normalMap, TextureData & texture,
+	unsigned int maxThreads = 0, double * psnr = NULL
+);
+
+// Same, from an uncompressed 8 bits texture as readBMP returns it (RGB, BGR, RGBA or BGRA)
+bool compressTexture(
+	const TextureData & source, BlockFormat format, bool normalMap, TextureData & texture,
+	unsigned int maxThreads = 0, double * psnr = NULL
+);
+
+// Expands blocks of internalFormat to RGBA, 4 bytes per pixel, as the GPU
+// would : the DXT1/3/5 formats (sRGB too), and the unsigned RGTC1/2 ones
+// (BC4 and BC5, in R and RG). Returns false for any other format.
+// Uses up to maxThreads threads (0 means all the cores) for big images.
+// Use it where the driver can't, or to check textures without a GPU.
+bool decompressImage(
+	const unsigned char * blocks, unsigned int width, unsigned int height,
+	GLenum internalFormat, unsigned char * rgba, unsigned int maxThreads = 0
+);
+
+// Same, for every level and layer of a compressed texture : rgba then
+// holds GL_RGBA8 (or GL_SRGB8_ALPHA8) pixels, ready for uploadTexture.
+bool decompressTexture(const TextureData & texture, TextureData & rgba, unsigned int maxThreads = 0);
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef BVH_HPP
+#define BVH_HPP
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// One node of a BVH : 32 bytes, two per cache line. Nodes are stored depth
+// first, so the left child of an inner node is the node right after it.
+struct BVHNode{
+	glm::vec3 boundsMin;
+	unsigned int index;   // leaf : first triangle in BVH::triangles. Inner node : right child
+	glm::vec3 boundsMax;
+	unsigned short count; // leaf : number of triangles. 0 for inner nodes
+	unsigned short axis;  // inner node : axis the children were split along
+};
+
+// A triangle, as the intersection test wants it
+struct BVHTriangle{
+	glm::vec3 v0;
+	glm::vec3 edge1; // v1 - v0
+	glm::vec3 edge2; // v2 - v0
+};
+
+struct BVH{
+	std::vector<BVHNode> nodes; // nodes[0] is the root
+	std::vector<BVHTriangle> triangles;        // in leaf order
+	std::vector<unsigned int> triangleIndices; // index in the mesh of each of triangles
+};
+
+struct Ray{
+	glm::vec3 origin;
+	glm::vec3 direction; // not necessarily normalized : distances are in units of its length
+	float maxDistance;
+};
+
+static const unsigned int BVH_NO_HIT = 0xFFFFFFFF;
+
+struct RayHit{
+	float distance;        // maxDistance of the ray if nothing was hit
+	unsigned int triangle; // index of the triangle in the mesh, BVH_NO_HIT if nothing was hit
+	float u, v;            // barycentric coordinates : the hit is at v0 + u * edge1 + v * edge2
+};
+
+// Builds a BVH over a triangle list as loadOBJ returns it (3 vertices per
+// triangle), with the surface area heuristic evaluated in bins. Big nodes
+// are binned, and their children built, on up to maxThreads threads (0 means
+// all the cores). The result doesn't depend on the number of threads.
+void buildBVH(const std::vector<glm::vec3> & vertices, BVH & bvh, unsigned int maxThreads = 0);
+
+// Same, for an indexed mesh
+void buildBVH(
+	const std::vector<unsigned int> & indices, const std::vector<glm::vec3> & vertices,
+	BVH & bvh, unsigned int maxThreads = 0
+);
+
+// Closest hit of the ray with the mesh, both sides of the triangles count.
+// Returns false (and hit.triangle == BVH_NO_HIT) if the ray hits nothing within maxDistance.
+bool intersectBVH(const BVH & bvh, const Ray & ray, RayHit & hit);
+
+// Closest hits of count rays. Rays are traced in packets of neighbours, one
+// per SIMD lane, that walk down the tree together : keep rays that go the
+// same way (pixels of an image, samples of a probe...) next to each other.
+// Uses up to maxThreads threads (0 means all the cores) for big batches.
+void intersectBVH(const BVH & bvh, const Ray * rays, size_t count, RayHit * hits, unsigned int maxThreads = 0);
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef HASH_HPP
+#define HASH_HPP
+
+#include <cstddef>
+
+// 64-bit content hash (XXH64). Fast enough to hash a whole file every time
+// it is opened, and good enough to use as a cache key.
+unsigned long long hash64(const void * data, size_t size, unsigned long long seed = 0);
+
+#endif
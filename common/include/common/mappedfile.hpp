@@ -0,0 +1,37 @@
+#ifndef MAPPEDFILE_HPP
+#define MAPPEDFILE_HPP
+
+#include <cstddef>
+
+// Read-only view of a whole file, mapped in memory by the OS.
+// Nothing is copied : pages are faulted in when they are first touched,
+// and everything is released when the object dies (or close() is called).
+class MappedFile{
+public:
+	MappedFile();
+	~MappedFile();
+
+	MappedFile(MappedFile && other);
+	MappedFile & operator=(MappedFile && other);
+
+	bool open(const char * path);
+	void close();
+
+	bool isOpen() const { return opened; }
+	const unsigned char * data() const { return fileData; }
+	size_t size() const { return fileSize; }
+
+private:
+	MappedFile(const MappedFile &) = delete;
+	MappedFile & operator=(const MappedFile &) = delete;
+
+	const unsigned char * fileData;
+	size_t fileSize;
+	bool opened;
+#ifdef _WIN32
+	void * fileHandle;
+	void * mappingHandle;
+#endif
+};
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef MESHCACHE_HPP
+#define MESHCACHE_HPP
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "mappedfile.hpp"
+#include "vertexformat.hpp"
+#include "meshsimplify.hpp"
+#include "meshlet.hpp"
+
+// What loadOBJCached should store, on top of positions, UVs and normals
+enum MeshCacheFlags{
+	MESH_CACHE_INDEXED  = 1, // index the mesh as in the OBJ file, optimize it for the vertex cache and keep the index buffer
+	MESH_CACHE_TANGENTS = 2, // computeTangentBasis (computeTangentBasisIndexed with MESH_CACHE_INDEXED), and keep tangents & bitangents
+	MESH_CACHE_INTERLEAVED = 4, // one interleaved vertex buffer, in the vertex format given to loadOBJCached
+	MESH_CACHE_LODS = 8,        // with MESH_CACHE_INDEXED : simplified levels of detail after the full mesh, in the same index buffer
+	MESH_CACHE_MESHLETS = 16    // with MESH_CACHE_INDEXED : split the full mesh in meshlets, for cullMeshlets
+};
+
+// A mesh that lives in a binary cache file. All the pointers point
+// straight into the mapped file, and can be given as is to glBufferData.
+struct CachedMesh{
+	unsigned int vertexCount = 0;
+	unsigned int indexCount = 0;  // 0 if not indexed. With MESH_CACHE_LODS, the indices of all the levels
+	unsigned int indexSize = 0;   // 2 (unsigned short) or 4 (unsigned int) bytes per index
+
+	const glm::vec3 * vertices = NULL;
+	const glm::vec2 * uvs = NULL;
+	const glm::vec3 * normals = NULL;
+	const glm::vec3 * tangents = NULL;   // NULL without MESH_CACHE_TANGENTS
+	const glm::vec3 * bitangents = NULL; // NULL without MESH_CACHE_TANGENTS
+	const void * indices = NULL;         // NULL without MESH_CACHE_INDEXED
+
+	// With MESH_CACHE_LODS, the ranges of indices to draw for each level of
+	// detail (see selectLOD). lods[0] is the full mesh.
+	unsigned int lodCount = 0;
+	const LODLevel * lods = NULL;
+
+	// With MESH_CACHE_MESHLETS, ranges of the full detail indices (the
+	// first lods[0].indexCount with MESH_CACHE_LODS) that can be culled separately
+	unsigned int meshletCount = 0;
+	const Meshlet * meshlets = NULL;
+
+	// With MESH_CACHE_INTERLEAVED, the vertices are only there, and the
+	// pointers above are NULL (except indices). unpackVertex reads them back.
+	const void * interleaved = NULL;
+	VertexLayout layout;
+
+	unsigned int index(size_t i) const {
+		return indexSize == 4 ? ((const unsigned int *)indices)[i] : ((const unsigned short *)indices)[i];
+	}
+
+	// Keeps the data alive
+	MappedFile file;
+	std::vector<unsigned char> memory; // only used if the cache file couldn't be written
+};
+
+// Loads an OBJ file through a binary cache stored next to it : path, then the
+// flags and the vertex format in hexadecimal, then ".meshcache"
+// (suzanne.obj.3-0.meshcache for MESH_CACHE_INDEXED | MESH_CACHE_TANGENTS).
+// The first load parses the OBJ and writes the cache; the next ones only map it.
+// The cache is keyed by a hash of the OBJ contents, so editing the OBJ rebuilds it.
+// vertexFormat (VertexFormatFlags) is only used with MESH_CACHE_INTERLEAVED; the
+// tangent frame follows MESH_CACHE_TANGENTS.
+bool loadOBJCached(const char * path, unsigned int flags, CachedMesh & mesh, unsigned int vertexFormat = VERTEX_FORMAT_COMPACT);
+
+// What loadOBJCached stores in the cache file, for the OBJ file in source :
+// for tools that keep meshes elsewhere, as asset_packer does.
+bool buildMeshCacheBlob(const char * source, size_t sourceSize, unsigned int flags, std::vector<unsigned char> & blob, unsigned int vertexFormat = VERTEX_FORMAT_COMPACT);
+
+// Points mesh into a blob of buildMeshCacheBlob, that the caller keeps alive
+// as long as mesh is used. Returns false if the blob is damaged, or was made
+// with other flags.
+bool bindMeshCacheBlob(const unsigned char * blob, size_t blobSize, unsigned int flags, CachedMesh & mesh, unsigned int vertexFormat = VERTEX_FORMAT_COMPACT);
+
+#endif
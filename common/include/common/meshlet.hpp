@@ -0,0 +1,46 @@
+#ifndef MESHLET_HPP
+#define MESHLET_HPP
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// A small cluster of neighbouring triangles, drawn as one range of the index buffer
+struct Meshlet{
+	unsigned int firstIndex;
+	unsigned int indexCount;
+	unsigned int vertexCount; // different vertices used
+
+	// Bounding sphere, in model space
+	glm::vec3 center;
+	float radius;
+
+	// All the triangle normals are within a cone around coneAxis.
+	// coneCutoff is the sine of its half angle; 1 if the cone is too wide to ever be culled.
+	glm::vec3 coneAxis;
+	float coneCutoff;
+};
+
+// Splits an indexed triangle list into meshlets of at most maxVertices
+// vertices and maxTriangles triangles, grown from neighbouring triangles
+// that face the same way. indices are reordered so that each meshlet is a
+// contiguous range (itself ordered for the vertex cache). Run it after optimizeVertexCache.
+void buildMeshlets(
+	std::vector<unsigned int> & indices,
+	const std::vector<glm::vec3> & vertices,
+	std::vector<Meshlet> & meshlets,
+	unsigned int maxVertices = 64,
+	unsigned int maxTriangles = 124
+);
+
+// Puts in visible the meshlets that may be visible : inside the view frustum
+// of mvp (from model space to clip space), and not entirely back-facing
+// from cameraPosition (in model space).
+// Returns the number of triangles that survive.
+size_t cullMeshlets(
+	const Meshlet * meshlets, size_t meshletCount,
+	const glm::mat4 & mvp, const glm::vec3 & cameraPosition,
+	std::vector<unsigned int> & visible
+);
+
+#endif
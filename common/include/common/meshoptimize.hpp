@@ -0,0 +1,47 @@
+#ifndef MESHOPTIMIZE_HPP
+#define MESHOPTIMIZE_HPP
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Optimizations of an indexed triangle list, to run after indexVBO, in this order :
+// optimizeVertexCache, optimizeOverdraw, then optimizeVertexFetch.
+
+// Reorders the triangles so that they reuse the vertices still in the GPU's
+// post-transform cache (Tom Forsyth's "Linear-Speed Vertex Cache Optimisation").
+void optimizeVertexCache(std::vector<unsigned int> & indices, size_t vertexCount);
+
+// Sorts runs of triangles (that optimizeVertexCache left cache-friendly) so
+// that the outer, front-most parts of the mesh tend to be drawn first.
+// Costs very little vertex cache efficiency, and reduces overdraw from any view.
+void optimizeOverdraw(std::vector<unsigned int> & indices, const std::vector<glm::vec3> & vertices);
+
+// Renumbers the vertices in the order the index buffer first uses them, so
+// that vertex fetches walk the vertex buffer forward. remap[old] is the new
+// index of each vertex (0xFFFFFFFF if unused); apply it with remapVertices.
+// Returns the number of vertices used.
+size_t optimizeVertexFetch(std::vector<unsigned int> & indices, size_t vertexCount, std::vector<unsigned int> & remap);
+
+template<class T>
+void remapVertices(std::vector<T> & vertices, const std::vector<unsigned int> & remap, size_t newCount){
+	if (vertices.empty())
+		return;
+	std::vector<T> remapped(newCount);
+	for (size_t i = 0; i < remap.size(); i++){
+		if (remap[i] != 0xFFFFFFFF)
+			remapped[remap[i]] = vertices[i];
+	}
+	vertices.swap(remapped);
+}
+
+// Result of a FIFO post-transform cache simulation
+struct VertexCacheStats{
+	unsigned int transformedVertices;
+	float acmr; // average cache miss ratio : vertex shader runs per triangle (0.5 is ideal, 3 is worst)
+	float atvr; // average transform to vertex ratio : vertex shader runs per vertex (1 is ideal)
+};
+
+VertexCacheStats analyzeVertexCache(const std::vector<unsigned int> & indices, size_t vertexCount, unsigned int cacheSize = 16);
+
+#endif
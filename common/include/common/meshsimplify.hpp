@@ -0,0 +1,56 @@
+#ifndef MESHSIMPLIFY_HPP
+#define MESHSIMPLIFY_HPP
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Simplifies an indexed triangle list down to at most targetIndexCount indices
+// (or as close as the mesh allows), by quadric error edge collapses
+// (Garland & Heckbert, "Surface Simplification Using Quadric Error Metrics").
+// Vertices only ever collapse onto other existing vertices, so the result
+// indexes the same vertex buffer. Open borders and seams (vertices at the same
+// position, but with different UVs or normals) only collapse along themselves,
+// so they keep their shape and the attributes stay continuous.
+// out_error, if not NULL, gets the largest distance to the original surface, in model units.
+// Returns the number of indices left.
+size_t simplifyMesh(
+	const std::vector<unsigned int> & indices,
+	const std::vector<glm::vec3> & vertices,
+	size_t targetIndexCount,
+	std::vector<unsigned int> & out_indices,
+	float * out_error
+);
+
+// One level of detail : a range of a shared index buffer
+struct LODLevel{
+	unsigned int firstIndex;
+	unsigned int indexCount;
+	float error; // distance to the full detail surface, in model units
+};
+
+// Builds up to levelCount levels of detail, each with about ratio times the
+// triangles of the previous one. Level 0 is the mesh itself. All the levels
+// are stored one after the other in lodIndices, and share the vertex buffer.
+// Stops early when the mesh can't be simplified any further.
+void buildLODChain(
+	const std::vector<unsigned int> & indices,
+	const std::vector<glm::vec3> & vertices,
+	std::vector<unsigned int> & lodIndices,
+	std::vector<LODLevel> & levels,
+	unsigned int levelCount = 5,
+	float ratio = 0.5f
+);
+
+// Size in pixels of an error (in world units) seen at distance from the camera,
+// with a perspective projection such as getProjectionMatrix()
+float projectedLODError(float error, const glm::mat4 & projection, float distance, float viewportHeight);
+
+// The coarsest level whose error stays under maxPixelError pixels on screen
+size_t selectLOD(
+	const LODLevel * levels, size_t levelCount,
+	const glm::mat4 & projection, float distance, float viewportHeight,
+	float maxPixelError = 1.0f
+);
+
+#endif
@@ -1,13 +1,48 @@
 #ifndef OBJLOADER_H
 #define OBJLOADER_H
 
+// Big files are parsed on several threads. maxThreads = 1 forces a serial
+// parse, 0 uses every core. The output is the same either way.
 bool loadOBJ(
 	const char * path, 
 	std::vector<glm::vec3> & out_vertices, 
 	std::vector<glm::vec2> & out_uvs, 
-	std::vector<glm::vec3> & out_normals
+	std::vector<glm::vec3> & out_normals,
+	unsigned int maxThreads = 0
 );
 
+// Same as loadOBJ, for an OBJ file that is already in memory
+bool loadOBJFromMemory(
+	const char * data,
+	size_t size,
+	std::vector<glm::vec3> & out_vertices, 
+	std::vector<glm::vec2> & out_uvs, 
+	std::vector<glm::vec3> & out_normals,
+	unsigned int maxThreads = 0
+);
+
+// Loads an OBJ file straight into an indexed mesh, without going through
+// loadOBJ + indexVBO. Vertices are shared between face corners that use the
+// same position/UV/normal indices in the file. Indices are 32 bits.
+bool loadOBJIndexed(
+	const char * path,
+	std::vector<unsigned int> & out_indices,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals,
+	unsigned int maxThreads = 0
+);
+
+// Same as loadOBJIndexed, for an OBJ file that is already in memory
+bool loadOBJIndexedFromMemory(
+	const char * data,
+	size_t size,
+	std::vector<unsigned int> & out_indices,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals,
+	unsigned int maxThreads = 0
+);
 
 
 bool loadAssImp(
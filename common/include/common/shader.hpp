@@ -1,6 +1,96 @@
 #ifndef SHADER_HPP
 #define SHADER_HPP
 
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
 GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path);
 GLuint LoadShadersCode(const std::string& VertexShaderCode,const std::string& FragmentShaderCode);
+// Same, from null terminated sources
+GLuint LoadShadersCode(const char * VertexShaderCode,const char * FragmentShaderCode);
+
+// Linked programs are kept in a cache directory ("shadercache" in the working
+// directory by default), keyed by a hash of their sources and of the driver :
+// the next runs load them with glProgramBinary instead of compiling them.
+// Entries that are damaged, or that the driver refuses, are compiled again.
+// NULL turns the cache off.
+void setShaderCacheDirectory(const char * path);
+
+// The programs compiled and loaded from the cache so far, and the time they took
+struct ShaderCacheStats{
+	unsigned int compiledPrograms, cachedPrograms;
+	double compileSeconds, cacheSeconds;
+};
+ShaderCacheStats shaderCacheStats();
+
+// Compiles many programs at once. Checking a shader right after compiling it
+// waits for the compiler, one shader after the other : here, submit() hands
+// every compile and link to the driver before anything is checked, so that
+// drivers with GL_KHR_parallel_shader_compile (or their own compiler threads)
+// work on all of them together. program() checks a program, and prints its
+// logs, the first time it is needed. Shader files are read on the thread pool
+// as soon as they are added, and cached programs (see setShaderCacheDirectory)
+// aren't compiled at all.
+//
+// Only use it from the GL thread. The programs belong to the caller, as with
+// LoadShaders : ask for all of them before the batch goes away.
+class ShaderBatch{
+public:
+	ShaderBatch();
+	// Waits for the file reads
+	~ShaderBatch();
+
+	// Queue a program, and return its index in the batch
+	unsigned int addFiles(const char * vertex_file_path, const char * fragment_file_path);
+	unsigned int addCode(const std::string& VertexShaderCode, const std::string& FragmentShaderCode);
+
+	// Starts compiling and linking everything queued so far
+	void submit();
+
+	// Whether program(index) would return without waiting for the compiler
+	bool isReady(unsigned int index);
+	// Same, for every program of the batch
+	bool isReady();
+
+	// The program, submitting it if needed and waiting for it. 0 if its files can't be read.
+	GLuint program(unsigned int index);
+
+	unsigned int size() const { return (unsigned int)entries.size(); }
+
+	// Seconds from the first submit() until the last program was checked by
+	// program(), or loaded from the cache : what compiling cost, apart from
+	// the rest of the first frame. 0 while some program isn't checked yet.
+	double readySeconds() const { return readyTime > 0.0 ? readyTime - submitTime : 0.0; }
+	// Seconds since the first submit(), 0 before it
+	double submittedSeconds() const;
+
+private:
+	ShaderBatch(const ShaderBatch &) = delete;
+	ShaderBatch & operator=(const ShaderBatch &) = delete;
+
+	struct Entry{
+		std::string vertexName, fragmentName; // the files, or empty
+		std::future<bool> reading;            // fills the codes, for files
+		std::string vertexCode, fragmentCode;
+		unsigned long long cacheKey;
+		GLuint vertexShader, fragmentShader;
+		GLuint program;
+		bool submitted;
+		bool checked;                         // program is final
+	};
+
+	// Notes the time once every program is checked
+	void updateReadyTime();
+
+	std::vector< std::unique_ptr<Entry> > entries;
+	double submitTime, readyTime;
+};
+
+// Prints what the programs of batch cost at startup : compiled on the first
+// run, loaded from the cache on the next ones (see shaderCacheStats), the
+// time until the last one was ready, and until now. Call it once the first
+// frame that uses them all is swapped.
+void printShaderStartupReport(const ShaderBatch & batch);
 #endif
@@ -0,0 +1,107 @@
+#ifndef SIMDLANES_HPP
+#define SIMDLANES_HPP
+
+// SIMD_LANES floats processed at once, for the batched kernels (tangent
+// space, BVH ray packets...). The width is chosen at compile time : AVX2
+// when the compiler targets it (-mavx2, -march=native, /arch:AVX2), SSE2 on
+// any other x86-64. Elsewhere SIMD_LANES is not defined, and the kernels
+// use their scalar path.
+// Masks are lanes with all bits set (true) or cleared (false).
+
+#include <stddef.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SIMD_LANES 8
+typedef __m256 Lanes;
+static inline Lanes lanesLoad(const float * p){ return _mm256_loadu_ps(p); }
+static inline Lanes lanesGather(const float * p, size_t stride){ return _mm256_set_ps(p[7 * stride], p[6 * stride], p[5 * stride], p[4 * stride], p[3 * stride], p[2 * stride], p[stride], p[0]); }
+static inline Lanes lanesGatherBytes(const unsigned char * p, size_t stride){ return _mm256_cvtepi32_ps(_mm256_set_epi32(p[7 * stride], p[6 * stride], p[5 * stride], p[4 * stride], p[3 * stride], p[2 * stride], p[stride], p[0])); }
+static inline void lanesStore(float * p, Lanes a){ _mm256_storeu_ps(p, a); }
+static inline Lanes lanesSet(float a){ return _mm256_set1_ps(a); }
+static inline Lanes lanesSetBits(unsigned int a){ return _mm256_castsi256_ps(_mm256_set1_epi32((int)a)); }
+static inline Lanes lanesAdd(Lanes a, Lanes b){ return _mm256_add_ps(a, b); }
+static inline Lanes lanesSub(Lanes a, Lanes b){ return _mm256_sub_ps(a, b); }
+static inline Lanes lanesMul(Lanes a, Lanes b){ return _mm256_mul_ps(a, b); }
+static inline Lanes lanesDiv(Lanes a, Lanes b){ return _mm256_div_ps(a, b); }
+static inline Lanes lanesSqrt(Lanes a){ return _mm256_sqrt_ps(a); }
+static inline Lanes lanesMin(Lanes a, Lanes b){ return _mm256_min_ps(a, b); }
+static inline Lanes lanesMax(Lanes a, Lanes b){ return _mm256_max_ps(a, b); }
+static inline Lanes lanesAbs(Lanes a){ return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+static inline Lanes lanesLess(Lanes a, Lanes b){ return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+static inline Lanes lanesLessEqual(Lanes a, Lanes b){ return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+static inline Lanes lanesAnd(Lanes a, Lanes b){ return _mm256_and_ps(a, b); }
+static inline Lanes lanesOr(Lanes a, Lanes b){ return _mm256_or_ps(a, b); }
+static inline Lanes lanesSelect(Lanes mask, Lanes a, Lanes b){ return _mm256_blendv_ps(b, a, mask); }
+static inline Lanes lanesNegateIf(Lanes mask, Lanes a){ return _mm256_xor_ps(a, _mm256_and_ps(mask, _mm256_set1_ps(-0.0f))); }
+static inline int lanesMask(Lanes mask){ return _mm256_movemask_ps(mask); } // bit i : lane i
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SIMD_LANES 4
+typedef __m128 Lanes;
+static inline Lanes lanesLoad(const float * p){ return _mm_loadu_ps(p); }
+static inline Lanes lanesGather(const float * p, size_t stride){ return _mm_set_ps(p[3 * stride], p[2 * stride], p[stride], p[0]); }
+static inline Lanes lanesGatherBytes(const unsigned char * p, size_t stride){ return _mm_cvtepi32_ps(_mm_set_epi32(p[3 * stride], p[2 * stride], p[stride], p[0])); }
+static inline void lanesStore(float * p, Lanes a){ _mm_storeu_ps(p, a); }
+static inline Lanes lanesSet(float a){ return _mm_set1_ps(a); }
+static inline Lanes lanesSetBits(unsigned int a){ return _mm_castsi128_ps(_mm_set1_epi32((int)a)); }
+static inline Lanes lanesAdd(Lanes a, Lanes b){ return _mm_add_ps(a, b); }
+static inline Lanes lanesSub(Lanes a, Lanes b){ return _mm_sub_ps(a, b); }
+static inline Lanes lanesMul(Lanes a, Lanes b){ return _mm_mul_ps(a, b); }
+static inline Lanes lanesDiv(Lanes a, Lanes b){ return _mm_div_ps(a, b); }
+static inline Lanes lanesSqrt(Lanes a){ return _mm_sqrt_ps(a); }
+static inline Lanes lanesMin(Lanes a, Lanes b){ return _mm_min_ps(a, b); }
+static inline Lanes lanesMax(Lanes a, Lanes b){ return _mm_max_ps(a, b); }
+static inline Lanes lanesAbs(Lanes a){ return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+static inline Lanes lanesLess(Lanes a, Lanes b){ return _mm_cmplt_ps(a, b); }
+static inline Lanes lanesLessEqual(Lanes a, Lanes b){ return _mm_cmple_ps(a, b); }
+static inline Lanes lanesAnd(Lanes a, Lanes b){ return _mm_and_ps(a, b); }
+static inline Lanes lanesOr(Lanes a, Lanes b){ return _mm_or_ps(a, b); }
+static inline Lanes lanesSelect(Lanes mask, Lanes a, Lanes b){ return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+static inline Lanes lanesNegateIf(Lanes mask, Lanes a){ return _mm_xor_ps(a, _mm_and_ps(mask, _mm_set1_ps(-0.0f))); }
+static inline int lanesMask(Lanes mask){ return _mm_movemask_ps(mask); } // bit i : lane i
+#endif
+
+#ifdef SIMD_LANES
+
+// SIMD_LANES 3D vectors, one component per register
+struct LanesVec3{
+	Lanes x, y, z;
+};
+
+static inline LanesVec3 lanesSet3(float x, float y, float z){
+	LanesVec3 r = {lanesSet(x), lanesSet(y), lanesSet(z)};
+	return r;
+}
+
+static inline LanesVec3 lanesSub3(const LanesVec3 & a, const LanesVec3 & b){
+	LanesVec3 r = {lanesSub(a.x, b.x), lanesSub(a.y, b.y), lanesSub(a.z, b.z)};
+	return r;
+}
+
+static inline LanesVec3 lanesScale3(const LanesVec3 & a, Lanes s){
+	LanesVec3 r = {lanesMul(a.x, s), lanesMul(a.y, s), lanesMul(a.z, s)};
+	return r;
+}
+
+static inline Lanes lanesDot3(const LanesVec3 & a, const LanesVec3 & b){
+	return lanesAdd(lanesAdd(lanesMul(a.x, b.x), lanesMul(a.y, b.y)), lanesMul(a.z, b.z));
+}
+
+static inline LanesVec3 lanesCross3(const LanesVec3 & a, const LanesVec3 & b){
+	LanesVec3 r = {
+		lanesSub(lanesMul(a.y, b.z), lanesMul(b.y, a.z)),
+		lanesSub(lanesMul(a.z, b.x), lanesMul(b.z, a.x)),
+		lanesSub(lanesMul(a.x, b.y), lanesMul(b.x, a.y))
+	};
+	return r;
+}
+
+static inline LanesVec3 lanesSelect3(Lanes mask, const LanesVec3 & a, const LanesVec3 & b){
+	LanesVec3 r = {lanesSelect(mask, a.x, b.x), lanesSelect(mask, a.y, b.y), lanesSelect(mask, a.z, b.z)};
+	return r;
+}
+
+#endif
+
+#endif
@@ -1,6 +1,11 @@
 #ifndef TANGENTSPACE_HPP
 #define TANGENTSPACE_HPP
 
+// One tangent & bitangent per vertex of a triangle list (3 vertices per
+// triangle, not indexed). The tangent is orthogonalized to the normal and
+// follows the handedness of the UV mapping; triangles without a UV mapping
+// get a tangent along their first edge. The outputs are resized to fit.
+// Uses SIMD, and up to maxThreads threads (0 means all the cores) for big meshes.
 void computeTangentBasis(
 	// inputs
 	std::vector<glm::vec3> & vertices,
@@ -8,8 +13,26 @@ void computeTangentBasis(
 	std::vector<glm::vec3> & normals,
 	// outputs
 	std::vector<glm::vec3> & tangents,
-	std::vector<glm::vec3> & bitangents
+	std::vector<glm::vec3> & bitangents,
+	unsigned int maxThreads = 0
 );
 
+// Same, for an indexed mesh : the tangents of the triangles around each vertex
+// are summed, weighted by the angle of their corner, and orthonormalized once.
+// Where the UV mapping is mirrored on one side of a vertex only, the vertex is
+// split in two (appended to vertices, uvs & normals, and indices are updated),
+// so that each keeps a consistent handedness. Costs time & memory per unique
+// vertex instead of per triangle corner, and needs no welding afterwards.
+// The bitangents are cross(normal, tangent).
+void computeTangentBasisIndexed(
+	// inputs & outputs
+	std::vector<unsigned int> & indices,
+	std::vector<glm::vec3> & vertices,
+	std::vector<glm::vec2> & uvs,
+	std::vector<glm::vec3> & normals,
+	// outputs
+	std::vector<glm::vec3> & tangents,
+	std::vector<glm::vec3> & bitangents
+);
 
 #endif
\ No newline at end of file
@@ -1,16 +1,190 @@
 #ifndef TEXTURE_HPP
 #define TEXTURE_HPP
 
-// Load a .BMP file using our custom loader
-GLuint loadBMP_custom(const char * imagepath);
+#include <vector>
+#include <string>
+#include <future>
+#include <memory>
 
-//// Since GLFW 3, glfwLoadTexture2D() has been removed. You have to use another texture loading library, 
+#include "mappedfile.hpp"
+
+// What generateMipmaps filters, and how
+enum MipmapFlags{
+	MIPMAP_SRGB = 1,       // the colors are sRGB : they are averaged as linear light. Alpha never is.
+	MIPMAP_NORMAL_MAP = 2, // RGB holds unit vectors (as x * 0.5 + 0.5) : renormalized on every level
+	MIPMAP_KAISER = 4      // a Kaiser windowed sinc over 8x8 pixels instead of the 2x2 box : sharper mips
+};
+
+// Load a .BMP file using our custom loader. Its mipmaps are built with
+// generateMipmaps and mipmapFlags : use MIPMAP_NORMAL_MAP for normal maps.
+GLuint loadBMP_custom(const char * imagepath, unsigned int mipmapFlags = MIPMAP_SRGB);
+
+//// Since GLFW 3, glfwLoadTexture2D() has been removed. You have to use another texture loading library,
 //// or do it yourself (just like loadBMP_custom and loadDDS)
 //// Load a .TGA file using GLFW's own loader
 //GLuint loadTGA_glfw(const char * imagepath);
 
-// Load a .DDS file using GLFW's own loader
+// Load a .DDS file using GLFW's own loader. Cube maps and texture arrays
+// are bound to their own targets : see TextureData::target.
 GLuint loadDDS(const char * imagepath);
 
+// Memory for files on their way to the GPU. Released buffers go back to a
+// pool (by power of two size) for the next loads, instead of to the heap.
+// Safe to use from any thread.
+class StagingBuffer{
+public:
+	StagingBuffer() : bytes(NULL), length(0), sizeClass(0) {}
+	~StagingBuffer(){ release(); }
+	StagingBuffer(StagingBuffer && other);
+	StagingBuffer & operator=(StagingBuffer && other);
+
+	// size bytes, contents undefined. Returns false if out of memory.
+	bool resize(size_t size);
+	void release();
+
+	unsigned char * data() const { return bytes; }
+	size_t size() const { return length; }
+
+private:
+	StagingBuffer(const StagingBuffer &) = delete;
+	StagingBuffer & operator=(const StagingBuffer &) = delete;
+
+	unsigned char * bytes;
+	size_t length;
+	int sizeClass; // the buffer holds 1 << sizeClass bytes
+};
+
+struct TextureLevel{
+	unsigned int width, height;
+	size_t offset; // from the start of its layer
+	size_t size;
+};
+
+// An image read from a file, ready to upload. Reading it makes no GL call,
+// so it can be done on any thread.
+struct TextureData{
+	GLenum target;           // GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY, GL_TEXTURE_CUBE_MAP or GL_TEXTURE_CUBE_MAP_ARRAY
+	GLenum internalFormat;   // GL_RGB, GL_COMPRESSED_RGBA_S3TC_DXT1_EXT...
+	GLenum format, type;     // of the pixels, if not compressed
+	bool compressed;
+	bool generateMipmaps;    // only level 0 was in the file
+	bool trilinear;          // repeated, with trilinear filtering, rather than the GL defaults
+	unsigned int bandHeight; // rows that are uploaded together : 4 (one row of blocks) if compressed, 1 otherwise
+	unsigned int layers;     // array elements, times 6 (+X, -X, +Y, -Y, +Z, -Z) for cube maps
+	size_t layerSize;        // all the levels of one layer : layers are stored one after the other
+	std::vector<TextureLevel> levels;
+
+	// The pixels are either copied to pixels, or left in the file, fileOffset
+	// bytes after fileData : in file, or in memory kept alive by someone else
+	// (an AssetArchive)
+	StagingBuffer pixels;
+	MappedFile file;
+	const unsigned char * fileData;
+	size_t fileOffset;
+
+	TextureData()
+		: target(GL_TEXTURE_2D), internalFormat(0), format(0), type(0), compressed(false), generateMipmaps(false),
+		  trilinear(false), bandHeight(1), layers(1), layerSize(0), fileData(NULL), fileOffset(0) {}
+	const unsigned char * pixelData() const { return fileData ? fileData + fileOffset : pixels.data(); }
+	const unsigned char * levelData(unsigned int layer, size_t level) const { return pixelData() + layer * layerSize + levels[level].offset; }
+};
+
+// Read a .BMP (24 bits) or a .DDS file. Print why and return false if they can't.
+bool readBMP(const char * imagepath, TextureData & texture);
+
+// DDS files are mapped, not read : the pixels are uploaded straight from the
+// file. Both the legacy and the DX10 headers are understood, with BC1 to BC5,
+// BC7 and 32 bits RGBA pixels, mip chains, cube maps and texture arrays.
+bool readDDS(const char * imagepath, TextureData & texture);
+
+// Same, for the size bytes of a DDS file that the caller keeps in memory for
+// as long as texture is used. name is only used in the messages.
+bool readDDSFromMemory(const unsigned char * bytes, size_t size, const char * name, TextureData & texture);
+
+// Writes a texture with all its levels in a .DDS file : the legacy header for
+// 2D DXT1/3/5 textures, the DX10 one otherwise.
+bool writeDDS(const char * imagepath, const TextureData & texture);
+
+// Same, into bytes, as readDDSFromMemory reads them. name is only used in the messages.
+bool writeDDSToMemory(const char * name, const TextureData & texture, std::vector<unsigned char> & bytes);
+
+// All the levels of an uncompressed 8 bits texture (RGB, BGR, RGBA or BGRA,
+// as readBMP returns it) down to 1x1, built from its level 0, as RGBA : ready
+// for uploadTexture, TextureLoader or compressTexture. mipmapped can be source.
+// Filtering is done in fixed point, with SIMD, on up to maxThreads threads (0
+// means all the cores) : the result is the same on every machine. Edges are clamped.
+bool generateMipmaps(const TextureData & source, unsigned int flags, TextureData & mipmapped, unsigned int maxThreads = 0);
+
+// Creates a texture from texture, all at once
+GLuint uploadTexture(const TextureData & texture);
+
+// Same, from level firstLevel down : it becomes level 0 of the texture, and
+// the finer levels are left out. TextureStreamer pages levels in and out with it.
+GLuint uploadTextureLevels(const TextureData & texture, size_t firstLevel);
+
+// Whether the driver can't take the compressed format of texture, which the
+// upload functions then expand to RGBA (see decompressTexture). The GL
+// context must be initialized.
+bool needsDecompression(const TextureData & texture);
+
+typedef unsigned int TextureHandle;
+
+// Loads textures in the background : files are read and checked on the
+// thread pool, then update() sends at most bytesPerFrame bytes per frame to
+// the GPU, through a pixel buffer, so that big textures don't stall a frame.
+// Everything but the file reads happens on the GL thread.
+class TextureLoader{
+public:
+	explicit TextureLoader(size_t bytesPerFrame = 4 << 20);
+	// Waits for the reads in flight. Call release() before the GL context goes away.
+	~TextureLoader();
+
+	// Starts loading a .DDS or a .BMP file (by its extension). BMP mipmaps
+	// are built with mipmapFlags, as by loadBMP_custom.
+	TextureHandle load(const char * imagepath, unsigned int mipmapFlags = MIPMAP_SRGB);
+
+	// Call once per frame : uploads the next bytes of the files read so far.
+	// Returns the number of textures still loading.
+	size_t update();
+
+	// Uploads everything, waiting for the reads if needed
+	void finish();
+
+	// The texture, once completely uploaded; 0 before, or if it failed.
+	// It then belongs to the caller, as with loadDDS.
+	GLuint texture(TextureHandle handle) const;
+	GLenum target(TextureHandle handle) const;
+	bool failed(TextureHandle handle) const;
+
+	// Deletes the pixel buffer, and the textures still uploading
+	void release();
+
+private:
+	TextureLoader(const TextureLoader &) = delete;
+	TextureLoader & operator=(const TextureLoader &) = delete;
+
+	struct Entry{
+		std::string path;
+		std::future<bool> reading;
+		std::unique_ptr<TextureData> data;
+		GLuint texture;
+		GLenum target;
+		bool ready;          // reading is over, and succeeded
+		bool done;           // uploaded, or failed
+		bool failed;
+		unsigned int layer;  // next band to upload
+		size_t level;
+		unsigned int row;
+	};
+
+	// Uploads bands of the pending textures, up to budget bytes (at least one band)
+	void upload(size_t budget, bool wait);
+
+	std::vector<Entry> entries; // indexed by TextureHandle
+	std::vector<TextureHandle> pending; // in load order
+	GLuint pixelBuffer;
+	size_t bytesPerFrame;
+};
+
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,72 @@
+#ifndef TEXTURECACHE_HPP
+#define TEXTURECACHE_HPP
+
+#include <cstddef>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+#include "texture.hpp"
+
+// Textures shared by everything that loads the same file. Files are known
+// by their canonical path, then by a hash of their contents : two paths to
+// the same file, or two copies of it, give the same texture. Loading a file
+// that is already cached costs a map lookup.
+//
+// Each acquire() must be paired with a release(). Released textures stay in
+// VRAM, ready for the next acquire(), until the textures of the cache weigh
+// more than the budget : then the least recently used unreferenced ones are
+// deleted. Textures in use are never deleted, even over budget.
+//
+// Only use it from the GL thread, and clear() it before the context goes away.
+//
+// Textures made by TextureLoader, TextureStreamer and AssetArchive don't go
+// through it : they belong to their caller (TextureStreamer even recreates
+// them as it pages levels), and an archive entry has no file to key it by.
+class TextureCache{
+public:
+	explicit TextureCache(size_t budgetBytes = 256 << 20);
+	~TextureCache();
+
+	// The texture of a .DDS or a .BMP file (by its extension), loaded if
+	// needed. 0 if it can't be loaded. BMP mipmaps are built with mipmapFlags,
+	// as by loadBMP_custom : the same BMP with other flags is another texture.
+	GLuint acquire(const char * imagepath, unsigned int mipmapFlags = MIPMAP_SRGB);
+	void release(GLuint texture);
+
+	void setBudget(size_t budgetBytes);
+	size_t budget() const { return budgetBytes; }
+
+	// Estimated VRAM used by a texture of the cache, and by all of them
+	size_t textureBytes(GLuint texture) const;
+	size_t residentBytes() const { return totalBytes; }
+
+	// Deletes every texture, even those in use
+	void clear();
+
+	static TextureCache & global();
+
+private:
+	TextureCache(const TextureCache &) = delete;
+	TextureCache & operator=(const TextureCache &) = delete;
+
+	struct Entry{
+		GLuint texture;
+		size_t bytes;
+		unsigned long long contentHash;
+		unsigned int references;
+		std::list<GLuint>::iterator lastUse; // in unused, if references == 0
+	};
+
+	// Deletes unused textures, least recently used first, until under budget
+	void evict();
+
+	std::unordered_map<GLuint, Entry> entries;
+	std::unordered_map<std::string, GLuint> paths;               // canonical path (and BMP flags) -> texture
+	std::unordered_map<unsigned long long, GLuint> contents;     // hash64 of the file (and BMP flags) -> texture
+	std::list<GLuint> unused; // textures with no reference, most recently released first
+	size_t budgetBytes;
+	size_t totalBytes;
+};
+
+#endif
@@ -0,0 +1,168 @@
+#ifndef TEXTURESTREAMER_HPP
+#define TEXTURESTREAMER_HPP
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "texture.hpp"
+
+struct CachedMesh;
+
+// UV units per world unit of a mesh : the square root of its UV area over its
+// surface area. A texture of size texels then covers about
+// size * uvDensity texels per world unit of the mesh.
+float computeUVDensity(const unsigned int * indices, size_t indexCount, const glm::vec3 * vertices, const glm::vec2 * uvs);
+// Same, for any CachedMesh (indexed or not, interleaved or not). With
+// MESH_CACHE_LODS, only the full level is measured.
+float computeUVDensity(const CachedMesh & mesh);
+
+// The finest mip level that sampling can reach, for a texture of textureSize
+// texels (its largest side) on a mesh of uvDensity seen at distance from the
+// camera, with a perspective projection such as getProjectionMatrix() : the
+// log2 of texels per pixel, as the GPU picks it. 0 is the full texture.
+float estimateMipLevel(unsigned int textureSize, float uvDensity, const glm::mat4 & projection, float distance, float viewportHeight);
+
+// Decides which mip levels of streamed textures stay in VRAM. Every frame,
+// request() records the finest level each texture was sampled at (from
+// estimateMipLevel), and how much it matters; update() then gives each
+// texture a target level, so that the most important ones get their levels
+// first and all of them fit in the budget.
+//
+// A texture always keeps its tail (the levels from tailLevel on), even over
+// budget. Levels are resident from some level down to 1x1, never with holes.
+// Textures keep their finest request for keepFrames frames, so that objects
+// at the edge of a level don't page it in and out every frame.
+//
+// No GL call is made here : decisions can be checked without a GPU.
+// TextureStreamer applies them.
+class MipResidency{
+public:
+	explicit MipResidency(size_t budgetBytes = 128 << 20, unsigned int keepFrames = 30);
+
+	// A texture whose level i weighs levelBytes[i] (all layers). Its tail is
+	// resident. Returns its id; the ids of removed textures are reused.
+	unsigned int add(const std::vector<size_t> & levelBytes, unsigned int tailLevel);
+	void remove(unsigned int id);
+
+	// The texture was sampled at level this frame, for something of priority
+	// (the larger, the more important : its size on screen, for instance).
+	// Several requests in a frame keep the finest level and the highest priority.
+	void request(unsigned int id, float level, float priority);
+
+	// Ends the frame : sets the target level of every texture
+	void update();
+
+	// What the requests of the last frames ask for, and what fits in the budget
+	unsigned int wantedLevel(unsigned int id) const { return textures[id].wanted; }
+	unsigned int targetLevel(unsigned int id) const { return textures[id].target; }
+	unsigned int tailLevel(unsigned int id) const { return textures[id].tail; }
+
+	// What is in VRAM : the owner calls setResident() once it paged levels in or out
+	unsigned int residentLevel(unsigned int id) const { return textures[id].resident; }
+	void setResident(unsigned int id, unsigned int level);
+
+	// The textures whose resident level isn't their target, after update() :
+	// those to page out first, then those to page in, most important first
+	const std::vector<unsigned int> & changes() const { return pending; }
+
+	// What the levels from level on of a texture weigh
+	size_t chainBytes(unsigned int id, unsigned int level) const { return textures[id].chain[level]; }
+	size_t residentBytes() const { return totalResident; }
+	size_t targetBytes() const { return totalTarget; }
+
+	void setBudget(size_t budgetBytes){ this->budgetBytes = budgetBytes; }
+	size_t budget() const { return budgetBytes; }
+
+	unsigned int frame() const { return frameIndex; }
+
+private:
+	struct Texture{
+		std::vector<size_t> chain; // chain[l] : levels l to the last one
+		unsigned int tail;
+		unsigned int resident, target;
+		bool used;
+		// This frame's requests
+		bool requested;
+		float frameLevel, framePriority;
+		// What is kept of the last keepFrames frames
+		unsigned int wanted;
+		float priority;
+		unsigned int wantedFrame;
+	};
+
+	std::vector<Texture> textures;       // indexed by id
+	std::vector<unsigned int> freeIds;
+	std::vector<unsigned int> pending;
+	size_t budgetBytes;
+	size_t totalResident, totalTarget;
+	unsigned int keepFrames;
+	unsigned int frameIndex;
+};
+
+typedef unsigned int StreamedTexture;
+
+// Textures whose finest levels are only in VRAM when something needs them.
+// load() uploads the tail of a .DDS file (its levels of tailSize texels or
+// less) and keeps the file mapped; each frame, the program requests the
+// textures it draws with, and update() pages levels in (at most
+// bytesPerFrame bytes a frame, most important textures first) and out,
+// under the budget of residency().
+//
+// Paging a texture recreates it with a different level 0, so its name
+// changes : get it with texture() every frame. Only GL_TEXTURE_2D textures
+// are streamed; others, and files without mips, are uploaded whole.
+//
+// Only use it from the GL thread, and release() it before the context goes away.
+class TextureStreamer{
+public:
+	explicit TextureStreamer(size_t budgetBytes = 128 << 20, size_t bytesPerFrame = 4 << 20, unsigned int tailSize = 64);
+	~TextureStreamer();
+
+	// Returns 0 if the file can't be read
+	StreamedTexture load(const char * imagepath);
+	// Same, for a texture read by readDDS or AssetArchive::readTexture : texture is moved from
+	StreamedTexture add(TextureData & texture);
+	void unload(StreamedTexture handle);
+
+	// The texture is drawn this frame on a mesh of uvDensity (computeUVDensity)
+	// within objectRadius of a point at distance from the camera. Its priority
+	// is the size of the object on screen.
+	void request(StreamedTexture handle, float uvDensity, float objectRadius,
+		const glm::mat4 & projection, float distance, float viewportHeight);
+
+	// Call once per frame, after the requests
+	void update();
+
+	// The texture to bind this frame, 0 for the handle of a failed load
+	GLuint texture(StreamedTexture handle) const { return handle ? entries[handle - 1].texture : 0; }
+
+	MipResidency & residency(){ return mipResidency; }
+	const MipResidency & residency() const { return mipResidency; }
+
+	// Deletes every texture
+	void release();
+
+private:
+	TextureStreamer(const TextureStreamer &) = delete;
+	TextureStreamer & operator=(const TextureStreamer &) = delete;
+
+	struct Entry{
+		std::unique_ptr<TextureData> data; // NULL if unused
+		GLuint texture;
+		unsigned int id;                   // in mipResidency
+	};
+
+	// Recreates the texture from level on
+	bool page(Entry & entry, unsigned int level);
+
+	std::vector<Entry> entries; // indexed by StreamedTexture - 1
+	std::vector<StreamedTexture> handles; // by MipResidency id
+	MipResidency mipResidency;
+	size_t bytesPerFrame;
+	unsigned int tailSize;
+};
+
+#endif
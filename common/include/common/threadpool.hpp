@@ -0,0 +1,57 @@
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads eating a shared queue of jobs.
+// Use ThreadPool::global() rather than creating your own pool : it has one
+// worker per core (minus the calling thread, which helps in parallelFor).
+class ThreadPool{
+public:
+	// 0 means "one per core, minus one"
+	explicit ThreadPool(unsigned int threadCount = 0);
+	~ThreadPool();
+
+	// Number of worker threads (the calling thread is not counted)
+	unsigned int size() const { return (unsigned int)workers.size(); }
+
+	// Runs task() on a worker thread. The future holds the result.
+	template<class Task>
+	std::future<decltype(std::declval<Task>()())> submit(Task task){
+		typedef decltype(task()) Result;
+		std::shared_ptr< std::packaged_task<Result()> > job = std::make_shared< std::packaged_task<Result()> >(std::move(task));
+		std::future<Result> result = job->get_future();
+		enqueue([job](){ (*job)(); });
+		return result;
+	}
+
+	// Calls body(i) for every i in [0, count), spread over the workers and
+	// the calling thread. Returns when every call has finished.
+	// Safe to call from a worker thread.
+	void parallelFor(size_t count, const std::function<void(size_t)> & body);
+
+	static ThreadPool & global();
+
+private:
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool & operator=(const ThreadPool &) = delete;
+
+	void enqueue(std::function<void()> job);
+	void workerLoop();
+
+	std::vector<std::thread> workers;
+	std::deque< std::function<void()> > jobs;
+	std::mutex mutex;
+	std::condition_variable wakeUp;
+	bool stopping;
+};
+
+#endif
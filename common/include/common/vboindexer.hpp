@@ -1,6 +1,9 @@
 #ifndef VBOINDEXER_HPP
 #define VBOINDEXER_HPP
 
+// The unsigned short versions only work for up to 65536 output vertices :
+// past that, they print an error and return empty buffers.
+
 void indexVBO(
 	std::vector<glm::vec3> & in_vertices,
 	std::vector<glm::vec2> & in_uvs,
@@ -28,4 +31,49 @@ void indexVBO_TBN(
 	std::vector<glm::vec3> & out_bitangents
 );
 
+// Same as above, for meshes of any size
+void indexVBO(
+	std::vector<glm::vec3> & in_vertices,
+	std::vector<glm::vec2> & in_uvs,
+	std::vector<glm::vec3> & in_normals,
+
+	std::vector<unsigned int> & out_indices,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals
+);
+
+// Same result as indexVBO, using up to maxThreads threads (0 means all
+// the cores). Worth it for meshes of a few hundred thousand vertices or more.
+void indexVBO_parallel(
+	std::vector<glm::vec3> & in_vertices,
+	std::vector<glm::vec2> & in_uvs,
+	std::vector<glm::vec3> & in_normals,
+
+	std::vector<unsigned int> & out_indices,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals,
+	unsigned int maxThreads = 0
+);
+
+void indexVBO_TBN(
+	std::vector<glm::vec3> & in_vertices,
+	std::vector<glm::vec2> & in_uvs,
+	std::vector<glm::vec3> & in_normals,
+	std::vector<glm::vec3> & in_tangents,
+	std::vector<glm::vec3> & in_bitangents,
+
+	std::vector<unsigned int> & out_indices,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals,
+	std::vector<glm::vec3> & out_tangents,
+	std::vector<glm::vec3> & out_bitangents
+);
+
+// Copies indices to out as unsigned short if vertexCount allows it,
+// as unsigned int otherwise. Returns the size of one index : 2 or 4.
+size_t packIndices(const std::vector<unsigned int> & indices, size_t vertexCount, std::vector<unsigned char> & out);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,87 @@
+#ifndef VERTEXFORMAT_HPP
+#define VERTEXFORMAT_HPP
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// How each attribute is stored in an interleaved vertex.
+// 0 is the plain float layout : 32 bytes per vertex, 56 with tangents & bitangents.
+enum VertexFormatFlags{
+	VERTEX_HALF_POSITIONS = 1,  // 4 half floats, relative to the bounds of the mesh
+	VERTEX_SHORT_UVS      = 2,  // 2 normalized unsigned shorts, relative to the UV bounds of the mesh
+	VERTEX_OCT_NORMALS    = 4,  // 2 normalized shorts, octahedral encoding
+	VERTEX_TANGENTS       = 8,  // with a tangent frame. With VERTEX_OCT_NORMALS, the tangent is
+	                            // octahedral too, with the handedness in its 3rd component
+	VERTEX_QTANGENTS      = 16, // normal + tangent frame as one quaternion of 4 normalized shorts,
+	                            // with the handedness in the sign of w. Replaces the normal.
+
+	// 16 bytes per vertex, 24 with an octahedral tangent frame, 20 with QTangents
+	VERTEX_FORMAT_COMPACT = VERTEX_HALF_POSITIONS | VERTEX_SHORT_UVS | VERTEX_OCT_NORMALS
+};
+
+// Attribute locations used by setupVertexAttributes. The shaders must use the same.
+enum VertexAttributeLocation{
+	VERTEX_ATTRIB_POSITION  = 0,
+	VERTEX_ATTRIB_UV        = 1,
+	VERTEX_ATTRIB_NORMAL    = 2,
+	VERTEX_ATTRIB_TANGENT   = 3, // tangent, octahedral tangent or QTangent
+	VERTEX_ATTRIB_BITANGENT = 4
+};
+
+struct VertexLayout{
+	unsigned int format = 0;
+	unsigned int stride = 0;
+
+	// Byte offset of each attribute in a vertex, -1 if it isn't stored
+	int positionOffset = -1;
+	int uvOffset = -1;
+	int normalOffset = -1;
+	int tangentOffset = -1;
+	int bitangentOffset = -1;
+
+	// position = positionCenter + positionExtent * stored position
+	glm::vec3 positionCenter = glm::vec3(0.0f);
+	glm::vec3 positionExtent = glm::vec3(1.0f);
+	// uv = uvMin + uvScale * stored uv
+	glm::vec2 uvMin = glm::vec2(0.0f);
+	glm::vec2 uvScale = glm::vec2(1.0f);
+};
+
+// Stride and offsets of a format. The bounds are left to packVertices.
+VertexLayout makeVertexLayout(unsigned int format);
+
+// Interleaves and encodes count vertices. tangents and bitangents are only
+// read if format has VERTEX_TANGENTS or VERTEX_QTANGENTS.
+// Compact tangent frames are orthonormalized : the bitangent comes back as
+// handedness * cross(normal, tangent).
+void packVertices(
+	unsigned int format, size_t count,
+	const glm::vec3 * vertices,
+	const glm::vec2 * uvs,
+	const glm::vec3 * normals,
+	const glm::vec3 * tangents,
+	const glm::vec3 * bitangents,
+	VertexLayout & layout,
+	std::vector<unsigned char> & out
+);
+
+// Decodes vertex i, for use on the CPU. Any output can be NULL.
+void unpackVertex(
+	const VertexLayout & layout, const void * data, size_t i,
+	glm::vec3 * position,
+	glm::vec2 * uv,
+	glm::vec3 * normal,
+	glm::vec3 * tangent,
+	glm::vec3 * bitangent
+);
+
+// Describes the layout to the bound vertex array object, reading from the
+// buffer bound to GL_ARRAY_BUFFER. Call it once, when creating the VAO.
+void setupVertexAttributes(const VertexLayout & layout);
+
+// Sets the decoding uniforms (VertexPositionCenter, VertexPositionExtent,
+// VertexUVMin, VertexUVScale) of the program, which must be in use.
+void setVertexLayoutUniforms(unsigned int programID, const VertexLayout & layout);
+
+#endif
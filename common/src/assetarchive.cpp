@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <GL/glew.h>
+
+#include "shader.hpp"
+#include "assetarchive.hpp"
+
+// Layout of an archive :
+// - an ArchiveHeader
+// - the table of contents : an ArchiveEntry per asset, sorted by name
+// - the names, each followed by a 0
+// - the assets, each starting on a 64-byte boundary.
+// As for .meshcache files, everything is in the machine's native byte order.
+
+static const char archiveMagic[8] = {'A', 'S', 'S', 'E', 'T', 'P', 'A', 'K'};
+static const unsigned int archiveVersion = 1;
+static const unsigned int archiveByteOrder = 0x01020304;
+static const size_t archiveAlignment = 64;
+
+struct ArchiveHeader{
+	char magic[8];
+	unsigned int version;
+	unsigned int byteOrder;
+	unsigned int assetCount;
+	unsigned int reserved;
+	unsigned long long entriesOffset; // from the start of the file
+	unsigned long long namesOffset;
+	unsigned long long namesSize;
+};
+
+struct ArchiveEntry{
+	unsigned long long offset; // from the start of the file
+	unsigned long long size;   // without the 0 of ASSET_SOURCE
+	unsigned int nameOffset;   // in the names
+	unsigned int nameLength;
+	unsigned int type;         // AssetType
+	unsigned int reserved;
+};
+
+AssetArchive::AssetArchive()
+	: entries(NULL), names(NULL), count(0)
+{
+}
+
+bool AssetArchive::open(const char * path){
+	close();
+	if (!file.open(path))
+		return false;
+	const unsigned char * bytes = file.data();
+	size_t size = file.size();
+
+	ArchiveHeader header;
+	if (size < sizeof(header)){
+		printf("%s is not an asset archive\n", path);
+		file.close();
+		return false;
+	}
+	memcpy(&header, bytes, sizeof(header));
+	if (memcmp(header.magic, archiveMagic, sizeof(archiveMagic)) != 0 ||
+		header.version != archiveVersion ||
+		header.byteOrder != archiveByteOrder){
+		printf("%s is not an asset archive, or was made by another version of asset_packer\n", path);
+		file.close();
+		return false;
+	}
+
+	// Never trust a file : the table, the names and every asset must be inside it
+	bool valid =
+		header.entriesOffset % alignof(ArchiveEntry) == 0 &&
+		header.entriesOffset <= size &&
+		header.assetCount <= (size - header.entriesOffset) / sizeof(ArchiveEntry) &&
+		header.namesOffset <= size &&
+		header.namesSize <= size - header.namesOffset &&
+		header.namesSize < 0xFFFFFFFFu;
+	const ArchiveEntry * table = (const ArchiveEntry *)(bytes + header.entriesOffset);
+	const char * nameData = (const char *)(bytes + header.namesOffset);
+	for (unsigned int i = 0; valid && i < header.assetCount; i++){
+		const ArchiveEntry & entry = table[i];
+		valid =
+			entry.offset % archiveAlignment == 0 &&
+			entry.offset <= size &&
+			entry.size <= size - entry.offset &&
+			(entry.type != ASSET_SOURCE || (entry.size < size - entry.offset && bytes[entry.offset + entry.size] == 0)) &&
+			(unsigned long long)entry.nameOffset + entry.nameLength < header.namesSize &&
+			nameData[entry.nameOffset + entry.nameLength] == 0 &&
+			(i == 0 || strcmp(nameData + table[i - 1].nameOffset, nameData + entry.nameOffset) < 0);
+	}
+	if (!valid){
+		printf("%s is damaged\n", path);
+		file.close();
+		return false;
+	}
+
+	entries = table;
+	names = nameData;
+	count = header.assetCount;
+	return true;
+}
+
+void AssetArchive::close(){
+	file.close();
+	entries = NULL;
+	names = NULL;
+	count = 0;
+}
+
+const unsigned char * AssetArchive::find(const char * name, AssetType type, size_t * size) const {
+	// Binary search in the sorted table : no hashing, no allocation
+	unsigned int first = 0, last = count;
+	while (first < last){
+		unsigned int middle = first + (last - first) / 2;
+		int order = strcmp(names + entries[middle].nameOffset, name);
+		if (order == 0){
+			if (entries[middle].type != (unsigned int)type)
+				return NULL;
+			if (size)
+				*size = (size_t)entries[middle].size;
+			return file.data() + entries[middle].offset;
+		}
+		if (order < 0)
+			first = middle + 1;
+		else
+			last = middle;
+	}
+	return NULL;
+}
+
+bool AssetArchive::loadMesh(const char * name, unsigned int flags, CachedMesh & mesh, unsigned int vertexFormat) const {
+	size_t size;
+	const unsigned char * blob = find(name, ASSET_MESH, &size);
+	if (!blob){
+		if (isOpen())
+			printf("%s isn't in the asset archive\n", name);
+		return loadOBJCached(name, flags, mesh, vertexFormat);
+	}
+	if (!bindMeshCacheBlob(blob, size, flags, mesh, vertexFormat)){
+		printf("%s was packed with other mesh flags : run asset_packer again\n", name);
+		return loadOBJCached(name, flags, mesh, vertexFormat);
+	}
+	return true;
+}
+
+bool AssetArchive::readTexture(const char * name, TextureData & texture) const {
+	size_t size;
+	const unsigned char * bytes = find(name, ASSET_TEXTURE, &size);
+	if (!bytes){
+		if (isOpen())
+			printf("%s isn't in the asset archive\n", name);
+		return readDDS(name, texture);
+	}
+	texture.file.close();
+	return readDDSFromMemory(bytes, size, name, texture);
+}
+
+GLuint AssetArchive::loadTexture(const char * name) const {
+	TextureData texture;
+	if (!readTexture(name, texture))
+		return 0;
+	return uploadTexture(texture);
+}
+
+GLuint AssetArchive::loadShaders(const char * vertexName, const char * fragmentName) const {
+	const unsigned char * vertexSource = find(vertexName, ASSET_SOURCE);
+	const unsigned char * fragmentSource = find(fragmentName, ASSET_SOURCE);
+	if (!vertexSource || !fragmentSource){
+		if (isOpen())
+			printf("%s or %s isn't in the asset archive\n", vertexName, fragmentName);
+		return LoadShaders(vertexName, fragmentName);
+	}
+	printf("Compiling shaders : %s, %s\n", vertexName, fragmentName);
+	return LoadShadersCode((const char *)vertexSource, (const char *)fragmentSource);
+}
+
+static bool nameLess(const AssetDescription * a, const AssetDescription * b){
+	return strcmp(a->name, b->name) < 0;
+}
+
+static size_t alignArchiveOffset(size_t offset){
+	return (offset + archiveAlignment - 1) / archiveAlignment * archiveAlignment;
+}
+
+bool writeAssetArchive(const char * path, const AssetDescription * assets, size_t assetCount){
+	std::vector<const AssetDescription *> sorted(assetCount);
+	for (size_t i = 0; i < assetCount; i++)
+		sorted[i] = &assets[i];
+	std::sort(sorted.begin(), sorted.end(), nameLess);
+	for (size_t i = 1; i < assetCount; i++){
+		if (strcmp(sorted[i - 1]->name, sorted[i]->name) == 0){
+			printf("%s is packed twice\n", sorted[i]->name);
+			return false;
+		}
+	}
+
+	ArchiveHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, archiveMagic, sizeof(archiveMagic));
+	header.version = archiveVersion;
+	header.byteOrder = archiveByteOrder;
+	header.assetCount = (unsigned int)assetCount;
+	header.entriesOffset = sizeof(header);
+
+	std::vector<ArchiveEntry> table(assetCount);
+	std::string nameData;
+	for (size_t i = 0; i < assetCount; i++){
+		table[i].nameOffset = (unsigned int)nameData.size();
+		table[i].nameLength = (unsigned int)strlen(sorted[i]->name);
+		table[i].type = sorted[i]->type;
+		table[i].reserved = 0;
+		nameData.append(sorted[i]->name, table[i].nameLength + 1);
+	}
+	header.namesOffset = header.entriesOffset + assetCount * sizeof(ArchiveEntry);
+	header.namesSize = nameData.size();
+
+	size_t offset = (size_t)(header.namesOffset + header.namesSize);
+	for (size_t i = 0; i < assetCount; i++){
+		offset = alignArchiveOffset(offset);
+		table[i].offset = offset;
+		table[i].size = sorted[i]->size;
+		offset += sorted[i]->size + (sorted[i]->type == ASSET_SOURCE ? 1 : 0);
+	}
+
+	// Written to a temporary file first, as the mesh caches, so that nobody maps half an archive
+	std::string tempPath = std::string(path) + ".tmp";
+	FILE * out = fopen(tempPath.c_str(), "wb");
+	if (out == NULL){
+		printf("Can't write %s\n", path);
+		return false;
+	}
+	static const unsigned char zeros[archiveAlignment] = {0};
+	bool written =
+		fwrite(&header, sizeof(header), 1, out) == 1 &&
+		(assetCount == 0 || fwrite(table.data(), sizeof(ArchiveEntry), assetCount, out) == assetCount) &&
+		fwrite(nameData.data(), 1, nameData.size(), out) == nameData.size();
+	size_t position = (size_t)(header.namesOffset + header.namesSize);
+	for (size_t i = 0; written && i < assetCount; i++){
+		size_t padding = (size_t)table[i].offset - position;
+		written =
+			fwrite(zeros, 1, padding, out) == padding &&
+			fwrite(sorted[i]->data, 1, sorted[i]->size, out) == sorted[i]->size &&
+			(sorted[i]->type != ASSET_SOURCE || fwrite(zeros, 1, 1, out) == 1);
+		position = (size_t)table[i].offset + sorted[i]->size + (sorted[i]->type == ASSET_SOURCE ? 1 : 0);
+	}
+	written = fclose(out) == 0 && written;
+	if (written){
+		remove(path); // rename() doesn't replace files on Windows
+		written = rename(tempPath.c_str(), path) == 0;
+	}
+	if (!written){
+		remove(tempPath.c_str());
+		printf("Can't write %s\n", path);
+	}
+	return written;
+}
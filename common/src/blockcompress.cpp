@@ -0,0 +1,719 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+#include <GL/glew.h>
+
+#include "threadpool.hpp"
+#include "simdlanes.hpp"
+#include "blockcompress.hpp"
+
+// Fewest blocks per job of the multithreaded paths
+static const size_t minParallelBlockCount = 1 << 12;
+static const size_t minParallelDecodeBlockCount = 1 << 14;
+
+// Power iterations to find the principal axis of the colors of a block
+static const int axisIterationCount = 4;
+
+#ifdef SIMD_LANES
+#define BLOCK_LANES SIMD_LANES
+#else
+// Without SIMD, the same kernels run on one block at a time
+#define BLOCK_LANES 1
+typedef float Lanes;
+static inline float maskFromBits(unsigned int bits){ float f; memcpy(&f, &bits, 4); return f; }
+static inline unsigned int bitsFromMask(float f){ unsigned int bits; memcpy(&bits, &f, 4); return bits; }
+static inline Lanes lanesLoad(const float * p){ return *p; }
+static inline Lanes lanesGatherBytes(const unsigned char * p, size_t){ return (float)*p; }
+static inline void lanesStore(float * p, Lanes a){ *p = a; }
+static inline Lanes lanesSet(float a){ return a; }
+static inline Lanes lanesAdd(Lanes a, Lanes b){ return a + b; }
+static inline Lanes lanesSub(Lanes a, Lanes b){ return a - b; }
+static inline Lanes lanesMul(Lanes a, Lanes b){ return a * b; }
+static inline Lanes lanesDiv(Lanes a, Lanes b){ return a / b; }
+static inline Lanes lanesMin(Lanes a, Lanes b){ return a < b ? a : b; }
+static inline Lanes lanesMax(Lanes a, Lanes b){ return a > b ? a : b; }
+static inline Lanes lanesAbs(Lanes a){ return fabsf(a); }
+static inline Lanes lanesLess(Lanes a, Lanes b){ return maskFromBits(a < b ? 0xFFFFFFFF : 0); }
+static inline Lanes lanesAnd(Lanes a, Lanes b){ return maskFromBits(bitsFromMask(a) & bitsFromMask(b)); }
+static inline Lanes lanesSelect(Lanes mask, Lanes a, Lanes b){ return bitsFromMask(mask) ? a : b; }
+#endif
+
+// BLOCK_LANES blocks side by side, one per lane
+struct BlockGroup{
+	Lanes pixels[4][16]; // [channel][pixel]
+	Lanes weights[16];   // 1 for the pixels of the image, 0 for the padding
+};
+
+// Blocks [firstX, firstX + count) of row blockY. The lanes after count
+// repeat the last block : they are encoded, but not written.
+static void gatherBlocks(
+	const unsigned char * rgba, unsigned int width, unsigned int height,
+	unsigned int firstX, unsigned int blockY, unsigned int count, BlockGroup & group
+){
+	if (count == BLOCK_LANES && (firstX + count) * 4 <= width && blockY * 4 + 4 <= height){
+		// Inside the image : the same pixel of neighbouring blocks is 16 bytes further
+		for (unsigned int i = 0; i < 16; i++){
+			const unsigned char * pixel = rgba + ((size_t)(blockY * 4 + (i >> 2)) * width + firstX * 4 + (i & 3)) * 4;
+			for (int c = 0; c < 4; c++)
+				group.pixels[c][i] = lanesGatherBytes(pixel + c, 16);
+			group.weights[i] = lanesSet(1.0f);
+		}
+		return;
+	}
+
+	// On the edges, pixels out of the image are copies of the closest ones
+	float pixels[4][16][BLOCK_LANES], weights[16][BLOCK_LANES];
+	for (unsigned int lane = 0; lane < BLOCK_LANES; lane++){
+		unsigned int blockX = firstX + std::min(lane, count - 1);
+		for (unsigned int i = 0; i < 16; i++){
+			unsigned int x = blockX * 4 + (i & 3), y = blockY * 4 + (i >> 2);
+			const unsigned char * pixel = rgba + ((size_t)std::min(y, height - 1) * width + std::min(x, width - 1)) * 4;
+			for (int c = 0; c < 4; c++)
+				pixels[c][i][lane] = pixel[c];
+			weights[i][lane] = x < width && y < height ? 1.0f : 0.0f;
+		}
+	}
+	for (unsigned int i = 0; i < 16; i++){
+		for (int c = 0; c < 4; c++)
+			group.pixels[c][i] = lanesLoad(pixels[c][i]);
+		group.weights[i] = lanesLoad(weights[i]);
+	}
+}
+
+static inline unsigned int to565(float r, float g, float b){
+	unsigned int r5 = (unsigned int)(r * (31.0f / 255.0f) + 0.5f);
+	unsigned int g6 = (unsigned int)(g * (63.0f / 255.0f) + 0.5f);
+	unsigned int b5 = (unsigned int)(b * (31.0f / 255.0f) + 0.5f);
+	return (r5 << 11) | (g6 << 5) | b5;
+}
+
+// The color a decoder reads for a 565 endpoint
+static inline void from565(unsigned int c, float * rgb){
+	unsigned int r5 = c >> 11, g6 = (c >> 5) & 63, b5 = c & 31;
+	rgb[0] = (float)((r5 << 3) | (r5 >> 2));
+	rgb[1] = (float)((g6 << 2) | (g6 >> 4));
+	rgb[2] = (float)((b5 << 3) | (b5 >> 2));
+}
+
+static inline void writeLittleEndian(unsigned char * out, unsigned long long value, int bytes){
+	for (int i = 0; i < bytes; i++)
+		out[i] = (unsigned char)(value >> (8 * i));
+}
+
+// BC1 color blocks : endpoints along the principal axis of the colors,
+// refined by least squares, then the closest of the 4 colors for each pixel.
+// Writes count blocks, stride bytes apart. Adds the squared errors to errors.
+static void encodeColors(const BlockGroup & group, unsigned int count, unsigned char * out, size_t stride, float * errors){
+	const Lanes zero = lanesSet(0.0f);
+
+	// Weighted mean
+	Lanes weightSum = zero, meanR = zero, meanG = zero, meanB = zero;
+	for (int i = 0; i < 16; i++){
+		Lanes w = group.weights[i];
+		weightSum = lanesAdd(weightSum, w);
+		meanR = lanesAdd(meanR, lanesMul(w, group.pixels[0][i]));
+		meanG = lanesAdd(meanG, lanesMul(w, group.pixels[1][i]));
+		meanB = lanesAdd(meanB, lanesMul(w, group.pixels[2][i]));
+	}
+	Lanes invWeightSum = lanesDiv(lanesSet(1.0f), weightSum);
+	meanR = lanesMul(meanR, invWeightSum);
+	meanG = lanesMul(meanG, invWeightSum);
+	meanB = lanesMul(meanB, invWeightSum);
+
+	// Covariance
+	Lanes crr = zero, crg = zero, crb = zero, cgg = zero, cgb = zero, cbb = zero;
+	for (int i = 0; i < 16; i++){
+		Lanes w = group.weights[i];
+		Lanes r = lanesSub(group.pixels[0][i], meanR);
+		Lanes g = lanesSub(group.pixels[1][i], meanG);
+		Lanes b = lanesSub(group.pixels[2][i], meanB);
+		Lanes wr = lanesMul(w, r), wg = lanesMul(w, g);
+		crr = lanesAdd(crr, lanesMul(wr, r));
+		crg = lanesAdd(crg, lanesMul(wr, g));
+		crb = lanesAdd(crb, lanesMul(wr, b));
+		cgg = lanesAdd(cgg, lanesMul(wg, g));
+		cgb = lanesAdd(cgb, lanesMul(wg, b));
+		cbb = lanesAdd(cbb, lanesMul(lanesMul(w, b), b));
+	}
+
+	// Principal axis : power iterations, from the column with the most variance
+	Lanes rIsMax = lanesAnd(lanesLess(cgg, crr), lanesLess(cbb, crr));
+	Lanes gIsMax = lanesLess(cbb, cgg);
+	Lanes axisR = lanesSelect(rIsMax, crr, lanesSelect(gIsMax, crg, crb));
+	Lanes axisG = lanesSelect(rIsMax, crg, lanesSelect(gIsMax, cgg, cgb));
+	Lanes axisB = lanesSelect(rIsMax, crb, lanesSelect(gIsMax, cgb, cbb));
+	for (int iteration = 0; iteration < axisIterationCount; iteration++){
+		Lanes r = lanesAdd(lanesAdd(lanesMul(crr, axisR), lanesMul(crg, axisG)), lanesMul(crb, axisB));
+		Lanes g = lanesAdd(lanesAdd(lanesMul(crg, axisR), lanesMul(cgg, axisG)), lanesMul(cgb, axisB));
+		Lanes b = lanesAdd(lanesAdd(lanesMul(crb, axisR), lanesMul(cgb, axisG)), lanesMul(cbb, axisB));
+		// Keep the components around 1, so that they don't overflow
+		Lanes scale = lanesDiv(lanesSet(1.0f), lanesMax(lanesMax(lanesAbs(r), lanesAbs(g)), lanesMax(lanesAbs(b), lanesSet(1e-20f))));
+		axisR = lanesMul(r, scale);
+		axisG = lanesMul(g, scale);
+		axisB = lanesMul(b, scale);
+	}
+	// A flat block has no axis : any will do
+	Lanes length2 = lanesAdd(lanesAdd(lanesMul(axisR, axisR), lanesMul(axisG, axisG)), lanesMul(axisB, axisB));
+	Lanes flat = lanesLess(length2, lanesSet(1e-10f));
+	axisR = lanesSelect(flat, lanesSet(1.0f), axisR);
+	axisG = lanesSelect(flat, lanesSet(1.0f), axisG);
+	axisB = lanesSelect(flat, lanesSet(1.0f), axisB);
+	length2 = lanesSelect(flat, lanesSet(3.0f), length2);
+
+	// Extent of the colors along the axis
+	Lanes projections[16];
+	Lanes minT = lanesSet(1e30f), maxT = lanesSet(-1e30f);
+	for (int i = 0; i < 16; i++){
+		Lanes t = lanesAdd(lanesAdd(
+			lanesMul(lanesSub(group.pixels[0][i], meanR), axisR),
+			lanesMul(lanesSub(group.pixels[1][i], meanG), axisG)),
+			lanesMul(lanesSub(group.pixels[2][i], meanB), axisB));
+		projections[i] = t;
+		minT = lanesMin(minT, t);
+		maxT = lanesMax(maxT, t);
+	}
+
+	// Least squares endpoints, for the pixels snapped to the 4 colors
+	// between the extremes : minimizes sum w |alpha e0 + (1 - alpha) e1 - c|^2
+	Lanes toPalette = lanesDiv(lanesSet(3.0f), lanesMax(lanesSub(maxT, minT), lanesSet(1e-20f)));
+	Lanes alphaAlpha = zero, alphaBeta = zero, betaBeta = zero;
+	Lanes alphaR = zero, alphaG = zero, alphaB = zero, betaR = zero, betaG = zero, betaB = zero;
+	for (int i = 0; i < 16; i++){
+		Lanes s = lanesMul(lanesSub(projections[i], minT), toPalette);
+		Lanes step = zero;
+		for (int k = 0; k < 3; k++)
+			step = lanesAdd(step, lanesAnd(lanesLess(lanesSet(k + 0.5f), s), lanesSet(1.0f)));
+		Lanes w = group.weights[i];
+		Lanes alpha = lanesMul(step, lanesSet(1.0f / 3.0f));
+		Lanes beta = lanesSub(lanesSet(1.0f), alpha);
+		Lanes wAlpha = lanesMul(w, alpha), wBeta = lanesMul(w, beta);
+		alphaAlpha = lanesAdd(alphaAlpha, lanesMul(wAlpha, alpha));
+		alphaBeta = lanesAdd(alphaBeta, lanesMul(wAlpha, beta));
+		betaBeta = lanesAdd(betaBeta, lanesMul(wBeta, beta));
+		Lanes r = group.pixels[0][i], g = group.pixels[1][i], b = group.pixels[2][i];
+		alphaR = lanesAdd(alphaR, lanesMul(wAlpha, r));
+		alphaG = lanesAdd(alphaG, lanesMul(wAlpha, g));
+		alphaB = lanesAdd(alphaB, lanesMul(wAlpha, b));
+		betaR = lanesAdd(betaR, lanesMul(wBeta, r));
+		betaG = lanesAdd(betaG, lanesMul(wBeta, g));
+		betaB = lanesAdd(betaB, lanesMul(wBeta, b));
+	}
+	Lanes determinant = lanesSub(lanesMul(alphaAlpha, betaBeta), lanesMul(alphaBeta, alphaBeta));
+	Lanes solvable = lanesLess(lanesSet(1e-3f), determinant);
+	Lanes invDeterminant = lanesDiv(lanesSet(1.0f), lanesSelect(solvable, determinant, lanesSet(1.0f)));
+	Lanes maxScale = lanesDiv(maxT, length2), minScale = lanesDiv(minT, length2);
+	Lanes endpoints[2][3] = {
+		{
+			lanesSelect(solvable, lanesMul(lanesSub(lanesMul(betaBeta, alphaR), lanesMul(alphaBeta, betaR)), invDeterminant), lanesAdd(meanR, lanesMul(axisR, maxScale))),
+			lanesSelect(solvable, lanesMul(lanesSub(lanesMul(betaBeta, alphaG), lanesMul(alphaBeta, betaG)), invDeterminant), lanesAdd(meanG, lanesMul(axisG, maxScale))),
+			lanesSelect(solvable, lanesMul(lanesSub(lanesMul(betaBeta, alphaB), lanesMul(alphaBeta, betaB)), invDeterminant), lanesAdd(meanB, lanesMul(axisB, maxScale)))
+		},
+		{
+			lanesSelect(solvable, lanesMul(lanesSub(lanesMul(alphaAlpha, betaR), lanesMul(alphaBeta, alphaR)), invDeterminant), lanesAdd(meanR, lanesMul(axisR, minScale))),
+			lanesSelect(solvable, lanesMul(lanesSub(lanesMul(alphaAlpha, betaG), lanesMul(alphaBeta, alphaG)), invDeterminant), lanesAdd(meanG, lanesMul(axisG, minScale))),
+			lanesSelect(solvable, lanesMul(lanesSub(lanesMul(alphaAlpha, betaB), lanesMul(alphaBeta, alphaB)), invDeterminant), lanesAdd(meanB, lanesMul(axisB, minScale)))
+		}
+	};
+	float endpointValues[2][3][BLOCK_LANES];
+	for (int e = 0; e < 2; e++){
+		for (int c = 0; c < 3; c++)
+			lanesStore(endpointValues[e][c], lanesMin(lanesMax(endpoints[e][c], zero), lanesSet(255.0f)));
+	}
+
+	// 565 endpoints, in the order of the 4 colors mode (c0 > c1), and the colors they decode to
+	unsigned int packed[BLOCK_LANES][2];
+	float palette[4][3][BLOCK_LANES];
+	for (unsigned int lane = 0; lane < BLOCK_LANES; lane++){
+		unsigned int c0 = to565(endpointValues[0][0][lane], endpointValues[0][1][lane], endpointValues[0][2][lane]);
+		unsigned int c1 = to565(endpointValues[1][0][lane], endpointValues[1][1][lane], endpointValues[1][2][lane]);
+		if (c0 < c1)
+			std::swap(c0, c1);
+		packed[lane][0] = c0;
+		packed[lane][1] = c1;
+		float p0[3], p1[3];
+		from565(c0, p0);
+		from565(c1, p1);
+		for (int c = 0; c < 3; c++){
+			palette[0][c][lane] = p0[c];
+			palette[1][c][lane] = p1[c];
+			// c0 == c1 is the 3 colors mode, where index 3 is black : only use index 0
+			palette[2][c][lane] = c0 == c1 ? p0[c] : (2.0f * p0[c] + p1[c]) * (1.0f / 3.0f);
+			palette[3][c][lane] = c0 == c1 ? p0[c] : (p0[c] + 2.0f * p1[c]) * (1.0f / 3.0f);
+		}
+	}
+
+	// Closest color of each pixel
+	Lanes colors[4][3];
+	for (int k = 0; k < 4; k++){
+		for (int c = 0; c < 3; c++)
+			colors[k][c] = lanesLoad(palette[k][c]);
+	}
+	float indices[16][BLOCK_LANES];
+	Lanes error = zero;
+	for (int i = 0; i < 16; i++){
+		Lanes r = group.pixels[0][i], g = group.pixels[1][i], b = group.pixels[2][i];
+		Lanes best = lanesSet(1e30f), index = zero;
+		for (int k = 0; k < 4; k++){
+			Lanes dr = lanesSub(r, colors[k][0]), dg = lanesSub(g, colors[k][1]), db = lanesSub(b, colors[k][2]);
+			Lanes distance = lanesAdd(lanesAdd(lanesMul(dr, dr), lanesMul(dg, dg)), lanesMul(db, db));
+			Lanes closer = lanesLess(distance, best);
+			best = lanesSelect(closer, distance, best);
+			index = lanesSelect(closer, lanesSet((float)k), index);
+		}
+		error = lanesAdd(error, lanesMul(group.weights[i], best));
+		lanesStore(indices[i], index);
+	}
+	float blockErrors[BLOCK_LANES];
+	lanesStore(blockErrors, error);
+
+	for (unsigned int lane = 0; lane < count; lane++){
+		unsigned int bits = 0;
+		for (int i = 0; i < 16; i++)
+			bits |= (unsigned int)indices[i][lane] << (2 * i);
+		unsigned char * block = out + lane * stride;
+		writeLittleEndian(block, packed[lane][0], 2);
+		writeLittleEndian(block + 2, packed[lane][1], 2);
+		writeLittleEndian(block + 4, bits, 4);
+		errors[lane] += blockErrors[lane];
+	}
+}
+
+// BC4 blocks of one channel (the alpha of BC3, each half of BC5) : the 8
+// values mode between the extremes, and the closest value for each pixel.
+static void encodeChannel(const BlockGroup & group, int channel, unsigned int count, unsigned char * out, size_t stride, float * errors){
+	const Lanes zero = lanesSet(0.0f);
+
+	Lanes minValue = lanesSet(255.0f), maxValue = zero;
+	for (int i = 0; i < 16; i++){
+		Lanes v = group.pixels[channel][i];
+		minValue = lanesMin(minValue, v);
+		maxValue = lanesMax(maxValue, v);
+	}
+	Lanes range = lanesSub(maxValue, minValue);
+	Lanes toSteps = lanesDiv(lanesSet(7.0f), lanesMax(range, lanesSet(1e-20f)));
+	Lanes stepSize = lanesMul(range, lanesSet(1.0f / 7.0f));
+
+	// Steps from the maximum, rounded
+	float steps[16][BLOCK_LANES];
+	Lanes error = zero;
+	for (int i = 0; i < 16; i++){
+		Lanes v = group.pixels[channel][i];
+		Lanes s = lanesMul(lanesSub(maxValue, v), toSteps);
+		Lanes step = zero;
+		for (int k = 0; k < 7; k++)
+			step = lanesAdd(step, lanesAnd(lanesLess(lanesSet(k + 0.5f), s), lanesSet(1.0f)));
+		Lanes difference = lanesSub(lanesSub(maxValue, lanesMul(step, stepSize)), v);
+		error = lanesAdd(error, lanesMul(group.weights[i], lanesMul(difference, difference)));
+		lanesStore(steps[i], step);
+	}
+	float blockErrors[BLOCK_LANES], minValues[BLOCK_LANES], maxValues[BLOCK_LANES];
+	lanesStore(blockErrors, error);
+	lanesStore(minValues, minValue);
+	lanesStore(maxValues, maxValue);
+
+	for (unsigned int lane = 0; lane < count; lane++){
+		// The pixels are whole numbers, and so are their extremes
+		unsigned int a0 = (unsigned int)maxValues[lane], a1 = (unsigned int)minValues[lane];
+		unsigned long long bits = 0;
+		// Index 0 is a0 (0 steps), 1 is a1 (7 steps), 2 to 7 are the steps in between
+		static const unsigned long long stepIndices[8] = {0, 2, 3, 4, 5, 6, 7, 1};
+		for (int i = 0; a0 != a1 && i < 16; i++)
+			bits |= stepIndices[(unsigned int)steps[i][lane]] << (3 * i);
+		unsigned char * block = out + lane * stride;
+		block[0] = (unsigned char)a0;
+		block[1] = (unsigned char)a1;
+		writeLittleEndian(block + 2, bits, 6);
+		errors[lane] += blockErrors[lane];
+	}
+}
+
+static unsigned int blockBytes(BlockFormat format){
+	return format == BLOCK_BC1 ? 8 : 16;
+}
+
+size_t compressedImageSize(BlockFormat format, unsigned int width, unsigned int height){
+	return (size_t)((width + 3) / 4) * ((height + 3) / 4) * blockBytes(format);
+}
+
+// Rows of blocks [firstRow, lastRow). rowErrors gets the squared error of each row.
+static void compressRows(
+	const unsigned char * rgba, unsigned int width, unsigned int height, BlockFormat format,
+	unsigned char * blocks, unsigned int firstRow, unsigned int lastRow, double * rowErrors
+){
+	unsigned int blocksX = (width + 3) / 4;
+	size_t stride = blockBytes(format);
+	BlockGroup group;
+	for (unsigned int blockY = firstRow; blockY < lastRow; blockY++){
+		double rowError = 0.0;
+		for (unsigned int blockX = 0; blockX < blocksX; blockX += BLOCK_LANES){
+			unsigned int count = std::min((unsigned int)BLOCK_LANES, blocksX - blockX);
+			gatherBlocks(rgba, width, height, blockX, blockY, count, group);
+			unsigned char * out = blocks + ((size_t)blockY * blocksX + blockX) * stride;
+			float errors[BLOCK_LANES] = {};
+			switch (format){
+			case BLOCK_BC1:
+				encodeColors(group, count, out, stride, errors);
+				break;
+			case BLOCK_BC3:
+				encodeChannel(group, 3, count, out, stride, errors);
+				encodeColors(group, count, out + 8, stride, errors);
+				break;
+			case BLOCK_BC5:
+				encodeChannel(group, 0, count, out, stride, errors);
+				encodeChannel(group, 1, count, out + 8, stride, errors);
+				break;
+			}
+			for (unsigned int lane = 0; lane < count; lane++)
+				rowError += errors[lane];
+		}
+		rowErrors[blockY] = rowError;
+	}
+}
+
+double compressImage(
+	const unsigned char * rgba, unsigned int width, unsigned int height,
+	BlockFormat format, unsigned char * blocks, unsigned int maxThreads
+){
+	if (width == 0 || height == 0)
+		return 0.0;
+	unsigned int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+	std::vector<double> rowErrors(blocksY);
+
+	// Rows of blocks are independent : split them in ranges, one job each
+	ThreadPool & pool = ThreadPool::global();
+	size_t threadCount = maxThreads ? maxThreads : pool.size() + 1;
+	size_t rangeCount = std::min(std::min(threadCount, (size_t)blocksX * blocksY / minParallelBlockCount), (size_t)blocksY);
+	if (rangeCount < 2){
+		compressRows(rgba, width, height, format, blocks, 0, blocksY, rowErrors.data());
+	}else{
+		pool.parallelFor(rangeCount, [&](size_t range){
+			compressRows(rgba, width, height, format, blocks,
+				(unsigned int)(blocksY * range / rangeCount), (unsigned int)(blocksY * (range + 1) / rangeCount), rowErrors.data());
+		});
+	}
+
+	// Summed in order, so that the result doesn't depend on the threads
+	double error = 0.0;
+	for (unsigned int y = 0; y < blocksY; y++)
+		error += rowErrors[y];
+	return error;
+}
+
+bool compressTexture(
+	const unsigned char * rgba, unsigned int width, unsigned int height,
+	BlockFormat format, bool normalMap, TextureData & texture,
+	unsigned int maxThreads, double * psnr
+){
+	if (width == 0 || height == 0 || width > 65536 || height > 65536){
+		printf("Can't compress a %u x %u image\n", width, height);
+		return false;
+	}
+
+	// The whole mip chain, down to 1x1
+	texture.levels.clear();
+	size_t offset = 0;
+	for (unsigned int w = width, h = height; ; w = std::max(w / 2, 1u), h = std::max(h / 2, 1u)){
+		TextureLevel level = {w, h, offset, compressedImageSize(format, w, h)};
+		texture.levels.push_back(level);
+		offset += level.size;
+		if (w == 1 && h == 1)
+			break;
+	}
+	if (!texture.pixels.resize(offset)){
+		printf("Out of memory\n");
+		return false;
+	}
+	texture.file.close();
+	texture.fileData = NULL;
+	texture.fileOffset = 0;
+	texture.target = GL_TEXTURE_2D;
+	texture.internalFormat =
+		format == BLOCK_BC1 ? GL_COMPRESSED_RGBA_S3TC_DXT1_EXT :
+		format == BLOCK_BC3 ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT :
+		GL_COMPRESSED_RG_RGTC2;
+	texture.format = GL_RGBA;
+	texture.type = GL_UNSIGNED_BYTE;
+	texture.compressed = true;
+	texture.generateMipmaps = false;
+	texture.trilinear = false;
+	texture.bandHeight = 4;
+	texture.layers = 1;
+	texture.layerSize = offset;
+
+	double error = compressImage(rgba, width, height, format, texture.pixels.data(), maxThreads);
+	if (psnr){
+		int channels = format == BLOCK_BC1 ? 3 : format == BLOCK_BC3 ? 4 : 2;
+		double meanError = error / ((double)width * height * channels);
+		*psnr = 10.0 * log10(255.0 * 255.0 / std::max(meanError, 1e-10));
+	}
+
+	// The image, seen as a texture, for its mipmaps. Colors are averaged as light.
+	TextureData image, mipmaps;
+	image.fileData = rgba;
+	image.internalFormat = GL_RGBA8;
+	image.format = GL_RGBA;
+	image.type = GL_UNSIGNED_BYTE;
+	image.compressed = false;
+	TextureLevel top = {width, height, 0, (size_t)width * height * 4};
+	image.levels.assign(1, top);
+	image.layerSize = top.size;
+	unsigned int mipmapFlags = normalMap ? MIPMAP_NORMAL_MAP : format == BLOCK_BC5 ? 0 : MIPMAP_SRGB;
+	if (!generateMipmaps(image, mipmapFlags, mipmaps, maxThreads))
+		return false;
+	for (size_t level = 1; level < texture.levels.size(); level++){
+		const TextureLevel & mip = texture.levels[level];
+		compressImage(mipmaps.levelData(0, level), mip.width, mip.height, format, texture.pixels.data() + mip.offset, maxThreads);
+	}
+	return true;
+}
+
+bool compressTexture(
+	const TextureData & source, BlockFormat format, bool normalMap, TextureData & texture,
+	unsigned int maxThreads, double * psnr
+){
+	bool swapRB = source.format == GL_BGR || source.format == GL_BGRA;
+	int channels = source.format == GL_RGB || source.format == GL_BGR ? 3 : source.format == GL_RGBA || source.format == GL_BGRA ? 4 : 0;
+	if (source.compressed || source.type != GL_UNSIGNED_BYTE || channels == 0 || source.levels.empty()){
+		printf("Only 8 bits RGB(A) textures can be compressed\n");
+		return false;
+	}
+
+	// To tightly packed RGBA : rows may be padded, as in BMP files
+	const TextureLevel & level = source.levels[0];
+	size_t rowSize = level.size / level.height;
+	std::vector<unsigned char> rgba((size_t)level.width * level.height * 4);
+	const unsigned char * pixels = source.levelData(0, 0);
+	for (unsigned int y = 0; y < level.height; y++){
+		const unsigned char * in = pixels + y * rowSize;
+		unsigned char * out = &rgba[(size_t)y * level.width * 4];
+		for (unsigned int x = 0; x < level.width; x++, in += channels, out += 4){
+			out[0] = in[swapRB ? 2 : 0];
+			out[1] = in[1];
+			out[2] = in[swapRB ? 0 : 2];
+			out[3] = channels == 4 ? in[3] : 255;
+		}
+	}
+	return compressTexture(rgba.data(), level.width, level.height, format, normalMap, texture, maxThreads, psnr);
+}
+
+// Block formats decompressImage knows
+enum BlockKind{
+	KIND_NONE,
+	KIND_BC1_RGB,  // the 3 colors mode has opaque black
+	KIND_BC1_RGBA, // the 3 colors mode has transparent black
+	KIND_BC2,
+	KIND_BC3,
+	KIND_BC4,
+	KIND_BC5
+};
+
+static BlockKind blockKind(GLenum internalFormat){
+	switch (internalFormat){
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+		return KIND_BC1_RGB;
+	case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT:
+		return KIND_BC1_RGBA;
+	case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+	case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT:
+		return KIND_BC2;
+	case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+	case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+		return KIND_BC3;
+	case GL_COMPRESSED_RED_RGTC1:
+		return KIND_BC4;
+	case GL_COMPRESSED_RG_RGTC2:
+		return KIND_BC5;
+	}
+	return KIND_NONE;
+}
+
+// RGBA pixels are handled as 32 bits words : R in the low byte (little-endian)
+static inline unsigned int packPixel(unsigned int r, unsigned int g, unsigned int b, unsigned int a){
+	return r | (g << 8) | (b << 16) | (a << 24);
+}
+
+// The 16 pixels of a BC1 color block. In the BC2 and BC3 blocks, the 4
+// colors mode is used whatever the order of the endpoints.
+static void decodeColors(const unsigned char * block, BlockKind kind, unsigned int * pixels){
+	unsigned int c0 = block[0] | (block[1] << 8), c1 = block[2] | (block[3] << 8);
+	unsigned int r0 = c0 >> 11, g0 = (c0 >> 5) & 63, b0 = c0 & 31;
+	unsigned int r1 = c1 >> 11, g1 = (c1 >> 5) & 63, b1 = c1 & 31;
+	r0 = (r0 << 3) | (r0 >> 2); g0 = (g0 << 2) | (g0 >> 4); b0 = (b0 << 3) | (b0 >> 2);
+	r1 = (r1 << 3) | (r1 >> 2); g1 = (g1 << 2) | (g1 >> 4); b1 = (b1 << 3) | (b1 >> 2);
+
+	unsigned int palette[4];
+	palette[0] = packPixel(r0, g0, b0, 255);
+	palette[1] = packPixel(r1, g1, b1, 255);
+	if (c0 > c1 || (kind != KIND_BC1_RGB && kind != KIND_BC1_RGBA)){
+		palette[2] = packPixel((2 * r0 + r1 + 1) / 3, (2 * g0 + g1 + 1) / 3, (2 * b0 + b1 + 1) / 3, 255);
+		palette[3] = packPixel((r0 + 2 * r1 + 1) / 3, (g0 + 2 * g1 + 1) / 3, (b0 + 2 * b1 + 1) / 3, 255);
+	}else{
+		palette[2] = packPixel((r0 + r1 + 1) / 2, (g0 + g1 + 1) / 2, (b0 + b1 + 1) / 2, 255);
+		palette[3] = kind == KIND_BC1_RGBA ? 0 : packPixel(0, 0, 0, 255);
+	}
+
+	unsigned int bits = block[4] | (block[5] << 8) | (block[6] << 16) | ((unsigned int)block[7] << 24);
+	for (int i = 0; i < 16; i++, bits >>= 2)
+		pixels[i] = palette[bits & 3];
+}
+
+// The 16 values of a BC4 block (the alpha of BC3, each half of BC5), into
+// the bits [shift, shift + 8) of the pixels
+static void decodeChannel(const unsigned char * block, int shift, unsigned int * pixels){
+	unsigned int a0 = block[0], a1 = block[1];
+	unsigned int palette[8];
+	palette[0] = a0;
+	palette[1] = a1;
+	if (a0 > a1){
+		for (unsigned int i = 2; i < 8; i++)
+			palette[i] = ((8 - i) * a0 + (i - 1) * a1 + 3) / 7;
+	}else{
+		for (unsigned int i = 2; i < 6; i++)
+			palette[i] = ((6 - i) * a0 + (i - 1) * a1 + 2) / 5;
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+	for (int i = 0; i < 8; i++)
+		palette[i] <<= shift;
+
+	unsigned long long bits = 0;
+	for (int i = 0; i < 6; i++)
+		bits |= (unsigned long long)block[2 + i] << (8 * i);
+	unsigned int mask = ~(0xFFu << shift);
+	for (int i = 0; i < 16; i++, bits >>= 3)
+		pixels[i] = (pixels[i] & mask) | palette[bits & 7];
+}
+
+static void decodeBlock(const unsigned char * block, BlockKind kind, unsigned int * pixels){
+	switch (kind){
+	case KIND_BC1_RGB:
+	case KIND_BC1_RGBA:
+		decodeColors(block, kind, pixels);
+		break;
+	case KIND_BC2:{
+		decodeColors(block + 8, kind, pixels);
+		// 4 bits of alpha per pixel
+		unsigned long long bits = 0;
+		for (int i = 0; i < 8; i++)
+			bits |= (unsigned long long)block[i] << (8 * i);
+		for (int i = 0; i < 16; i++, bits >>= 4)
+			pixels[i] = (pixels[i] & 0x00FFFFFF) | ((unsigned int)(bits & 15) * 17 << 24);
+		break;
+	}
+	case KIND_BC3:
+		decodeColors(block + 8, kind, pixels);
+		decodeChannel(block, 24, pixels);
+		break;
+	case KIND_BC4:
+		for (int i = 0; i < 16; i++)
+			pixels[i] = packPixel(0, 0, 0, 255);
+		decodeChannel(block, 0, pixels);
+		break;
+	case KIND_BC5:
+		for (int i = 0; i < 16; i++)
+			pixels[i] = packPixel(0, 0, 0, 255);
+		decodeChannel(block, 0, pixels);
+		decodeChannel(block + 8, 8, pixels);
+		break;
+	case KIND_NONE:
+		break;
+	}
+}
+
+static void decompressRows(
+	const unsigned char * blocks, unsigned int width, unsigned int height, BlockKind kind,
+	unsigned char * rgba, unsigned int firstRow, unsigned int lastRow
+){
+	unsigned int blocksX = (width + 3) / 4;
+	size_t stride = kind == KIND_BC1_RGB || kind == KIND_BC1_RGBA || kind == KIND_BC4 ? 8 : 16;
+	for (unsigned int blockY = firstRow; blockY < lastRow; blockY++){
+		unsigned int rows = std::min(4u, height - blockY * 4);
+		for (unsigned int blockX = 0; blockX < blocksX; blockX++){
+			unsigned int pixels[16];
+			decodeBlock(blocks + ((size_t)blockY * blocksX + blockX) * stride, kind, pixels);
+			unsigned char * out = rgba + ((size_t)blockY * 4 * width + blockX * 4) * 4;
+			if (rows == 4 && blockX * 4 + 4 <= width){
+				for (unsigned int y = 0; y < 4; y++)
+					memcpy(out + (size_t)y * width * 4, pixels + 4 * y, 16);
+				continue;
+			}
+			// The edges of the image cut the blocks
+			unsigned int columns = std::min(4u, width - blockX * 4);
+			for (unsigned int y = 0; y < rows; y++)
+				memcpy(out + (size_t)y * width * 4, pixels + 4 * y, columns * 4);
+		}
+	}
+}
+
+bool decompressImage(
+	const unsigned char * blocks, unsigned int width, unsigned int height,
+	GLenum internalFormat, unsigned char * rgba, unsigned int maxThreads
+){
+	BlockKind kind = blockKind(internalFormat);
+	if (kind == KIND_NONE)
+		return false;
+	if (width == 0 || height == 0)
+		return true;
+	unsigned int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+
+	ThreadPool & pool = ThreadPool::global();
+	size_t threadCount = maxThreads ? maxThreads : pool.size() + 1;
+	size_t rangeCount = std::min(std::min(threadCount, (size_t)blocksX * blocksY / minParallelDecodeBlockCount), (size_t)blocksY);
+	if (rangeCount < 2){
+		decompressRows(blocks, width, height, kind, rgba, 0, blocksY);
+		return true;
+	}
+	pool.parallelFor(rangeCount, [&](size_t range){
+		decompressRows(blocks, width, height, kind, rgba,
+			(unsigned int)(blocksY * range / rangeCount), (unsigned int)(blocksY * (range + 1) / rangeCount));
+	});
+	return true;
+}
+
+bool decompressTexture(const TextureData & texture, TextureData & rgba, unsigned int maxThreads){
+	bool srgb =
+		texture.internalFormat == GL_COMPRESSED_SRGB_S3TC_DXT1_EXT || texture.internalFormat == GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT ||
+		texture.internalFormat == GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT || texture.internalFormat == GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT;
+	if (!texture.compressed || blockKind(texture.internalFormat) == KIND_NONE)
+		return false;
+
+	rgba.levels.clear();
+	size_t offset = 0;
+	for (size_t level = 0; level < texture.levels.size(); level++){
+		const TextureLevel & mip = texture.levels[level];
+		TextureLevel expanded = {mip.width, mip.height, offset, (size_t)mip.width * mip.height * 4};
+		rgba.levels.push_back(expanded);
+		offset += expanded.size;
+	}
+	if (!rgba.pixels.resize(offset * texture.layers)){
+		printf("Out of memory\n");
+		return false;
+	}
+	rgba.file.close();
+	rgba.fileData = NULL;
+	rgba.fileOffset = 0;
+	rgba.target = texture.target;
+	rgba.internalFormat = srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8;
+	rgba.format = GL_RGBA;
+	rgba.type = GL_UNSIGNED_BYTE;
+	rgba.compressed = false;
+	rgba.generateMipmaps = false;
+	rgba.trilinear = texture.trilinear;
+	rgba.bandHeight = 1;
+	rgba.layers = texture.layers;
+	rgba.layerSize = offset;
+
+	for (unsigned int layer = 0; layer < texture.layers; layer++){
+		for (size_t level = 0; level < texture.levels.size(); level++){
+			const TextureLevel & mip = texture.levels[level];
+			decompressImage(texture.levelData(layer, level), mip.width, mip.height, texture.internalFormat,
+				rgba.pixels.data() + layer * rgba.layerSize + rgba.levels[level].offset, maxThreads);
+		}
+	}
+	return true;
+}
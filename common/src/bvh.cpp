@@ -0,0 +1,478 @@
+#include <vector>
+#include <algorithm>
+#include <math.h>
+#include <float.h>
+
+#include <glm/glm.hpp>
+
+#include "threadpool.hpp"
+#include "simdlanes.hpp"
+#include "bvh.hpp"
+
+// Split candidates per axis of the binned SAH
+static const int binCount = 16;
+
+// Cost of visiting a node, relative to one ray/triangle test
+static const float traversalCost = 1.0f;
+
+// Nodes with more triangles are always split, even if the SAH says otherwise
+static const unsigned int maxLeafSize = 8;
+
+// Past that depth, nodes are split in the middle instead : the traversal
+// stacks are deep enough for any mesh (2^32 triangles would need 32 levels)
+static const unsigned int maxSAHDepth = 64;
+static const int maxStackSize = 128;
+
+// Fewest triangles of a node to bin it, and build its children, in parallel
+static const size_t minParallelBuildCount = 1 << 14;
+
+// Fewest rays per job of the multithreaded intersectBVH
+static const size_t minParallelRayCount = 1 << 10;
+
+// Rays traced together
+#ifdef SIMD_LANES
+static const size_t packetSize = SIMD_LANES;
+#else
+static const size_t packetSize = 1;
+#endif
+
+struct AABB{
+	glm::vec3 min, max;
+
+	AABB() : min(FLT_MAX), max(-FLT_MAX) {}
+	void grow(const glm::vec3 & p){ min = glm::min(min, p); max = glm::max(max, p); }
+	void grow(const AABB & b){ min = glm::min(min, b.min); max = glm::max(max, b.max); }
+	// Half the area, which is all the SAH needs
+	float area() const {
+		glm::vec3 e = max - min;
+		return e.x < 0.0f ? 0.0f : e.x * e.y + e.y * e.z + e.z * e.x;
+	}
+};
+
+struct Bin{
+	AABB bounds;
+	unsigned int count;
+
+	Bin() : count(0) {}
+};
+
+struct BuildState{
+	std::vector<AABB> bounds;           // per triangle of the mesh
+	std::vector<glm::vec3> centroids;   // centers of the bounds
+	std::vector<unsigned int> order;    // triangles, in leaf order once built
+	size_t threadCount;
+};
+
+// Calls body(chunk) for each chunk : on the thread pool if there are several,
+// directly otherwise (most nodes are small, and this is called for each of them)
+template<class Body>
+static void forEachChunk(size_t chunkCount, const Body & body){
+	if (chunkCount > 1)
+		ThreadPool::global().parallelFor(chunkCount, body);
+	else
+		body(0);
+}
+
+// Bounds of the triangles, and of their centroids, in order[first, first + count)
+static void computeNodeBounds(
+	const BuildState & state, size_t first, size_t count, size_t chunkCount,
+	AABB & bounds, AABB & centroidBounds
+){
+	// [2 * chunk] : bounds of the triangles, [2 * chunk + 1] : bounds of their centroids
+	AABB localBounds[2];
+	std::vector<AABB> sharedBounds;
+	AABB * chunkBounds = localBounds;
+	if (chunkCount > 1){
+		sharedBounds.resize(2 * chunkCount);
+		chunkBounds = sharedBounds.data();
+	}
+	forEachChunk(chunkCount, [&](size_t chunk){
+		AABB b, c;
+		for (size_t i = first + count * chunk / chunkCount; i < first + count * (chunk + 1) / chunkCount; i++){
+			unsigned int t = state.order[i];
+			b.grow(state.bounds[t]);
+			c.grow(state.centroids[t]);
+		}
+		chunkBounds[2 * chunk] = b;
+		chunkBounds[2 * chunk + 1] = c;
+	});
+	for (size_t chunk = 0; chunk < chunkCount; chunk++){
+		bounds.grow(chunkBounds[2 * chunk]);
+		centroidBounds.grow(chunkBounds[2 * chunk + 1]);
+	}
+}
+
+static inline int binOf(float centroid, float minimum, float scale){
+	return std::min(binCount - 1, (int)((centroid - minimum) * scale));
+}
+
+// Builds the subtree of order[first, first + count) at the end of nodes.
+// Node indices are relative to the start of nodes.
+static void buildNode(BuildState & state, size_t first, size_t count, unsigned int depth, std::vector<BVHNode> & nodes){
+	bool parallel = state.threadCount > 1 && count >= minParallelBuildCount;
+	size_t chunkCount = parallel ? state.threadCount : 1;
+
+	AABB bounds, centroidBounds;
+	computeNodeBounds(state, first, count, chunkCount, bounds, centroidBounds);
+
+	size_t self = nodes.size();
+	BVHNode node;
+	node.boundsMin = bounds.min;
+	node.boundsMax = bounds.max;
+	node.index = (unsigned int)first;
+	node.count = (unsigned short)count;
+	node.axis = 0;
+	nodes.push_back(node);
+	if (count == 1)
+		return;
+
+	// Bins of the three axes at once, one set per chunk
+	glm::vec3 extent = centroidBounds.max - centroidBounds.min;
+	glm::vec3 scale;
+	for (int axis = 0; axis < 3; axis++)
+		scale[axis] = extent[axis] > 0.0f ? binCount / extent[axis] : 0.0f;
+	Bin localBins[3 * binCount];
+	std::vector<Bin> sharedBins;
+	Bin * chunkBins = localBins;
+	if (chunkCount > 1){
+		sharedBins.resize(chunkCount * 3 * binCount);
+		chunkBins = sharedBins.data();
+	}
+	forEachChunk(chunkCount, [&](size_t chunk){
+		Bin * bins = &chunkBins[chunk * 3 * binCount];
+		for (size_t i = first + count * chunk / chunkCount; i < first + count * (chunk + 1) / chunkCount; i++){
+			unsigned int t = state.order[i];
+			for (int axis = 0; axis < 3; axis++){
+				Bin & bin = bins[axis * binCount + binOf(state.centroids[t][axis], centroidBounds.min[axis], scale[axis])];
+				bin.bounds.grow(state.bounds[t]);
+				bin.count++;
+			}
+		}
+	});
+	for (size_t chunk = 1; chunk < chunkCount; chunk++){
+		for (int b = 0; b < 3 * binCount; b++){
+			chunkBins[b].bounds.grow(chunkBins[chunk * 3 * binCount + b].bounds);
+			chunkBins[b].count += chunkBins[chunk * 3 * binCount + b].count;
+		}
+	}
+
+	// Cheapest split : bins [0, split) on the left, [split, binCount) on the right
+	float bestCost = FLT_MAX;
+	int bestAxis = -1, bestSplit = 0;
+	for (int axis = 0; axis < 3 && depth < maxSAHDepth; axis++){
+		if (scale[axis] == 0.0f)
+			continue;
+		const Bin * bins = &chunkBins[axis * binCount];
+		float rightCosts[binCount];
+		AABB right;
+		unsigned int rightCount = 0;
+		for (int b = binCount - 1; b > 0; b--){
+			right.grow(bins[b].bounds);
+			rightCount += bins[b].count;
+			rightCosts[b] = right.area() * rightCount;
+		}
+		AABB left;
+		unsigned int leftCount = 0;
+		for (int split = 1; split < binCount; split++){
+			left.grow(bins[split - 1].bounds);
+			leftCount += bins[split - 1].count;
+			float cost = left.area() * leftCount + rightCosts[split];
+			if (leftCount > 0 && leftCount < count && cost < bestCost){
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = split;
+			}
+		}
+	}
+
+	size_t leftCount;
+	if (bestAxis >= 0){
+		// Splitting has to be cheaper than testing every triangle
+		if (count <= maxLeafSize && traversalCost + bestCost / bounds.area() >= (float)count)
+			return;
+		unsigned int * begin = &state.order[first];
+		float minimum = centroidBounds.min[bestAxis], axisScale = scale[bestAxis];
+		unsigned int * middle = std::partition(begin, begin + count, [&](unsigned int t){
+			return binOf(state.centroids[t][bestAxis], minimum, axisScale) < bestSplit;
+		});
+		leftCount = middle - begin;
+	}else{
+		// All the centroids at the same place (or too deep) : any split is as good
+		if (count <= maxLeafSize)
+			return;
+		leftCount = count / 2;
+		bestAxis = 0;
+	}
+
+	nodes[self].count = 0;
+	nodes[self].axis = (unsigned short)bestAxis;
+	if (parallel){
+		// The right subtree is built on the side, then appended after the left one
+		std::vector<BVHNode> rightNodes;
+		ThreadPool::global().parallelFor(2, [&](size_t side){
+			if (side == 0)
+				buildNode(state, first, leftCount, depth + 1, nodes);
+			else
+				buildNode(state, first + leftCount, count - leftCount, depth + 1, rightNodes);
+		});
+		unsigned int offset = (unsigned int)nodes.size();
+		nodes[self].index = offset;
+		for (size_t i = 0; i < rightNodes.size(); i++){
+			if (rightNodes[i].count == 0)
+				rightNodes[i].index += offset;
+			nodes.push_back(rightNodes[i]);
+		}
+	}else{
+		buildNode(state, first, leftCount, depth + 1, nodes);
+		nodes[self].index = (unsigned int)nodes.size();
+		buildNode(state, first + leftCount, count - leftCount, depth + 1, nodes);
+	}
+}
+
+// Corner k of triangle t : indices may be NULL for a triangle list
+static inline const glm::vec3 & corner(const unsigned int * indices, const std::vector<glm::vec3> & vertices, size_t t, int k){
+	return vertices[indices ? indices[3 * t + k] : 3 * t + k];
+}
+
+static void buildBVH(
+	const unsigned int * indices, size_t triangleCount, const std::vector<glm::vec3> & vertices,
+	BVH & bvh, unsigned int maxThreads
+){
+	bvh.nodes.clear();
+	bvh.triangles.clear();
+	bvh.triangleIndices.clear();
+	if (triangleCount == 0)
+		return;
+
+	BuildState state;
+	state.threadCount = maxThreads ? maxThreads : ThreadPool::global().size() + 1;
+	state.bounds.resize(triangleCount);
+	state.centroids.resize(triangleCount);
+	state.order.resize(triangleCount);
+	for (size_t t = 0; t < triangleCount; t++){
+		for (int k = 0; k < 3; k++)
+			state.bounds[t].grow(corner(indices, vertices, t, k));
+		state.centroids[t] = (state.bounds[t].min + state.bounds[t].max) * 0.5f;
+		state.order[t] = (unsigned int)t;
+	}
+
+	bvh.nodes.reserve(2 * triangleCount - 1);
+	buildNode(state, 0, triangleCount, 0, bvh.nodes);
+
+	// Triangles in leaf order : a leaf reads one contiguous range
+	bvh.triangles.resize(triangleCount);
+	bvh.triangleIndices.swap(state.order);
+	for (size_t i = 0; i < triangleCount; i++){
+		size_t t = bvh.triangleIndices[i];
+		const glm::vec3 & v0 = corner(indices, vertices, t, 0);
+		bvh.triangles[i].v0 = v0;
+		bvh.triangles[i].edge1 = corner(indices, vertices, t, 1) - v0;
+		bvh.triangles[i].edge2 = corner(indices, vertices, t, 2) - v0;
+	}
+}
+
+void buildBVH(const std::vector<glm::vec3> & vertices, BVH & bvh, unsigned int maxThreads){
+	buildBVH(NULL, vertices.size() / 3, vertices, bvh, maxThreads);
+}
+
+void buildBVH(
+	const std::vector<unsigned int> & indices, const std::vector<glm::vec3> & vertices,
+	BVH & bvh, unsigned int maxThreads
+){
+	buildBVH(indices.data(), indices.size() / 3, vertices, bvh, maxThreads);
+}
+
+// 1 / direction, with zero components replaced by tiny ones of the same sign :
+// the slab test then never computes 0 * infinity
+static inline float safeInverse(float d){
+	return 1.0f / (fabsf(d) > 1e-20f ? d : (d < 0.0f ? -1e-20f : 1e-20f));
+}
+
+bool intersectBVH(const BVH & bvh, const Ray & ray, RayHit & hit){
+	hit.distance = ray.maxDistance;
+	hit.triangle = BVH_NO_HIT;
+	hit.u = hit.v = 0.0f;
+	if (bvh.nodes.empty())
+		return false;
+
+	glm::vec3 inverse(safeInverse(ray.direction.x), safeInverse(ray.direction.y), safeInverse(ray.direction.z));
+	unsigned int stack[maxStackSize];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0){
+		const BVHNode & node = bvh.nodes[stack[--stackSize]];
+
+		// Slab test, against the closest hit so far
+		glm::vec3 t1 = (node.boundsMin - ray.origin) * inverse;
+		glm::vec3 t2 = (node.boundsMax - ray.origin) * inverse;
+		glm::vec3 entry = glm::min(t1, t2), leave = glm::max(t1, t2);
+		float tNear = std::max(std::max(entry.x, entry.y), std::max(entry.z, 0.0f));
+		float tFar = std::min(std::min(leave.x, leave.y), leave.z);
+		if (!(tNear <= tFar && tNear < hit.distance))
+			continue;
+
+		if (node.count == 0){
+			// The near child is popped first
+			unsigned int left = (unsigned int)(&node - &bvh.nodes[0]) + 1;
+			if (ray.direction[node.axis] < 0.0f){
+				stack[stackSize++] = left;
+				stack[stackSize++] = node.index;
+			}else{
+				stack[stackSize++] = node.index;
+				stack[stackSize++] = left;
+			}
+			continue;
+		}
+
+		// Möller & Trumbore. NaNs, from degenerate triangles, fail every test.
+		for (unsigned int i = node.index; i < node.index + node.count; i++){
+			const BVHTriangle & triangle = bvh.triangles[i];
+			glm::vec3 p = glm::cross(ray.direction, triangle.edge2);
+			float inverseDeterminant = 1.0f / glm::dot(triangle.edge1, p);
+			glm::vec3 s = ray.origin - triangle.v0;
+			float u = glm::dot(s, p) * inverseDeterminant;
+			glm::vec3 q = glm::cross(s, triangle.edge1);
+			float v = glm::dot(ray.direction, q) * inverseDeterminant;
+			float t = glm::dot(triangle.edge2, q) * inverseDeterminant;
+			if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t >= 0.0f && t < hit.distance){
+				hit.distance = t;
+				hit.triangle = i;
+				hit.u = u;
+				hit.v = v;
+			}
+		}
+	}
+
+	if (hit.triangle == BVH_NO_HIT)
+		return false;
+	hit.triangle = bvh.triangleIndices[hit.triangle];
+	return true;
+}
+
+#ifdef SIMD_LANES
+
+// Traces SIMD_LANES rays at once. A node is visited if any ray of the packet
+// hits it, and every ray is tested against it : coherent rays visit mostly
+// the same nodes, so this costs one traversal instead of SIMD_LANES.
+static void intersectPacket(const BVH & bvh, const Ray * rays, RayHit * hits){
+	const size_t stride = sizeof(Ray) / sizeof(float);
+	const float * first = &rays[0].origin.x;
+	LanesVec3 origin = {lanesGather(first, stride), lanesGather(first + 1, stride), lanesGather(first + 2, stride)};
+	LanesVec3 direction = {lanesGather(first + 3, stride), lanesGather(first + 4, stride), lanesGather(first + 5, stride)};
+	Lanes distance = lanesGather(first + 6, stride);
+	float inverses[3][SIMD_LANES];
+	for (int r = 0; r < SIMD_LANES; r++){
+		for (int c = 0; c < 3; c++)
+			inverses[c][r] = safeInverse(rays[r].direction[c]);
+	}
+	LanesVec3 inverse = {lanesLoad(inverses[0]), lanesLoad(inverses[1]), lanesLoad(inverses[2])};
+	Lanes zero = lanesSet(0.0f), one = lanesSet(1.0f);
+	Lanes triangle = lanesSetBits(BVH_NO_HIT), u = zero, v = zero;
+
+	// The packet goes the way of its first ray
+	int signs[3] = {rays[0].direction.x < 0.0f, rays[0].direction.y < 0.0f, rays[0].direction.z < 0.0f};
+
+	unsigned int stack[maxStackSize];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0){
+		unsigned int nodeIndex = stack[--stackSize];
+		const BVHNode & node = bvh.nodes[nodeIndex];
+
+		Lanes t1 = lanesMul(lanesSub(lanesSet(node.boundsMin.x), origin.x), inverse.x);
+		Lanes t2 = lanesMul(lanesSub(lanesSet(node.boundsMax.x), origin.x), inverse.x);
+		Lanes tNear = lanesMax(lanesMin(t1, t2), zero);
+		Lanes tFar = lanesMax(t1, t2);
+		t1 = lanesMul(lanesSub(lanesSet(node.boundsMin.y), origin.y), inverse.y);
+		t2 = lanesMul(lanesSub(lanesSet(node.boundsMax.y), origin.y), inverse.y);
+		tNear = lanesMax(tNear, lanesMin(t1, t2));
+		tFar = lanesMin(tFar, lanesMax(t1, t2));
+		t1 = lanesMul(lanesSub(lanesSet(node.boundsMin.z), origin.z), inverse.z);
+		t2 = lanesMul(lanesSub(lanesSet(node.boundsMax.z), origin.z), inverse.z);
+		tNear = lanesMax(tNear, lanesMin(t1, t2));
+		tFar = lanesMin(tFar, lanesMax(t1, t2));
+		Lanes active = lanesAnd(lanesLessEqual(tNear, tFar), lanesLess(tNear, distance));
+		if (lanesMask(active) == 0)
+			continue;
+
+		if (node.count == 0){
+			if (signs[node.axis]){
+				stack[stackSize++] = nodeIndex + 1;
+				stack[stackSize++] = node.index;
+			}else{
+				stack[stackSize++] = node.index;
+				stack[stackSize++] = nodeIndex + 1;
+			}
+			continue;
+		}
+
+		for (unsigned int i = node.index; i < node.index + node.count; i++){
+			const BVHTriangle & tri = bvh.triangles[i];
+			LanesVec3 v0 = lanesSet3(tri.v0.x, tri.v0.y, tri.v0.z);
+			LanesVec3 edge1 = lanesSet3(tri.edge1.x, tri.edge1.y, tri.edge1.z);
+			LanesVec3 edge2 = lanesSet3(tri.edge2.x, tri.edge2.y, tri.edge2.z);
+			LanesVec3 p = lanesCross3(direction, edge2);
+			Lanes inverseDeterminant = lanesDiv(one, lanesDot3(edge1, p));
+			LanesVec3 s = lanesSub3(origin, v0);
+			Lanes hitU = lanesMul(lanesDot3(s, p), inverseDeterminant);
+			LanesVec3 q = lanesCross3(s, edge1);
+			Lanes hitV = lanesMul(lanesDot3(direction, q), inverseDeterminant);
+			Lanes t = lanesMul(lanesDot3(edge2, q), inverseDeterminant);
+			Lanes hit = lanesAnd(
+				lanesAnd(lanesLessEqual(zero, hitU), lanesLessEqual(zero, hitV)),
+				lanesAnd(lanesLessEqual(lanesAdd(hitU, hitV), one), lanesAnd(lanesLessEqual(zero, t), lanesLess(t, distance)))
+			);
+			if (lanesMask(hit) == 0)
+				continue;
+			distance = lanesSelect(hit, t, distance);
+			triangle = lanesSelect(hit, lanesSetBits(i), triangle);
+			u = lanesSelect(hit, hitU, u);
+			v = lanesSelect(hit, hitV, v);
+		}
+	}
+
+	float distances[SIMD_LANES], us[SIMD_LANES], vs[SIMD_LANES];
+	unsigned int triangles[SIMD_LANES];
+	lanesStore(distances, distance);
+	lanesStore((float *)triangles, triangle);
+	lanesStore(us, u);
+	lanesStore(vs, v);
+	for (int r = 0; r < SIMD_LANES; r++){
+		hits[r].distance = distances[r];
+		hits[r].triangle = triangles[r] == BVH_NO_HIT ? BVH_NO_HIT : bvh.triangleIndices[triangles[r]];
+		hits[r].u = us[r];
+		hits[r].v = vs[r];
+	}
+}
+
+#endif
+
+// Rays [first, last)
+static void intersectRange(const BVH & bvh, const Ray * rays, RayHit * hits, size_t first, size_t last){
+	size_t i = first;
+#ifdef SIMD_LANES
+	if (!bvh.nodes.empty()){
+		for (; i + SIMD_LANES <= last; i += SIMD_LANES)
+			intersectPacket(bvh, rays + i, hits + i);
+	}
+#endif
+	for (; i < last; i++)
+		intersectBVH(bvh, rays[i], hits[i]);
+}
+
+void intersectBVH(const BVH & bvh, const Ray * rays, size_t count, RayHit * hits, unsigned int maxThreads){
+	ThreadPool & pool = ThreadPool::global();
+	size_t threadCount = maxThreads ? maxThreads : pool.size() + 1;
+	size_t rangeCount = std::min(threadCount, count / minParallelRayCount);
+	if (rangeCount < 2){
+		intersectRange(bvh, rays, hits, 0, count);
+		return;
+	}
+	// Ranges of whole packets, so that every packet stays coherent
+	size_t packetCount = count / packetSize;
+	pool.parallelFor(rangeCount, [&](size_t range){
+		size_t first = packetCount * range / rangeCount * packetSize;
+		size_t last = range + 1 == rangeCount ? count : packetCount * (range + 1) / rangeCount * packetSize;
+		intersectRange(bvh, rays, hits, first, last);
+	});
+}
@@ -0,0 +1,93 @@
+#include <string.h>
+
+#include "hash.hpp"
+
+static const unsigned long long PRIME64_1 = 0x9E3779B185EBCA87ULL;
+static const unsigned long long PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const unsigned long long PRIME64_3 = 0x165667B19E3779F9ULL;
+static const unsigned long long PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+static const unsigned long long PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+static inline unsigned long long rotl64(unsigned long long x, int r){
+	return (x << r) | (x >> (64 - r));
+}
+
+// Unaligned little-endian reads. memcpy compiles down to a plain load.
+static inline unsigned long long read64(const unsigned char * p){
+	unsigned long long v;
+	memcpy(&v, p, 8);
+	return v;
+}
+
+static inline unsigned int read32(const unsigned char * p){
+	unsigned int v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static inline unsigned long long round64(unsigned long long acc, unsigned long long input){
+	acc += input * PRIME64_2;
+	acc = rotl64(acc, 31);
+	return acc * PRIME64_1;
+}
+
+static inline unsigned long long mergeRound64(unsigned long long acc, unsigned long long val){
+	acc ^= round64(0, val);
+	return acc * PRIME64_1 + PRIME64_4;
+}
+
+unsigned long long hash64(const void * data, size_t size, unsigned long long seed){
+	const unsigned char * p = (const unsigned char *)data;
+	const unsigned char * end = p + size;
+	unsigned long long h;
+
+	if (size >= 32){
+		// 4 independent lanes, so the multiplies can overlap
+		unsigned long long v1 = seed + PRIME64_1 + PRIME64_2;
+		unsigned long long v2 = seed + PRIME64_2;
+		unsigned long long v3 = seed;
+		unsigned long long v4 = seed - PRIME64_1;
+		const unsigned char * limit = end - 32;
+		do{
+			v1 = round64(v1, read64(p));
+			v2 = round64(v2, read64(p + 8));
+			v3 = round64(v3, read64(p + 16));
+			v4 = round64(v4, read64(p + 24));
+			p += 32;
+		}while (p <= limit);
+
+		h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+		h = mergeRound64(h, v1);
+		h = mergeRound64(h, v2);
+		h = mergeRound64(h, v3);
+		h = mergeRound64(h, v4);
+	}else{
+		h = seed + PRIME64_5;
+	}
+
+	h += (unsigned long long)size;
+
+	while (p + 8 <= end){
+		h ^= round64(0, read64(p));
+		h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+		p += 8;
+	}
+	if (p + 4 <= end){
+		h ^= (unsigned long long)read32(p) * PRIME64_1;
+		h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+		p += 4;
+	}
+	while (p < end){
+		h ^= (*p) * PRIME64_5;
+		h = rotl64(h, 11) * PRIME64_1;
+		p++;
+	}
+
+	// Final avalanche
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
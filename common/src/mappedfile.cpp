@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <utility>
+
+#ifdef _WIN32
+	#ifndef WIN32_LEAN_AND_MEAN
+	#define WIN32_LEAN_AND_MEAN
+	#endif
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+#include "mappedfile.hpp"
+
+MappedFile::MappedFile()
+	: fileData(NULL), fileSize(0), opened(false)
+#ifdef _WIN32
+	, fileHandle(NULL), mappingHandle(NULL)
+#endif
+{
+}
+
+MappedFile::~MappedFile(){
+	close();
+}
+
+MappedFile::MappedFile(MappedFile && other)
+	: fileData(NULL), fileSize(0), opened(false)
+#ifdef _WIN32
+	, fileHandle(NULL), mappingHandle(NULL)
+#endif
+{
+	*this = std::move(other);
+}
+
+MappedFile & MappedFile::operator=(MappedFile && other){
+	if (this != &other){
+		close();
+		std::swap(fileData, other.fileData);
+		std::swap(fileSize, other.fileSize);
+		std::swap(opened, other.opened);
+#ifdef _WIN32
+		std::swap(fileHandle, other.fileHandle);
+		std::swap(mappingHandle, other.mappingHandle);
+#endif
+	}
+	return *this;
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const char * path){
+	close();
+
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size)){
+		CloseHandle(file);
+		return false;
+	}
+
+	// Empty files can't be mapped, but they are still valid files
+	if (size.QuadPart == 0){
+		CloseHandle(file);
+		opened = true;
+		return true;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping == NULL){
+		CloseHandle(file);
+		return false;
+	}
+
+	void * view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (view == NULL){
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	fileHandle = file;
+	mappingHandle = mapping;
+	fileData = (const unsigned char *)view;
+	fileSize = (size_t)size.QuadPart;
+	opened = true;
+	return true;
+}
+
+void MappedFile::close(){
+	if (fileData)
+		UnmapViewOfFile(fileData);
+	if (mappingHandle)
+		CloseHandle((HANDLE)mappingHandle);
+	if (fileHandle)
+		CloseHandle((HANDLE)fileHandle);
+	fileData = NULL;
+	fileSize = 0;
+	opened = false;
+	fileHandle = NULL;
+	mappingHandle = NULL;
+}
+
+#else
+
+bool MappedFile::open(const char * path){
+	close();
+
+	int fd = ::open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0){
+		::close(fd);
+		return false;
+	}
+
+	// Empty files can't be mapped, but they are still valid files
+	if (st.st_size == 0){
+		::close(fd);
+		opened = true;
+		return true;
+	}
+
+	void * view = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// The mapping keeps its own reference to the file
+	::close(fd);
+	if (view == MAP_FAILED)
+		return false;
+
+	fileData = (const unsigned char *)view;
+	fileSize = (size_t)st.st_size;
+	opened = true;
+	return true;
+}
+
+void MappedFile::close(){
+	if (fileData)
+		munmap((void *)fileData, fileSize);
+	fileData = NULL;
+	fileSize = 0;
+	opened = false;
+}
+
+#endif
@@ -0,0 +1,414 @@
+#include <vector>
+#include <string>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+
+#include <glm/glm.hpp>
+
+#include "objloader.hpp"
+#include "tangentspace.hpp"
+#include "vboindexer.hpp"
+#include "hash.hpp"
+#include "vertexformat.hpp"
+#include "meshoptimize.hpp"
+#include "meshsimplify.hpp"
+#include "meshlet.hpp"
+#include "meshcache.hpp"
+
+// Layout of a .meshcache file :
+// - a MeshCacheHeader
+// - each stream, in MeshCacheStream order, starting on a 64-byte boundary.
+// Absent streams have a size of 0. Everything is stored in the machine's
+// native byte order; the byte order tag rejects caches from other machines.
+
+static const char meshCacheMagic[8] = {'M', 'E', 'S', 'H', 'C', 'A', 'C', 'H'};
+static const unsigned int meshCacheVersion = 7;
+static const unsigned int meshCacheByteOrder = 0x01020304;
+static const size_t meshCacheAlignment = 64;
+
+enum MeshCacheStream{
+	MESH_STREAM_VERTICES,
+	MESH_STREAM_UVS,
+	MESH_STREAM_NORMALS,
+	MESH_STREAM_TANGENTS,
+	MESH_STREAM_BITANGENTS,
+	MESH_STREAM_INDICES,
+	MESH_STREAM_INTERLEAVED,
+	MESH_STREAM_LODS,
+	MESH_STREAM_MESHLETS,
+	MESH_STREAM_COUNT
+};
+
+struct MeshCacheHeader{
+	char magic[8];
+	unsigned int version;
+	unsigned int byteOrder;
+	unsigned long long sourceHash; // hash64 of the whole OBJ file
+	unsigned long long sourceSize;
+	unsigned int flags;
+	unsigned int vertexCount;
+	unsigned int indexCount;
+	unsigned int indexSize;
+	unsigned int lodCount;         // with MESH_CACHE_LODS
+	unsigned int meshletCount;     // with MESH_CACHE_MESHLETS
+	unsigned int vertexFormat;     // VertexFormatFlags, with MESH_CACHE_INTERLEAVED
+	float positionCenter[3];       // decoding transforms of the VertexLayout
+	float positionExtent[3];
+	float uvMin[2];
+	float uvScale[2];
+	unsigned long long offsets[MESH_STREAM_COUNT]; // from the start of the file
+	unsigned long long sizes[MESH_STREAM_COUNT];   // in bytes
+};
+
+// Points mesh into a cache blob, after checking that it matches the OBJ file
+static bool bindMeshCache(
+	const unsigned char * blob, size_t blobSize,
+	unsigned int flags, unsigned int vertexFormat, unsigned long long sourceHash, unsigned long long sourceSize,
+	CachedMesh & mesh
+){
+	if (blobSize < sizeof(MeshCacheHeader))
+		return false;
+	MeshCacheHeader header;
+	memcpy(&header, blob, sizeof(header));
+	if (memcmp(header.magic, meshCacheMagic, sizeof(meshCacheMagic)) != 0 ||
+		header.version != meshCacheVersion ||
+		header.byteOrder != meshCacheByteOrder ||
+		header.flags != flags ||
+		header.vertexFormat != vertexFormat ||
+		header.sourceHash != sourceHash ||
+		header.sourceSize != sourceSize)
+		return false;
+
+	// Never trust a file : every stream must be inside it, and aligned
+	for (int i = 0; i < MESH_STREAM_COUNT; i++){
+		if (header.sizes[i] == 0)
+			continue;
+		if (header.offsets[i] % meshCacheAlignment != 0 ||
+			header.offsets[i] > blobSize ||
+			header.sizes[i] > blobSize - header.offsets[i])
+			return false;
+	}
+	unsigned long long vec3Size = (unsigned long long)header.vertexCount * sizeof(glm::vec3);
+	unsigned long long vec2Size = (unsigned long long)header.vertexCount * sizeof(glm::vec2);
+	unsigned long long indicesSize = (unsigned long long)header.indexCount * header.indexSize;
+	bool hasTangents = (flags & MESH_CACHE_TANGENTS) != 0;
+	bool hasIndices = (flags & MESH_CACHE_INDEXED) != 0;
+	bool interleaved = (flags & MESH_CACHE_INTERLEAVED) != 0;
+	bool hasLods = (flags & MESH_CACHE_LODS) != 0;
+	unsigned long long lodsSize = (unsigned long long)header.lodCount * sizeof(LODLevel);
+	bool hasMeshlets = (flags & MESH_CACHE_MESHLETS) != 0;
+	unsigned long long meshletsSize = (unsigned long long)header.meshletCount * sizeof(Meshlet);
+	VertexLayout layout = makeVertexLayout(vertexFormat);
+	unsigned long long interleavedSize = (unsigned long long)header.vertexCount * layout.stride;
+	if (interleaved){
+		vec3Size = 0;
+		vec2Size = 0;
+	}
+	if (header.sizes[MESH_STREAM_VERTICES]    != vec3Size ||
+		header.sizes[MESH_STREAM_UVS]         != vec2Size ||
+		header.sizes[MESH_STREAM_NORMALS]     != vec3Size ||
+		header.sizes[MESH_STREAM_TANGENTS]    != (hasTangents ? vec3Size : 0) ||
+		header.sizes[MESH_STREAM_BITANGENTS]  != (hasTangents ? vec3Size : 0) ||
+		header.sizes[MESH_STREAM_INDICES]     != (hasIndices ? indicesSize : 0) ||
+		header.sizes[MESH_STREAM_INTERLEAVED] != (interleaved ? interleavedSize : 0) ||
+		header.sizes[MESH_STREAM_LODS]        != (hasLods ? lodsSize : 0) ||
+		header.sizes[MESH_STREAM_MESHLETS]    != (hasMeshlets ? meshletsSize : 0) ||
+		(hasIndices && header.indexSize != 2 && header.indexSize != 4))
+		return false;
+
+	// The levels of detail and the meshlets must stay inside the index buffer
+	const LODLevel * lods = hasLods ? (const LODLevel *)(blob + header.offsets[MESH_STREAM_LODS]) : NULL;
+	for (unsigned int i = 0; hasLods && i < header.lodCount; i++){
+		if ((unsigned long long)lods[i].firstIndex + lods[i].indexCount > header.indexCount)
+			return false;
+	}
+	const Meshlet * meshlets = hasMeshlets ? (const Meshlet *)(blob + header.offsets[MESH_STREAM_MESHLETS]) : NULL;
+	for (unsigned int i = 0; hasMeshlets && i < header.meshletCount; i++){
+		if ((unsigned long long)meshlets[i].firstIndex + meshlets[i].indexCount > header.indexCount)
+			return false;
+	}
+
+	mesh.vertexCount = header.vertexCount;
+	mesh.indexCount  = hasIndices ? header.indexCount : 0;
+	mesh.indexSize   = hasIndices ? header.indexSize : 0;
+	mesh.vertices    = !interleaved ? (const glm::vec3 *)(blob + header.offsets[MESH_STREAM_VERTICES]) : NULL;
+	mesh.uvs         = !interleaved ? (const glm::vec2 *)(blob + header.offsets[MESH_STREAM_UVS]) : NULL;
+	mesh.normals     = !interleaved ? (const glm::vec3 *)(blob + header.offsets[MESH_STREAM_NORMALS]) : NULL;
+	mesh.tangents    = !interleaved && hasTangents ? (const glm::vec3 *)(blob + header.offsets[MESH_STREAM_TANGENTS]) : NULL;
+	mesh.bitangents  = !interleaved && hasTangents ? (const glm::vec3 *)(blob + header.offsets[MESH_STREAM_BITANGENTS]) : NULL;
+	mesh.indices     = hasIndices ? (const void *)(blob + header.offsets[MESH_STREAM_INDICES]) : NULL;
+	mesh.interleaved = interleaved ? (const void *)(blob + header.offsets[MESH_STREAM_INTERLEAVED]) : NULL;
+	mesh.lodCount    = hasLods ? header.lodCount : 0;
+	mesh.lods        = lods;
+	mesh.meshletCount = hasMeshlets ? header.meshletCount : 0;
+	mesh.meshlets    = meshlets;
+	mesh.layout      = layout;
+	if (interleaved){
+		mesh.layout.positionCenter = glm::vec3(header.positionCenter[0], header.positionCenter[1], header.positionCenter[2]);
+		mesh.layout.positionExtent = glm::vec3(header.positionExtent[0], header.positionExtent[1], header.positionExtent[2]);
+		mesh.layout.uvMin          = glm::vec2(header.uvMin[0], header.uvMin[1]);
+		mesh.layout.uvScale        = glm::vec2(header.uvScale[0], header.uvScale[1]);
+	}
+	return true;
+}
+
+// Parses the OBJ file, runs the requested processing and serializes the result
+static bool buildMeshCache(
+	const char * source, size_t sourceSize, unsigned long long sourceHash,
+	unsigned int flags, unsigned int vertexFormat,
+	std::vector<unsigned char> & blob
+){
+	std::vector<glm::vec3> vertices;
+	std::vector<glm::vec2> uvs;
+	std::vector<glm::vec3> normals;
+	std::vector<glm::vec3> tangents;
+	std::vector<glm::vec3> bitangents;
+	std::vector<unsigned int> indices;
+
+	if (flags & MESH_CACHE_INDEXED){
+		// The OBJ indices can be used directly : tangents are summed per vertex, no welding needed
+		if (!loadOBJIndexedFromMemory(source, sourceSize, indices, vertices, uvs, normals))
+			return false;
+
+		// Some exporters write each corner with its own records, so the OBJ
+		// indices share almost nothing : weld equal vertices by value then
+		if (vertices.size() > indices.size() / 2){
+			std::vector<glm::vec3> cornerVertices(indices.size()), cornerNormals(indices.size());
+			std::vector<glm::vec2> cornerUVs(indices.size());
+			for (size_t i = 0; i < indices.size(); i++){
+				cornerVertices[i] = vertices[indices[i]];
+				cornerUVs[i]      = uvs[indices[i]];
+				cornerNormals[i]  = normals[indices[i]];
+			}
+			size_t objVertexCount = vertices.size();
+			indices.clear();
+			vertices.clear();
+			uvs.clear();
+			normals.clear();
+			indexVBO_parallel(cornerVertices, cornerUVs, cornerNormals, indices, vertices, uvs, normals);
+			if (vertices.size() < objVertexCount)
+				printf("Welded %u vertices into %u\n", (unsigned int)objVertexCount, (unsigned int)vertices.size());
+		}
+
+		if (flags & MESH_CACHE_TANGENTS)
+			computeTangentBasisIndexed(indices, vertices, uvs, normals, tangents, bitangents);
+	}else{
+		if (!loadOBJFromMemory(source, sourceSize, vertices, uvs, normals))
+			return false;
+
+		if (flags & MESH_CACHE_TANGENTS)
+			computeTangentBasis(vertices, uvs, normals, tangents, bitangents);
+	}
+
+	// Level 0 is the mesh itself; with MESH_CACHE_LODS, the simplified levels follow it in the index buffer
+	std::vector<LODLevel> lods;
+	if (flags & MESH_CACHE_LODS){
+		std::vector<unsigned int> lodIndices;
+		buildLODChain(indices, vertices, lodIndices, lods);
+		indices.swap(lodIndices);
+		for (size_t l = 0; l < lods.size(); l++)
+			printf("LOD %u : %u triangles, error %f\n", (unsigned int)l, lods[l].indexCount / 3, lods[l].error);
+	}else{
+		LODLevel level = {0, (unsigned int)indices.size(), 0.0f};
+		lods.push_back(level);
+	}
+
+	std::vector<Meshlet> meshlets;
+	if (flags & MESH_CACHE_INDEXED){
+		// Reorder triangles and vertices for the GPU caches. Done once, when the cache is built.
+		// Each level is reordered on its own; the vertices follow the full mesh.
+		std::vector<unsigned int> levelIndices(indices.begin(), indices.begin() + lods[0].indexCount);
+		VertexCacheStats before = analyzeVertexCache(levelIndices, vertices.size());
+		for (size_t l = 0; l < lods.size(); l++){
+			std::vector<unsigned int>::iterator first = indices.begin() + lods[l].firstIndex;
+			levelIndices.assign(first, first + lods[l].indexCount);
+			optimizeVertexCache(levelIndices, vertices.size());
+			optimizeOverdraw(levelIndices, vertices);
+			// Only the full mesh is worth culling in pieces : the other levels are for far away meshes
+			if (l == 0 && (flags & MESH_CACHE_MESHLETS))
+				buildMeshlets(levelIndices, vertices, meshlets);
+			std::copy(levelIndices.begin(), levelIndices.end(), first);
+		}
+		std::vector<unsigned int> remap;
+		size_t usedVertices = optimizeVertexFetch(indices, vertices.size(), remap);
+		remapVertices(vertices, remap, usedVertices);
+		remapVertices(uvs, remap, usedVertices);
+		remapVertices(normals, remap, usedVertices);
+		remapVertices(tangents, remap, usedVertices);
+		remapVertices(bitangents, remap, usedVertices);
+		levelIndices.assign(indices.begin(), indices.begin() + lods[0].indexCount);
+		VertexCacheStats after = analyzeVertexCache(levelIndices, vertices.size());
+		printf("Vertex cache : ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n", before.acmr, after.acmr, before.atvr, after.atvr);
+		if (flags & MESH_CACHE_MESHLETS)
+			printf("%u meshlets\n", (unsigned int)meshlets.size());
+	}
+
+	// 16-bit indices whenever they are enough : half the index bandwidth
+	std::vector<unsigned char> packed_indices;
+	size_t indexSize = packIndices(indices, vertices.size(), packed_indices);
+
+	// Everything goes in one interleaved buffer, instead of a stream per attribute
+	std::vector<unsigned char> interleaved;
+	VertexLayout layout;
+	if (flags & MESH_CACHE_INTERLEAVED){
+		packVertices(vertexFormat, vertices.size(), vertices.data(), uvs.data(), normals.data(), tangents.data(), bitangents.data(), layout, interleaved);
+		vertices.clear();
+		uvs.clear();
+		normals.clear();
+		tangents.clear();
+		bitangents.clear();
+	}
+
+	MeshCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, meshCacheMagic, sizeof(meshCacheMagic));
+	header.version     = meshCacheVersion;
+	header.byteOrder   = meshCacheByteOrder;
+	header.sourceHash  = sourceHash;
+	header.sourceSize  = sourceSize;
+	header.flags       = flags;
+	header.vertexCount = (unsigned int)(layout.stride ? interleaved.size() / layout.stride : vertices.size());
+	header.indexCount  = (unsigned int)indices.size();
+	header.indexSize   = (flags & MESH_CACHE_INDEXED) ? (unsigned int)indexSize : 0;
+	header.lodCount    = (flags & MESH_CACHE_LODS) ? (unsigned int)lods.size() : 0;
+	header.meshletCount = (unsigned int)meshlets.size();
+	header.vertexFormat = vertexFormat;
+	for (int k = 0; k < 3; k++){
+		header.positionCenter[k] = layout.positionCenter[k];
+		header.positionExtent[k] = layout.positionExtent[k];
+	}
+	for (int k = 0; k < 2; k++){
+		header.uvMin[k] = layout.uvMin[k];
+		header.uvScale[k] = layout.uvScale[k];
+	}
+
+	const void * streams[MESH_STREAM_COUNT] = {
+		vertices.data(), uvs.data(), normals.data(), tangents.data(), bitangents.data(), packed_indices.data(), interleaved.data(), lods.data(), meshlets.data()
+	};
+	header.sizes[MESH_STREAM_VERTICES]   = vertices.size()   * sizeof(glm::vec3);
+	header.sizes[MESH_STREAM_UVS]        = uvs.size()        * sizeof(glm::vec2);
+	header.sizes[MESH_STREAM_NORMALS]    = normals.size()    * sizeof(glm::vec3);
+	header.sizes[MESH_STREAM_TANGENTS]   = tangents.size()   * sizeof(glm::vec3);
+	header.sizes[MESH_STREAM_BITANGENTS] = bitangents.size() * sizeof(glm::vec3);
+	header.sizes[MESH_STREAM_INDICES]    = packed_indices.size();
+	header.sizes[MESH_STREAM_INTERLEAVED] = interleaved.size();
+	header.sizes[MESH_STREAM_LODS]       = (flags & MESH_CACHE_LODS) ? lods.size() * sizeof(LODLevel) : 0;
+	header.sizes[MESH_STREAM_MESHLETS]   = meshlets.size() * sizeof(Meshlet);
+
+	size_t offset = sizeof(header);
+	for (int i = 0; i < MESH_STREAM_COUNT; i++){
+		offset = (offset + meshCacheAlignment - 1) / meshCacheAlignment * meshCacheAlignment;
+		header.offsets[i] = offset;
+		offset += (size_t)header.sizes[i];
+	}
+
+	blob.assign(offset, 0);
+	memcpy(blob.data(), &header, sizeof(header));
+	for (int i = 0; i < MESH_STREAM_COUNT; i++){
+		if (header.sizes[i])
+			memcpy(blob.data() + header.offsets[i], streams[i], (size_t)header.sizes[i]);
+	}
+	return true;
+}
+
+// Writes to a temporary file first, so that nobody ever maps half a cache
+static bool writeMeshCache(const std::string & cachePath, const std::vector<unsigned char> & blob){
+	std::string tempPath = cachePath + ".tmp";
+	FILE * file = fopen(tempPath.c_str(), "wb");
+	if (file == NULL)
+		return false;
+	bool written = fwrite(blob.data(), 1, blob.size(), file) == blob.size();
+	written = fclose(file) == 0 && written;
+	if (written){
+		remove(cachePath.c_str()); // rename() doesn't replace files on Windows
+		written = rename(tempPath.c_str(), cachePath.c_str()) == 0;
+	}
+	if (!written)
+		remove(tempPath.c_str());
+	return written;
+}
+
+// Drops the flags that don't apply, so that equivalent requests share a cache
+static void normalizeMeshCacheFlags(unsigned int & flags, unsigned int & vertexFormat){
+	// Levels of detail and meshlets are ranges of the index buffer
+	if (!(flags & MESH_CACHE_INDEXED))
+		flags &= ~(MESH_CACHE_LODS | MESH_CACHE_MESHLETS);
+
+	// The tangent frame of the vertex format follows MESH_CACHE_TANGENTS
+	if (!(flags & MESH_CACHE_INTERLEAVED))
+		vertexFormat = 0;
+	else if (flags & MESH_CACHE_TANGENTS)
+		vertexFormat |= VERTEX_TANGENTS;
+	else
+		vertexFormat &= ~(VERTEX_TANGENTS | VERTEX_QTANGENTS);
+}
+
+bool buildMeshCacheBlob(const char * source, size_t sourceSize, unsigned int flags, std::vector<unsigned char> & blob, unsigned int vertexFormat){
+	normalizeMeshCacheFlags(flags, vertexFormat);
+	return buildMeshCache(source, sourceSize, hash64(source, sourceSize), flags, vertexFormat, blob);
+}
+
+bool bindMeshCacheBlob(const unsigned char * blob, size_t blobSize, unsigned int flags, CachedMesh & mesh, unsigned int vertexFormat){
+	normalizeMeshCacheFlags(flags, vertexFormat);
+	mesh.file.close();
+	mesh.memory.clear();
+	// Whatever OBJ file the blob was made from
+	MeshCacheHeader header;
+	if (blobSize < sizeof(header))
+		return false;
+	memcpy(&header, blob, sizeof(header));
+	return bindMeshCache(blob, blobSize, flags, vertexFormat, header.sourceHash, header.sourceSize, mesh);
+}
+
+bool loadOBJCached(const char * path, unsigned int flags, CachedMesh & mesh, unsigned int vertexFormat){
+	printf("Loading OBJ file %s through its cache...\n", path);
+
+	normalizeMeshCacheFlags(flags, vertexFormat);
+
+	std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+	mesh.file.close();
+	mesh.memory.clear();
+
+	MappedFile source;
+	if( !source.open(path) ){
+		printf("Impossible to open the file ! Are you in the right path ? See Tutorial 1 for details\n");
+		getchar();
+		return false;
+	}
+	unsigned long long sourceHash = hash64(source.data(), source.size());
+
+	// Warm path : the cache exists and matches the OBJ file. Each set of
+	// flags has its own file, so that programs loading the same OBJ
+	// differently don't rebuild each other's cache.
+	char suffix[32];
+	snprintf(suffix, sizeof(suffix), ".%x-%x.meshcache", flags, vertexFormat);
+	std::string cachePath = std::string(path) + suffix;
+	if (mesh.file.open(cachePath.c_str()) &&
+		bindMeshCache(mesh.file.data(), mesh.file.size(), flags, vertexFormat, sourceHash, source.size(), mesh)){
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+		printf("Mapped %s in %.2f ms\n", cachePath.c_str(), ms);
+		return true;
+	}
+	mesh.file.close();
+
+	// Cold path : parse, process, and write the cache for next time
+	std::vector<unsigned char> blob;
+	if (!buildMeshCache((const char *)source.data(), source.size(), sourceHash, flags, vertexFormat, blob))
+		return false;
+
+	if (writeMeshCache(cachePath, blob) &&
+		mesh.file.open(cachePath.c_str()) &&
+		bindMeshCache(mesh.file.data(), mesh.file.size(), flags, vertexFormat, sourceHash, source.size(), mesh)){
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+		printf("Wrote %s in %.2f ms\n", cachePath.c_str(), ms);
+		return true;
+	}
+	mesh.file.close();
+
+	// The cache couldn't be written (read-only folder ?) : keep it in memory
+	printf("Can't write %s, the mesh will be parsed again next time\n", cachePath.c_str());
+	mesh.memory.swap(blob);
+	return bindMeshCache(mesh.memory.data(), mesh.memory.size(), flags, vertexFormat, sourceHash, source.size(), mesh);
+}
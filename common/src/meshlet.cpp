@@ -0,0 +1,274 @@
+#include <vector>
+#include <algorithm>
+#include <math.h>
+#include <float.h>
+
+#include <glm/glm.hpp>
+
+#include "meshoptimize.hpp"
+#include "meshlet.hpp"
+
+static const unsigned int NO_TRIANGLE = 0xFFFFFFFF;
+
+// Bounding sphere and normal cone of the triangles of a meshlet
+static void computeMeshletBounds(
+	Meshlet & meshlet, const unsigned int * indices,
+	const std::vector<glm::vec3> & vertices, const std::vector<glm::vec3> & triangleNormals, size_t firstTriangle
+){
+	glm::vec3 minimum(FLT_MAX), maximum(-FLT_MAX);
+	for (unsigned int i = 0; i < meshlet.indexCount; i++){
+		minimum = glm::min(minimum, vertices[indices[i]]);
+		maximum = glm::max(maximum, vertices[indices[i]]);
+	}
+	meshlet.center = (minimum + maximum) * 0.5f;
+	meshlet.radius = 0.0f;
+	for (unsigned int i = 0; i < meshlet.indexCount; i++)
+		meshlet.radius = std::max(meshlet.radius, glm::length(vertices[indices[i]] - meshlet.center));
+
+	glm::vec3 axis(0.0f);
+	for (unsigned int t = 0; t < meshlet.indexCount / 3; t++)
+		axis += triangleNormals[firstTriangle + t];
+	float length = glm::length(axis);
+	meshlet.coneAxis = length > 0.0f ? axis / length : glm::vec3(0.0f, 0.0f, 1.0f);
+
+	float minimumDot = length > 0.0f ? 1.0f : -1.0f;
+	for (unsigned int t = 0; t < meshlet.indexCount / 3; t++){
+		const glm::vec3 & normal = triangleNormals[firstTriangle + t];
+		// Degenerate triangles are never seen : they don't widen the cone
+		if (normal != glm::vec3(0.0f))
+			minimumDot = std::min(minimumDot, glm::dot(meshlet.coneAxis, normal));
+	}
+	// Past 90 degrees, some triangle faces every camera position
+	meshlet.coneCutoff = minimumDot > 0.0f ? sqrtf(1.0f - minimumDot * minimumDot) : 1.0f;
+}
+
+// Appends the triangles of a finished meshlet to the output, as its range
+static void closeMeshlet(
+	std::vector<Meshlet> & meshlets, std::vector<unsigned int> & output,
+	const std::vector<unsigned int> & indices, const std::vector<unsigned int> & triangles, unsigned int vertexCount
+){
+	Meshlet meshlet;
+	meshlet.firstIndex = (unsigned int)output.size();
+	meshlet.indexCount = (unsigned int)triangles.size() * 3;
+	meshlet.vertexCount = vertexCount;
+	for (size_t i = 0; i < triangles.size(); i++)
+		output.insert(output.end(), indices.begin() + 3 * triangles[i], indices.begin() + 3 * triangles[i] + 3);
+	meshlets.push_back(meshlet);
+}
+
+void buildMeshlets(
+	std::vector<unsigned int> & indices,
+	const std::vector<glm::vec3> & vertices,
+	std::vector<Meshlet> & meshlets,
+	unsigned int maxVertices,
+	unsigned int maxTriangles
+){
+	meshlets.clear();
+	size_t vertexCount = vertices.size();
+	size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0 || maxVertices < 3 || maxTriangles < 1)
+		return;
+
+	std::vector<glm::vec3> normals(triangleCount);
+	std::vector<glm::vec3> centroids(triangleCount);
+	for (size_t t = 0; t < triangleCount; t++){
+		const glm::vec3 & a = vertices[indices[3 * t]];
+		const glm::vec3 & b = vertices[indices[3 * t + 1]];
+		const glm::vec3 & c = vertices[indices[3 * t + 2]];
+		glm::vec3 normal = glm::cross(b - a, c - a);
+		float area = glm::length(normal);
+		normals[t] = area > 0.0f ? normal / area : glm::vec3(0.0f);
+		centroids[t] = (a + b + c) / 3.0f;
+	}
+
+	// Triangles of each vertex, packed in one array
+	std::vector<unsigned int> firstAdjacent(vertexCount + 1, 0);
+	for (size_t i = 0; i < triangleCount * 3; i++)
+		firstAdjacent[indices[i] + 1]++;
+	for (size_t v = 0; v < vertexCount; v++)
+		firstAdjacent[v + 1] += firstAdjacent[v];
+	std::vector<unsigned int> adjacent(triangleCount * 3);
+	{
+		std::vector<unsigned int> filled(firstAdjacent.begin(), firstAdjacent.end() - 1);
+		for (size_t i = 0; i < triangleCount * 3; i++)
+			adjacent[filled[indices[i]]++] = (unsigned int)(i / 3);
+	}
+
+	std::vector<unsigned int> output;
+	output.reserve(triangleCount * 3);
+	std::vector<bool> emitted(triangleCount, false);
+	// inMeshlet[v] == meshlets.size() + 1 while v is in the meshlet being built
+	std::vector<unsigned int> inMeshlet(vertexCount, 0);
+	std::vector<unsigned int> candidateMark(triangleCount, 0);
+	std::vector<unsigned int> candidates;
+	std::vector<unsigned int> meshletTriangles;
+	size_t nextUnemitted = 0;
+	unsigned int pending = NO_TRIANGLE;
+
+	unsigned int meshletVertices = 0;
+	glm::vec3 centroidSum(0.0f), normalSum(0.0f);
+
+	for (size_t emittedCount = 0; emittedCount < triangleCount; ){
+		unsigned int stamp = (unsigned int)meshlets.size() + 1;
+		unsigned int best = NO_TRIANGLE;
+		if (meshletTriangles.empty()){
+			// New meshlet : start next to the previous one if possible, in draw order otherwise
+			if (pending != NO_TRIANGLE && !emitted[pending]){
+				best = pending;
+			}else{
+				while (emitted[nextUnemitted])
+					nextUnemitted++;
+				best = (unsigned int)nextUnemitted;
+			}
+			pending = NO_TRIANGLE;
+		}else{
+			// The neighbouring triangle that adds the fewest vertices, then the closest
+			// one that faces the same way, so that the sphere and the cone stay tight
+			glm::vec3 center = centroidSum / (float)meshletTriangles.size();
+			float normalLength = glm::length(normalSum);
+			glm::vec3 axis = normalLength > 0.0f ? normalSum / normalLength : glm::vec3(0.0f);
+			unsigned int bestExtra = 4;
+			float bestCost = FLT_MAX;
+			size_t kept = 0;
+			for (size_t i = 0; i < candidates.size(); i++){
+				unsigned int t = candidates[i];
+				if (emitted[t])
+					continue;
+				candidates[kept++] = t;
+				unsigned int extra = 0;
+				for (int k = 0; k < 3; k++)
+					extra += inMeshlet[indices[3 * t + k]] != stamp;
+				float cost = glm::length(centroids[t] - center) * (1.0f + 16.0f * (1.0f - glm::dot(normals[t], axis)));
+				if (extra < bestExtra || (extra == bestExtra && cost < bestCost)){
+					best = t;
+					bestExtra = extra;
+					bestCost = cost;
+				}
+			}
+			candidates.resize(kept);
+		}
+
+		bool full = meshletTriangles.size() >= maxTriangles;
+		if (best != NO_TRIANGLE && !full){
+			unsigned int extra = 0;
+			for (int k = 0; k < 3; k++)
+				extra += inMeshlet[indices[3 * best + k]] != stamp;
+			full = meshletVertices + extra > maxVertices;
+		}
+
+		if (best == NO_TRIANGLE || full){
+			// Close the meshlet. The triangle that didn't fit starts the next one.
+			closeMeshlet(meshlets, output, indices, meshletTriangles, meshletVertices);
+			meshletTriangles.clear();
+			candidates.clear();
+			meshletVertices = 0;
+			centroidSum = glm::vec3(0.0f);
+			normalSum = glm::vec3(0.0f);
+			pending = best;
+			continue;
+		}
+
+		emitted[best] = true;
+		emittedCount++;
+		meshletTriangles.push_back(best);
+		centroidSum += centroids[best];
+		normalSum += normals[best];
+		for (int k = 0; k < 3; k++){
+			unsigned int v = indices[3 * best + k];
+			if (inMeshlet[v] == stamp)
+				continue;
+			inMeshlet[v] = stamp;
+			meshletVertices++;
+			for (unsigned int j = firstAdjacent[v]; j < firstAdjacent[v + 1]; j++){
+				unsigned int t = adjacent[j];
+				if (!emitted[t] && candidateMark[t] != stamp){
+					candidateMark[t] = stamp;
+					candidates.push_back(t);
+				}
+			}
+		}
+	}
+	if (!meshletTriangles.empty())
+		closeMeshlet(meshlets, output, indices, meshletTriangles, meshletVertices);
+
+	// Degenerate leftovers (index count not a multiple of 3) stay at the end
+	output.insert(output.end(), indices.begin() + triangleCount * 3, indices.end());
+	indices.swap(output);
+
+	// The triangles are in growth order : reorder each meshlet for the vertex
+	// cache, on local indices so that it only costs the size of the meshlet
+	std::vector<unsigned int> local, globalIndex;
+	std::vector<unsigned int> localIndex(vertexCount, 0xFFFFFFFF);
+	std::vector<glm::vec3> meshletNormals(triangleCount);
+	for (size_t m = 0; m < meshlets.size(); m++){
+		unsigned int * range = &indices[meshlets[m].firstIndex];
+		local.resize(meshlets[m].indexCount);
+		globalIndex.clear();
+		for (unsigned int i = 0; i < meshlets[m].indexCount; i++){
+			unsigned int v = range[i];
+			if (localIndex[v] == 0xFFFFFFFF){
+				localIndex[v] = (unsigned int)globalIndex.size();
+				globalIndex.push_back(v);
+			}
+			local[i] = localIndex[v];
+		}
+		optimizeVertexCache(local, globalIndex.size());
+		for (unsigned int i = 0; i < meshlets[m].indexCount; i++)
+			range[i] = globalIndex[local[i]];
+		for (size_t i = 0; i < globalIndex.size(); i++)
+			localIndex[globalIndex[i]] = 0xFFFFFFFF;
+
+		size_t firstTriangle = meshlets[m].firstIndex / 3;
+		for (unsigned int t = 0; t < meshlets[m].indexCount / 3; t++){
+			const glm::vec3 & a = vertices[range[3 * t]];
+			const glm::vec3 & b = vertices[range[3 * t + 1]];
+			const glm::vec3 & c = vertices[range[3 * t + 2]];
+			glm::vec3 normal = glm::cross(b - a, c - a);
+			float area = glm::length(normal);
+			meshletNormals[firstTriangle + t] = area > 0.0f ? normal / area : glm::vec3(0.0f);
+		}
+		computeMeshletBounds(meshlets[m], range, vertices, meshletNormals, firstTriangle);
+	}
+}
+
+size_t cullMeshlets(
+	const Meshlet * meshlets, size_t meshletCount,
+	const glm::mat4 & mvp, const glm::vec3 & cameraPosition,
+	std::vector<unsigned int> & visible
+){
+	// Frustum planes, in model space (Gribb & Hartmann) : row 3 +- rows 0, 1 and 2 of the matrix
+	glm::vec4 planes[6];
+	for (int i = 0; i < 3; i++){
+		glm::vec4 row(mvp[0][i], mvp[1][i], mvp[2][i], mvp[3][i]);
+		glm::vec4 w(mvp[0][3], mvp[1][3], mvp[2][3], mvp[3][3]);
+		planes[2 * i]     = w + row;
+		planes[2 * i + 1] = w - row;
+	}
+	for (int p = 0; p < 6; p++){
+		float length = glm::length(glm::vec3(planes[p].x, planes[p].y, planes[p].z));
+		if (length > 0.0f)
+			planes[p] = planes[p] / length;
+	}
+
+	visible.clear();
+	size_t triangles = 0;
+	for (size_t m = 0; m < meshletCount; m++){
+		const Meshlet & meshlet = meshlets[m];
+
+		bool outside = false;
+		for (int p = 0; p < 6 && !outside; p++)
+			outside = glm::dot(glm::vec3(planes[p].x, planes[p].y, planes[p].z), meshlet.center) + planes[p].w < -meshlet.radius;
+		if (outside)
+			continue;
+
+		// Back-facing from anywhere in the sphere : every triangle normal points away from the camera
+		glm::vec3 toCenter = meshlet.center - cameraPosition;
+		if (meshlet.coneCutoff < 1.0f &&
+			glm::dot(toCenter, meshlet.coneAxis) >= meshlet.coneCutoff * glm::length(toCenter) + meshlet.radius)
+			continue;
+
+		visible.push_back((unsigned int)m);
+		triangles += meshlet.indexCount / 3;
+	}
+	return triangles;
+}
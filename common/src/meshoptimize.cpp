@@ -0,0 +1,258 @@
+#include <vector>
+#include <algorithm>
+#include <math.h>
+
+#include <glm/glm.hpp>
+
+#include "meshoptimize.hpp"
+
+// Tom Forsyth's scoring. A vertex scores high if it was used recently
+// (it is likely still in the cache), and if few triangles still use it
+// (so that lonely vertices are finished off, instead of being reloaded later).
+static const int forsythCacheSize = 32;
+static const float forsythCacheDecayPower = 1.5f;
+static const float forsythLastTriangleScore = 0.75f;
+static const float forsythValenceBoostScale = 2.0f;
+static const float forsythValenceBoostPower = 0.5f;
+
+static float forsythVertexScore(int cachePosition, unsigned int remainingValence){
+	if (remainingValence == 0)
+		return -1.0f; // nothing left to draw with this vertex
+
+	float score = 0.0f;
+	if (cachePosition >= 0){
+		if (cachePosition < 3){
+			// Used by the last triangle : it was already rewarded
+			score = forsythLastTriangleScore;
+		}else{
+			float scaler = 1.0f / (forsythCacheSize - 3);
+			score = powf(1.0f - (cachePosition - 3) * scaler, forsythCacheDecayPower);
+		}
+	}
+	score += forsythValenceBoostScale * powf((float)remainingValence, -forsythValenceBoostPower);
+	return score;
+}
+
+void optimizeVertexCache(std::vector<unsigned int> & indices, size_t vertexCount){
+	size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0)
+		return;
+
+	// Triangles of each vertex, packed in one array
+	std::vector<unsigned int> remaining(vertexCount, 0);
+	for (size_t i = 0; i < triangleCount * 3; i++)
+		remaining[indices[i]]++;
+	std::vector<size_t> firstAdjacent(vertexCount + 1, 0);
+	for (size_t v = 0; v < vertexCount; v++)
+		firstAdjacent[v + 1] = firstAdjacent[v] + remaining[v];
+	std::vector<unsigned int> adjacent(triangleCount * 3);
+	{
+		std::vector<size_t> filled(firstAdjacent.begin(), firstAdjacent.end() - 1);
+		for (size_t i = 0; i < triangleCount * 3; i++)
+			adjacent[filled[indices[i]]++] = (unsigned int)(i / 3);
+	}
+
+	std::vector<int> cachePosition(vertexCount, -1);
+	std::vector<float> vertexScore(vertexCount);
+	for (size_t v = 0; v < vertexCount; v++)
+		vertexScore[v] = forsythVertexScore(-1, remaining[v]);
+
+	std::vector<float> triangleScore(triangleCount);
+	std::vector<bool> emitted(triangleCount, false);
+	for (size_t t = 0; t < triangleCount; t++)
+		triangleScore[t] = vertexScore[indices[3 * t]] + vertexScore[indices[3 * t + 1]] + vertexScore[indices[3 * t + 2]];
+
+	// Start with the best triangle of the whole mesh
+	size_t best = 0;
+	for (size_t t = 1; t < triangleCount; t++){
+		if (triangleScore[t] > triangleScore[best])
+			best = t;
+	}
+
+	std::vector<unsigned int> cache, newCache;
+	cache.reserve(forsythCacheSize + 3);
+	newCache.reserve(forsythCacheSize + 3);
+	std::vector<unsigned int> output;
+	output.reserve(triangleCount * 3);
+	size_t nextUnemitted = 0;
+
+	for (size_t count = 0; count < triangleCount; count++){
+		if (best == (size_t)-1){
+			// Nothing left around the cache : continue with the first triangle left
+			while (emitted[nextUnemitted])
+				nextUnemitted++;
+			best = nextUnemitted;
+		}
+
+		const unsigned int * triangle = &indices[3 * best];
+		output.insert(output.end(), triangle, triangle + 3);
+		emitted[best] = true;
+
+		// The triangle is done : remove it from its vertices
+		newCache.clear();
+		for (int k = 0; k < 3; k++){
+			unsigned int v = triangle[k];
+			unsigned int * triangles = &adjacent[firstAdjacent[v]];
+			for (unsigned int j = 0; j < remaining[v]; j++){
+				if (triangles[j] == best){
+					triangles[j] = triangles[remaining[v] - 1];
+					remaining[v]--;
+					break;
+				}
+			}
+			if (std::find(newCache.begin(), newCache.end(), v) == newCache.end())
+				newCache.push_back(v);
+		}
+
+		// Its vertices go to the front of the (LRU) cache
+		for (size_t i = 0; i < cache.size(); i++){
+			if (std::find(newCache.begin(), newCache.end(), cache[i]) == newCache.end())
+				newCache.push_back(cache[i]);
+		}
+
+		// Update the scores of the vertices that moved in, or fell out of the cache
+		for (size_t i = 0; i < newCache.size(); i++){
+			unsigned int v = newCache[i];
+			cachePosition[v] = i < (size_t)forsythCacheSize ? (int)i : -1;
+			float score = forsythVertexScore(cachePosition[v], remaining[v]);
+			float delta = score - vertexScore[v];
+			vertexScore[v] = score;
+			const unsigned int * triangles = &adjacent[firstAdjacent[v]];
+			for (unsigned int j = 0; j < remaining[v]; j++)
+				triangleScore[triangles[j]] += delta;
+		}
+		if (newCache.size() > (size_t)forsythCacheSize)
+			newCache.resize(forsythCacheSize);
+		cache.swap(newCache);
+
+		// The next triangle is the best one that uses a vertex in the cache
+		best = (size_t)-1;
+		float bestScore = -1.0f;
+		for (size_t i = 0; i < cache.size(); i++){
+			unsigned int v = cache[i];
+			const unsigned int * triangles = &adjacent[firstAdjacent[v]];
+			for (unsigned int j = 0; j < remaining[v]; j++){
+				unsigned int t = triangles[j];
+				if (triangleScore[t] > bestScore || (triangleScore[t] == bestScore && t < best)){
+					bestScore = triangleScore[t];
+					best = t;
+				}
+			}
+		}
+	}
+
+	// Degenerate leftovers (index count not a multiple of 3) stay at the end
+	output.insert(output.end(), indices.begin() + triangleCount * 3, indices.end());
+	indices.swap(output);
+}
+
+// Runs of triangles, in draw order. A run starts wherever the cache restarts
+// (a triangle with no vertex in the cache), so reordering runs keeps almost
+// all of the vertex cache efficiency.
+struct OverdrawCluster{
+	size_t first, count; // in triangles
+	float sortKey;
+};
+
+static bool drawnBefore(const OverdrawCluster & a, const OverdrawCluster & b){
+	return a.sortKey > b.sortKey;
+}
+
+void optimizeOverdraw(std::vector<unsigned int> & indices, const std::vector<glm::vec3> & vertices){
+	size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0)
+		return;
+
+	// Split in clusters, with the same FIFO cache model as analyzeVertexCache
+	const unsigned int cacheSize = 16;
+	std::vector<unsigned int> timestamps(vertices.size(), 0);
+	unsigned int time = cacheSize + 1;
+	std::vector<OverdrawCluster> clusters;
+	for (size_t t = 0; t < triangleCount; t++){
+		unsigned int misses = 0;
+		for (int k = 0; k < 3; k++){
+			unsigned int v = indices[3 * t + k];
+			if (time - timestamps[v] > cacheSize){
+				timestamps[v] = time++;
+				misses++;
+			}
+		}
+		if (clusters.empty() || misses == 3){
+			OverdrawCluster cluster = {t, 0, 0.0f};
+			clusters.push_back(cluster);
+		}
+		clusters.back().count++;
+	}
+
+	// Centroid of the whole mesh, weighted by area
+	std::vector<glm::vec3> clusterCentroids(clusters.size());
+	std::vector<glm::vec3> clusterNormals(clusters.size());
+	glm::vec3 meshCentroid(0.0f);
+	float meshArea = 0.0f;
+	for (size_t c = 0; c < clusters.size(); c++){
+		glm::vec3 centroid(0.0f), normal(0.0f);
+		float area = 0.0f;
+		for (size_t t = clusters[c].first; t < clusters[c].first + clusters[c].count; t++){
+			const glm::vec3 & a = vertices[indices[3 * t]];
+			const glm::vec3 & b = vertices[indices[3 * t + 1]];
+			const glm::vec3 & d = vertices[indices[3 * t + 2]];
+			glm::vec3 n = glm::cross(b - a, d - a);
+			float triangleArea = glm::length(n);
+			centroid += (a + b + d) * (triangleArea / 3.0f);
+			normal += n;
+			area += triangleArea;
+		}
+		meshCentroid += centroid;
+		meshArea += area;
+		clusterCentroids[c] = area > 0.0f ? centroid / area : vertices[indices[3 * clusters[c].first]];
+		float length = glm::length(normal);
+		clusterNormals[c] = length > 0.0f ? normal / length : glm::vec3(0.0f);
+	}
+	if (meshArea > 0.0f)
+		meshCentroid /= meshArea;
+
+	// Clusters that face away from the center are on the outside of the mesh :
+	// from wherever they are visible, they tend to hide the others
+	for (size_t c = 0; c < clusters.size(); c++)
+		clusters[c].sortKey = glm::dot(clusterCentroids[c] - meshCentroid, clusterNormals[c]);
+	std::stable_sort(clusters.begin(), clusters.end(), drawnBefore);
+
+	std::vector<unsigned int> output;
+	output.reserve(indices.size());
+	for (size_t c = 0; c < clusters.size(); c++)
+		output.insert(output.end(), indices.begin() + 3 * clusters[c].first, indices.begin() + 3 * (clusters[c].first + clusters[c].count));
+	output.insert(output.end(), indices.begin() + triangleCount * 3, indices.end());
+	indices.swap(output);
+}
+
+size_t optimizeVertexFetch(std::vector<unsigned int> & indices, size_t vertexCount, std::vector<unsigned int> & remap){
+	remap.assign(vertexCount, 0xFFFFFFFF);
+	unsigned int next = 0;
+	for (size_t i = 0; i < indices.size(); i++){
+		unsigned int & index = indices[i];
+		if (remap[index] == 0xFFFFFFFF)
+			remap[index] = next++;
+		index = remap[index];
+	}
+	return next;
+}
+
+VertexCacheStats analyzeVertexCache(const std::vector<unsigned int> & indices, size_t vertexCount, unsigned int cacheSize){
+	// A vertex is in the FIFO cache if less than cacheSize vertices were loaded since it was
+	std::vector<unsigned int> timestamps(vertexCount, 0);
+	unsigned int time = cacheSize + 1;
+	size_t usedVertices = 0;
+	for (size_t i = 0; i < indices.size(); i++){
+		unsigned int v = indices[i];
+		if (timestamps[v] == 0)
+			usedVertices++;
+		if (time - timestamps[v] > cacheSize)
+			timestamps[v] = time++;
+	}
+
+	VertexCacheStats stats;
+	stats.transformedVertices = time - (cacheSize + 1);
+	stats.acmr = indices.size() >= 3 ? (float)stats.transformedVertices / (indices.size() / 3) : 0.0f;
+	stats.atvr = usedVertices ? (float)stats.transformedVertices / usedVertices : 0.0f;
+	return stats;
+}
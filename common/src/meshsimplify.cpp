@@ -0,0 +1,515 @@
+#include <vector>
+#include <algorithm>
+#include <math.h>
+#include <float.h>
+
+#include <glm/glm.hpp>
+
+#include "meshsimplify.hpp"
+
+static const unsigned int NO_VERTEX = 0xFFFFFFFF;
+
+// How a vertex is allowed to move
+enum SimplifyVertexKind{
+	SIMPLIFY_MANIFOLD, // inside the surface : collapses onto any neighbour
+	SIMPLIFY_BORDER,   // on an open edge : only collapses along it, onto another border vertex
+	SIMPLIFY_SEAM,     // one of the 2 vertices of a seam : both collapse along the seam, onto another seam
+	SIMPLIFY_LOCKED    // corners, seams of more than 2 vertices, non manifold edges : never moves
+};
+
+static const bool canCollapse[4][4] = {
+	{true,  true,  true,  true },
+	{false, true,  false, false},
+	{false, false, true,  false},
+	{false, false, false, false}
+};
+
+// Edges between these kinds are in 2 triangles, once in each direction
+static const bool hasOpposite[4][4] = {
+	{true, true,  true, true },
+	{true, false, true, false},
+	{true, true,  true, true },
+	{true, false, true, false}
+};
+
+// Sum of squared distances to a set of planes, weighted :
+// error(p) = p.A.p + 2 b.p + c, with A symmetric
+struct Quadric{
+	float a00, a11, a22, a10, a20, a21;
+	float b0, b1, b2;
+	float c;
+	float w;
+};
+
+static void quadricFromPlane(Quadric & Q, const glm::vec3 & n, float d, float w){
+	Q.a00 = w * n.x * n.x;
+	Q.a11 = w * n.y * n.y;
+	Q.a22 = w * n.z * n.z;
+	Q.a10 = w * n.y * n.x;
+	Q.a20 = w * n.z * n.x;
+	Q.a21 = w * n.z * n.y;
+	Q.b0 = w * n.x * d;
+	Q.b1 = w * n.y * d;
+	Q.b2 = w * n.z * d;
+	Q.c = w * d * d;
+	Q.w = w;
+}
+
+static void quadricAdd(Quadric & Q, const Quadric & R){
+	Q.a00 += R.a00; Q.a11 += R.a11; Q.a22 += R.a22;
+	Q.a10 += R.a10; Q.a20 += R.a20; Q.a21 += R.a21;
+	Q.b0 += R.b0; Q.b1 += R.b1; Q.b2 += R.b2;
+	Q.c += R.c;
+	Q.w += R.w;
+}
+
+// Squared distance, averaged over the planes
+static float quadricError(const Quadric & Q, const glm::vec3 & p){
+	// A.p + 2 b, dotted with p
+	float rx = Q.a00 * p.x + Q.a10 * p.y + Q.a20 * p.z + 2.0f * Q.b0;
+	float ry = Q.a10 * p.x + Q.a11 * p.y + Q.a21 * p.z + 2.0f * Q.b1;
+	float rz = Q.a20 * p.x + Q.a21 * p.y + Q.a22 * p.z + 2.0f * Q.b2;
+	float r = Q.c + rx * p.x + ry * p.y + rz * p.z;
+	return Q.w > 0.0f ? fabsf(r) / Q.w : 0.0f;
+}
+
+// The plane of the triangle, weighted by the square root of its area so that
+// it adds up with the edge quadrics, weighted by length
+static void quadricFromTriangle(Quadric & Q, const glm::vec3 & p0, const glm::vec3 & p1, const glm::vec3 & p2){
+	glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+	float area = glm::length(normal);
+	if (area > 0.0f)
+		normal /= area;
+	quadricFromPlane(Q, normal, -glm::dot(normal, p0), sqrtf(area));
+}
+
+// The plane through the edge p0 p1 that is perpendicular to the triangle :
+// keeps the vertices of a border (or seam) on its line
+static void quadricFromTriangleEdge(Quadric & Q, const glm::vec3 & p0, const glm::vec3 & p1, const glm::vec3 & p2, float weight){
+	glm::vec3 edge = p1 - p0;
+	float length = glm::length(edge);
+	if (length > 0.0f)
+		edge /= length;
+	glm::vec3 normal = (p2 - p0) - edge * glm::dot(p2 - p0, edge);
+	float normalLength = glm::length(normal);
+	if (normalLength > 0.0f)
+		normal /= normalLength;
+	quadricFromPlane(Q, normal, -glm::dot(normal, p0), length * weight);
+}
+
+// Half-edges leaving each vertex, with the 2 other vertices of their triangle
+struct EdgeAdjacency{
+	std::vector<unsigned int> offsets; // vertexCount + 1
+	std::vector<unsigned int> next;
+	std::vector<unsigned int> prev;
+};
+
+static void buildEdgeAdjacency(EdgeAdjacency & adjacency, const std::vector<unsigned int> & indices, size_t vertexCount){
+	adjacency.offsets.assign(vertexCount + 1, 0);
+	for (size_t i = 0; i < indices.size(); i++)
+		adjacency.offsets[indices[i] + 1]++;
+	for (size_t v = 0; v < vertexCount; v++)
+		adjacency.offsets[v + 1] += adjacency.offsets[v];
+
+	adjacency.next.resize(indices.size());
+	adjacency.prev.resize(indices.size());
+	std::vector<unsigned int> filled(adjacency.offsets.begin(), adjacency.offsets.end() - 1);
+	for (size_t i = 0; i < indices.size(); i += 3){
+		unsigned int a = indices[i], b = indices[i + 1], c = indices[i + 2];
+		adjacency.next[filled[a]] = b; adjacency.prev[filled[a]++] = c;
+		adjacency.next[filled[b]] = c; adjacency.prev[filled[b]++] = a;
+		adjacency.next[filled[c]] = a; adjacency.prev[filled[c]++] = b;
+	}
+}
+
+static bool hasEdge(const EdgeAdjacency & adjacency, unsigned int a, unsigned int b){
+	for (unsigned int e = adjacency.offsets[a]; e < adjacency.offsets[a + 1]; e++){
+		if (adjacency.next[e] == b)
+			return true;
+	}
+	return false;
+}
+
+// remap[v] is the first vertex at the same position as v, and the vertices at
+// the same position are linked in a ring by wedge (wedge[v] == v if v is alone)
+static void buildPositionRemap(const std::vector<glm::vec3> & vertices, std::vector<unsigned int> & remap, std::vector<unsigned int> & wedge){
+	size_t vertexCount = vertices.size();
+	std::vector<unsigned int> sorted(vertexCount);
+	for (size_t v = 0; v < vertexCount; v++)
+		sorted[v] = (unsigned int)v;
+	std::stable_sort(sorted.begin(), sorted.end(), [&vertices](unsigned int a, unsigned int b){
+		const glm::vec3 & p = vertices[a];
+		const glm::vec3 & q = vertices[b];
+		if (p.x != q.x) return p.x < q.x;
+		if (p.y != q.y) return p.y < q.y;
+		return p.z < q.z;
+	});
+
+	remap.resize(vertexCount);
+	wedge.resize(vertexCount);
+	for (size_t first = 0; first < vertexCount; ){
+		size_t last = first + 1;
+		while (last < vertexCount && vertices[sorted[last]] == vertices[sorted[first]])
+			last++;
+		// The sort is stable : the first one has the lowest index
+		for (size_t i = first; i < last; i++){
+			remap[sorted[i]] = sorted[first];
+			wedge[sorted[i]] = sorted[i + 1 < last ? i + 1 : first];
+		}
+		first = last;
+	}
+}
+
+// loop[v] is the vertex after v on its open edge, loopback[v] the one before
+// (NO_VERTEX if v has no open edge, v itself if it has several)
+static void classifyVertices(
+	const EdgeAdjacency & adjacency, const std::vector<unsigned int> & remap, const std::vector<unsigned int> & wedge,
+	std::vector<unsigned char> & kinds, std::vector<unsigned int> & loop, std::vector<unsigned int> & loopback
+){
+	size_t vertexCount = remap.size();
+	loop.assign(vertexCount, NO_VERTEX);
+	loopback.assign(vertexCount, NO_VERTEX);
+	for (unsigned int v = 0; v < vertexCount; v++){
+		for (unsigned int e = adjacency.offsets[v]; e < adjacency.offsets[v + 1]; e++){
+			unsigned int target = adjacency.next[e];
+			if (!hasEdge(adjacency, target, v)){
+				loop[v] = loop[v] == NO_VERTEX ? target : v;
+				loopback[target] = loopback[target] == NO_VERTEX ? v : target;
+			}
+		}
+	}
+
+	kinds.resize(vertexCount);
+	for (unsigned int v = 0; v < vertexCount; v++){
+		if (remap[v] != v)
+			continue;
+		unsigned char kind = SIMPLIFY_LOCKED;
+		if (wedge[v] == v){
+			// Alone at its position : inside the surface, or on exactly one border
+			if (loop[v] == NO_VERTEX && loopback[v] == NO_VERTEX)
+				kind = SIMPLIFY_MANIFOLD;
+			else if (loop[v] != NO_VERTEX && loop[v] != v && loopback[v] != NO_VERTEX && loopback[v] != v)
+				kind = SIMPLIFY_BORDER;
+		}else if (wedge[wedge[v]] == v){
+			// 2 vertices : each side of the seam has one open edge, and the 2 sides must join up
+			unsigned int w = wedge[v];
+			if (loop[v] != NO_VERTEX && loop[v] != v && loopback[v] != NO_VERTEX && loopback[v] != v &&
+				loop[w] != NO_VERTEX && loop[w] != w && loopback[w] != NO_VERTEX && loopback[w] != w &&
+				remap[loopback[v]] == remap[loop[w]] && remap[loop[v]] == remap[loopback[w]] &&
+				remap[loop[v]] != remap[loopback[v]])
+				kind = SIMPLIFY_SEAM;
+		}
+		kinds[v] = kind;
+	}
+	for (unsigned int v = 0; v < vertexCount; v++)
+		kinds[v] = kinds[remap[v]];
+}
+
+// Borders and seams must keep their shape even though the triangles around
+// them only pull on one side
+static void addEdgeQuadrics(
+	std::vector<Quadric> & quadrics, const std::vector<unsigned int> & indices, const std::vector<glm::vec3> & positions,
+	const std::vector<unsigned int> & remap, const std::vector<unsigned char> & kinds,
+	const std::vector<unsigned int> & loop, const std::vector<unsigned int> & loopback
+){
+	static const int next[4] = {1, 2, 0, 1};
+	for (size_t i = 0; i < indices.size(); i += 3){
+		for (int k = 0; k < 3; k++){
+			unsigned int i0 = indices[i + k];
+			unsigned int i1 = indices[i + next[k]];
+			unsigned char k0 = kinds[i0], k1 = kinds[i1];
+			bool open0 = k0 == SIMPLIFY_BORDER || k0 == SIMPLIFY_SEAM;
+			bool open1 = k1 == SIMPLIFY_BORDER || k1 == SIMPLIFY_SEAM;
+			// Edges to locked vertices count too, or the corners would be free to move
+			if (!open0 && !open1)
+				continue;
+			if ((open0 && loop[i0] != i1) || (open1 && loopback[i1] != i0))
+				continue;
+			if (hasOpposite[k0][k1] && remap[i1] > remap[i0])
+				continue;
+
+			// Borders are where holes would appear : they are held much more firmly
+			float weight = (k0 == SIMPLIFY_BORDER || k1 == SIMPLIFY_BORDER) ? 10.0f : 1.0f;
+			Quadric Q;
+			quadricFromTriangleEdge(Q, positions[i0], positions[i1], positions[indices[i + next[k + 1]]], weight);
+			quadricAdd(quadrics[remap[i0]], Q);
+			quadricAdd(quadrics[remap[i1]], Q);
+		}
+	}
+}
+
+struct EdgeCollapse{
+	unsigned int v0, v1; // v0 moves onto v1
+	bool bidirectional;  // or the other way around, if cheaper
+	float error;
+};
+
+static void pickEdgeCollapses(
+	std::vector<EdgeCollapse> & collapses, const std::vector<unsigned int> & indices,
+	const std::vector<unsigned int> & remap, const std::vector<unsigned char> & kinds, const std::vector<unsigned int> & loop
+){
+	static const int next[3] = {1, 2, 0};
+	collapses.clear();
+	for (size_t i = 0; i < indices.size(); i += 3){
+		for (int k = 0; k < 3; k++){
+			unsigned int i0 = indices[i + k];
+			unsigned int i1 = indices[i + next[k]];
+			if (remap[i0] == remap[i1])
+				continue;
+			unsigned char k0 = kinds[i0], k1 = kinds[i1];
+			if (!canCollapse[k0][k1] && !canCollapse[k1][k0])
+				continue;
+			// Only once per edge
+			if (hasOpposite[k0][k1] && remap[i1] > remap[i0])
+				continue;
+			// 2 border (or seam) vertices that aren't next to each other on it : collapsing them would tear the surface
+			if (k0 == k1 && (k0 == SIMPLIFY_BORDER || k0 == SIMPLIFY_SEAM) && loop[i0] != i1)
+				continue;
+
+			EdgeCollapse collapse;
+			collapse.bidirectional = canCollapse[k0][k1] && canCollapse[k1][k0];
+			collapse.v0 = canCollapse[k0][k1] ? i0 : i1;
+			collapse.v1 = canCollapse[k0][k1] ? i1 : i0;
+			collapse.error = 0.0f;
+			collapses.push_back(collapse);
+		}
+	}
+}
+
+static void rankEdgeCollapses(std::vector<EdgeCollapse> & collapses, const std::vector<glm::vec3> & positions, const std::vector<Quadric> & quadrics, const std::vector<unsigned int> & remap){
+	for (size_t i = 0; i < collapses.size(); i++){
+		EdgeCollapse & c = collapses[i];
+		c.error = quadricError(quadrics[remap[c.v0]], positions[c.v1]);
+		if (c.bidirectional){
+			float reverse = quadricError(quadrics[remap[c.v1]], positions[c.v0]);
+			if (reverse < c.error){
+				std::swap(c.v0, c.v1);
+				c.error = reverse;
+			}
+		}
+	}
+}
+
+// Would moving position r0 onto r1 turn one of the triangles around r0 upside down ?
+// Those are the triangles of every vertex at r0 (all the sides of a seam);
+// collapseRemap tells where the vertices that already moved in this pass went.
+static bool hasTriangleFlips(
+	const EdgeAdjacency & adjacency, const std::vector<glm::vec3> & positions,
+	const std::vector<unsigned int> & remap, const std::vector<unsigned int> & wedge,
+	const std::vector<unsigned int> & collapseRemap,
+	unsigned int r0, unsigned int r1
+){
+	const glm::vec3 & p0 = positions[r0];
+	const glm::vec3 & p1 = positions[r1];
+	unsigned int v = r0;
+	do{
+		for (unsigned int e = adjacency.offsets[v]; e < adjacency.offsets[v + 1]; e++){
+			unsigned int a = collapseRemap[adjacency.next[e]];
+			unsigned int b = collapseRemap[adjacency.prev[e]];
+			// Triangles that this collapse removes, or that previous ones already did
+			if (remap[a] == r1 || remap[b] == r1 || remap[a] == remap[b])
+				continue;
+			glm::vec3 edge = positions[b] - positions[a];
+			glm::vec3 before = glm::cross(edge, p0 - positions[a]);
+			glm::vec3 after = glm::cross(edge, p1 - positions[a]);
+			// Turning by more than about 75 degrees counts too : a triangle
+			// that turns a bit at each pass would end up upside down
+			if (glm::dot(before, after) <= 0.25f * glm::length(before) * glm::length(after))
+				return true;
+		}
+		v = wedge[v];
+	}while (v != r0);
+	return false;
+}
+
+size_t simplifyMesh(
+	const std::vector<unsigned int> & indices,
+	const std::vector<glm::vec3> & vertices,
+	size_t targetIndexCount,
+	std::vector<unsigned int> & out_indices,
+	float * out_error
+){
+	size_t vertexCount = vertices.size();
+
+	// Degenerate triangles have no place in the adjacency
+	out_indices.clear();
+	out_indices.reserve(indices.size());
+	for (size_t i = 0; i + 2 < indices.size(); i += 3){
+		unsigned int a = indices[i], b = indices[i + 1], c = indices[i + 2];
+		if (a != b && b != c && c != a){
+			out_indices.push_back(a);
+			out_indices.push_back(b);
+			out_indices.push_back(c);
+		}
+	}
+
+	// Work in the unit cube : the quadrics are in floats
+	glm::vec3 minimum(FLT_MAX), maximum(-FLT_MAX);
+	for (size_t v = 0; v < vertexCount; v++){
+		minimum = glm::min(minimum, vertices[v]);
+		maximum = glm::max(maximum, vertices[v]);
+	}
+	glm::vec3 size = maximum - minimum;
+	float extent = std::max(size.x, std::max(size.y, size.z));
+	float scale = extent > 0.0f ? 1.0f / extent : 1.0f;
+	std::vector<glm::vec3> positions(vertexCount);
+	for (size_t v = 0; v < vertexCount; v++)
+		positions[v] = (vertices[v] - minimum) * scale;
+
+	std::vector<unsigned int> remap, wedge;
+	buildPositionRemap(vertices, remap, wedge);
+
+	// One quadric per position : the 2 sides of a seam share theirs
+	Quadric zero;
+	quadricFromPlane(zero, glm::vec3(0.0f), 0.0f, 0.0f);
+	std::vector<Quadric> quadrics(vertexCount, zero);
+	for (size_t i = 0; i < out_indices.size(); i += 3){
+		Quadric Q;
+		quadricFromTriangle(Q, positions[out_indices[i]], positions[out_indices[i + 1]], positions[out_indices[i + 2]]);
+		quadricAdd(quadrics[remap[out_indices[i]]], Q);
+		quadricAdd(quadrics[remap[out_indices[i + 1]]], Q);
+		quadricAdd(quadrics[remap[out_indices[i + 2]]], Q);
+	}
+
+	EdgeAdjacency adjacency;
+	std::vector<unsigned char> kinds;
+	std::vector<unsigned int> loop, loopback;
+	std::vector<EdgeCollapse> collapses;
+	std::vector<unsigned int> order;
+	std::vector<unsigned int> collapseRemap(vertexCount);
+	std::vector<unsigned char> collapseLocked(vertexCount);
+	float resultError = 0.0f;
+
+	// Each pass collapses a batch of the cheapest edges that don't touch each
+	// other, then everything is reclassified on the new mesh
+	for (int pass = 0; out_indices.size() > targetIndexCount; pass++){
+		buildEdgeAdjacency(adjacency, out_indices, vertexCount);
+		classifyVertices(adjacency, remap, wedge, kinds, loop, loopback);
+		if (pass == 0)
+			addEdgeQuadrics(quadrics, out_indices, positions, remap, kinds, loop, loopback);
+
+		pickEdgeCollapses(collapses, out_indices, remap, kinds, loop);
+		if (collapses.empty())
+			break;
+		rankEdgeCollapses(collapses, positions, quadrics, remap);
+		order.resize(collapses.size());
+		for (size_t i = 0; i < order.size(); i++)
+			order[i] = (unsigned int)i;
+		std::stable_sort(order.begin(), order.end(), [&collapses](unsigned int a, unsigned int b){
+			return collapses[a].error < collapses[b].error;
+		});
+
+		for (size_t v = 0; v < vertexCount; v++)
+			collapseRemap[v] = (unsigned int)v;
+		std::fill(collapseLocked.begin(), collapseLocked.end(), 0);
+
+		size_t triangleGoal = (out_indices.size() - targetIndexCount) / 3;
+		size_t edgeGoal = triangleGoal / 2;
+		// Many collapses get skipped because a neighbour moved : allow a bit more than the error of the goal
+		float errorGoal = edgeGoal < order.size() ? 1.5f * collapses[order[edgeGoal]].error : FLT_MAX;
+		size_t triangleCollapses = 0, edgeCollapses = 0;
+		for (size_t i = 0; i < order.size() && triangleCollapses < triangleGoal; i++){
+			const EdgeCollapse & c = collapses[order[i]];
+			unsigned int r0 = remap[c.v0];
+			unsigned int r1 = remap[c.v1];
+			// A vertex moves at most once per pass, and never onto one that moved :
+			// the errors were ranked for the mesh as it was at the start of the pass
+			if (collapseLocked[r0] || collapseLocked[r1])
+				continue;
+			if (c.error > errorGoal && triangleCollapses > triangleGoal / 6)
+				break;
+			if (hasTriangleFlips(adjacency, positions, remap, wedge, collapseRemap, r0, r1))
+				continue;
+
+			if (kinds[c.v0] == SIMPLIFY_SEAM){
+				// The other side of the seam follows, onto the other side of v1
+				unsigned int s0 = wedge[c.v0];
+				unsigned int s1 = loop[c.v0] == c.v1 ? loopback[s0] : loop[s0];
+				if (s1 == NO_VERTEX || remap[s1] != r1)
+					continue;
+				collapseRemap[s0] = s1;
+			}
+			collapseRemap[c.v0] = c.v1;
+			quadricAdd(quadrics[r1], quadrics[r0]);
+			collapseLocked[r0] = 1;
+			collapseLocked[r1] = 1;
+			// A border edge is in one triangle, the others in 2
+			triangleCollapses += kinds[c.v0] == SIMPLIFY_BORDER ? 1 : 2;
+			edgeCollapses++;
+			resultError = std::max(resultError, c.error);
+		}
+		if (edgeCollapses == 0)
+			break;
+
+		size_t kept = 0;
+		for (size_t i = 0; i < out_indices.size(); i += 3){
+			unsigned int a = collapseRemap[out_indices[i]];
+			unsigned int b = collapseRemap[out_indices[i + 1]];
+			unsigned int c = collapseRemap[out_indices[i + 2]];
+			if (a != b && b != c && c != a){
+				out_indices[kept++] = a;
+				out_indices[kept++] = b;
+				out_indices[kept++] = c;
+			}
+		}
+		out_indices.resize(kept);
+	}
+
+	if (out_error)
+		*out_error = sqrtf(resultError) * extent;
+	return out_indices.size();
+}
+
+void buildLODChain(
+	const std::vector<unsigned int> & indices,
+	const std::vector<glm::vec3> & vertices,
+	std::vector<unsigned int> & lodIndices,
+	std::vector<LODLevel> & levels,
+	unsigned int levelCount,
+	float ratio
+){
+	lodIndices.assign(indices.begin(), indices.end());
+	levels.clear();
+	LODLevel full = {0, (unsigned int)indices.size(), 0.0f};
+	levels.push_back(full);
+
+	// Every level is simplified from the previous one : each pass only sees
+	// half the triangles, and the errors add up (a bound on the distance to the full mesh)
+	std::vector<unsigned int> previous(indices.begin(), indices.end());
+	std::vector<unsigned int> simplified;
+	for (unsigned int l = 1; l < levelCount; l++){
+		size_t target = (size_t)(previous.size() * ratio) / 3 * 3;
+		if (target < 3)
+			break;
+		float error = 0.0f;
+		size_t count = simplifyMesh(previous, vertices, target, simplified, &error);
+		// Not worth its memory if it barely removes anything : the mesh is stuck
+		if (count == 0 || count > previous.size() * 0.9f)
+			break;
+		LODLevel level = {(unsigned int)lodIndices.size(), (unsigned int)count, levels.back().error + error};
+		levels.push_back(level);
+		lodIndices.insert(lodIndices.end(), simplified.begin(), simplified.end());
+		previous.swap(simplified);
+	}
+}
+
+float projectedLODError(float error, const glm::mat4 & projection, float distance, float viewportHeight){
+	if (distance <= 0.0f)
+		return FLT_MAX;
+	// projection[1][1] is 1/tan(fov/2) : it maps a height at distance 1 to half the viewport
+	return error * projection[1][1] * 0.5f * viewportHeight / distance;
+}
+
+size_t selectLOD(
+	const LODLevel * levels, size_t levelCount,
+	const glm::mat4 & projection, float distance, float viewportHeight,
+	float maxPixelError
+){
+	size_t selected = 0;
+	for (size_t l = 1; l < levelCount; l++){
+		if (projectedLODError(levels[l].error, projection, distance, viewportHeight) > maxPixelError)
+			break;
+		selected = l;
+	}
+	return selected;
+}
@@ -2,9 +2,14 @@
 #include <stdio.h>
 #include <string>
 #include <cstring>
+#include <chrono>
+#include <atomic>
+#include <algorithm>
 
 #include <glm/glm.hpp>
 
+#include "mappedfile.hpp"
+#include "threadpool.hpp"
 #include "objloader.hpp"
 
 // Very, VERY simple OBJ loader.
@@ -12,101 +17,814 @@
 // - Binary files. Reading a model should be just a few memcpy's away, not parsing a file at runtime. In short : OBJ is not very great.
 // - Animations & bones (includes bones weights)
 // - Multiple UVs
-// - All attributes should be optional, not "forced"
+// - All attributes should be optional, not "forced" (now they are : missing UVs are 0, missing normals are computed)
 // - More stable. Change a line in the OBJ file and it crashes.
 // - More secure. Change another line and you can inject code.
 // - Loading from memory, stream, etc
 
+// The loader below maps the file in memory and parses it in place with a
+// small hand-written tokenizer : no fscanf, no locale, no per-token copies.
+// A first quick pass counts the records so that every vector is allocated once.
+// Big files are cut in chunks at line boundaries, and both passes run on every
+// chunk in parallel. The result doesn't depend on the number of threads.
+
+enum OBJLineType{
+	OBJ_LINE_OTHER,
+	OBJ_LINE_VERTEX,
+	OBJ_LINE_UV,
+	OBJ_LINE_NORMAL,
+	OBJ_LINE_FACE
+};
+
+// Number of records of each kind, indexed by OBJLineType
+struct OBJCounts{
+	size_t lines[5];
+};
+
+// Attribute indices of a face corner, 0-based and already resolved
+// (OBJ indices start at 1, and negative ones count back from the last record)
+struct OBJCorner{
+	unsigned int v, vt, vn;
+	OBJCorner(){} // not cleared : resize() would clear corners the parser overwrites anyway
+};
+static const unsigned int OBJ_MISSING = 0xFFFFFFFF; // no UV or no normal for this corner
+static const unsigned int OBJ_INVALID = 0xFFFFFFFE; // bad index, rejected when the faces are expanded
+
+// Where a chunk of the file writes what it parses. Attributes go straight
+// to their final place in the shared arrays, and so do the triangles
+// written as "v/vt/vn" with positive indices : every face has 3 slots in
+// triangles. Other faces stay with the chunk until every position is known
+// and they can be triangulated; polygonFaces tells which faces they are.
+struct OBJCursor{
+	glm::vec3 * vertices;
+	glm::vec2 * uvs;
+	glm::vec3 * normals;
+	OBJCorner * triangles;
+	// Records of each kind before the cursor, in the whole file
+	size_t vertexCount, uvCount, normalCount;
+	size_t faceCount; // in this chunk
+
+	std::vector<OBJCorner> corners;
+	std::vector<unsigned int> polygonSizes;
+	std::vector<size_t> polygonFaces;
+	size_t triangleCount;
+};
+
+static inline bool isBlank(char c){
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline bool isDigit(char c){
+	return (unsigned char)(c - '0') < 10;
+}
+
+static inline const char * skipBlanks(const char * p, const char * end){
+	while (p < end && isBlank(*p))
+		p++;
+	return p;
+}
+
+static inline const char * skipLine(const char * p, const char * end){
+	const char * eol = (const char *)memchr(p, '\n', end - p);
+	return eol ? eol + 1 : end;
+}
+
+// Looks at the keyword of the line starting at p (leading blanks already skipped)
+// and moves p right after it.
+static inline OBJLineType classifyLine(const char * & p, const char * end){
+	char c0 = p[0];
+	char c1 = p + 1 < end ? p[1] : '\n';
+	if (c0 == 'v'){
+		if (isBlank(c1)){
+			p += 1;
+			return OBJ_LINE_VERTEX;
+		}
+		char c2 = p + 2 < end ? p[2] : '\n';
+		if (isBlank(c2)){
+			if (c1 == 't'){
+				p += 2;
+				return OBJ_LINE_UV;
+			}
+			if (c1 == 'n'){
+				p += 2;
+				return OBJ_LINE_NORMAL;
+			}
+		}
+	}else if (c0 == 'f' && isBlank(c1)){
+		p += 1;
+		return OBJ_LINE_FACE;
+	}
+	return OBJ_LINE_OTHER;
+}
+
+static const double powersOf10[] = {
+	1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Locale-independent replacement for strtof.
+// Up to 19 significant digits are accumulated in an integer, then scaled once
+// by an exact power of ten, which is correctly rounded for everything an
+// exporter writes in practice. Returns NULL if there is no number at p.
+static const char * parseFloat(const char * p, const char * end, float & result){
+	p = skipBlanks(p, end);
+
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+')){
+		negative = *p == '-';
+		p++;
+	}
+
+	unsigned long long mantissa = 0;
+	int digits = 0;   // significant digits stored in mantissa
+	int exponent = 0; // decimal exponent to apply to mantissa
+	const char * start = p;
+
+	while (p < end && isDigit(*p)){
+		if (digits < 19){
+			mantissa = mantissa * 10 + (*p - '0');
+			digits += mantissa != 0;
+		}else{
+			exponent++;
+		}
+		p++;
+	}
+	if (p < end && *p == '.'){
+		p++;
+		while (p < end && isDigit(*p)){
+			if (digits < 19){
+				mantissa = mantissa * 10 + (*p - '0');
+				digits += mantissa != 0;
+				exponent--;
+			}
+			p++;
+		}
+	}
+	if (p == start || (p == start + 1 && *start == '.'))
+		return NULL;
+
+	if (p < end && (*p == 'e' || *p == 'E')){
+		const char * q = p + 1;
+		bool negativeExponent = false;
+		if (q < end && (*q == '-' || *q == '+')){
+			negativeExponent = *q == '-';
+			q++;
+		}
+		if (q < end && isDigit(*q)){
+			int e = 0;
+			while (q < end && isDigit(*q)){
+				if (e < 10000)
+					e = e * 10 + (*q - '0');
+				q++;
+			}
+			exponent += negativeExponent ? -e : e;
+			p = q;
+		}
+	}
+
+	double value = (double)mantissa;
+	if (mantissa != 0){
+		while (exponent > 22){
+			value *= 1e22;
+			exponent -= 22;
+		}
+		while (exponent < -22){
+			value /= 1e22;
+			exponent += 22;
+		}
+		value = exponent < 0 ? value / powersOf10[-exponent] : value * powersOf10[exponent];
+	}
+	result = (float)(negative ? -value : value);
+	return p;
+}
+
+// Parses a signed index. Returns NULL if there is none at p.
+static inline const char * parseIndex(const char * p, const char * end, long long & result){
+	bool negative = p < end && *p == '-';
+	if (negative)
+		p++;
+	if (p == end || !isDigit(*p))
+		return NULL;
+	long long value = 0;
+	while (p < end && isDigit(*p)){
+		if (value < 0x100000000LL)
+			value = value * 10 + (*p - '0');
+		p++;
+	}
+	result = negative ? -value : value;
+	return p;
+}
+
+// count is the number of records of this kind read so far
+static inline unsigned int resolveIndex(long long index, size_t count){
+	if (index > 0)
+		return index - 1 < OBJ_INVALID ? (unsigned int)(index - 1) : OBJ_INVALID;
+	if (index < 0 && -index <= (long long)count)
+		return (unsigned int)(count + index);
+	return OBJ_INVALID;
+}
+
+// Parses one face corner : "v", "v/vt", "v//vn" or "v/vt/vn"
+static inline const char * parseCorner(const char * p, const char * end, const OBJCursor & at, OBJCorner & corner){
+	long long index;
+	p = parseIndex(p, end, index);
+	if (!p)
+		return NULL;
+	corner.v = resolveIndex(index, at.vertexCount);
+	corner.vt = OBJ_MISSING;
+	corner.vn = OBJ_MISSING;
+	if (p < end && *p == '/'){
+		p++;
+		if (p < end && *p != '/'){
+			p = parseIndex(p, end, index);
+			if (!p)
+				return NULL;
+			corner.vt = resolveIndex(index, at.uvCount);
+		}
+		if (p < end && *p == '/'){
+			p = parseIndex(p + 1, end, index);
+			if (!p)
+				return NULL;
+			corner.vn = resolveIndex(index, at.normalCount);
+		}
+	}
+	return p;
+}
+
+// Parses a corner written as "v/vt/vn" with positive indices, as exporters
+// write them. Returns NULL for anything else : parseCorner reads it then.
+static inline const char * parseFullCorner(const char * p, const char * end, OBJCorner & corner){
+	unsigned int * fields[3] = {&corner.v, &corner.vt, &corner.vn};
+	for (int k = 0; k < 3; k++){
+		if (k > 0){
+			if (p == end || *p != '/')
+				return NULL;
+			p++;
+		}
+		const char * start = p;
+		unsigned int value = 0;
+		while (p < end && isDigit(*p) && p - start < 9){
+			value = value * 10 + (*p - '0');
+			p++;
+		}
+		if (p == start || value == 0 || (p < end && isDigit(*p)))
+			return NULL;
+		*fields[k] = value - 1;
+	}
+	return p;
+}
+
+// Counts the records of each kind, so that everything can be allocated up front
+static void countOBJRecords(const char * p, const char * end, OBJCounts & counts){
+	for (int i = 0; i < 5; i++)
+		counts.lines[i] = 0;
+	while (p < end){
+		p = skipBlanks(p, end);
+		if (p == end)
+			break;
+		counts.lines[classifyLine(p, end)]++;
+		p = skipLine(p, end);
+	}
+}
+
+static bool parseOBJRecords(const char * p, const char * end, OBJCursor & out){
+	while (p < end){
+		p = skipBlanks(p, end);
+		if (p == end)
+			break;
+
+		const char * q = p;
+		switch (classifyLine(q, end)){
+		case OBJ_LINE_VERTEX:{
+			glm::vec3 vertex;
+			q = parseFloat(q, end, vertex.x);
+			if (q) q = parseFloat(q, end, vertex.y);
+			if (q) q = parseFloat(q, end, vertex.z);
+			if (!q)
+				return false;
+			*out.vertices++ = vertex;
+			out.vertexCount++;
+			break;
+		}
+		case OBJ_LINE_UV:{
+			glm::vec2 uv;
+			q = parseFloat(q, end, uv.x);
+			if (q) q = parseFloat(q, end, uv.y);
+			if (!q)
+				return false;
+			uv.y = -uv.y; // Invert V coordinate since we will only use DDS texture, which are inverted. Remove if you want to use TGA or BMP loaders.
+			*out.uvs++ = uv;
+			out.uvCount++;
+			break;
+		}
+		case OBJ_LINE_NORMAL:{
+			glm::vec3 normal;
+			q = parseFloat(q, end, normal.x);
+			if (q) q = parseFloat(q, end, normal.y);
+			if (q) q = parseFloat(q, end, normal.z);
+			if (!q)
+				return false;
+			*out.normals++ = normal;
+			out.normalCount++;
+			break;
+		}
+		case OBJ_LINE_FACE:{
+			// Triangles go straight to the slots of the face
+			const char * r = q;
+			OBJCorner * triangle = out.triangles + 3 * out.faceCount;
+			for (int k = 0; k < 3 && r; k++)
+				r = parseFullCorner(skipBlanks(r, end), end, triangle[k]);
+			if (r){
+				r = skipBlanks(r, end);
+				if (r == end || *r == '\n' || *r == '#'){
+					out.faceCount++;
+					out.triangleCount++;
+					q = r;
+					break;
+				}
+			}
+
+			// Anything else : any number of corners, up to the end of the line (or a comment)
+			size_t firstCorner = out.corners.size();
+			while (true){
+				q = skipBlanks(q, end);
+				if (q == end || *q == '\n' || *q == '#')
+					break;
+				OBJCorner corner;
+				q = parseCorner(q, end, out, corner);
+				if (!q || (q < end && !isBlank(*q) && *q != '\n' && *q != '#'))
+					return false;
+				out.corners.push_back(corner);
+			}
+			size_t cornerCount = out.corners.size() - firstCorner;
+			if (cornerCount < 3)
+				return false;
+			out.polygonSizes.push_back((unsigned int)cornerCount);
+			out.polygonFaces.push_back(out.faceCount++);
+			out.triangleCount += cornerCount - 2;
+			break;
+		}
+		default:
+			// Probably a comment, the rest of the line is skipped below
+			break;
+		}
+		p = skipLine(q, end);
+	}
+	return true;
+}
+
+// Below this size, a chunk isn't worth waking up a thread for
+static const size_t minOBJChunkSize = 1 << 20;
+
+// Everything read from the file : the attribute arrays as they are in the file,
+// and 3 corners per triangle
+struct OBJData{
+	std::vector<glm::vec3> temp_vertices;
+	std::vector<glm::vec2> temp_uvs;
+	std::vector<glm::vec3> temp_normals;
+	std::vector<OBJCorner> triangles;
+	bool onlyTriangles; // all written as "v/vt/vn" : no corner misses an attribute
+	size_t threadCount;
+};
+
+// Cuts a polygon in triangles, keeping its winding. Convex polygons (almost all
+// of them) are fanned around their first corner; concave ones are ear-clipped.
+// Everything is done in 3D, against the polygon's Newell normal.
+static void triangulatePolygon(const OBJCorner * polygon, size_t n, const std::vector<glm::vec3> & positions, OBJCorner * & out){
+	bool canUsePositions = true;
+	for (size_t i = 0; i < n; i++)
+		canUsePositions = canUsePositions && polygon[i].v < positions.size();
+
+	glm::vec3 normal(0.0f);
+	bool convex = true;
+	if (canUsePositions){
+		for (size_t i = 0; i < n; i++){
+			const glm::vec3 & a = positions[polygon[i].v];
+			const glm::vec3 & b = positions[polygon[(i + 1) % n].v];
+			normal += glm::vec3((a.y - b.y) * (a.z + b.z), (a.z - b.z) * (a.x + b.x), (a.x - b.x) * (a.y + b.y));
+		}
+		for (size_t i = 0; i < n && convex; i++){
+			const glm::vec3 & a = positions[polygon[(i + n - 1) % n].v];
+			const glm::vec3 & b = positions[polygon[i].v];
+			const glm::vec3 & c = positions[polygon[(i + 1) % n].v];
+			convex = glm::dot(glm::cross(b - a, c - b), normal) >= 0.0f;
+		}
+	}
+
+	std::vector<size_t> remaining;
+	if (!convex){
+		for (size_t i = 0; i < n; i++)
+			remaining.push_back(i);
+
+		while (remaining.size() > 3){
+			size_t m = remaining.size();
+			bool clipped = false;
+			for (size_t k = 0; k < m && !clipped; k++){
+				size_t ia = remaining[(k + m - 1) % m], ib = remaining[k], ic = remaining[(k + 1) % m];
+				const glm::vec3 & a = positions[polygon[ia].v];
+				const glm::vec3 & b = positions[polygon[ib].v];
+				const glm::vec3 & c = positions[polygon[ic].v];
+				if (glm::dot(glm::cross(b - a, c - b), normal) <= 0.0f)
+					continue; // reflex corner, can't be an ear
+
+				// An ear has no other corner inside it
+				bool empty = true;
+				for (size_t j = 0; j < m && empty; j++){
+					const glm::vec3 & p = positions[polygon[remaining[j]].v];
+					if (remaining[j] == ia || remaining[j] == ib || remaining[j] == ic || p == a || p == b || p == c)
+						continue;
+					empty = !(glm::dot(glm::cross(b - a, p - a), normal) >= 0.0f &&
+						glm::dot(glm::cross(c - b, p - b), normal) >= 0.0f &&
+						glm::dot(glm::cross(a - c, p - c), normal) >= 0.0f);
+				}
+				if (!empty)
+					continue;
+
+				*out++ = polygon[ia];
+				*out++ = polygon[ib];
+				*out++ = polygon[ic];
+				remaining.erase(remaining.begin() + k);
+				clipped = true;
+			}
+			if (!clipped)
+				break; // degenerate or self-intersecting : fan whatever is left
+		}
+	}else{
+		for (size_t i = 0; i < n; i++)
+			remaining.push_back(i);
+	}
+
+	for (size_t i = 1; i + 1 < remaining.size(); i++){
+		*out++ = polygon[remaining[0]];
+		*out++ = polygon[remaining[i]];
+		*out++ = polygon[remaining[i + 1]];
+	}
+}
+
+static bool parseOBJ(const char * data, size_t size, unsigned int maxThreads, OBJData & obj){
+	const char * end = data + size;
+	ThreadPool & pool = ThreadPool::global();
+
+	// Split the file in chunks that start right after a newline.
+	// Each record then belongs to exactly one chunk.
+	obj.threadCount = maxThreads ? maxThreads : pool.size() + 1;
+	size_t chunkCount = std::max<size_t>(1, std::min(obj.threadCount, size / minOBJChunkSize));
+	std::vector<const char *> chunkStarts(chunkCount + 1);
+	chunkStarts[0] = data;
+	chunkStarts[chunkCount] = end;
+	for (size_t i = 1; i < chunkCount; i++){
+		const char * p = std::max(data + size / chunkCount * i, chunkStarts[i - 1]);
+		chunkStarts[i] = p < end ? skipLine(p, end) : end;
+	}
+
+	// First pass : count the records of every chunk
+	std::vector<OBJCounts> counts(chunkCount);
+	pool.parallelFor(chunkCount, [&](size_t i){
+		countOBJRecords(chunkStarts[i], chunkStarts[i + 1], counts[i]);
+	});
+
+	// Prefix sums give every chunk the offset where its records go,
+	// so the arrays come out in file order, exactly as a serial parse
+	std::vector<OBJCounts> offsets(chunkCount);
+	OBJCounts total = {};
+	for (size_t i = 0; i < chunkCount; i++){
+		offsets[i] = total;
+		for (int k = 0; k < 5; k++)
+			total.lines[k] += counts[i].lines[k];
+	}
+
+	obj.temp_vertices.resize(total.lines[OBJ_LINE_VERTEX]);
+	obj.temp_uvs     .resize(total.lines[OBJ_LINE_UV]);
+	obj.temp_normals .resize(total.lines[OBJ_LINE_NORMAL]);
+	obj.triangles    .resize(3 * total.lines[OBJ_LINE_FACE]);
+
+	std::vector<OBJCursor> cursors(chunkCount);
+	for (size_t i = 0; i < chunkCount; i++){
+		cursors[i].vertexCount   = offsets[i].lines[OBJ_LINE_VERTEX];
+		cursors[i].uvCount       = offsets[i].lines[OBJ_LINE_UV];
+		cursors[i].normalCount   = offsets[i].lines[OBJ_LINE_NORMAL];
+		cursors[i].vertices      = obj.temp_vertices.data() + cursors[i].vertexCount;
+		cursors[i].uvs           = obj.temp_uvs.data()      + cursors[i].uvCount;
+		cursors[i].normals       = obj.temp_normals.data()  + cursors[i].normalCount;
+		cursors[i].triangles     = obj.triangles.data() + 3 * offsets[i].lines[OBJ_LINE_FACE];
+		cursors[i].faceCount     = 0;
+		cursors[i].triangleCount = 0;
+	}
+
+	// Second pass : parse every chunk. Attributes and triangles go straight
+	// to their slice of the arrays, other faces are kept with their chunk for now.
+	std::atomic<bool> failed(false);
+	pool.parallelFor(chunkCount, [&](size_t i){
+		if (!parseOBJRecords(chunkStarts[i], chunkStarts[i + 1], cursors[i]))
+			failed = true;
+	});
+	if (failed){
+		printf("File can't be read by our simple parser :-( Try exporting with other options\n");
+		return false;
+	}
+
+	obj.onlyTriangles = true;
+	for (size_t i = 0; i < chunkCount; i++)
+		obj.onlyTriangles = obj.onlyTriangles && cursors[i].polygonSizes.empty();
+	if (obj.onlyTriangles)
+		return true; // already in place
+
+	// Triangulate, and move the triangles of the other faces to make room.
+	// Each chunk knows how many triangles it makes, so prefix sums tell it
+	// where to write them.
+	std::vector<size_t> triangleOffsets(chunkCount);
+	size_t totalTriangles = 0;
+	for (size_t i = 0; i < chunkCount; i++){
+		triangleOffsets[i] = totalTriangles;
+		totalTriangles += cursors[i].triangleCount;
+	}
+	std::vector<OBJCorner> triangles(3 * totalTriangles);
+	pool.parallelFor(chunkCount, [&](size_t i){
+		const OBJCursor & cursor = cursors[i];
+		OBJCorner * out = triangles.data() + 3 * triangleOffsets[i];
+		const OBJCorner * polygon = cursor.corners.data();
+		size_t face = 0;
+		for (size_t k = 0; k <= cursor.polygonSizes.size(); k++){
+			// The triangles up to the next polygon
+			size_t next = k < cursor.polygonSizes.size() ? cursor.polygonFaces[k] : cursor.faceCount;
+			if (next > face)
+				memcpy(out, cursor.triangles + 3 * face, 3 * (next - face) * sizeof(OBJCorner));
+			out += 3 * (next - face);
+			if (k == cursor.polygonSizes.size())
+				break;
+
+			size_t n = cursor.polygonSizes[k];
+			if (n == 3){
+				*out++ = polygon[0];
+				*out++ = polygon[1];
+				*out++ = polygon[2];
+			}else{
+				triangulatePolygon(polygon, n, obj.temp_vertices, out);
+			}
+			polygon += n;
+			face = next + 1;
+		}
+	});
+	obj.triangles.swap(triangles);
+	return true;
+}
+
+static inline bool isValidCorner(const OBJCorner & corner, const OBJData & obj){
+	return corner.v < obj.temp_vertices.size() &&
+		(corner.vt == OBJ_MISSING || corner.vt < obj.temp_uvs.size()) &&
+		(corner.vn == OBJ_MISSING || corner.vn < obj.temp_normals.size());
+}
+
+// Used for the corners that don't have a normal in the file
+static inline glm::vec3 faceNormal(const glm::vec3 & a, const glm::vec3 & b, const glm::vec3 & c){
+	glm::vec3 n = glm::cross(b - a, c - a);
+	float length = glm::length(n);
+	return length > 0.0f ? n / length : glm::vec3(0.0f);
+}
+
+bool loadOBJFromMemory(
+	const char * data,
+	size_t size,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals,
+	unsigned int maxThreads
+){
+	OBJData obj;
+	if (!parseOBJ(data, size, maxThreads, obj))
+		return false;
+
+	size_t totalCorners = obj.triangles.size();
+	size_t totalTriangles = totalCorners / 3;
+	size_t base = out_vertices.size();
+	out_vertices.resize(base + totalCorners);
+	out_uvs     .resize(base + totalCorners);
+	out_normals .resize(base + totalCorners);
+
+	// For each triangle
+	std::atomic<bool> failed(false);
+	size_t rangeCount = std::max<size_t>(1, std::min(obj.threadCount, totalTriangles / 65536));
+	ThreadPool::global().parallelFor(rangeCount, [&](size_t range){
+		size_t first = totalTriangles * range / rangeCount;
+		size_t last = totalTriangles * (range + 1) / rangeCount;
+		for( size_t t=first; t<last && obj.onlyTriangles; t++ ){
+			// Every corner has its attributes : only the indices need a check
+			for (int k = 0; k < 3; k++){
+				const OBJCorner & corner = obj.triangles[3 * t + k];
+				if (corner.v >= obj.temp_vertices.size() || corner.vt >= obj.temp_uvs.size() || corner.vn >= obj.temp_normals.size()){
+					failed = true;
+					return;
+				}
+				size_t i = base + 3 * t + k;
+				out_vertices[i] = obj.temp_vertices[corner.v];
+				out_uvs     [i] = obj.temp_uvs[corner.vt];
+				out_normals [i] = obj.temp_normals[corner.vn];
+			}
+		}
+		for( size_t t=first; t<last && !obj.onlyTriangles; t++ ){
+			const OBJCorner * corners = &obj.triangles[3 * t];
+			if (!isValidCorner(corners[0], obj) || !isValidCorner(corners[1], obj) || !isValidCorner(corners[2], obj)){
+				failed = true;
+				return;
+			}
+
+			glm::vec3 normal(0.0f);
+			if (corners[0].vn == OBJ_MISSING || corners[1].vn == OBJ_MISSING || corners[2].vn == OBJ_MISSING)
+				normal = faceNormal(obj.temp_vertices[corners[0].v], obj.temp_vertices[corners[1].v], obj.temp_vertices[corners[2].v]);
+
+			// Put the attributes of each vertex in buffers
+			for (int k = 0; k < 3; k++){
+				const OBJCorner & corner = corners[k];
+				size_t i = base + 3 * t + k;
+				out_vertices[i] = obj.temp_vertices[corner.v];
+				out_uvs     [i] = corner.vt == OBJ_MISSING ? glm::vec2(0.0f) : obj.temp_uvs[corner.vt];
+				out_normals [i] = corner.vn == OBJ_MISSING ? normal : obj.temp_normals[corner.vn];
+			}
+		}
+	});
+	if (failed){
+		printf("Face refers to a vertex that doesn't exist\n");
+		out_vertices.resize(base);
+		out_uvs     .resize(base);
+		out_normals .resize(base);
+		return false;
+	}
+	return true;
+}
+
+// Open-addressing hash table from a (v, vt, vn) index triple to its output vertex.
+// The slots only hold vertex numbers (+1, so that 0 means empty) : the triples
+// themselves are kept once, in the order the vertices are created.
+struct OBJCornerTable{
+	std::vector<unsigned int> slots;
+	std::vector<OBJCorner> keys;
+	size_t mask;
+
+	explicit OBJCornerTable(size_t expected){
+		size_t capacity = 16;
+		while (capacity < 2 * expected)
+			capacity *= 2;
+		slots.assign(capacity, 0);
+		mask = capacity - 1;
+		keys.reserve(expected);
+	}
+
+	static inline size_t hash(const OBJCorner & c){
+		unsigned long long h = c.v * 0x9E3779B185EBCA87ULL + c.vt * 0xC2B2AE3D27D4EB4FULL + c.vn * 0x165667B19E3779F9ULL;
+		return (size_t)(h ^ (h >> 29));
+	}
+
+	// Returns the vertex of this triple, creating it if it's new
+	unsigned int insert(const OBJCorner & corner){
+		size_t i = hash(corner) & mask;
+		while (slots[i] != 0){
+			const OBJCorner & key = keys[slots[i] - 1];
+			if (key.v == corner.v && key.vt == corner.vt && key.vn == corner.vn)
+				return slots[i] - 1;
+			i = (i + 1) & mask; // linear probing
+		}
+		keys.push_back(corner);
+		slots[i] = (unsigned int)keys.size();
+		if (2 * keys.size() > slots.size())
+			grow();
+		return (unsigned int)keys.size() - 1;
+	}
+
+	void grow(){
+		slots.assign(slots.size() * 2, 0);
+		mask = slots.size() - 1;
+		for (size_t k = 0; k < keys.size(); k++){
+			size_t i = hash(keys[k]) & mask;
+			while (slots[i] != 0)
+				i = (i + 1) & mask;
+			slots[i] = (unsigned int)k + 1;
+		}
+	}
+};
+
+bool loadOBJIndexedFromMemory(
+	const char * data,
+	size_t size,
+	std::vector<unsigned int> & out_indices,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals,
+	unsigned int maxThreads
+){
+	OBJData obj;
+	if (!parseOBJ(data, size, maxThreads, obj))
+		return false;
+
+	// Most exporters write about as many vertices as there are distinct corners
+	size_t totalCorners = obj.triangles.size();
+	size_t expected = std::max(obj.temp_vertices.size(), std::max(obj.temp_uvs.size(), obj.temp_normals.size()));
+	OBJCornerTable table(std::min(expected, totalCorners));
+
+	// Give a vertex to each distinct triple, in order of first use
+	size_t baseIndex = out_indices.size();
+	size_t baseVertex = out_vertices.size();
+	out_indices.resize(baseIndex + totalCorners);
+	for (size_t i = 0; i < totalCorners; i++){
+		if (!isValidCorner(obj.triangles[i], obj)){
+			printf("Face refers to a vertex that doesn't exist\n");
+			out_indices.resize(baseIndex);
+			return false;
+		}
+		out_indices[baseIndex + i] = (unsigned int)baseVertex + table.insert(obj.triangles[i]);
+	}
+
+	// Then fetch the attributes of each vertex, once
+	size_t uniqueCount = table.keys.size();
+	bool missingNormals = false;
+	out_vertices.resize(baseVertex + uniqueCount);
+	out_uvs     .resize(baseVertex + uniqueCount);
+	out_normals .resize(baseVertex + uniqueCount);
+	for (size_t k = 0; k < uniqueCount; k++){
+		const OBJCorner & key = table.keys[k];
+		out_vertices[baseVertex + k] = obj.temp_vertices[key.v];
+		out_uvs     [baseVertex + k] = key.vt == OBJ_MISSING ? glm::vec2(0.0f) : obj.temp_uvs[key.vt];
+		out_normals [baseVertex + k] = key.vn == OBJ_MISSING ? glm::vec3(0.0f) : obj.temp_normals[key.vn];
+		missingNormals = missingNormals || key.vn == OBJ_MISSING;
+	}
+
+	// Vertices without a normal get the area-weighted average of their faces' normals
+	if (missingNormals){
+		for (size_t i = 0; i < totalCorners; i += 3){
+			const OBJCorner * corners = &obj.triangles[i];
+			glm::vec3 weightedNormal = glm::cross(
+				obj.temp_vertices[corners[1].v] - obj.temp_vertices[corners[0].v],
+				obj.temp_vertices[corners[2].v] - obj.temp_vertices[corners[0].v]);
+			for (int k = 0; k < 3; k++){
+				if (corners[k].vn == OBJ_MISSING)
+					out_normals[out_indices[baseIndex + i + k]] += weightedNormal;
+			}
+		}
+		for (size_t k = 0; k < uniqueCount; k++){
+			if (table.keys[k].vn != OBJ_MISSING)
+				continue;
+			glm::vec3 & n = out_normals[baseVertex + k];
+			float length = glm::length(n);
+			if (length > 0.0f)
+				n /= length;
+		}
+	}
+	return true;
+}
+
+static void printOBJLoadTime(size_t fileSize, std::chrono::steady_clock::time_point startTime){
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+	double megabytes = fileSize / (1024.0 * 1024.0);
+	printf("Loaded %.2f MB in %.2f ms (%.1f MB/s)\n", megabytes, seconds * 1000.0, seconds > 0.0 ? megabytes / seconds : 0.0);
+}
+
 bool loadOBJ(
 	const char * path, 
 	std::vector<glm::vec3> & out_vertices, 
 	std::vector<glm::vec2> & out_uvs,
-	std::vector<glm::vec3> & out_normals
+	std::vector<glm::vec3> & out_normals,
+	unsigned int maxThreads
 ){
 	printf("Loading OBJ file %s...\n", path);
 
-	std::vector<unsigned int> vertexIndices, uvIndices, normalIndices;
-	std::vector<glm::vec3> temp_vertices; 
-	std::vector<glm::vec2> temp_uvs;
-	std::vector<glm::vec3> temp_normals;
-
+	std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
 
-	FILE * file = fopen(path, "r");
-	if( file == NULL ){
+	MappedFile file;
+	if( !file.open(path) ){
 		printf("Impossible to open the file ! Are you in the right path ? See Tutorial 1 for details\n");
 		getchar();
 		return false;
 	}
 
-	while( 1 ){
+	if (!loadOBJFromMemory((const char *)file.data(), file.size(), out_vertices, out_uvs, out_normals, maxThreads))
+		return false;
 
-		char lineHeader[128];
-		// read the first word of the line
-		int res = fscanf(file, "%s", lineHeader);
-		if (res == EOF)
-			break; // EOF = End Of File. Quit the loop.
+	printOBJLoadTime(file.size(), startTime);
+	return true;
+}
 
-		// else : parse lineHeader
-		
-		if ( strcmp( lineHeader, "v" ) == 0 ){
-			glm::vec3 vertex;
-			fscanf(file, "%f %f %f\n", &vertex.x, &vertex.y, &vertex.z );
-			temp_vertices.push_back(vertex);
-		}else if ( strcmp( lineHeader, "vt" ) == 0 ){
-			glm::vec2 uv;
-			fscanf(file, "%f %f\n", &uv.x, &uv.y );
-			uv.y = -uv.y; // Invert V coordinate since we will only use DDS texture, which are inverted. Remove if you want to use TGA or BMP loaders.
-			temp_uvs.push_back(uv);
-		}else if ( strcmp( lineHeader, "vn" ) == 0 ){
-			glm::vec3 normal;
-			fscanf(file, "%f %f %f\n", &normal.x, &normal.y, &normal.z );
-			temp_normals.push_back(normal);
-		}else if ( strcmp( lineHeader, "f" ) == 0 ){
-			std::string vertex1, vertex2, vertex3;
-			unsigned int vertexIndex[3], uvIndex[3], normalIndex[3];
-			int matches = fscanf(file, "%d/%d/%d %d/%d/%d %d/%d/%d\n", &vertexIndex[0], &uvIndex[0], &normalIndex[0], &vertexIndex[1], &uvIndex[1], &normalIndex[1], &vertexIndex[2], &uvIndex[2], &normalIndex[2] );
-			if (matches != 9){
-				printf("File can't be read by our simple parser :-( Try exporting with other options\n");
-				fclose(file);
-				return false;
-			}
-			vertexIndices.push_back(vertexIndex[0]);
-			vertexIndices.push_back(vertexIndex[1]);
-			vertexIndices.push_back(vertexIndex[2]);
-			uvIndices    .push_back(uvIndex[0]);
-			uvIndices    .push_back(uvIndex[1]);
-			uvIndices    .push_back(uvIndex[2]);
-			normalIndices.push_back(normalIndex[0]);
-			normalIndices.push_back(normalIndex[1]);
-			normalIndices.push_back(normalIndex[2]);
-		}else{
-			// Probably a comment, eat up the rest of the line
-			char stupidBuffer[1000];
-			fgets(stupidBuffer, 1000, file);
-		}
-
-	}
-
-	// For each vertex of each triangle
-	for( unsigned int i=0; i<vertexIndices.size(); i++ ){
-
-		// Get the indices of its attributes
-		unsigned int vertexIndex = vertexIndices[i];
-		unsigned int uvIndex = uvIndices[i];
-		unsigned int normalIndex = normalIndices[i];
-		
-		// Get the attributes thanks to the index
-		glm::vec3 vertex = temp_vertices[ vertexIndex-1 ];
-		glm::vec2 uv = temp_uvs[ uvIndex-1 ];
-		glm::vec3 normal = temp_normals[ normalIndex-1 ];
-		
-		// Put the attributes in buffers
-		out_vertices.push_back(vertex);
-		out_uvs     .push_back(uv);
-		out_normals .push_back(normal);
-	
+bool loadOBJIndexed(
+	const char * path,
+	std::vector<unsigned int> & out_indices,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals,
+	unsigned int maxThreads
+){
+	printf("Loading OBJ file %s (indexed)...\n", path);
+
+	std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+	MappedFile file;
+	if( !file.open(path) ){
+		printf("Impossible to open the file ! Are you in the right path ? See Tutorial 1 for details\n");
+		getchar();
+		return false;
 	}
-	fclose(file);
+
+	if (!loadOBJIndexedFromMemory((const char *)file.data(), file.size(), out_indices, out_vertices, out_uvs, out_normals, maxThreads))
+		return false;
+
+	printOBJLoadTime(file.size(), startTime);
 	return true;
 }
 
@@ -9,16 +9,175 @@ using namespace std;
 
 #include <stdlib.h>
 #include <string.h>
+#include <chrono>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
 
 #include <GL/glew.h>
 
+#include "hash.hpp"
+#include "threadpool.hpp"
 #include "shader.hpp"
 
-GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path){
+// Program cache : one file per program in shaderCacheDirectory, named after
+// its key, with a ProgramCacheHeader and what glGetProgramBinary returned.
 
-	// Create the shaders
-	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+static std::string shaderCacheDirectory = "shadercache";
+static ShaderCacheStats cacheStats = {0, 0, 0.0, 0.0};
+
+static const char programCacheMagic[8] = {'G', 'L', 'P', 'R', 'O', 'G', 'R', 'M'};
+static const unsigned int programCacheVersion = 1;
+
+struct ProgramCacheHeader{
+	char magic[8];
+	unsigned int version;
+	unsigned int binaryFormat;
+	unsigned long long key;
+	unsigned long long size; // of the binary, after the header
+};
+
+static double now(){
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void setShaderCacheDirectory(const char * path){
+	shaderCacheDirectory = path ? path : "";
+}
+
+ShaderCacheStats shaderCacheStats(){
+	return cacheStats;
+}
+
+void printShaderStartupReport(const ShaderBatch & batch){
+	printf("Shaders : %u programs compiled in %.1f ms, %u loaded from the cache in %.1f ms\n",
+		cacheStats.compiledPrograms, cacheStats.compileSeconds * 1e3, cacheStats.cachedPrograms, cacheStats.cacheSeconds * 1e3);
+	// Compiling alone, then the whole first frame, which waited for it
+	printf("Shaders : last program ready %.1f ms after submit, first frame swapped after %.1f ms\n",
+		batch.readySeconds() * 1e3, batch.submittedSeconds() * 1e3);
+}
+
+// Whether the driver gives binaries back : some report no format at all
+static bool programCacheSupported(){
+	if (shaderCacheDirectory.empty() || !(GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary))
+		return false;
+	GLint formatCount = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+	return formatCount > 0;
+}
+
+// The sources, and the driver that compiles them : another GPU or another
+// driver version gets other binaries. 0 if there's no cache.
+static unsigned long long programCacheKey(const char * VertexShaderCode, const char * FragmentShaderCode){
+	if (!programCacheSupported())
+		return 0;
+	unsigned long long key = programCacheVersion;
+	const GLenum driverStrings[] = {GL_VENDOR, GL_RENDERER, GL_VERSION};
+	for (GLenum name : driverStrings){
+		const char * value = (const char *)glGetString(name);
+		if (value)
+			key = hash64(value, strlen(value), key);
+	}
+	key = hash64(VertexShaderCode, strlen(VertexShaderCode), key);
+	key = hash64(FragmentShaderCode, strlen(FragmentShaderCode), key);
+	return key ? key : 1;
+}
+
+static std::string programCachePath(unsigned long long key){
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.glprogram", key);
+	return shaderCacheDirectory + "/" + name;
+}
+
+// The program from the cache, or 0 if it isn't there, or if the driver
+// doesn't take it anymore : it is then compiled, and cached again
+static GLuint loadCachedProgram(unsigned long long key){
+	if (key == 0)
+		return 0;
+	std::string path = programCachePath(key);
+	FILE * file = fopen(path.c_str(), "rb");
+	if (file == NULL)
+		return 0;
+	ProgramCacheHeader header;
+	std::vector<unsigned char> binary;
+	bool valid =
+		fread(&header, sizeof(header), 1, file) == 1 &&
+		memcmp(header.magic, programCacheMagic, sizeof(programCacheMagic)) == 0 &&
+		header.version == programCacheVersion &&
+		header.key == key &&
+		header.size > 0 && header.size < (1u << 30);
+	if (valid){
+		binary.resize((size_t)header.size);
+		// Nothing may follow the binary : a longer file is a damaged one
+		valid = fread(binary.data(), 1, binary.size(), file) == binary.size() && fgetc(file) == EOF;
+	}
+	fclose(file);
+	if (!valid){
+		printf("%s is damaged : compiling the program again\n", path.c_str());
+		return 0;
+	}
+
+	GLuint ProgramID = glCreateProgram();
+	glProgramBinary(ProgramID, header.binaryFormat, binary.data(), (GLsizei)binary.size());
+	GLint Result = GL_FALSE;
+	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
+	if (Result != GL_TRUE){
+		printf("The driver refused %s : compiling the program again\n", path.c_str());
+		glDeleteProgram(ProgramID);
+		return 0;
+	}
+	return ProgramID;
+}
+
+// Written to a temporary file first, as the mesh caches, so that nobody reads half a binary
+static void saveCachedProgram(GLuint ProgramID, unsigned long long key){
+	if (key == 0)
+		return;
+	GLint Result = GL_FALSE, length = 0;
+	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
+	glGetProgramiv(ProgramID, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (Result != GL_TRUE || length <= 0)
+		return;
+	std::vector<unsigned char> binary(length);
+	GLenum binaryFormat = 0;
+	GLsizei written = 0;
+	glGetProgramBinary(ProgramID, length, &written, &binaryFormat, binary.data());
+	if (written <= 0)
+		return;
+
+	ProgramCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, programCacheMagic, sizeof(programCacheMagic));
+	header.version = programCacheVersion;
+	header.binaryFormat = binaryFormat;
+	header.key = key;
+	header.size = (unsigned long long)written;
+
+#ifdef _WIN32
+	_mkdir(shaderCacheDirectory.c_str());
+#else
+	mkdir(shaderCacheDirectory.c_str(), 0755);
+#endif
+	std::string path = programCachePath(key);
+	std::string tempPath = path + ".tmp";
+	FILE * file = fopen(tempPath.c_str(), "wb");
+	if (file == NULL)
+		return;
+	bool saved =
+		fwrite(&header, sizeof(header), 1, file) == 1 &&
+		fwrite(binary.data(), 1, (size_t)written, file) == (size_t)written;
+	saved = fclose(file) == 0 && saved;
+	if (saved){
+		remove(path.c_str()); // rename() doesn't replace files on Windows
+		saved = rename(tempPath.c_str(), path.c_str()) == 0;
+	}
+	if (!saved)
+		remove(tempPath.c_str());
+}
+
+GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path){
 
 	// Read the Vertex Shader code from the file
 	std::string VertexShaderCode;
@@ -44,6 +203,21 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 		FragmentShaderStream.close();
 	}
 
+	// Programs linked by a previous run are in the cache
+	double start = now();
+	unsigned long long cacheKey = programCacheKey(VertexShaderCode.c_str(), FragmentShaderCode.c_str());
+	GLuint CachedProgramID = loadCachedProgram(cacheKey);
+	if (CachedProgramID){
+		printf("Loaded program from the cache : %s, %s\n", vertex_file_path, fragment_file_path);
+		cacheStats.cachedPrograms++;
+		cacheStats.cacheSeconds += now() - start;
+		return CachedProgramID;
+	}
+
+	// Create the shaders
+	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
+	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+
 	GLint Result = GL_FALSE;
 	int InfoLogLength;
 
@@ -87,6 +261,8 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 	GLuint ProgramID = glCreateProgram();
 	glAttachShader(ProgramID, VertexShaderID);
 	glAttachShader(ProgramID, FragmentShaderID);
+	if (cacheKey)
+		glProgramParameteri(ProgramID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	glLinkProgram(ProgramID);
 
 	// Check the program
@@ -105,10 +281,29 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 	glDeleteShader(VertexShaderID);
 	glDeleteShader(FragmentShaderID);
 
+	saveCachedProgram(ProgramID, cacheKey);
+	cacheStats.compiledPrograms++;
+	cacheStats.compileSeconds += now() - start;
+
 	return ProgramID;
 }
 
 GLuint LoadShadersCode(const std::string& VertexShaderCode,const std::string& FragmentShaderCode){
+	return LoadShadersCode(VertexShaderCode.c_str(), FragmentShaderCode.c_str());
+}
+
+GLuint LoadShadersCode(const char * VertexShaderCode,const char * FragmentShaderCode){
+
+	// Programs linked by a previous run are in the cache
+	double start = now();
+	unsigned long long cacheKey = programCacheKey(VertexShaderCode, FragmentShaderCode);
+	GLuint CachedProgramID = loadCachedProgram(cacheKey);
+	if (CachedProgramID){
+		printf("Loaded program from the cache\n");
+		cacheStats.cachedPrograms++;
+		cacheStats.cacheSeconds += now() - start;
+		return CachedProgramID;
+	}
 
 	// Create the shaders
 	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
@@ -118,8 +313,7 @@ GLuint LoadShadersCode(const std::string& VertexShaderCode,const std::string& Fr
 	int InfoLogLength;
 
 
-	char const * VertexSourcePointer = VertexShaderCode.c_str();
-	glShaderSource(VertexShaderID, 1, &VertexSourcePointer , NULL);
+	glShaderSource(VertexShaderID, 1, &VertexShaderCode , NULL);
 	glCompileShader(VertexShaderID);
 
 	// Check Vertex Shader
@@ -133,7 +327,7 @@ GLuint LoadShadersCode(const std::string& VertexShaderCode,const std::string& Fr
 
 
 
-	char const * FragmentSourcePointer = FragmentShaderCode.c_str();
+	char const * FragmentSourcePointer = FragmentShaderCode;
 	glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer , NULL);
 	glCompileShader(FragmentShaderID);
 
@@ -153,6 +347,8 @@ GLuint LoadShadersCode(const std::string& VertexShaderCode,const std::string& Fr
 	GLuint ProgramID = glCreateProgram();
 	glAttachShader(ProgramID, VertexShaderID);
 	glAttachShader(ProgramID, FragmentShaderID);
+	if (cacheKey)
+		glProgramParameteri(ProgramID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	glLinkProgram(ProgramID);
 
 	// Check the program
@@ -171,5 +367,216 @@ GLuint LoadShadersCode(const std::string& VertexShaderCode,const std::string& Fr
 	glDeleteShader(VertexShaderID);
 	glDeleteShader(FragmentShaderID);
 
+	saveCachedProgram(ProgramID, cacheKey);
+	cacheStats.compiledPrograms++;
+	cacheStats.compileSeconds += now() - start;
+
 	return ProgramID;
 }
+
+static bool readShaderFile(const std::string & path, std::string & code){
+	std::ifstream stream(path.c_str(), std::ios::in);
+	if (!stream.is_open())
+		return false;
+	std::stringstream sstr;
+	sstr << stream.rdbuf();
+	code = sstr.str();
+	return true;
+}
+
+// Prints the log of a shader or a program, if it has one
+static void printShaderLog(GLuint ShaderID){
+	int InfoLogLength = 0;
+	glGetShaderiv(ShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+	if ( InfoLogLength > 0 ){
+		std::vector<char> ShaderErrorMessage(InfoLogLength+1);
+		glGetShaderInfoLog(ShaderID, InfoLogLength, NULL, &ShaderErrorMessage[0]);
+		printf("%s\n", &ShaderErrorMessage[0]);
+	}
+}
+
+static void printProgramLog(GLuint ProgramID){
+	int InfoLogLength = 0;
+	glGetProgramiv(ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+	if ( InfoLogLength > 0 ){
+		std::vector<char> ProgramErrorMessage(InfoLogLength+1);
+		glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
+		printf("%s\n", &ProgramErrorMessage[0]);
+	}
+}
+
+ShaderBatch::ShaderBatch() : submitTime(0.0), readyTime(0.0){
+}
+
+ShaderBatch::~ShaderBatch(){
+	for (size_t i = 0; i < entries.size(); i++){
+		if (entries[i]->reading.valid())
+			entries[i]->reading.wait();
+	}
+}
+
+unsigned int ShaderBatch::addFiles(const char * vertex_file_path, const char * fragment_file_path){
+	std::unique_ptr<Entry> entry(new Entry());
+	entry->vertexName = vertex_file_path;
+	entry->fragmentName = fragment_file_path;
+	entry->cacheKey = 0;
+	entry->vertexShader = entry->fragmentShader = entry->program = 0;
+	entry->submitted = entry->checked = false;
+	Entry * reading = entry.get();
+	entry->reading = ThreadPool::global().submit([reading](){
+		return readShaderFile(reading->vertexName, reading->vertexCode) &&
+			readShaderFile(reading->fragmentName, reading->fragmentCode);
+	});
+	entries.push_back(std::move(entry));
+	readyTime = 0.0;
+	return (unsigned int)entries.size() - 1;
+}
+
+unsigned int ShaderBatch::addCode(const std::string& VertexShaderCode, const std::string& FragmentShaderCode){
+	std::unique_ptr<Entry> entry(new Entry());
+	entry->vertexCode = VertexShaderCode;
+	entry->fragmentCode = FragmentShaderCode;
+	entry->cacheKey = 0;
+	entry->vertexShader = entry->fragmentShader = entry->program = 0;
+	entry->submitted = entry->checked = false;
+	entries.push_back(std::move(entry));
+	readyTime = 0.0;
+	return (unsigned int)entries.size() - 1;
+}
+
+double ShaderBatch::submittedSeconds() const {
+	return submitTime > 0.0 ? now() - submitTime : 0.0;
+}
+
+void ShaderBatch::updateReadyTime(){
+	for (size_t i = 0; i < entries.size(); i++){
+		if (!entries[i]->checked)
+			return;
+	}
+	readyTime = now();
+}
+
+void ShaderBatch::submit(){
+	// Let the driver use as many compiler threads as it likes
+	if (GLEW_KHR_parallel_shader_compile)
+		glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+	else if (GLEW_ARB_parallel_shader_compile)
+		glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+
+	// The cached programs first : they need a status query, which must not
+	// wait behind the compiles
+	double start = now();
+	if (submitTime == 0.0)
+		submitTime = start;
+	std::vector<size_t> compiles;
+	for (size_t i = 0; i < entries.size(); i++){
+		Entry & entry = *entries[i];
+		if (entry.submitted)
+			continue;
+		entry.submitted = true;
+		if (entry.reading.valid() && !entry.reading.get()){
+			printf("Impossible to open %s or %s. Are you in the right directory ? Don't forget to read the FAQ !\n",
+				entry.vertexName.c_str(), entry.fragmentName.c_str());
+			entry.checked = true;
+			continue;
+		}
+		entry.cacheKey = programCacheKey(entry.vertexCode.c_str(), entry.fragmentCode.c_str());
+		entry.program = loadCachedProgram(entry.cacheKey);
+		if (entry.program){
+			entry.checked = true;
+			cacheStats.cachedPrograms++;
+			continue;
+		}
+		compiles.push_back(i);
+	}
+	double cached = now();
+	cacheStats.cacheSeconds += cached - start;
+
+	// Then every compile and link, without asking for anything
+	for (size_t i : compiles){
+		Entry * entry = entries[i].get();
+		if (entry->vertexName.empty())
+			printf("Compiling program %u\n", (unsigned int)i);
+		else
+			printf("Compiling shaders : %s, %s\n", entry->vertexName.c_str(), entry->fragmentName.c_str());
+		const char * VertexSourcePointer = entry->vertexCode.c_str();
+		const char * FragmentSourcePointer = entry->fragmentCode.c_str();
+		entry->vertexShader = glCreateShader(GL_VERTEX_SHADER);
+		glShaderSource(entry->vertexShader, 1, &VertexSourcePointer, NULL);
+		glCompileShader(entry->vertexShader);
+		entry->fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+		glShaderSource(entry->fragmentShader, 1, &FragmentSourcePointer, NULL);
+		glCompileShader(entry->fragmentShader);
+	}
+	for (size_t i : compiles){
+		Entry * entry = entries[i].get();
+		entry->program = glCreateProgram();
+		glAttachShader(entry->program, entry->vertexShader);
+		glAttachShader(entry->program, entry->fragmentShader);
+		if (entry->cacheKey)
+			glProgramParameteri(entry->program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		glLinkProgram(entry->program);
+	}
+	cacheStats.compileSeconds += now() - cached;
+	updateReadyTime();
+}
+
+bool ShaderBatch::isReady(unsigned int index){
+	Entry & entry = *entries[index];
+	if (!entry.submitted)
+		return false;
+	if (entry.checked)
+		return true;
+	if (GLEW_KHR_parallel_shader_compile || GLEW_ARB_parallel_shader_compile){
+		GLint done = GL_FALSE;
+		glGetProgramiv(entry.program, GL_COMPLETION_STATUS_KHR, &done);
+		return done == GL_TRUE;
+	}
+	// Without the extension, there's no asking without waiting
+	return true;
+}
+
+bool ShaderBatch::isReady(){
+	for (unsigned int i = 0; i < entries.size(); i++){
+		if (!isReady(i))
+			return false;
+	}
+	return true;
+}
+
+GLuint ShaderBatch::program(unsigned int index){
+	Entry & entry = *entries[index];
+	if (!entry.submitted)
+		submit();
+	if (entry.checked)
+		return entry.program;
+	entry.checked = true;
+
+	double start = now();
+	GLint Result = GL_FALSE;
+	glGetShaderiv(entry.vertexShader, GL_COMPILE_STATUS, &Result);
+	if (Result != GL_TRUE && !entry.vertexName.empty())
+		printf("%s :\n", entry.vertexName.c_str());
+	printShaderLog(entry.vertexShader);
+	glGetShaderiv(entry.fragmentShader, GL_COMPILE_STATUS, &Result);
+	if (Result != GL_TRUE && !entry.fragmentName.empty())
+		printf("%s :\n", entry.fragmentName.c_str());
+	printShaderLog(entry.fragmentShader);
+	printProgramLog(entry.program);
+
+	glDetachShader(entry.program, entry.vertexShader);
+	glDetachShader(entry.program, entry.fragmentShader);
+	glDeleteShader(entry.vertexShader);
+	glDeleteShader(entry.fragmentShader);
+	entry.vertexShader = entry.fragmentShader = 0;
+
+	saveCachedProgram(entry.program, entry.cacheKey);
+	cacheStats.compiledPrograms++;
+	cacheStats.compileSeconds += now() - start;
+
+	// The sources aren't needed anymore
+	std::string().swap(entry.vertexCode);
+	std::string().swap(entry.fragmentCode);
+	updateReadyTime();
+	return entry.program;
+}
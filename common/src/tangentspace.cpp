@@ -1,8 +1,178 @@
 #include <vector>
+#include <algorithm>
+#include <math.h>
 #include <glm/glm.hpp>
 
+#include "threadpool.hpp"
+#include "simdlanes.hpp"
 #include "tangentspace.hpp"
 
+// Below this UV area (twice it, in fact), a triangle has no usable UV
+// mapping : its tangent is taken along its first edge instead.
+static const float minUVDeterminant = 1e-20f;
+
+// Below this, the tangent is parallel to the normal (or zero) and can't be
+// orthogonalized : any direction perpendicular to the normal will do.
+static const float minTangentLength2 = 1e-30f;
+
+// Fewest triangles per job of the multithreaded path
+static const size_t minParallelTriangleCount = 1 << 15;
+
+// Gram-Schmidt orthogonalizes the tangent t against the normal n, and normalizes it
+static glm::vec3 orthonormalizeTangent(const glm::vec3 & n, const glm::vec3 & t){
+	glm::vec3 tangent = t - n * glm::dot(n, t);
+	float length2 = glm::dot(tangent, tangent);
+	if (!(length2 > minTangentLength2)){
+		glm::vec3 axis = fabsf(n.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+		tangent = axis - n * glm::dot(n, axis);
+		length2 = glm::dot(tangent, tangent);
+	}
+	return tangent * (1.0f / sqrtf(length2));
+}
+
+// orthonormalizeTangent, then flips the tangent so that (t, b, n) has the
+// handedness of the UV mapping
+static glm::vec3 orthogonalizeTangent(const glm::vec3 & n, const glm::vec3 & t, const glm::vec3 & b){
+	glm::vec3 tangent = orthonormalizeTangent(n, t);
+
+	// Calculate handedness
+	if (glm::dot(glm::cross(n, tangent), b) < 0.0f){
+		tangent = tangent * -1.0f;
+	}
+	return tangent;
+}
+
+// Unnormalized tangent & bitangent of the triangle (p0, p1, p2), from its UV mapping
+static void triangleTangent(
+	const glm::vec3 & p0, const glm::vec3 & p1, const glm::vec3 & p2,
+	const glm::vec2 & uv0, const glm::vec2 & uv1, const glm::vec2 & uv2,
+	glm::vec3 & tangent, glm::vec3 & bitangent
+){
+	// Edges of the triangle : postion delta
+	glm::vec3 deltaPos1 = p1 - p0;
+	glm::vec3 deltaPos2 = p2 - p0;
+
+	// UV delta
+	glm::vec2 deltaUV1 = uv1 - uv0;
+	glm::vec2 deltaUV2 = uv2 - uv0;
+
+	tangent = deltaPos1;
+	bitangent = deltaPos2;
+	float determinant = deltaUV1.x * deltaUV2.y - deltaUV1.y * deltaUV2.x;
+	if (fabsf(determinant) > minUVDeterminant){
+		float r = 1.0f / determinant;
+		tangent = (deltaPos1 * deltaUV2.y   - deltaPos2 * deltaUV1.y)*r;
+		bitangent = (deltaPos2 * deltaUV1.x   - deltaPos1 * deltaUV2.x)*r;
+	}
+}
+
+static void computeTriangleTangents(
+	const glm::vec3 * vertices, const glm::vec2 * uvs, const glm::vec3 * normals,
+	glm::vec3 * tangents, glm::vec3 * bitangents, size_t i
+){
+	glm::vec3 tangent, bitangent;
+	triangleTangent(vertices[i], vertices[i+1], vertices[i+2], uvs[i], uvs[i+1], uvs[i+2], tangent, bitangent);
+
+	// Same tangent for all three vertices of the triangle (they will be
+	// merged later, in vboindexer.cpp), orthogonalized to each normal
+	for (int k = 0; k < 3; k++){
+		tangents[i+k] = orthogonalizeTangent(normals[i+k], tangent, bitangent);
+		bitangents[i+k] = bitangent;
+	}
+}
+
+#ifdef SIMD_LANES
+
+// Results of SIMD_LANES triangles, transposed back to AoS once computed
+struct TriangleBatch{
+	float tangent[3][3][SIMD_LANES]; // [corner][component][triangle]
+	float bitangent[3][SIMD_LANES];
+};
+
+// Component c of corner k of SIMD_LANES consecutive triangles
+static inline LanesVec3 lanesGather3(const glm::vec3 * p, int k){
+	const float * first = &p[k].x;
+	LanesVec3 r = {lanesGather(first, 9), lanesGather(first + 1, 9), lanesGather(first + 2, 9)};
+	return r;
+}
+
+static inline void lanesStore3(float (*p)[SIMD_LANES], const LanesVec3 & a){
+	lanesStore(p[0], a.x);
+	lanesStore(p[1], a.y);
+	lanesStore(p[2], a.z);
+}
+
+// Same as computeTriangleTangents, for SIMD_LANES triangles at a time
+static void computeTriangleTangentsLanes(
+	const glm::vec3 * vertices, const glm::vec2 * uvs, const glm::vec3 * normals,
+	glm::vec3 * tangents, glm::vec3 * bitangents, size_t first, TriangleBatch & batch
+){
+	LanesVec3 p0 = lanesGather3(vertices + first, 0);
+	LanesVec3 deltaPos1 = lanesSub3(lanesGather3(vertices + first, 1), p0);
+	LanesVec3 deltaPos2 = lanesSub3(lanesGather3(vertices + first, 2), p0);
+	const float * uv = &uvs[first].x;
+	Lanes u0 = lanesGather(uv, 6), v0 = lanesGather(uv + 1, 6);
+	Lanes deltaU1 = lanesSub(lanesGather(uv + 2, 6), u0);
+	Lanes deltaV1 = lanesSub(lanesGather(uv + 3, 6), v0);
+	Lanes deltaU2 = lanesSub(lanesGather(uv + 4, 6), u0);
+	Lanes deltaV2 = lanesSub(lanesGather(uv + 5, 6), v0);
+
+	Lanes determinant = lanesSub(lanesMul(deltaU1, deltaV2), lanesMul(deltaV1, deltaU2));
+	Lanes mapped = lanesLess(lanesSet(minUVDeterminant), lanesAbs(determinant));
+	Lanes r = lanesDiv(lanesSet(1.0f), lanesSelect(mapped, determinant, lanesSet(1.0f)));
+	LanesVec3 tangent = lanesScale3(lanesSub3(lanesScale3(deltaPos1, deltaV2), lanesScale3(deltaPos2, deltaV1)), r);
+	LanesVec3 bitangent = lanesScale3(lanesSub3(lanesScale3(deltaPos2, deltaU1), lanesScale3(deltaPos1, deltaU2)), r);
+	tangent = lanesSelect3(mapped, tangent, deltaPos1);
+	bitangent = lanesSelect3(mapped, bitangent, deltaPos2);
+	lanesStore3(batch.bitangent, bitangent);
+
+	for (int k = 0; k < 3; k++){
+		LanesVec3 n = lanesGather3(normals + first, k);
+		LanesVec3 t = lanesSub3(tangent, lanesScale3(n, lanesDot3(n, tangent)));
+		Lanes length2 = lanesDot3(t, t);
+
+		// Tangent along the normal : use whichever of X or Y is further from it
+		Lanes useY = lanesLess(lanesSet(0.9f), lanesAbs(n.x));
+		LanesVec3 axis = {lanesSelect(useY, lanesSet(0.0f), lanesSet(1.0f)), lanesSelect(useY, lanesSet(1.0f), lanesSet(0.0f)), lanesSet(0.0f)};
+		LanesVec3 fallback = lanesSub3(axis, lanesScale3(n, lanesDot3(n, axis)));
+		// NaN lengths compare false, and take the fallback too
+		Lanes usable = lanesLess(lanesSet(minTangentLength2), length2);
+		t = lanesSelect3(usable, t, fallback);
+		length2 = lanesSelect(usable, length2, lanesDot3(fallback, fallback));
+		t = lanesScale3(t, lanesDiv(lanesSet(1.0f), lanesSqrt(length2)));
+
+		// Handedness : dot(cross(n, t), b) < 0 flips the tangent
+		Lanes flip = lanesLess(lanesDot3(lanesCross3(n, t), bitangent), lanesSet(0.0f));
+		LanesVec3 flipped = {lanesNegateIf(flip, t.x), lanesNegateIf(flip, t.y), lanesNegateIf(flip, t.z)};
+		lanesStore3(batch.tangent[k], flipped);
+	}
+
+	for (int t = 0; t < SIMD_LANES; t++){
+		for (int k = 0; k < 3; k++){
+			size_t i = first + 3 * t + k;
+			tangents[i] = glm::vec3(batch.tangent[k][0][t], batch.tangent[k][1][t], batch.tangent[k][2][t]);
+			bitangents[i] = glm::vec3(batch.bitangent[0][t], batch.bitangent[1][t], batch.bitangent[2][t]);
+		}
+	}
+}
+
+#endif
+
+// Triangles [firstTriangle, lastTriangle)
+static void computeTangentRange(
+	const glm::vec3 * vertices, const glm::vec2 * uvs, const glm::vec3 * normals,
+	glm::vec3 * tangents, glm::vec3 * bitangents, size_t firstTriangle, size_t lastTriangle
+){
+	size_t t = firstTriangle;
+#ifdef SIMD_LANES
+	TriangleBatch batch;
+	for (; t + SIMD_LANES <= lastTriangle; t += SIMD_LANES)
+		computeTriangleTangentsLanes(vertices, uvs, normals, tangents, bitangents, 3 * t, batch);
+#endif
+	for (; t < lastTriangle; t++)
+		computeTriangleTangents(vertices, uvs, normals, tangents, bitangents, 3 * t);
+}
+
 void computeTangentBasis(
 	// inputs
 	std::vector<glm::vec3> & vertices,
@@ -10,64 +180,111 @@ void computeTangentBasis(
 	std::vector<glm::vec3> & normals,
 	// outputs
 	std::vector<glm::vec3> & tangents,
-	std::vector<glm::vec3> & bitangents
+	std::vector<glm::vec3> & bitangents,
+	unsigned int maxThreads
 ){
+	size_t triangleCount = vertices.size() / 3;
+	tangents.assign(vertices.size(), glm::vec3(0.0f));
+	bitangents.assign(vertices.size(), glm::vec3(0.0f));
+	if (uvs.size() < triangleCount * 3 || normals.size() < triangleCount * 3)
+		return;
 
-	for (unsigned int i=0; i<vertices.size(); i+=3 ){
-
-		// Shortcuts for vertices
-		glm::vec3 & v0 = vertices[i+0];
-		glm::vec3 & v1 = vertices[i+1];
-		glm::vec3 & v2 = vertices[i+2];
-
-		// Shortcuts for UVs
-		glm::vec2 & uv0 = uvs[i+0];
-		glm::vec2 & uv1 = uvs[i+1];
-		glm::vec2 & uv2 = uvs[i+2];
-
-		// Edges of the triangle : postion delta
-		glm::vec3 deltaPos1 = v1-v0;
-		glm::vec3 deltaPos2 = v2-v0;
+	// Every triangle is independent : split them in ranges, one job each
+	ThreadPool & pool = ThreadPool::global();
+	size_t threadCount = maxThreads ? maxThreads : pool.size() + 1;
+	size_t rangeCount = std::min(threadCount, triangleCount / minParallelTriangleCount);
+	if (rangeCount < 2){
+		computeTangentRange(vertices.data(), uvs.data(), normals.data(), tangents.data(), bitangents.data(), 0, triangleCount);
+		return;
+	}
+	pool.parallelFor(rangeCount, [&](size_t range){
+		computeTangentRange(
+			vertices.data(), uvs.data(), normals.data(), tangents.data(), bitangents.data(),
+			triangleCount * range / rangeCount, triangleCount * (range + 1) / rangeCount
+		);
+	});
+}
 
-		// UV delta
-		glm::vec2 deltaUV1 = uv1-uv0;
-		glm::vec2 deltaUV2 = uv2-uv0;
+void computeTangentBasisIndexed(
+	std::vector<unsigned int> & indices,
+	std::vector<glm::vec3> & vertices,
+	std::vector<glm::vec2> & uvs,
+	std::vector<glm::vec3> & normals,
+	std::vector<glm::vec3> & tangents,
+	std::vector<glm::vec3> & bitangents
+){
+	size_t vertexCount = vertices.size();
+	size_t triangleCount = indices.size() / 3;
+	tangents.assign(vertexCount, glm::vec3(0.0f));
+	bitangents.assign(vertexCount, glm::vec3(0.0f));
+	if (uvs.size() < vertexCount || normals.size() < vertexCount)
+		return;
 
-		float r = 1.0f / (deltaUV1.x * deltaUV2.y - deltaUV1.y * deltaUV2.x);
-		glm::vec3 tangent = (deltaPos1 * deltaUV2.y   - deltaPos2 * deltaUV1.y)*r;
-		glm::vec3 bitangent = (deltaPos2 * deltaUV1.x   - deltaPos1 * deltaUV2.x)*r;
+	// Two sums per vertex : [2 * v] for the corners whose UV mapping is
+	// right-handed, [2 * v + 1] for the mirrored ones
+	std::vector<glm::vec3> sums(2 * vertexCount, glm::vec3(0.0f));
+	std::vector<unsigned char> used(2 * vertexCount, 0);
+	std::vector<unsigned char> mirrored(triangleCount * 3, 0);
 
-		// Set the same tangent for all three vertices of the triangle.
-		// They will be merged later, in vboindexer.cpp
-		tangents.push_back(tangent);
-		tangents.push_back(tangent);
-		tangents.push_back(tangent);
+	for (size_t t = 0; t < triangleCount; t++){
+		const unsigned int * triangle = &indices[3 * t];
+		glm::vec3 tangent, bitangent;
+		triangleTangent(
+			vertices[triangle[0]], vertices[triangle[1]], vertices[triangle[2]],
+			uvs[triangle[0]], uvs[triangle[1]], uvs[triangle[2]],
+			tangent, bitangent
+		);
 
-		// Same thing for binormals
-		bitangents.push_back(bitangent);
-		bitangents.push_back(bitangent);
-		bitangents.push_back(bitangent);
+		for (int k = 0; k < 3; k++){
+			unsigned int v = triangle[k];
+			const glm::vec3 & n = normals[v];
+			mirrored[3 * t + k] = glm::dot(glm::cross(n, tangent), bitangent) < 0.0f;
+			size_t slot = 2 * v + mirrored[3 * t + k];
+			used[slot] = 1;
 
+			// Each triangle counts for the angle of its corner, so that the
+			// result doesn't depend on how the surface around v is triangulated
+			glm::vec3 e1 = vertices[triangle[(k + 1) % 3]] - vertices[v];
+			glm::vec3 e2 = vertices[triangle[(k + 2) % 3]] - vertices[v];
+			float lengths = sqrtf(glm::dot(e1, e1) * glm::dot(e2, e2));
+			glm::vec3 projected = tangent - n * glm::dot(n, tangent);
+			float length2 = glm::dot(projected, projected);
+			if (!(lengths > 0.0f) || !(length2 > minTangentLength2))
+				continue;
+			float angle = acosf(std::max(-1.0f, std::min(1.0f, glm::dot(e1, e2) / lengths)));
+			sums[slot] += projected * (angle / sqrtf(length2));
+		}
 	}
 
-	// See "Going Further"
-	for (unsigned int i=0; i<vertices.size(); i+=1 )
-	{
-		glm::vec3 & n = normals[i];
-		glm::vec3 & t = tangents[i];
-		glm::vec3 & b = bitangents[i];
-		
-		// Gram-Schmidt orthogonalize
-		t = glm::normalize(t - n * glm::dot(n, t));
-		
-		// Calculate handedness
-		if (glm::dot(glm::cross(n, t), b) < 0.0f){
-			t = t * -1.0f;
+	// Vertices used with both handednesses are split : the mirrored corners get a copy
+	std::vector<unsigned int> mirrorIndex(vertexCount);
+	for (size_t v = 0; v < vertexCount; v++){
+		mirrorIndex[v] = (unsigned int)v;
+		if (used[2 * v] && used[2 * v + 1]){
+			mirrorIndex[v] = (unsigned int)vertices.size();
+			vertices.push_back(vertices[v]);
+			uvs.push_back(uvs[v]);
+			normals.push_back(normals[v]);
 		}
-
+	}
+	for (size_t i = 0; i < triangleCount * 3; i++){
+		if (mirrored[i])
+			indices[i] = mirrorIndex[indices[i]];
 	}
 
-
+	// Orthonormalized once per vertex
+	tangents.resize(vertices.size());
+	bitangents.resize(vertices.size());
+	for (size_t v = 0; v < vertexCount; v++){
+		for (int m = 0; m < 2; m++){
+			size_t slot = 2 * v + m;
+			if (!used[slot] && (m == 1 || used[slot + 1]))
+				continue; // unused, except for vertices no triangle uses at all
+			unsigned int out = m ? mirrorIndex[v] : (unsigned int)v;
+			const glm::vec3 & n = normals[v];
+			// Same handedness as computeTangentBasis : the tangent is flipped for mirrored UVs
+			tangents[out] = orthonormalizeTangent(n, sums[slot]) * (m ? -1.0f : 1.0f);
+			bitangents[out] = glm::cross(n, tangents[out]);
+		}
+	}
 }
-
-
@@ -1,99 +1,197 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <utility>
 
 #include <GL/glew.h>
 
 #include <GLFW/glfw3.h>
 
+#include "threadpool.hpp"
+#include "simdlanes.hpp"
+#include "texture.hpp"
+#include "blockcompress.hpp"
 
-GLuint loadBMP_custom(const char * imagepath){
+// Staging buffers are kept by size class, up to this many bytes in all
+static const size_t maxPooledStagingBytes = 64 << 20;
+static const int minStagingSizeClass = 16; // 64 KB
+static const int stagingSizeClassCount = 48;
+
+static std::mutex stagingMutex;
+static std::vector<unsigned char *> stagingPool[stagingSizeClassCount];
+static size_t pooledStagingBytes = 0;
+
+StagingBuffer::StagingBuffer(StagingBuffer && other)
+	: bytes(other.bytes), length(other.length), sizeClass(other.sizeClass)
+{
+	other.bytes = NULL;
+	other.length = 0;
+}
+
+StagingBuffer & StagingBuffer::operator=(StagingBuffer && other){
+	if (this != &other){
+		release();
+		bytes = other.bytes;
+		length = other.length;
+		sizeClass = other.sizeClass;
+		other.bytes = NULL;
+		other.length = 0;
+	}
+	return *this;
+}
+
+bool StagingBuffer::resize(size_t size){
+	int wanted = minStagingSizeClass;
+	while (wanted < stagingSizeClassCount - 1 && ((size_t)1 << wanted) < size)
+		wanted++;
+	if (((size_t)1 << wanted) < size)
+		return false;
+	if (bytes && wanted == sizeClass){
+		length = size;
+		return true;
+	}
+	release();
+
+	{
+		std::lock_guard<std::mutex> lock(stagingMutex);
+		if (!stagingPool[wanted].empty()){
+			bytes = stagingPool[wanted].back();
+			stagingPool[wanted].pop_back();
+			pooledStagingBytes -= (size_t)1 << wanted;
+		}
+	}
+	if (!bytes)
+		bytes = (unsigned char *)malloc((size_t)1 << wanted);
+	if (!bytes)
+		return false;
+	sizeClass = wanted;
+	length = size;
+	return true;
+}
+
+void StagingBuffer::release(){
+	if (!bytes)
+		return;
+	{
+		std::lock_guard<std::mutex> lock(stagingMutex);
+		if (pooledStagingBytes + ((size_t)1 << sizeClass) <= maxPooledStagingBytes){
+			stagingPool[sizeClass].push_back(bytes);
+			pooledStagingBytes += (size_t)1 << sizeClass;
+			bytes = NULL;
+		}
+	}
+	free(bytes);
+	bytes = NULL;
+	length = 0;
+}
+
+static long fileSize(FILE * file){
+	long current = ftell(file);
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, current, SEEK_SET);
+	return size;
+}
+
+bool readBMP(const char * imagepath, TextureData & texture){
 
 	printf("Reading image %s\n", imagepath);
 
 	// Data read from the header of the BMP file
 	unsigned char header[54];
 	unsigned int dataPos;
-	unsigned int imageSize;
-	unsigned int width, height;
-	// Actual RGB data
-	unsigned char * data;
+	int width, height;
 
 	// Open the file
 	FILE * file = fopen(imagepath,"rb");
 	if (!file){
 		printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", imagepath);
-		getchar();
-		return 0;
+		return false;
 	}
 
 	// Read the header, i.e. the 54 first bytes
 
 	// If less than 54 bytes are read, problem
-	if ( fread(header, 1, 54, file)!=54 ){ 
+	if ( fread(header, 1, 54, file)!=54 ){
 		printf("Not a correct BMP file\n");
 		fclose(file);
-		return 0;
+		return false;
 	}
 	// A BMP files always begins with "BM"
 	if ( header[0]!='B' || header[1]!='M' ){
 		printf("Not a correct BMP file\n");
 		fclose(file);
-		return 0;
+		return false;
 	}
 	// Make sure this is a 24bpp file
-	if ( *(int*)&(header[0x1E])!=0  )         {printf("Not a correct BMP file\n");    fclose(file); return 0;}
-	if ( *(int*)&(header[0x1C])!=24 )         {printf("Not a correct BMP file\n");    fclose(file); return 0;}
+	if ( *(int*)&(header[0x1E])!=0  )         {printf("Not a correct BMP file\n");    fclose(file); return false;}
+	if ( *(int*)&(header[0x1C])!=24 )         {printf("Not a correct BMP file\n");    fclose(file); return false;}
 
 	// Read the information about the image
 	dataPos    = *(int*)&(header[0x0A]);
-	imageSize  = *(int*)&(header[0x22]);
 	width      = *(int*)&(header[0x12]);
 	height     = *(int*)&(header[0x16]);
 
+	// Negative heights are top-down images : their rows are flipped once read
+	bool topDown = height < 0 && height >= -65536;
+	if (topDown)
+		height = -height;
+	if (width <= 0 || height <= 0 || width > 65536 || height > 65536){
+		printf("%s : unsupported BMP size %d x %d\n", imagepath, width, height);
+		fclose(file);
+		return false;
+	}
+
 	// Some BMP files are misformatted, guess missing information
-	if (imageSize==0)    imageSize=width*height*3; // 3 : one byte for each Red, Green and Blue component
 	if (dataPos==0)      dataPos=54; // The BMP header is done that way
 
-	// Create a buffer
-	data = new unsigned char [imageSize];
+	// Rows are padded to 4 bytes : that's also OpenGL's default unpack alignment
+	size_t rowSize = ((size_t)width * 3 + 3) & ~(size_t)3; // 3 : one byte for each Red, Green and Blue component
+	size_t imageSize = rowSize * height;
+	if ((size_t)fileSize(file) < dataPos + imageSize){
+		printf("%s is truncated\n", imagepath);
+		fclose(file);
+		return false;
+	}
 
 	// Read the actual data from the file into the buffer
-	fread(data,1,imageSize,file);
+	if (!texture.pixels.resize(imageSize) ||
+		fseek(file, dataPos, SEEK_SET) != 0 ||
+		fread(texture.pixels.data(), 1, imageSize, file) != imageSize){
+		printf("%s could not be read\n", imagepath);
+		fclose(file);
+		return false;
+	}
 
 	// Everything is in memory now, the file can be closed.
 	fclose (file);
+	if (topDown){
+		unsigned char * pixels = texture.pixels.data();
+		for (size_t top = 0, bottom = height - 1; top < bottom; top++, bottom--)
+			std::swap_ranges(pixels + top * rowSize, pixels + (top + 1) * rowSize, pixels + bottom * rowSize);
+	}
+	texture.file.close();
+	texture.fileData = NULL;
 
-	// Create one OpenGL texture
-	GLuint textureID;
-	glGenTextures(1, &textureID);
-	
-	// "Bind" the newly created texture : all future texture functions will modify this texture
-	glBindTexture(GL_TEXTURE_2D, textureID);
-
-	// Give the image to OpenGL
-	glTexImage2D(GL_TEXTURE_2D, 0,GL_RGB, width, height, 0, GL_BGR, GL_UNSIGNED_BYTE, data);
-
-	// OpenGL has now copied the data. Free our own version
-	delete [] data;
-
-	// Poor filtering, or ...
-	//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST); 
-
-	// ... nice trilinear filtering ...
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	// ... which requires mipmaps. Generate them automatically.
-	glGenerateMipmap(GL_TEXTURE_2D);
-
-	// Return the ID of the texture we just created
-	return textureID;
+	texture.internalFormat = GL_RGB;
+	texture.format = GL_BGR;
+	texture.type = GL_UNSIGNED_BYTE;
+	texture.compressed = false;
+	texture.generateMipmaps = true;
+	texture.trilinear = true;
+	texture.bandHeight = 1;
+	texture.layerSize = imageSize;
+	TextureLevel level = {(unsigned int)width, (unsigned int)height, 0, imageSize};
+	texture.levels.assign(1, level);
+	return true;
 }
 
-// Since GLFW 3, glfwLoadTexture2D() has been removed. You have to use another texture loading library, 
+// Since GLFW 3, glfwLoadTexture2D() has been removed. You have to use another texture loading library,
 // or do it yourself (just like loadBMP_custom and loadDDS)
 //GLuint loadTGA_glfw(const char * imagepath){
 //
@@ -111,7 +209,7 @@ GLuint loadBMP_custom(const char * imagepath){
 //	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 //	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 //	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-//	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR); 
+//	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 //	glGenerateMipmap(GL_TEXTURE_2D);
 //
 //	// Return the ID of the texture we just created
@@ -123,96 +221,1041 @@ GLuint loadBMP_custom(const char * imagepath){
 #define FOURCC_DXT1 0x31545844 // Equivalent to "DXT1" in ASCII
 #define FOURCC_DXT3 0x33545844 // Equivalent to "DXT3" in ASCII
 #define FOURCC_DXT5 0x35545844 // Equivalent to "DXT5" in ASCII
+#define FOURCC_ATI1 0x31495441 // "ATI1", or "BC4U" : BC4
+#define FOURCC_BC4U 0x55344342
+#define FOURCC_ATI2 0x32495441 // "ATI2", or "BC5U" : BC5
+#define FOURCC_BC5U 0x55354342
+#define FOURCC_DX10 0x30315844 // "DX10" : a DDS_HEADER_DXT10 follows the header
 
-GLuint loadDDS(const char * imagepath){
+// The DDS_HEADER fields we use, from the start of the 124 bytes header
+#define DDS_FLAGS          4
+#define DDS_HEIGHT         8
+#define DDS_WIDTH          12
+#define DDS_DEPTH          20
+#define DDS_MIPMAPCOUNT    24
+#define DDS_PF_FLAGS       76
+#define DDS_PF_FOURCC      80
+#define DDS_PF_BITCOUNT    84
+#define DDS_PF_RMASK       88
+#define DDS_CAPS2          108
+
+#define DDSD_MIPMAPCOUNT   0x20000
+#define DDPF_FOURCC        0x4
+#define DDPF_RGB           0x40
+#define DDSCAPS2_CUBEMAP   0x200
+#define DDSCAPS2_VOLUME    0x200000
+
+// DDS_HEADER_DXT10
+#define DXT10_FORMAT       0
+#define DXT10_DIMENSION    4
+#define DXT10_MISCFLAG     8
+#define DXT10_ARRAYSIZE    12
+#define DXT10_SIZE         20
+
+#define DXT10_TEXTURE2D    3
+#define DXT10_TEXTURECUBE  0x4
+
+struct DDSFormat{
+	unsigned int dxgiFormat;
+	GLenum internalFormat;
+	GLenum format;            // if not compressed
+	unsigned int blockBytes;  // 4x4 block if compressed, pixel otherwise
+};
+
+static const DDSFormat ddsFormats[] = {
+	{ 71, GL_COMPRESSED_RGBA_S3TC_DXT1_EXT,       0, 8  }, // BC1_UNORM
+	{ 72, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT, 0, 8  }, // BC1_UNORM_SRGB
+	{ 74, GL_COMPRESSED_RGBA_S3TC_DXT3_EXT,       0, 16 }, // BC2_UNORM
+	{ 75, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT, 0, 16 }, // BC2_UNORM_SRGB
+	{ 77, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT,       0, 16 }, // BC3_UNORM
+	{ 78, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT, 0, 16 }, // BC3_UNORM_SRGB
+	{ 80, GL_COMPRESSED_RED_RGTC1,                0, 8  }, // BC4_UNORM
+	{ 81, GL_COMPRESSED_SIGNED_RED_RGTC1,         0, 8  }, // BC4_SNORM
+	{ 83, GL_COMPRESSED_RG_RGTC2,                 0, 16 }, // BC5_UNORM
+	{ 84, GL_COMPRESSED_SIGNED_RG_RGTC2,          0, 16 }, // BC5_SNORM
+	{ 98, GL_COMPRESSED_RGBA_BPTC_UNORM,          0, 16 }, // BC7_UNORM
+	{ 99, GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM,    0, 16 }, // BC7_UNORM_SRGB
+	{ 28, GL_RGBA8,         GL_RGBA, 4 },                  // R8G8B8A8_UNORM
+	{ 29, GL_SRGB8_ALPHA8,  GL_RGBA, 4 },                  // R8G8B8A8_UNORM_SRGB
+	{ 87, GL_RGBA8,         GL_BGRA, 4 },                  // B8G8R8A8_UNORM
+	{ 91, GL_SRGB8_ALPHA8,  GL_BGRA, 4 },                  // B8G8R8A8_UNORM_SRGB
+};
+
+// The DXGI format that a legacy header describes, 0 if none
+static unsigned int legacyDDSFormat(const unsigned char * header){
+	unsigned int flags = *(unsigned int*)&(header[DDS_PF_FLAGS]);
+	if (flags & DDPF_FOURCC){
+		switch(*(unsigned int*)&(header[DDS_PF_FOURCC])){
+		case FOURCC_DXT1: return 71;
+		case FOURCC_DXT3: return 74;
+		case FOURCC_DXT5: return 77;
+		case FOURCC_ATI1:
+		case FOURCC_BC4U: return 80;
+		case FOURCC_ATI2:
+		case FOURCC_BC5U: return 83;
+		}
+		return 0;
+	}
+	if ((flags & DDPF_RGB) && *(unsigned int*)&(header[DDS_PF_BITCOUNT]) == 32){
+		unsigned int redMask = *(unsigned int*)&(header[DDS_PF_RMASK]);
+		if (redMask == 0x000000FF) return 28;
+		if (redMask == 0x00FF0000) return 87;
+	}
+	return 0;
+}
 
-	unsigned char header[124];
+bool readDDS(const char * imagepath, TextureData & texture){
 
-	FILE *fp; 
- 
-	/* try to open the file */ 
-	fp = fopen(imagepath, "rb"); 
-	if (fp == NULL){
-		printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", imagepath); getchar(); 
+	/* try to open the file */
+	if (!texture.file.open(imagepath)){
+		printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", imagepath);
+		texture.fileData = NULL;
+		return false;
+	}
+	if (!readDDSFromMemory(texture.file.data(), texture.file.size(), imagepath, texture)){
+		texture.file.close();
+		return false;
+	}
+	return true;
+}
+
+bool readDDSFromMemory(const unsigned char * bytes, size_t size, const char * imagepath, TextureData & texture){
+	texture.fileData = NULL;
+
+	/* verify the type of file */
+	if (size < 4 + 124 || strncmp((const char *)bytes, "DDS ", 4) != 0 || *(unsigned int*)&(bytes[4]) != 124){
+		printf("%s is not a DDS file\n", imagepath);
+		return false;
+	}
+	const unsigned char * header = bytes + 4;
+	texture.fileOffset = 4 + 124;
+
+	unsigned int height      = *(unsigned int*)&(header[DDS_HEIGHT]);
+	unsigned int width       = *(unsigned int*)&(header[DDS_WIDTH]);
+	unsigned int mipMapCount = *(unsigned int*)&(header[DDS_MIPMAPCOUNT]);
+	unsigned int caps2       = *(unsigned int*)&(header[DDS_CAPS2]);
+	if (!(*(unsigned int*)&(header[DDS_FLAGS]) & DDSD_MIPMAPCOUNT))
+		mipMapCount = 1;
+
+	unsigned int dxgiFormat;
+	unsigned int arraySize = 1;
+	bool cube;
+	if (*(unsigned int*)&(header[DDS_PF_FLAGS]) & DDPF_FOURCC && *(unsigned int*)&(header[DDS_PF_FOURCC]) == FOURCC_DX10){
+		if (size < texture.fileOffset + DXT10_SIZE){
+			printf("%s is truncated\n", imagepath);
+			return false;
+		}
+		const unsigned char * header10 = bytes + texture.fileOffset;
+		texture.fileOffset += DXT10_SIZE;
+		dxgiFormat = *(unsigned int*)&(header10[DXT10_FORMAT]);
+		arraySize  = *(unsigned int*)&(header10[DXT10_ARRAYSIZE]);
+		cube       = (*(unsigned int*)&(header10[DXT10_MISCFLAG]) & DXT10_TEXTURECUBE) != 0;
+		if (*(unsigned int*)&(header10[DXT10_DIMENSION]) != DXT10_TEXTURE2D){
+			printf("%s : only 2D textures are supported\n", imagepath);
+			return false;
+		}
+	}else{
+		dxgiFormat = legacyDDSFormat(header);
+		// Legacy cube maps have all their faces, or the missing ones are undefined anyway
+		cube = (caps2 & DDSCAPS2_CUBEMAP) != 0;
+		if (caps2 & DDSCAPS2_VOLUME){
+			printf("%s : only 2D textures are supported\n", imagepath);
+			return false;
+		}
+	}
+
+	const DDSFormat * format = NULL;
+	for (size_t i = 0; i < sizeof(ddsFormats) / sizeof(ddsFormats[0]); i++){
+		if (ddsFormats[i].dxgiFormat == dxgiFormat)
+			format = &ddsFormats[i];
+	}
+	if (!format){
+		printf("%s : unsupported DDS format\n", imagepath);
+		return false;
+	}
+	if (width == 0 || height == 0 || width > 65536 || height > 65536 || arraySize == 0 || arraySize > 2048 || (cube && width != height)){
+		printf("%s : unsupported DDS size %u x %u x %u\n", imagepath, width, height, arraySize);
+		return false;
+	}
+
+	texture.internalFormat = format->internalFormat;
+	texture.compressed = format->format == 0;
+	texture.format = texture.compressed ? GL_RGBA : format->format;
+	texture.type = GL_UNSIGNED_BYTE;
+	texture.generateMipmaps = false;
+	texture.trilinear = false;
+	texture.bandHeight = texture.compressed ? 4 : 1;
+	texture.layers = arraySize * (cube ? 6 : 1);
+	if (cube)
+		texture.target = arraySize > 1 ? GL_TEXTURE_CUBE_MAP_ARRAY : GL_TEXTURE_CUBE_MAP;
+	else
+		texture.target = arraySize > 1 ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+
+	/* the exact size of each mipmap : no more levels than down to 1x1 */
+	texture.levels.clear();
+	size_t offset = 0;
+	for (unsigned int level = 0; level < std::max(mipMapCount, 1u); ++level)
+	{
+		size_t levelSize = texture.compressed ?
+			(size_t)((width+3)/4)*((height+3)/4)*format->blockBytes :
+			(size_t)width*height*format->blockBytes;
+		TextureLevel mip = {width, height, offset, levelSize};
+		texture.levels.push_back(mip);
+		offset += mip.size;
+		if (width == 1 && height == 1)
+			break;
+		width  = std::max(width / 2, 1u);
+		height = std::max(height / 2, 1u);
+	}
+	texture.layerSize = offset;
+
+	/* the layers follow each other, each with all its levels */
+	if (size < texture.fileOffset || (size - texture.fileOffset) / texture.layers < texture.layerSize){
+		printf("%s is truncated\n", imagepath);
+		return false;
+	}
+	texture.fileData = bytes;
+	return true;
+}
+
+// Fills header for texture and returns its size, 0 if texture can't be written
+static size_t makeDDSHeader(const char * name, const TextureData & texture, unsigned char (&header)[4 + 124 + DXT10_SIZE]){
+	const DDSFormat * format = NULL;
+	for (size_t i = 0; i < sizeof(ddsFormats) / sizeof(ddsFormats[0]); i++){
+		if (ddsFormats[i].internalFormat == texture.internalFormat && (texture.compressed ? ddsFormats[i].format == 0 : ddsFormats[i].format == texture.format))
+			format = &ddsFormats[i];
+	}
+	if (!format || texture.levels.empty() || texture.generateMipmaps){
+		printf("%s : this texture can't be written in a DDS file\n", name);
 		return 0;
 	}
-   
-	/* verify the type of file */ 
-	char filecode[4]; 
-	fread(filecode, 1, 4, fp); 
-	if (strncmp(filecode, "DDS ", 4) != 0) { 
-		fclose(fp); 
-		return 0; 
-	}
-	
-	/* get the surface desc */ 
-	fread(&header, 124, 1, fp); 
-
-	unsigned int height      = *(unsigned int*)&(header[8 ]);
-	unsigned int width	     = *(unsigned int*)&(header[12]);
-	unsigned int linearSize	 = *(unsigned int*)&(header[16]);
-	unsigned int mipMapCount = *(unsigned int*)&(header[24]);
-	unsigned int fourCC      = *(unsigned int*)&(header[80]);
-
- 
-	unsigned char * buffer;
-	unsigned int bufsize;
-	/* how big is it going to be including all mipmaps? */ 
-	bufsize = mipMapCount > 1 ? linearSize * 2 : linearSize; 
-	buffer = (unsigned char*)malloc(bufsize * sizeof(unsigned char)); 
-	fread(buffer, 1, bufsize, fp); 
-	/* close the file pointer */ 
-	fclose(fp);
-
-	unsigned int components  = (fourCC == FOURCC_DXT1) ? 3 : 4; 
-	unsigned int format;
-	switch(fourCC) 
-	{ 
-	case FOURCC_DXT1: 
-		format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT; 
-		break; 
-	case FOURCC_DXT3: 
-		format = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT; 
-		break; 
-	case FOURCC_DXT5: 
-		format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; 
-		break; 
-	default: 
-		free(buffer); 
-		return 0; 
+	bool cube = texture.target == GL_TEXTURE_CUBE_MAP || texture.target == GL_TEXTURE_CUBE_MAP_ARRAY;
+	unsigned int arraySize = cube ? texture.layers / 6 : texture.layers;
+	// Old readers only know the DXT formats of the legacy header
+	bool legacy = arraySize == 1 && !cube && (format->dxgiFormat == 71 || format->dxgiFormat == 74 || format->dxgiFormat == 77);
+
+	memset(header, 0, sizeof(header));
+	memcpy(header, "DDS ", 4);
+	unsigned char * dds = header + 4;
+	*(unsigned int*)&(dds[0]) = 124;
+	// DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_MIPMAPCOUNT, and DDSD_LINEARSIZE or DDSD_PITCH
+	*(unsigned int*)&(dds[DDS_FLAGS])       = 0x1 | 0x2 | 0x4 | 0x1000 | DDSD_MIPMAPCOUNT | (texture.compressed ? 0x80000 : 0x8);
+	*(unsigned int*)&(dds[DDS_HEIGHT])      = texture.levels[0].height;
+	*(unsigned int*)&(dds[DDS_WIDTH])       = texture.levels[0].width;
+	*(unsigned int*)&(dds[16])              = texture.compressed ? (unsigned int)texture.levels[0].size : texture.levels[0].width * format->blockBytes;
+	*(unsigned int*)&(dds[DDS_MIPMAPCOUNT]) = (unsigned int)texture.levels.size();
+	*(unsigned int*)&(dds[72])              = 32; // size of the pixel format
+	*(unsigned int*)&(dds[DDS_PF_FLAGS])    = DDPF_FOURCC;
+	*(unsigned int*)&(dds[DDS_PF_FOURCC])   = !legacy ? FOURCC_DX10 : format->dxgiFormat == 71 ? FOURCC_DXT1 : format->dxgiFormat == 74 ? FOURCC_DXT3 : FOURCC_DXT5;
+	// DDSCAPS_TEXTURE, and DDSCAPS_COMPLEX | DDSCAPS_MIPMAP with mipmaps
+	*(unsigned int*)&(dds[104])             = 0x1000 | (texture.levels.size() > 1 ? 0x8 | 0x400000 : 0);
+	*(unsigned int*)&(dds[DDS_CAPS2])       = cube ? DDSCAPS2_CUBEMAP | 0xFC00 : 0;
+	if (!legacy){
+		unsigned char * header10 = dds + 124;
+		*(unsigned int*)&(header10[DXT10_FORMAT])    = format->dxgiFormat;
+		*(unsigned int*)&(header10[DXT10_DIMENSION]) = DXT10_TEXTURE2D;
+		*(unsigned int*)&(header10[DXT10_MISCFLAG])  = cube ? DXT10_TEXTURECUBE : 0;
+		*(unsigned int*)&(header10[DXT10_ARRAYSIZE]) = arraySize;
+	}
+	return legacy ? 4 + 124 : sizeof(header);
+}
+
+bool writeDDS(const char * imagepath, const TextureData & texture){
+	unsigned char header[4 + 124 + DXT10_SIZE];
+	size_t headerSize = makeDDSHeader(imagepath, texture, header);
+	if (!headerSize)
+		return false;
+
+	FILE * file = fopen(imagepath, "wb");
+	if (!file){
+		printf("%s could not be opened for writing\n", imagepath);
+		return false;
+	}
+	size_t dataSize = texture.layerSize * texture.layers;
+	bool written = fwrite(header, 1, headerSize, file) == headerSize && fwrite(texture.pixelData(), 1, dataSize, file) == dataSize;
+	if (fclose(file) != 0 || !written){
+		printf("%s could not be written\n", imagepath);
+		return false;
+	}
+	return true;
+}
+
+bool writeDDSToMemory(const char * name, const TextureData & texture, std::vector<unsigned char> & bytes){
+	unsigned char header[4 + 124 + DXT10_SIZE];
+	size_t headerSize = makeDDSHeader(name, texture, header);
+	if (!headerSize)
+		return false;
+	const unsigned char * pixels = texture.pixelData();
+	bytes.assign(header, header + headerSize);
+	bytes.insert(bytes.end(), pixels, pixels + texture.layerSize * texture.layers);
+	return true;
+}
+
+// Mipmaps are filtered in fixed point : the weights of a filter sum to
+// 1 << mipWeightBits, and pixels are linear values from 0 to mipValueMax
+static const int mipWeightBits = 14;
+static const int mipValueMax = 32767;
+
+// Half the width of the Kaiser filter, in pixels of the smaller level
+static const double mipKaiserRadius = 2.0;
+static const double mipKaiserAlpha = 4.0;
+
+// Fewest pixels of a level per job of generateMipmaps
+static const size_t minParallelMipPixelCount = 1 << 15;
+
+// 8 bits values to linear ones and back, for sRGB and plain channels.
+// Rounded from double precision once, so they are the same everywhere.
+struct MipTables{
+	unsigned short srgbToLinear[256];
+	unsigned short unormToLinear[256];
+	unsigned char linearToSrgb[mipValueMax + 1];
+	unsigned char linearToUnorm[mipValueMax + 1];
+
+	MipTables(){
+		for (int i = 0; i < 256; i++){
+			double c = i / 255.0;
+			double linear = c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+			srgbToLinear[i] = (unsigned short)(linear * mipValueMax + 0.5);
+			unormToLinear[i] = (unsigned short)((i * mipValueMax + 127) / 255);
+		}
+		for (int v = 0; v <= mipValueMax; v++){
+			double linear = (double)v / mipValueMax;
+			double c = linear <= 0.0031308 ? linear * 12.92 : 1.055 * pow(linear, 1.0 / 2.4) - 0.055;
+			linearToSrgb[v] = (unsigned char)(c * 255.0 + 0.5);
+			linearToUnorm[v] = (unsigned char)((v * 255 + mipValueMax / 2) / mipValueMax);
+		}
+	}
+};
+
+static const MipTables & mipTables(){
+	static MipTables tables;
+	return tables;
+}
+
+static double besselI0(double x){
+	double sum = 1.0, term = 1.0;
+	for (int k = 1; k < 32; k++){
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+	}
+	return sum;
+}
+
+// Windowed sinc, x in pixels of the smaller level
+static double kaiserFilter(double x){
+	double t = x / mipKaiserRadius;
+	if (fabs(t) >= 1.0)
+		return 0.0;
+	const double pi = 3.14159265358979323846;
+	double sinc = x == 0.0 ? 1.0 : sin(pi * x) / (pi * x);
+	return sinc * besselI0(mipKaiserAlpha * sqrt(1.0 - t * t)) / besselI0(mipKaiserAlpha);
+}
+
+// The filter of one axis of a level : pixel i of the level is the sum of
+// tapCount source pixels sources[i * tapCount + t], times weights[i * tapCount + t].
+// pairs holds the weights two by two (low 16 bits first), for _mm_madd_epi16.
+struct MipTaps{
+	unsigned int tapCount; // even
+	std::vector<int> sources; // clamped to the source
+	std::vector<short> weights;
+	std::vector<int> pairs;
+};
+
+static void buildMipTaps(unsigned int sourceSize, unsigned int size, bool kaiser, MipTaps & taps){
+	double scale = (double)sourceSize / size;
+	double radius = (kaiser ? mipKaiserRadius : 0.5) * scale;
+	int span = (int)ceil(2.0 * radius) + 2;
+	std::vector<int> firsts(size);
+	std::vector<int> quantized((size_t)size * span);
+	unsigned int tapCount = 1;
+	for (unsigned int i = 0; i < size; i++){
+		double center = (i + 0.5) * scale;
+		int first = (int)floor(center - radius);
+		std::vector<double> weights(span);
+		double sum = 0.0;
+		for (int t = 0; t < span; t++){
+			double s = first + t;
+			if (kaiser)
+				weights[t] = kaiserFilter((s + 0.5 - center) / scale);
+			else // the part of source pixel s under pixel i
+				weights[t] = std::max(std::min(s + 1.0, center + radius) - std::max(s, center - radius), 0.0);
+			sum += weights[t];
+		}
+		// Rounded so that they sum to exactly 1 : the rest goes to the biggest
+		int * q = &quantized[(size_t)i * span];
+		int total = 0, biggest = 0;
+		for (int t = 0; t < span; t++){
+			q[t] = (int)floor(weights[t] / sum * (1 << mipWeightBits) + 0.5);
+			total += q[t];
+			if (abs(q[t]) > abs(q[biggest]))
+				biggest = t;
+		}
+		q[biggest] += (1 << mipWeightBits) - total;
+		// Only keep the taps between the first and the last non zero weights
+		int lo = 0, hi = span - 1;
+		while (lo < hi && q[lo] == 0) lo++;
+		while (hi > lo && q[hi] == 0) hi--;
+		memmove(q, q + lo, (hi - lo + 1) * sizeof(int));
+		for (int t = hi - lo + 1; t < span; t++)
+			q[t] = 0;
+		firsts[i] = first + lo;
+		tapCount = std::max(tapCount, (unsigned int)(hi - lo + 1));
+	}
+	tapCount += tapCount & 1;
+
+	taps.tapCount = tapCount;
+	taps.sources.resize((size_t)size * tapCount);
+	taps.weights.resize((size_t)size * tapCount);
+	taps.pairs.resize((size_t)size * tapCount / 2);
+	for (unsigned int i = 0; i < size; i++){
+		for (unsigned int t = 0; t < tapCount; t++){
+			size_t k = (size_t)i * tapCount + t;
+			taps.sources[k] = std::min(std::max(firsts[i] + (int)t, 0), (int)sourceSize - 1);
+			taps.weights[k] = (short)(t < (unsigned int)span ? quantized[(size_t)i * span + t] : 0);
+		}
+		for (unsigned int t = 0; t < tapCount; t += 2){
+			size_t k = (size_t)i * tapCount + t;
+			taps.pairs[k / 2] = (int)((unsigned int)(unsigned short)taps.weights[k] | ((unsigned int)(unsigned short)taps.weights[k + 1] << 16));
+		}
+	}
+}
+
+static inline short mipRound(int sum){
+	return (short)std::min(std::max((sum + (1 << (mipWeightBits - 1))) >> mipWeightBits, 0), mipValueMax);
+}
+
+// Vertical pass : out[e] = the sum of weights[t] * rows[t][e], for count values
+static void filterMipColumns(const short * const * rows, const short * weights, const int * pairs, unsigned int tapCount, size_t count, short * out){
+	size_t e = 0;
+#ifdef SIMD_LANES
+	// 8 values at once : _mm_madd_epi16 gives the exact sums of the scalar loop
+	const __m128i rounding = _mm_set1_epi32(1 << (mipWeightBits - 1));
+	for (; e + 8 <= count; e += 8){
+		__m128i low = rounding, high = rounding;
+		for (unsigned int t = 0; t < tapCount; t += 2){
+			__m128i a = _mm_loadu_si128((const __m128i *)(rows[t] + e));
+			__m128i b = _mm_loadu_si128((const __m128i *)(rows[t + 1] + e));
+			__m128i w = _mm_set1_epi32(pairs[t / 2]);
+			low  = _mm_add_epi32(low,  _mm_madd_epi16(_mm_unpacklo_epi16(a, b), w));
+			high = _mm_add_epi32(high, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), w));
+		}
+		// packs saturates to 32767 = mipValueMax
+		__m128i values = _mm_packs_epi32(_mm_srai_epi32(low, mipWeightBits), _mm_srai_epi32(high, mipWeightBits));
+		_mm_storeu_si128((__m128i *)(out + e), _mm_max_epi16(values, _mm_setzero_si128()));
+	}
+#else
+	(void)pairs;
+#endif
+	for (; e < count; e++){
+		int sum = 0;
+		for (unsigned int t = 0; t < tapCount; t++)
+			sum += weights[t] * rows[t][e];
+		out[e] = mipRound(sum);
+	}
+}
+
+// Horizontal pass, on RGBA pixels
+static void filterMipRow(const short * row, const MipTaps & taps, unsigned int width, short * out){
+	unsigned int tapCount = taps.tapCount;
+	for (unsigned int x = 0; x < width; x++){
+		const int * sources = &taps.sources[(size_t)x * tapCount];
+#ifdef SIMD_LANES
+		const int * pairs = &taps.pairs[(size_t)x * tapCount / 2];
+		__m128i sum = _mm_set1_epi32(1 << (mipWeightBits - 1));
+		for (unsigned int t = 0; t < tapCount; t += 2){
+			__m128i a = _mm_loadl_epi64((const __m128i *)(row + sources[t] * 4));
+			__m128i b = _mm_loadl_epi64((const __m128i *)(row + sources[t + 1] * 4));
+			sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), _mm_set1_epi32(pairs[t / 2])));
+		}
+		sum = _mm_srai_epi32(sum, mipWeightBits);
+		_mm_storel_epi64((__m128i *)(out + x * 4), _mm_max_epi16(_mm_packs_epi32(sum, sum), _mm_setzero_si128()));
+#else
+		const short * weights = &taps.weights[(size_t)x * tapCount];
+		for (int c = 0; c < 4; c++){
+			int sum = 0;
+			for (unsigned int t = 0; t < tapCount; t++)
+				sum += weights[t] * row[sources[t] * 4 + c];
+			out[x * 4 + c] = mipRound(sum);
+		}
+#endif
+	}
+}
+
+static unsigned int integerSqrt(unsigned long long n){
+	unsigned long long root = (unsigned long long)sqrt((double)n);
+	while (root * root > n)
+		root--;
+	while ((root + 1) * (root + 1) <= n)
+		root++;
+	return (unsigned int)root;
+}
+
+// Back to unit vectors, in integers so that every machine rounds the same
+static void renormalizeMipRow(short * row, unsigned int width){
+	for (unsigned int x = 0; x < width; x++){
+		short * pixel = row + x * 4;
+		long long n[3];
+		unsigned long long length2 = 0;
+		for (int c = 0; c < 3; c++){
+			n[c] = 2 * pixel[c] - mipValueMax;
+			length2 += n[c] * n[c];
+		}
+		if (length2 == 0)
+			continue;
+		long long length = integerSqrt(length2);
+		for (int c = 0; c < 3; c++){
+			long long scaled = n[c] * 2 * mipValueMax;
+			long long rounded = (scaled + (scaled >= 0 ? length : -length)) / (2 * length);
+			rounded = std::min(std::max(rounded, (long long)-mipValueMax), (long long)mipValueMax);
+			pixel[c] = (short)((rounded + mipValueMax + 1) >> 1);
+		}
+	}
+}
+
+// Splits rows in ranges, one job each, for images of pixelCount pixels
+static void forEachRowRange(unsigned int rows, size_t pixelCount, unsigned int maxThreads,
+	const std::function<void(unsigned int, unsigned int)> & body)
+{
+	ThreadPool & pool = ThreadPool::global();
+	size_t threadCount = maxThreads ? maxThreads : pool.size() + 1;
+	size_t rangeCount = std::min(std::min(threadCount, pixelCount / minParallelMipPixelCount), (size_t)rows);
+	if (rangeCount < 2){
+		body(0, rows);
+		return;
+	}
+	pool.parallelFor(rangeCount, [&](size_t range){
+		body((unsigned int)(rows * range / rangeCount), (unsigned int)(rows * (range + 1) / rangeCount));
+	});
+}
+
+bool generateMipmaps(const TextureData & source, unsigned int flags, TextureData & mipmapped, unsigned int maxThreads){
+	bool swapRB = source.format == GL_BGR || source.format == GL_BGRA;
+	int channels = source.format == GL_RGB || source.format == GL_BGR ? 3 : source.format == GL_RGBA || source.format == GL_BGRA ? 4 : 0;
+	if (source.compressed || source.type != GL_UNSIGNED_BYTE || channels == 0 || source.levels.empty()){
+		printf("Mipmaps can only be generated for 8 bits RGB(A) textures\n");
+		return false;
+	}
+	// Normals are never sRGB
+	if (flags & MIPMAP_NORMAL_MAP)
+		flags &= ~MIPMAP_SRGB;
+	const MipTables & tables = mipTables();
+	const unsigned short * toLinear = (flags & MIPMAP_SRGB) ? tables.srgbToLinear : tables.unormToLinear;
+	const unsigned char * fromLinear = (flags & MIPMAP_SRGB) ? tables.linearToSrgb : tables.linearToUnorm;
+
+	// Built aside, so that source and mipmapped can be the same
+	TextureData result;
+	size_t offset = 0;
+	for (unsigned int w = source.levels[0].width, h = source.levels[0].height; ; w = std::max(w / 2, 1u), h = std::max(h / 2, 1u)){
+		TextureLevel level = {w, h, offset, (size_t)w * h * 4};
+		result.levels.push_back(level);
+		offset += level.size;
+		if (w == 1 && h == 1)
+			break;
+	}
+	result.layerSize = offset;
+	result.layers = source.layers;
+	if (!result.pixels.resize(result.layerSize * result.layers)){
+		printf("Out of memory\n");
+		return false;
+	}
+	result.target = source.target;
+	bool srgbFormat = source.internalFormat == GL_SRGB8 || source.internalFormat == GL_SRGB8_ALPHA8;
+	result.internalFormat = srgbFormat ? GL_SRGB8_ALPHA8 : GL_RGBA8;
+	result.format = GL_RGBA;
+	result.type = GL_UNSIGNED_BYTE;
+	result.compressed = false;
+	result.generateMipmaps = false;
+	result.trilinear = source.trilinear;
+	result.bandHeight = 1;
+
+	const TextureLevel & top = source.levels[0];
+	size_t rowSize = top.size / top.height; // rows may be padded, as in BMP files
+	std::vector<short> current, next;
+	for (unsigned int layer = 0; layer < source.layers; layer++){
+		// Level 0 : a copy of the source, in RGBA
+		const unsigned char * pixels = source.levelData(layer, 0);
+		unsigned char * out = result.pixels.data() + layer * result.layerSize;
+		forEachRowRange(top.height, (size_t)top.width * top.height, maxThreads, [&](unsigned int firstRow, unsigned int lastRow){
+			for (unsigned int y = firstRow; y < lastRow; y++){
+				const unsigned char * in = pixels + y * rowSize;
+				unsigned char * rgba = out + (size_t)y * top.width * 4;
+				if (channels == 4 && !swapRB){
+					memcpy(rgba, in, (size_t)top.width * 4);
+					continue;
+				}
+				for (unsigned int x = 0; x < top.width; x++, in += channels, rgba += 4){
+					rgba[0] = in[swapRB ? 2 : 0];
+					rgba[1] = in[1];
+					rgba[2] = in[swapRB ? 0 : 2];
+					rgba[3] = channels == 4 ? in[3] : 255;
+				}
+			}
+		});
+
+		// Each level from the one before it, in linear values : only the output
+		// is rounded to 8 bits. Level 0 is only converted row by row, as needed.
+		for (size_t level = 1; level < result.levels.size(); level++){
+			const TextureLevel & previous = result.levels[level - 1];
+			const TextureLevel & mip = result.levels[level];
+			MipTaps columns, rows;
+			buildMipTaps(previous.width, mip.width, (flags & MIPMAP_KAISER) != 0, columns);
+			buildMipTaps(previous.height, mip.height, (flags & MIPMAP_KAISER) != 0, rows);
+			next.resize((size_t)mip.width * mip.height * 4);
+			unsigned char * levelOut = out + mip.offset;
+			forEachRowRange(mip.height, (size_t)previous.width * previous.height, maxThreads, [&](unsigned int firstRow, unsigned int lastRow){
+				size_t rowValues = (size_t)previous.width * 4;
+				std::vector<short> filtered(rowValues);
+				std::vector<short> converted(level == 1 ? rows.tapCount * rowValues : 0);
+				std::vector<int> convertedRows(rows.tapCount, -1);
+				std::vector<const short *> sourceRows(rows.tapCount);
+				for (unsigned int y = firstRow; y < lastRow; y++){
+					size_t k = (size_t)y * rows.tapCount;
+					for (unsigned int t = 0; t < rows.tapCount; t++){
+						int sourceRow = rows.sources[k + t];
+						if (level > 1){
+							sourceRows[t] = &current[sourceRow * rowValues];
+							continue;
+						}
+						// Converted rows are kept in slot sourceRow % tapCount, for the next rows
+						unsigned int slot = sourceRow % rows.tapCount;
+						short * linear = &converted[slot * rowValues];
+						if (convertedRows[slot] != sourceRow){
+							const unsigned char * rgba = out + sourceRow * rowValues;
+							for (size_t e = 0; e < rowValues; e += 4){
+								linear[e]     = (short)toLinear[rgba[e]];
+								linear[e + 1] = (short)toLinear[rgba[e + 1]];
+								linear[e + 2] = (short)toLinear[rgba[e + 2]];
+								linear[e + 3] = (short)tables.unormToLinear[rgba[e + 3]];
+							}
+							convertedRows[slot] = sourceRow;
+						}
+						sourceRows[t] = linear;
+					}
+					filterMipColumns(sourceRows.data(), &rows.weights[k], &rows.pairs[k / 2], rows.tapCount, rowValues, filtered.data());
+					short * linear = &next[(size_t)y * mip.width * 4];
+					filterMipRow(filtered.data(), columns, mip.width, linear);
+					if (flags & MIPMAP_NORMAL_MAP)
+						renormalizeMipRow(linear, mip.width);
+					unsigned char * rgba = levelOut + (size_t)y * mip.width * 4;
+					for (unsigned int x = 0; x < mip.width * 4; x += 4){
+						for (int c = 0; c < 3; c++)
+							rgba[x + c] = fromLinear[linear[x + c]];
+						rgba[x + 3] = tables.linearToUnorm[linear[x + 3]];
+					}
+				}
+			});
+			current.swap(next);
+		}
+	}
+
+	mipmapped = std::move(result);
+	return true;
+}
+
+// The target of one layer, for the *TexImage2D functions
+static GLenum layerTarget(const TextureData & texture, unsigned int layer){
+	return texture.target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + layer : texture.target;
+}
+
+static bool isLayered(const TextureData & texture){
+	return texture.target == GL_TEXTURE_2D_ARRAY || texture.target == GL_TEXTURE_CUBE_MAP_ARRAY;
+}
+
+// Creates the storage of the levels from firstLevel on of the bound texture,
+// without pixels. Level firstLevel of texture is level 0 of the GL texture.
+static void allocateTexture(const TextureData & texture, size_t firstLevel = 0){
+	for (size_t level = firstLevel; level < texture.levels.size(); level++){
+		const TextureLevel & mip = texture.levels[level];
+		GLint glLevel = (GLint)(level - firstLevel);
+		if (isLayered(texture)){
+			if (texture.compressed)
+				glCompressedTexImage3D(texture.target, glLevel, texture.internalFormat, mip.width, mip.height, texture.layers,
+					0, (GLsizei)(mip.size * texture.layers), NULL);
+			else
+				glTexImage3D(texture.target, glLevel, texture.internalFormat, mip.width, mip.height, texture.layers,
+					0, texture.format, texture.type, NULL);
+			continue;
+		}
+		for (unsigned int layer = 0; layer < texture.layers; layer++){
+			if (texture.compressed)
+				glCompressedTexImage2D(layerTarget(texture, layer), glLevel, texture.internalFormat, mip.width, mip.height,
+					0, (GLsizei)mip.size, NULL);
+			else
+				glTexImage2D(layerTarget(texture, layer), glLevel, texture.internalFormat, mip.width, mip.height,
+					0, texture.format, texture.type, NULL);
+		}
+	}
+}
+
+// Uploads rows [row, row + rowCount) of one level of one layer of the bound texture
+static void uploadRows(const TextureData & texture, unsigned int layer, size_t level,
+	unsigned int row, unsigned int rowCount, size_t size, const void * pixels, size_t firstLevel = 0)
+{
+	unsigned int width = texture.levels[level].width;
+	GLint glLevel = (GLint)(level - firstLevel);
+	if (isLayered(texture)){
+		if (texture.compressed)
+			glCompressedTexSubImage3D(texture.target, glLevel, 0, row, layer, width, rowCount, 1,
+				texture.internalFormat, (GLsizei)size, pixels);
+		else
+			glTexSubImage3D(texture.target, glLevel, 0, row, layer, width, rowCount, 1,
+				texture.format, texture.type, pixels);
+	}else{
+		if (texture.compressed)
+			glCompressedTexSubImage2D(layerTarget(texture, layer), glLevel, 0, row, width, rowCount,
+				texture.internalFormat, (GLsizei)size, pixels);
+		else
+			glTexSubImage2D(layerTarget(texture, layer), glLevel, 0, row, width, rowCount,
+				texture.format, texture.type, pixels);
+	}
+}
+
+// Once every level is uploaded, on the bound texture
+static void finishTexture(const TextureData & texture, size_t firstLevel = 0){
+	if (texture.trilinear){
+		// ... nice trilinear filtering ...
+		glTexParameteri(texture.target, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(texture.target, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(texture.target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(texture.target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	}
+	if (texture.generateMipmaps){
+		// ... which requires mipmaps. Generate them automatically.
+		glGenerateMipmap(texture.target);
+	}else{
+		// Files with a partial mip chain are still complete textures
+		glTexParameteri(texture.target, GL_TEXTURE_MAX_LEVEL, (GLint)(texture.levels.size() - firstLevel) - 1);
+	}
+}
+
+// Whether the driver takes this compressed format. It must have been initialized.
+static bool isFormatSupported(GLenum internalFormat){
+	switch (internalFormat){
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+	case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+		return GLEW_EXT_texture_compression_s3tc;
+	case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT:
+	case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+		return GLEW_EXT_texture_compression_s3tc && GLEW_EXT_texture_sRGB;
+	case GL_COMPRESSED_RED_RGTC1:
+	case GL_COMPRESSED_SIGNED_RED_RGTC1:
+	case GL_COMPRESSED_RG_RGTC2:
+	case GL_COMPRESSED_SIGNED_RG_RGTC2:
+		return GLEW_VERSION_3_0 || GLEW_ARB_texture_compression_rgtc;
+	case GL_COMPRESSED_RGBA_BPTC_UNORM:
+	case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM:
+		return GLEW_VERSION_4_2 || GLEW_ARB_texture_compression_bptc;
+	}
+	return true;
+}
+
+// Compressed textures the driver can't take are expanded on the CPU : they
+// take 4 to 8 times more memory, but show up instead of staying black
+bool needsDecompression(const TextureData & texture){
+	return texture.compressed && !isFormatSupported(texture.internalFormat);
+}
+
+static bool decompressForUpload(const TextureData & texture, TextureData & expanded){
+	if (!decompressTexture(texture, expanded)){
+		printf("This compressed texture format (0x%x) isn't supported\n", texture.internalFormat);
+		return false;
+	}
+	return true;
+}
+
+GLuint uploadTexture(const TextureData & texture){
+	return uploadTextureLevels(texture, 0);
+}
+
+GLuint uploadTextureLevels(const TextureData & texture, size_t firstLevel){
+	if (needsDecompression(texture)){
+		TextureData expanded;
+		if (!decompressForUpload(texture, expanded))
+			return 0;
+		return uploadTextureLevels(expanded, firstLevel);
 	}
+	// Only level 0 is there to start from
+	if (texture.generateMipmaps || firstLevel >= texture.levels.size())
+		firstLevel = 0;
 
 	// Create one OpenGL texture
 	GLuint textureID;
 	glGenTextures(1, &textureID);
 
 	// "Bind" the newly created texture : all future texture functions will modify this texture
-	glBindTexture(GL_TEXTURE_2D, textureID);
-	glPixelStorei(GL_UNPACK_ALIGNMENT,1);	
-	
-	unsigned int blockSize = (format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT) ? 8 : 16; 
-	unsigned int offset = 0;
-
-	/* load the mipmaps */ 
-	for (unsigned int level = 0; level < mipMapCount && (width || height); ++level) 
-	{ 
-		unsigned int size = ((width+3)/4)*((height+3)/4)*blockSize; 
-		glCompressedTexImage2D(GL_TEXTURE_2D, level, format, width, height,  
-			0, size, buffer + offset); 
-	 
-		offset += size; 
-		width  /= 2; 
-		height /= 2; 
-
-		// Deal with Non-Power-Of-Two textures. This code is not included in the webpage to reduce clutter.
-		if(width < 1) width = 1;
-		if(height < 1) height = 1;
-
-	} 
-
-	free(buffer); 
+	glBindTexture(texture.target, textureID);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 
+	/* load the mipmaps, straight from the file if it is mapped */
+	if (texture.target == GL_TEXTURE_2D){
+		for (size_t level = firstLevel; level < texture.levels.size(); ++level){
+			const TextureLevel & mip = texture.levels[level];
+			if (texture.compressed)
+				glCompressedTexImage2D(GL_TEXTURE_2D, (GLint)(level - firstLevel), texture.internalFormat, mip.width, mip.height,
+					0, (GLsizei)mip.size, texture.levelData(0, level));
+			else
+				glTexImage2D(GL_TEXTURE_2D, (GLint)(level - firstLevel), texture.internalFormat, mip.width, mip.height,
+					0, texture.format, texture.type, texture.levelData(0, level));
+		}
+	}else{
+		allocateTexture(texture, firstLevel);
+		for (unsigned int layer = 0; layer < texture.layers; layer++){
+			for (size_t level = firstLevel; level < texture.levels.size(); ++level){
+				const TextureLevel & mip = texture.levels[level];
+				uploadRows(texture, layer, level, 0, mip.height, mip.size, texture.levelData(layer, level), firstLevel);
+			}
+		}
+	}
+	finishTexture(texture, firstLevel);
+
+	// Return the ID of the texture we just created
 	return textureID;
+}
+
+// BMP files only have level 0 : the others are made here rather than by
+// glGenerateMipmap, averaging the colors as light (or renormalizing normals)
+static bool readBMPMipmapped(const char * imagepath, unsigned int mipmapFlags, TextureData & texture){
+	return readBMP(imagepath, texture) && generateMipmaps(texture, mipmapFlags, texture);
+}
+
+GLuint loadBMP_custom(const char * imagepath, unsigned int mipmapFlags){
+	TextureData texture;
+	if (!readBMPMipmapped(imagepath, mipmapFlags, texture))
+		return 0;
+	return uploadTexture(texture);
+}
+
+GLuint loadDDS(const char * imagepath){
+	TextureData texture;
+	if (!readDDS(imagepath, texture))
+		return 0;
+	return uploadTexture(texture);
+}
+
+// Reads one byte per page, so that the OS reads the file
+static void touchPages(const unsigned char * bytes, size_t size){
+	volatile unsigned char sum = 0;
+	for (size_t i = 0; i < size; i += 4096)
+		sum += bytes[i];
+	(void)sum;
+}
+
+TextureLoader::TextureLoader(size_t bytesPerFrame)
+	: pixelBuffer(0), bytesPerFrame(bytesPerFrame)
+{
+}
+
+TextureLoader::~TextureLoader(){
+	// The workers write into the entries
+	for (size_t i = 0; i < entries.size(); i++){
+		if (entries[i].reading.valid())
+			entries[i].reading.wait();
+	}
+}
+
+TextureHandle TextureLoader::load(const char * imagepath, unsigned int mipmapFlags){
+	TextureHandle handle = (TextureHandle)entries.size();
+	entries.push_back(Entry());
+	Entry & entry = entries.back();
+	entry.path = imagepath;
+	entry.data.reset(new TextureData());
+	entry.texture = 0;
+	entry.target = GL_TEXTURE_2D;
+	entry.ready = false;
+	entry.done = false;
+	entry.failed = false;
+	entry.layer = 0;
+	entry.level = 0;
+	entry.row = 0;
 
+	size_t length = entry.path.size();
+	bool dds = length >= 4 && (entry.path.compare(length - 4, 4, ".dds") == 0 || entry.path.compare(length - 4, 4, ".DDS") == 0);
+	std::string path = entry.path;
+	TextureData * data = entry.data.get();
+	entry.reading = ThreadPool::global().submit([path, data, dds, mipmapFlags](){
+		if (!dds)
+			return readBMPMipmapped(path.c_str(), mipmapFlags, *data);
+		if (!readDDS(path.c_str(), *data))
+			return false;
+		// Fault the mapped pixels in here, rather than on the GL thread when they are uploaded
+		touchPages(data->pixelData(), data->layerSize * data->layers);
+		if (needsDecompression(*data)){
+			TextureData expanded;
+			if (!decompressForUpload(*data, expanded))
+				return false;
+			*data = std::move(expanded);
+		}
+		return true;
+	});
+	pending.push_back(handle);
+	return handle;
+}
+
+// A range of rows of one level of one layer, and where it goes in the pixel buffer
+struct UploadBand{
+	TextureHandle handle;
+	unsigned int layer;
+	size_t level;
+	unsigned int row, rowCount;
+	const unsigned char * source;
+	size_t size;
+	size_t offset; // in the pixel buffer
+};
+
+void TextureLoader::upload(size_t budget, bool wait){
+	// Cut the next levels of the textures already read in bands, up to budget bytes
+	std::vector<UploadBand> bands;
+	size_t used = 0;
+	bool full = false;
+	for (size_t p = 0; p < pending.size() && !full; p++){
+		Entry & entry = entries[pending[p]];
+		if (!entry.ready){
+			if (!wait && entry.reading.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+				continue; // read later ones in the meantime
+			entry.ready = entry.reading.get();
+			if (!entry.ready){
+				entry.done = entry.failed = true;
+				entry.data.reset();
+				continue;
+			}
+		}
+
+		const TextureData & data = *entry.data;
+		while (entry.layer < data.layers){
+			const TextureLevel & mip = data.levels[entry.level];
+			unsigned int bandCount = (mip.height + data.bandHeight - 1) / data.bandHeight;
+			size_t bandSize = mip.size / bandCount;
+			size_t offset = (used + 15) & ~(size_t)15;
+			size_t fit = offset < budget ? (budget - offset) / bandSize : 0;
+			// Always some progress, even if a single band is over budget
+			if (fit == 0 && !bands.empty()){
+				full = true;
+				break;
+			}
+			unsigned int firstBand = entry.row / data.bandHeight;
+			unsigned int count = (unsigned int)std::min(std::max(fit, (size_t)1), (size_t)(bandCount - firstBand));
+			UploadBand band;
+			band.handle = pending[p];
+			band.layer = entry.layer;
+			band.level = entry.level;
+			band.row = entry.row;
+			band.rowCount = std::min(count * data.bandHeight, mip.height - entry.row);
+			band.source = data.levelData(entry.layer, entry.level) + firstBand * bandSize;
+			band.size = count * bandSize;
+			band.offset = offset;
+			bands.push_back(band);
+			used = offset + band.size;
+
+			entry.row += band.rowCount;
+			if (entry.row >= mip.height){
+				entry.row = 0;
+				if (++entry.level == data.levels.size()){
+					entry.level = 0;
+					entry.layer++;
+				}
+			}
+		}
+	}
+
+	if (!bands.empty()){
+		// Textures are created (without pixels) when their first band goes up
+		for (size_t b = 0; b < bands.size(); b++){
+			Entry & entry = entries[bands[b].handle];
+			if (entry.texture)
+				continue;
+			entry.target = entry.data->target;
+			glGenTextures(1, &entry.texture);
+			glBindTexture(entry.target, entry.texture);
+			allocateTexture(*entry.data);
+		}
+
+		if (!pixelBuffer)
+			glGenBuffers(1, &pixelBuffer);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelBuffer);
+		// New storage every frame : the driver may still be reading the previous one
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, used, NULL, GL_STREAM_DRAW);
+		unsigned char * mapped = (unsigned char *)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, used, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		if (mapped){
+			for (size_t b = 0; b < bands.size(); b++)
+				memcpy(mapped + bands[b].offset, bands[b].source, bands[b].size);
+			if (!glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER))
+				mapped = NULL; // the contents were lost
+		}
+		if (!mapped)
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0); // upload from the file or our own memory instead
+
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		for (size_t b = 0; b < bands.size(); b++){
+			const UploadBand & band = bands[b];
+			const Entry & entry = entries[band.handle];
+			const void * pixels = mapped ? (const void *)band.offset : (const void *)band.source;
+			glBindTexture(entry.target, entry.texture);
+			uploadRows(*entry.data, band.layer, band.level, band.row, band.rowCount, band.size, pixels);
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+
+	// Finished textures leave the queue, and give their staging memory back
+	size_t kept = 0;
+	for (size_t p = 0; p < pending.size(); p++){
+		Entry & entry = entries[pending[p]];
+		if (!entry.done && entry.ready && entry.layer == entry.data->layers){
+			glBindTexture(entry.target, entry.texture);
+			finishTexture(*entry.data);
+			entry.data.reset();
+			entry.done = true;
+		}
+		if (entry.done){
+			if (entry.failed)
+				printf("%s could not be loaded\n", entry.path.c_str());
+			continue;
+		}
+		pending[kept++] = pending[p];
+	}
+	pending.resize(kept);
+}
 
-}
\ No newline at end of file
+size_t TextureLoader::update(){
+	if (!pending.empty())
+		upload(bytesPerFrame, false);
+	return pending.size();
+}
+
+void TextureLoader::finish(){
+	while (!pending.empty())
+		upload(bytesPerFrame, true);
+}
+
+GLuint TextureLoader::texture(TextureHandle handle) const {
+	const Entry & entry = entries[handle];
+	return entry.done && !entry.failed ? entry.texture : 0;
+}
+
+GLenum TextureLoader::target(TextureHandle handle) const {
+	return entries[handle].target;
+}
+
+bool TextureLoader::failed(TextureHandle handle) const {
+	return entries[handle].failed;
+}
+
+void TextureLoader::release(){
+	for (size_t p = 0; p < pending.size(); p++){
+		Entry & entry = entries[pending[p]];
+		if (entry.reading.valid())
+			entry.reading.wait();
+		if (entry.texture)
+			glDeleteTextures(1, &entry.texture);
+		entry.texture = 0;
+		entry.data.reset();
+		entry.done = entry.failed = true;
+	}
+	pending.clear();
+	if (pixelBuffer)
+		glDeleteBuffers(1, &pixelBuffer);
+	pixelBuffer = 0;
+}
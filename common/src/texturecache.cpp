@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+
+#include <GL/glew.h>
+
+#include "hash.hpp"
+#include "mappedfile.hpp"
+#include "texture.hpp"
+#include "texturecache.hpp"
+
+// The absolute path, without "..", "." or links : the same for every way to name a file
+static bool canonicalPath(const char * path, std::string & canonical){
+#ifdef _WIN32
+	char * full = _fullpath(NULL, path, 0);
+#else
+	char * full = realpath(path, NULL);
+#endif
+	if (!full)
+		return false;
+	canonical = full;
+	free(full);
+	return true;
+}
+
+// What the driver most likely allocates for the texture
+static size_t gpuBytes(const TextureData & texture){
+	if (texture.compressed)
+		return texture.layerSize * texture.layers;
+	// 3 components textures are padded to 4 bytes per texel
+	size_t bytes = 0;
+	unsigned int width = texture.levels[0].width, height = texture.levels[0].height;
+	size_t levelCount = texture.generateMipmaps ? 64 : texture.levels.size();
+	for (size_t level = 0; level < levelCount; level++){
+		bytes += (size_t)width * height * 4;
+		if (width == 1 && height == 1)
+			break;
+		width  = std::max(width / 2, 1u);
+		height = std::max(height / 2, 1u);
+	}
+	return bytes * texture.layers;
+}
+
+TextureCache::TextureCache(size_t budgetBytes)
+	: budgetBytes(budgetBytes), totalBytes(0)
+{
+}
+
+TextureCache::~TextureCache(){
+	// The GL context is probably gone by now : only complain
+	if (!entries.empty())
+		printf("TextureCache : %u textures were not cleared\n", (unsigned int)entries.size());
+}
+
+TextureCache & TextureCache::global(){
+	static TextureCache cache;
+	return cache;
+}
+
+GLuint TextureCache::acquire(const char * imagepath, unsigned int mipmapFlags){
+	std::string canonical;
+	if (!canonicalPath(imagepath, canonical)){
+		printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", imagepath);
+		return 0;
+	}
+	size_t length = canonical.size();
+	bool dds = length >= 4 && (canonical.compare(length - 4, 4, ".dds") == 0 || canonical.compare(length - 4, 4, ".DDS") == 0);
+	// The flags only change BMP textures : they are part of their keys
+	std::string key = canonical;
+	if (!dds)
+		key += "|" + std::to_string(mipmapFlags);
+
+	std::unordered_map<std::string, GLuint>::iterator path = paths.find(key);
+	GLuint texture = 0;
+	if (path != paths.end()){
+		texture = path->second;
+	}else{
+		// A new path : maybe a copy of a file already loaded
+		MappedFile file;
+		if (!file.open(imagepath)){
+			printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", imagepath);
+			return 0;
+		}
+		unsigned long long contentHash = hash64(file.data(), file.size());
+		if (!dds)
+			contentHash ^= (mipmapFlags + 1) * 0x9E3779B97F4A7C15ull;
+		file.close();
+
+		std::unordered_map<unsigned long long, GLuint>::iterator content = contents.find(contentHash);
+		if (content != contents.end()){
+			texture = content->second;
+		}else{
+			TextureData data;
+			// BMP files get their mipmaps here, as loadBMP_custom does
+			if (!(dds ? readDDS(imagepath, data) : readBMP(imagepath, data) && generateMipmaps(data, mipmapFlags, data)))
+				return 0;
+			texture = uploadTexture(data);
+			// Nothing is kept of a failed upload : the next acquire() tries again
+			if (!texture)
+				return 0;
+
+			Entry & entry = entries[texture];
+			entry.texture = texture;
+			entry.bytes = gpuBytes(data);
+			entry.contentHash = contentHash;
+			entry.references = 0;
+			entry.lastUse = unused.end();
+			totalBytes += entry.bytes;
+			contents[contentHash] = texture;
+		}
+		paths[key] = texture;
+	}
+
+	Entry & entry = entries[texture];
+	if (entry.references++ == 0 && entry.lastUse != unused.end()){
+		unused.erase(entry.lastUse);
+		entry.lastUse = unused.end();
+	}
+	// The new texture may push older ones out
+	evict();
+	return texture;
+}
+
+void TextureCache::release(GLuint texture){
+	std::unordered_map<GLuint, Entry>::iterator found = entries.find(texture);
+	if (found == entries.end() || found->second.references == 0){
+		printf("TextureCache : texture %u released but not acquired\n", texture);
+		return;
+	}
+	Entry & entry = found->second;
+	if (--entry.references == 0){
+		unused.push_front(texture);
+		entry.lastUse = unused.begin();
+		evict();
+	}
+}
+
+void TextureCache::setBudget(size_t budgetBytes){
+	this->budgetBytes = budgetBytes;
+	evict();
+}
+
+size_t TextureCache::textureBytes(GLuint texture) const {
+	std::unordered_map<GLuint, Entry>::const_iterator found = entries.find(texture);
+	return found != entries.end() ? found->second.bytes : 0;
+}
+
+void TextureCache::evict(){
+	while (totalBytes > budgetBytes && !unused.empty()){
+		GLuint texture = unused.back();
+		unused.pop_back();
+		Entry & entry = entries[texture];
+		totalBytes -= entry.bytes;
+		contents.erase(entry.contentHash);
+		for (std::unordered_map<std::string, GLuint>::iterator path = paths.begin(); path != paths.end();){
+			if (path->second == texture)
+				path = paths.erase(path);
+			else
+				++path;
+		}
+		entries.erase(texture);
+		glDeleteTextures(1, &texture);
+	}
+}
+
+void TextureCache::clear(){
+	for (std::unordered_map<GLuint, Entry>::iterator entry = entries.begin(); entry != entries.end(); ++entry)
+		glDeleteTextures(1, &entry->second.texture);
+	entries.clear();
+	paths.clear();
+	contents.clear();
+	unused.clear();
+	totalBytes = 0;
+}
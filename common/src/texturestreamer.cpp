@@ -0,0 +1,308 @@
+#include <stdio.h>
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+
+#include <GL/glew.h>
+
+#include "meshcache.hpp"
+#include "meshsimplify.hpp"
+#include "blockcompress.hpp"
+#include "texture.hpp"
+#include "texturestreamer.hpp"
+
+// Sums the areas of triangleCount triangles, whose corners fetch(corner, position, uv) reads
+template <typename Fetch>
+static float measureUVDensity(size_t triangleCount, Fetch fetch){
+	double surfaceArea = 0.0, uvArea = 0.0;
+	for (size_t t = 0; t < triangleCount; t++){
+		glm::vec3 p[3];
+		glm::vec2 uv[3];
+		for (int c = 0; c < 3; c++)
+			fetch(t * 3 + c, p[c], uv[c]);
+		surfaceArea += glm::length(glm::cross(p[1] - p[0], p[2] - p[0]));
+		glm::vec2 e1 = uv[1] - uv[0], e2 = uv[2] - uv[0];
+		uvArea += fabs(e1.x * e2.y - e1.y * e2.x);
+	}
+	if (surfaceArea <= 0.0)
+		return 0.0f;
+	return (float)sqrt(uvArea / surfaceArea);
+}
+
+float computeUVDensity(const unsigned int * indices, size_t indexCount, const glm::vec3 * vertices, const glm::vec2 * uvs){
+	return measureUVDensity(indexCount / 3, [&](size_t corner, glm::vec3 & position, glm::vec2 & uv){
+		unsigned int v = indices ? indices[corner] : (unsigned int)corner;
+		position = vertices[v];
+		uv = uvs[v];
+	});
+}
+
+float computeUVDensity(const CachedMesh & mesh){
+	if (mesh.interleaved ? mesh.layout.uvOffset < 0 : mesh.uvs == NULL)
+		return 0.0f;
+	size_t cornerCount = mesh.indices ? (mesh.lodCount > 0 ? mesh.lods[0].indexCount : mesh.indexCount) : mesh.vertexCount;
+	return measureUVDensity(cornerCount / 3, [&](size_t corner, glm::vec3 & position, glm::vec2 & uv){
+		unsigned int v = mesh.indices ? mesh.index(corner) : (unsigned int)corner;
+		if (mesh.interleaved){
+			unpackVertex(mesh.layout, mesh.interleaved, v, &position, &uv, NULL, NULL, NULL);
+		}else{
+			position = mesh.vertices[v];
+			uv = mesh.uvs[v];
+		}
+	});
+}
+
+float estimateMipLevel(unsigned int textureSize, float uvDensity, const glm::mat4 & projection, float distance, float viewportHeight){
+	float pixelsPerUnit = projectedLODError(1.0f, projection, distance, viewportHeight);
+	float texelsPerUnit = textureSize * uvDensity;
+	if (pixelsPerUnit == FLT_MAX || !(texelsPerUnit > 0.0f))
+		return 0.0f;
+	return std::max(log2f(texelsPerUnit / pixelsPerUnit), 0.0f);
+}
+
+MipResidency::MipResidency(size_t budgetBytes, unsigned int keepFrames)
+	: budgetBytes(budgetBytes), totalResident(0), totalTarget(0), keepFrames(keepFrames), frameIndex(0)
+{
+}
+
+unsigned int MipResidency::add(const std::vector<size_t> & levelBytes, unsigned int tailLevel){
+	unsigned int id;
+	if (!freeIds.empty()){
+		id = freeIds.back();
+		freeIds.pop_back();
+	}else{
+		id = (unsigned int)textures.size();
+		textures.push_back(Texture());
+	}
+	Texture & texture = textures[id];
+	texture.chain.assign(levelBytes.size() + 1, 0);
+	for (size_t level = levelBytes.size(); level-- > 0; )
+		texture.chain[level] = texture.chain[level + 1] + levelBytes[level];
+	texture.tail = levelBytes.empty() ? 0 : std::min(tailLevel, (unsigned int)levelBytes.size() - 1);
+	texture.resident = texture.target = texture.wanted = texture.tail;
+	texture.used = true;
+	texture.requested = false;
+	texture.frameLevel = 0.0f;
+	texture.framePriority = 0.0f;
+	texture.priority = 0.0f;
+	texture.wantedFrame = frameIndex;
+	totalResident += texture.chain[texture.tail];
+	totalTarget += texture.chain[texture.tail];
+	return id;
+}
+
+void MipResidency::remove(unsigned int id){
+	Texture & texture = textures[id];
+	if (!texture.used)
+		return;
+	totalResident -= texture.chain[texture.resident];
+	totalTarget -= texture.chain[texture.target];
+	texture.used = false;
+	texture.chain.clear();
+	freeIds.push_back(id);
+	pending.erase(std::remove(pending.begin(), pending.end(), id), pending.end());
+}
+
+void MipResidency::request(unsigned int id, float level, float priority){
+	Texture & texture = textures[id];
+	if (!(level >= 0.0f)) // NaN too : as fine as it gets
+		level = 0.0f;
+	if (!texture.requested || level < texture.frameLevel)
+		texture.frameLevel = level;
+	if (!texture.requested || priority > texture.framePriority)
+		texture.framePriority = priority;
+	texture.requested = true;
+}
+
+void MipResidency::setResident(unsigned int id, unsigned int level){
+	Texture & texture = textures[id];
+	totalResident -= texture.chain[texture.resident];
+	texture.resident = level;
+	totalResident += texture.chain[texture.resident];
+	pending.erase(std::remove(pending.begin(), pending.end(), id), pending.end());
+}
+
+void MipResidency::update(){
+	frameIndex++;
+
+	// What the last frames asked for : finer levels at once, coarser ones
+	// once nothing asked for the finer level in keepFrames frames
+	std::vector<unsigned int> order;
+	size_t tailBytes = 0;
+	for (unsigned int id = 0; id < textures.size(); id++){
+		Texture & texture = textures[id];
+		if (!texture.used)
+			continue;
+		bool expired = frameIndex - texture.wantedFrame >= keepFrames;
+		if (texture.requested){
+			unsigned int level = (unsigned int)std::min(texture.frameLevel, (float)texture.tail);
+			if (level <= texture.wanted || expired){
+				texture.wanted = level;
+				texture.wantedFrame = frameIndex;
+			}
+			texture.priority = texture.framePriority;
+		}else if (expired){
+			texture.wanted = texture.tail;
+			texture.priority = 0.0f;
+		}
+		texture.requested = false;
+		order.push_back(id);
+		tailBytes += texture.chain[texture.tail];
+	}
+
+	// Tails first, as they are always resident, then the levels that were
+	// asked for, most important texture first. A texture that doesn't fit
+	// gets as many levels as fit, and the next ones still get their chance.
+	std::stable_sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b){
+		return textures[a].priority > textures[b].priority;
+	});
+	size_t left = budgetBytes > tailBytes ? budgetBytes - tailBytes : 0;
+	totalTarget = tailBytes;
+	for (unsigned int id : order){
+		Texture & texture = textures[id];
+		texture.target = texture.tail;
+		while (texture.target > texture.wanted){
+			size_t levelBytes = texture.chain[texture.target - 1] - texture.chain[texture.target];
+			if (levelBytes > left)
+				break;
+			left -= levelBytes;
+			texture.target--;
+		}
+		totalTarget += texture.chain[texture.target] - texture.chain[texture.tail];
+	}
+
+	// Page outs free memory for the page ins : they come first
+	pending.clear();
+	for (unsigned int id : order){
+		if (textures[id].target > textures[id].resident)
+			pending.push_back(id);
+	}
+	for (unsigned int id : order){
+		if (textures[id].target < textures[id].resident)
+			pending.push_back(id);
+	}
+}
+
+TextureStreamer::TextureStreamer(size_t budgetBytes, size_t bytesPerFrame, unsigned int tailSize)
+	: mipResidency(budgetBytes), bytesPerFrame(bytesPerFrame), tailSize(tailSize)
+{
+}
+
+TextureStreamer::~TextureStreamer(){
+	// The textures can only be deleted with the context : see release()
+}
+
+StreamedTexture TextureStreamer::load(const char * imagepath){
+	TextureData texture;
+	if (!readDDS(imagepath, texture))
+		return 0;
+	return add(texture);
+}
+
+StreamedTexture TextureStreamer::add(TextureData & texture){
+	std::unique_ptr<TextureData> data(new TextureData(std::move(texture)));
+	if (needsDecompression(*data)){
+		// Expanded once here, rather than at every page in
+		std::unique_ptr<TextureData> expanded(new TextureData());
+		if (!decompressTexture(*data, *expanded)){
+			printf("This compressed texture format (0x%x) isn't supported\n", data->internalFormat);
+			return 0;
+		}
+		data.swap(expanded);
+	}
+
+	// The tail : the levels of tailSize texels or less, or all of them if
+	// the texture can't be streamed
+	unsigned int tail = 0;
+	bool streamed = data->target == GL_TEXTURE_2D && !data->generateMipmaps;
+	while (streamed && tail + 1 < data->levels.size() &&
+		std::max(data->levels[tail].width, data->levels[tail].height) > tailSize)
+		tail++;
+	std::vector<size_t> levelBytes(data->levels.size());
+	for (size_t level = 0; level < levelBytes.size(); level++)
+		levelBytes[level] = data->levels[level].size * data->layers;
+
+	Entry entry;
+	entry.data = std::move(data);
+	entry.texture = 0;
+	entry.id = mipResidency.add(levelBytes, tail);
+	if (!page(entry, tail)){
+		mipResidency.remove(entry.id);
+		return 0;
+	}
+	entries.push_back(std::move(entry));
+	StreamedTexture handle = (StreamedTexture)entries.size();
+	if (handles.size() <= entries.back().id)
+		handles.resize(entries.back().id + 1, 0);
+	handles[entries.back().id] = handle;
+	return handle;
+}
+
+void TextureStreamer::unload(StreamedTexture handle){
+	Entry & entry = entries[handle - 1];
+	if (!entry.data)
+		return;
+	glDeleteTextures(1, &entry.texture);
+	entry.texture = 0;
+	entry.data.reset();
+	mipResidency.remove(entry.id);
+	handles[entry.id] = 0;
+}
+
+void TextureStreamer::request(StreamedTexture handle, float uvDensity, float objectRadius,
+	const glm::mat4 & projection, float distance, float viewportHeight)
+{
+	if (handle == 0 || !entries[handle - 1].data)
+		return;
+	const Entry & entry = entries[handle - 1];
+	// The finest level is needed where the object is closest
+	const TextureLevel & full = entry.data->levels[0];
+	float level = estimateMipLevel(std::max(full.width, full.height), uvDensity, projection,
+		distance - objectRadius, viewportHeight);
+	float priority = std::min(projectedLODError(objectRadius, projection, distance, viewportHeight), viewportHeight);
+	mipResidency.request(entry.id, level, priority);
+}
+
+bool TextureStreamer::page(Entry & entry, unsigned int level){
+	GLuint texture = uploadTextureLevels(*entry.data, level);
+	if (texture == 0)
+		return false;
+	glDeleteTextures(1, &entry.texture);
+	entry.texture = texture;
+	mipResidency.setResident(entry.id, level);
+	return true;
+}
+
+void TextureStreamer::update(){
+	mipResidency.update();
+
+	// changes() shrinks as textures are paged
+	std::vector<unsigned int> changes = mipResidency.changes();
+	size_t uploaded = 0;
+	for (unsigned int id : changes){
+		Entry & entry = entries[handles[id] - 1];
+		unsigned int resident = mipResidency.residentLevel(id);
+		unsigned int target = mipResidency.targetLevel(id);
+		if (target > resident){
+			// Paging out only uploads the smaller levels again
+			uploaded += mipResidency.chainBytes(id, target);
+			page(entry, target);
+			continue;
+		}
+		// Paging in : as many levels as the frame allows, but at least one
+		unsigned int level = resident - 1;
+		while (level > target && uploaded + mipResidency.chainBytes(id, level - 1) <= bytesPerFrame)
+			level--;
+		if (uploaded > 0 && uploaded + mipResidency.chainBytes(id, level) > bytesPerFrame)
+			break;
+		uploaded += mipResidency.chainBytes(id, level);
+		page(entry, level);
+	}
+}
+
+void TextureStreamer::release(){
+	for (size_t i = 0; i < entries.size(); i++){
+		if (entries[i].data)
+			unload((StreamedTexture)(i + 1));
+	}
+}
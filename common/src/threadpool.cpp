@@ -0,0 +1,102 @@
+#include <atomic>
+#include <algorithm>
+
+#include "threadpool.hpp"
+
+ThreadPool::ThreadPool(unsigned int threadCount)
+	: stopping(false)
+{
+	if (threadCount == 0){
+		unsigned int cores = std::thread::hardware_concurrency();
+		threadCount = cores > 1 ? cores - 1 : 1;
+	}
+	for (unsigned int i = 0; i < threadCount; i++)
+		workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+}
+
+ThreadPool::~ThreadPool(){
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wakeUp.notify_all();
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+}
+
+ThreadPool & ThreadPool::global(){
+	static ThreadPool pool;
+	return pool;
+}
+
+void ThreadPool::enqueue(std::function<void()> job){
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		jobs.push_back(std::move(job));
+	}
+	wakeUp.notify_one();
+}
+
+void ThreadPool::workerLoop(){
+	while (true){
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wakeUp.wait(lock, [this](){ return stopping || !jobs.empty(); });
+			if (jobs.empty())
+				return; // stopping, and nothing left to do
+			job = std::move(jobs.front());
+			jobs.pop_front();
+		}
+		job();
+	}
+}
+
+// Shared between the caller of parallelFor and the helpers it enqueued.
+// The helpers may start after everything is done, so it must outlive the call.
+struct ParallelForState{
+	std::atomic<size_t> next;
+	std::atomic<size_t> finished;
+	size_t count;
+	const std::function<void(size_t)> * body;
+	std::mutex mutex;
+	std::condition_variable done;
+};
+
+static void runParallelFor(ParallelForState & state){
+	size_t ran = 0;
+	size_t i;
+	while ((i = state.next++) < state.count){
+		(*state.body)(i);
+		ran++;
+	}
+	if (ran > 0 && (state.finished += ran) == state.count){
+		std::lock_guard<std::mutex> lock(state.mutex);
+		state.done.notify_all();
+	}
+}
+
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t)> & body){
+	if (count == 0)
+		return;
+	if (count == 1 || workers.empty()){
+		for (size_t i = 0; i < count; i++)
+			body(i);
+		return;
+	}
+
+	std::shared_ptr<ParallelForState> state = std::make_shared<ParallelForState>();
+	state->next = 0;
+	state->finished = 0;
+	state->count = count;
+	state->body = &body;
+
+	// The calling thread works too, so it never waits on an idle pool
+	size_t helpers = std::min(count - 1, workers.size());
+	for (size_t i = 0; i < helpers; i++)
+		enqueue([state](){ runParallelFor(*state); });
+	runParallelFor(*state);
+
+	std::unique_lock<std::mutex> lock(state->mutex);
+	state->done.wait(lock, [&state](){ return state->finished == state->count; });
+}
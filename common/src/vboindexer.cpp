@@ -1,8 +1,12 @@
 #include <vector>
-#include <map>
+#include <algorithm>
+#include <stdio.h>
+#include <math.h>
 
 #include <glm/glm.hpp>
 
+#include "hash.hpp"
+#include "threadpool.hpp"
 #include "vboindexer.hpp"
 
 #include <string.h> // for memcmp
@@ -23,7 +27,7 @@ bool getSimilarVertexIndex(
 	std::vector<glm::vec3> & out_vertices,
 	std::vector<glm::vec2> & out_uvs,
 	std::vector<glm::vec3> & out_normals,
-	unsigned short & result
+	unsigned int & result
 ){
 	// Lame linear search
 	for ( unsigned int i=0; i<out_vertices.size(); i++ ){
@@ -51,7 +55,7 @@ void indexVBO_slow(
 	std::vector<glm::vec2> & in_uvs,
 	std::vector<glm::vec3> & in_normals,
 
-	std::vector<unsigned short> & out_indices,
+	std::vector<unsigned int> & out_indices,
 	std::vector<glm::vec3> & out_vertices,
 	std::vector<glm::vec2> & out_uvs,
 	std::vector<glm::vec3> & out_normals
@@ -60,7 +64,7 @@ void indexVBO_slow(
 	for ( unsigned int i=0; i<in_vertices.size(); i++ ){
 
 		// Try to find a similar vertex in out_XXXX
-		unsigned short index;
+		unsigned int index;
 		bool found = getSimilarVertexIndex(in_vertices[i], in_uvs[i], in_normals[i],     out_vertices, out_uvs, out_normals, index);
 
 		if ( found ){ // A similar vertex is already in the VBO, use it instead !
@@ -69,7 +73,7 @@ void indexVBO_slow(
 			out_vertices.push_back( in_vertices[i]);
 			out_uvs     .push_back( in_uvs[i]);
 			out_normals .push_back( in_normals[i]);
-			out_indices .push_back( (unsigned short)out_vertices.size() - 1 );
+			out_indices .push_back( (unsigned int)out_vertices.size() - 1 );
 		}
 	}
 }
@@ -78,56 +82,90 @@ struct PackedVertex{
 	glm::vec3 position;
 	glm::vec2 uv;
 	glm::vec3 normal;
-	bool operator<(const PackedVertex that) const{
-		return memcmp((void*)this, (void*)&that, sizeof(PackedVertex))>0;
-	};
 };
 
-bool getSimilarVertexIndex_fast( 
-	PackedVertex & packed, 
-	std::map<PackedVertex,unsigned short> & VertexToOutIndex,
-	unsigned short & result
-){
-	std::map<PackedVertex,unsigned short>::iterator it = VertexToOutIndex.find(packed);
-	if ( it == VertexToOutIndex.end() ){
-		return false;
-	}else{
-		result = it->second;
-		return true;
+// Open-addressing hash table from a packed vertex to its index in out_XXXX.
+// Sized once from the input (there can't be more unique vertices than input
+// ones), so it never grows. Each slot keeps 32 bits of the hash, so that
+// out_XXXX is only read for real matches.
+struct PackedVertexTable{
+	struct Slot{
+		unsigned int tag;
+		unsigned int index; // index in out_XXXX + 1, 0 if empty
+	};
+	std::vector<Slot> slots;
+	size_t mask;
+
+	explicit PackedVertexTable(size_t inputCount){
+		size_t capacity = 16;
+		while (capacity < 2 * inputCount)
+			capacity *= 2;
+		Slot empty = {0, 0};
+		slots.assign(capacity, empty);
+		mask = capacity - 1;
 	}
-}
+
+	// Returns the slot of packed : either its vertex, or the empty slot where it goes.
+	// h is hash64 of packed; the slot indices point into the given arrays.
+	Slot & find(
+		const PackedVertex & packed,
+		unsigned long long h,
+		const std::vector<glm::vec3> & vertices,
+		const std::vector<glm::vec2> & uvs,
+		const std::vector<glm::vec3> & normals
+	){
+		unsigned int tag = (unsigned int)(h >> 32);
+		size_t i = (size_t)h & mask;
+		while (true){
+			Slot & slot = slots[i];
+			if (slot.index == 0){
+				slot.tag = tag;
+				return slot;
+			}
+			if (slot.tag == tag){
+				// Same bytes as the map's memcmp, so 0.0 and -0.0 stay different
+				unsigned int index = slot.index - 1;
+				if (memcmp(&packed.position, &vertices[index], sizeof(glm::vec3)) == 0 &&
+					memcmp(&packed.uv,       &uvs     [index], sizeof(glm::vec2)) == 0 &&
+					memcmp(&packed.normal,   &normals [index], sizeof(glm::vec3)) == 0)
+					return slot;
+			}
+			i = (i + 1) & mask; // linear probing
+		}
+	}
+};
 
 void indexVBO(
 	std::vector<glm::vec3> & in_vertices,
 	std::vector<glm::vec2> & in_uvs,
 	std::vector<glm::vec3> & in_normals,
 
-	std::vector<unsigned short> & out_indices,
+	std::vector<unsigned int> & out_indices,
 	std::vector<glm::vec3> & out_vertices,
 	std::vector<glm::vec2> & out_uvs,
 	std::vector<glm::vec3> & out_normals
 ){
-	std::map<PackedVertex,unsigned short> VertexToOutIndex;
+	PackedVertexTable VertexToOutIndex(in_vertices.size());
+	out_indices.reserve(out_indices.size() + in_vertices.size());
 
 	// For each input vertex
 	for ( unsigned int i=0; i<in_vertices.size(); i++ ){
 
 		PackedVertex packed = {in_vertices[i], in_uvs[i], in_normals[i]};
-		
 
 		// Try to find a similar vertex in out_XXXX
-		unsigned short index;
-		bool found = getSimilarVertexIndex_fast( packed, VertexToOutIndex, index);
+		unsigned long long hash = hash64( &packed, sizeof(PackedVertex) );
+		PackedVertexTable::Slot & slot = VertexToOutIndex.find( packed, hash, out_vertices, out_uvs, out_normals );
 
-		if ( found ){ // A similar vertex is already in the VBO, use it instead !
-			out_indices.push_back( index );
+		if ( slot.index != 0 ){ // A similar vertex is already in the VBO, use it instead !
+			out_indices.push_back( slot.index - 1 );
 		}else{ // If not, it needs to be added in the output data.
 			out_vertices.push_back( in_vertices[i]);
 			out_uvs     .push_back( in_uvs[i]);
 			out_normals .push_back( in_normals[i]);
-			unsigned short newindex = (unsigned short)out_vertices.size() - 1;
+			unsigned int newindex = (unsigned int)out_vertices.size() - 1;
 			out_indices .push_back( newindex );
-			VertexToOutIndex[ packed ] = newindex;
+			slot.index = newindex + 1;
 		}
 	}
 }
@@ -138,6 +176,200 @@ void indexVBO(
 
 
 
+// Parallel version of indexVBO, in three steps :
+// - vertices are hashed, and split in partitions by their hash, so that equal
+//   vertices always land in the same partition;
+// - each partition finds, for each of its vertices, the first equal one;
+// - vertices that are their own first get consecutive numbers, in input order.
+// Nothing depends on how the threads are scheduled, and the result is
+// exactly the one of indexVBO.
+static const size_t minParallelIndexCount = 1 << 16;
+
+void indexVBO_parallel(
+	std::vector<glm::vec3> & in_vertices,
+	std::vector<glm::vec2> & in_uvs,
+	std::vector<glm::vec3> & in_normals,
+
+	std::vector<unsigned int> & out_indices,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals,
+	unsigned int maxThreads
+){
+	ThreadPool & pool = ThreadPool::global();
+	size_t count = in_vertices.size();
+	size_t threadCount = maxThreads ? maxThreads : pool.size() + 1;
+	if (threadCount < 2 || count < minParallelIndexCount){
+		indexVBO(in_vertices, in_uvs, in_normals, out_indices, out_vertices, out_uvs, out_normals);
+		return;
+	}
+
+	// Ranges of the input, and partitions of the hash space
+	size_t rangeCount = threadCount;
+	size_t partitionCount = threadCount;
+	std::vector<unsigned long long> hashes(count);
+	std::vector<size_t> partitionCounts(rangeCount * partitionCount, 0);
+	pool.parallelFor(rangeCount, [&](size_t range){
+		size_t * counts = &partitionCounts[range * partitionCount];
+		for (size_t i = count * range / rangeCount; i < count * (range + 1) / rangeCount; i++){
+			PackedVertex packed = {in_vertices[i], in_uvs[i], in_normals[i]};
+			hashes[i] = hash64(&packed, sizeof(PackedVertex));
+			counts[(hashes[i] >> 32) * partitionCount >> 32]++;
+		}
+	});
+
+	// Each partition lists its vertices in input order : ranges write
+	// one after the other in every partition
+	std::vector<size_t> partitionStarts(partitionCount + 1);
+	std::vector<size_t> writeOffsets(rangeCount * partitionCount);
+	size_t offset = 0;
+	for (size_t p = 0; p < partitionCount; p++){
+		partitionStarts[p] = offset;
+		for (size_t range = 0; range < rangeCount; range++){
+			writeOffsets[range * partitionCount + p] = offset;
+			offset += partitionCounts[range * partitionCount + p];
+		}
+	}
+	partitionStarts[partitionCount] = offset;
+
+	std::vector<unsigned int> partitioned(count);
+	pool.parallelFor(rangeCount, [&](size_t range){
+		size_t * offsets = &writeOffsets[range * partitionCount];
+		for (size_t i = count * range / rangeCount; i < count * (range + 1) / rangeCount; i++)
+			partitioned[offsets[(hashes[i] >> 32) * partitionCount >> 32]++] = (unsigned int)i;
+	});
+
+	// Local dedup : first[i] is the first input vertex equal to vertex i
+	std::vector<unsigned int> first(count);
+	pool.parallelFor(partitionCount, [&](size_t p){
+		PackedVertexTable table(partitionStarts[p + 1] - partitionStarts[p]);
+		for (size_t k = partitionStarts[p]; k < partitionStarts[p + 1]; k++){
+			unsigned int i = partitioned[k];
+			PackedVertex packed = {in_vertices[i], in_uvs[i], in_normals[i]};
+			PackedVertexTable::Slot & slot = table.find(packed, hashes[i], in_vertices, in_uvs, in_normals);
+			if (slot.index == 0)
+				slot.index = i + 1;
+			first[i] = slot.index - 1;
+		}
+	});
+	std::vector<unsigned long long>().swap(hashes);
+	std::vector<unsigned int>().swap(partitioned);
+
+	// Global renumbering : unique vertices keep the order of their first use
+	std::vector<size_t> uniqueOffsets(rangeCount + 1, 0);
+	pool.parallelFor(rangeCount, [&](size_t range){
+		size_t unique = 0;
+		for (size_t i = count * range / rangeCount; i < count * (range + 1) / rangeCount; i++)
+			unique += first[i] == i;
+		uniqueOffsets[range + 1] = unique;
+	});
+	for (size_t range = 0; range < rangeCount; range++)
+		uniqueOffsets[range + 1] += uniqueOffsets[range];
+
+	size_t baseVertex = out_vertices.size();
+	size_t baseIndex = out_indices.size();
+	out_vertices.resize(baseVertex + uniqueOffsets[rangeCount]);
+	out_uvs     .resize(baseVertex + uniqueOffsets[rangeCount]);
+	out_normals .resize(baseVertex + uniqueOffsets[rangeCount]);
+	out_indices .resize(baseIndex + count);
+
+	std::vector<unsigned int> remap(count);
+	pool.parallelFor(rangeCount, [&](size_t range){
+		size_t next = baseVertex + uniqueOffsets[range];
+		for (size_t i = count * range / rangeCount; i < count * (range + 1) / rangeCount; i++){
+			if (first[i] != i)
+				continue;
+			out_vertices[next] = in_vertices[i];
+			out_uvs     [next] = in_uvs[i];
+			out_normals [next] = in_normals[i];
+			remap[i] = (unsigned int)next++;
+		}
+	});
+	// first[i] may be in an earlier range : this needs the whole remap table
+	pool.parallelFor(rangeCount, [&](size_t range){
+		for (size_t i = count * range / rangeCount; i < count * (range + 1) / rangeCount; i++)
+			out_indices[baseIndex + i] = remap[first[i]];
+	});
+}
+
+// Spatial hash over the positions, so that indexVBO_TBN only compares a vertex
+// with its neighbours instead of every vertex exported so far.
+// Cells are bigger than twice the is_near tolerance : any position within
+// tolerance of p is in one of the 2x2x2 cells closest to p.
+static const float weldCellSize = 0.025f;
+
+struct WeldGrid{
+	std::vector<unsigned int> heads; // per bucket : last vertex added + 1, 0 if empty
+	std::vector<unsigned int> next;  // per vertex : previous vertex of its bucket + 1
+	size_t mask;
+
+	explicit WeldGrid(size_t expected){
+		size_t bucketCount = 16;
+		while (bucketCount < expected)
+			bucketCount *= 2;
+		heads.assign(bucketCount, 0);
+		mask = bucketCount - 1;
+		next.reserve(expected);
+	}
+
+	static inline long long cell(float x){
+		float c = floorf(x / weldCellSize);
+		if (!(c > -1e15f && c < 1e15f))
+			return 0; // NaN, infinite or absurdly far : is_near will sort it out
+		return (long long)c;
+	}
+
+	// Different cells may share a bucket : that only adds candidates to check
+	inline size_t bucket(long long x, long long y, long long z) const {
+		unsigned long long h = x * 0x9E3779B185EBCA87ULL + y * 0xC2B2AE3D27D4EB4FULL + z * 0x165667B19E3779F9ULL;
+		return (size_t)(h ^ (h >> 29)) & mask;
+	}
+
+	void add(unsigned int index, const glm::vec3 & position){
+		size_t b = bucket(cell(position.x), cell(position.y), cell(position.z));
+		next.push_back(heads[b]);
+		heads[b] = index + 1;
+	}
+
+	// Same answer as getSimilarVertexIndex : the first similar vertex
+	bool find(
+		const glm::vec3 & in_vertex, const glm::vec2 & in_uv, const glm::vec3 & in_normal,
+		const std::vector<glm::vec3> & out_vertices,
+		const std::vector<glm::vec2> & out_uvs,
+		const std::vector<glm::vec3> & out_normals,
+		unsigned int & result
+	) const {
+		long long c[3], n[3];
+		for (int k = 0; k < 3; k++){
+			c[k] = cell(in_vertex[k]);
+			// The other cell to look at is on the side p is closest to
+			n[k] = in_vertex[k] / weldCellSize - (float)c[k] < 0.5f ? c[k] - 1 : c[k] + 1;
+		}
+
+		unsigned int best = 0xFFFFFFFF;
+		for (int corner = 0; corner < 8; corner++){
+			size_t b = bucket(corner & 1 ? n[0] : c[0], corner & 2 ? n[1] : c[1], corner & 4 ? n[2] : c[2]);
+			for (unsigned int i = heads[b]; i != 0; i = next[i - 1]){
+				unsigned int candidate = i - 1;
+				if (candidate < best &&
+					is_near( in_vertex.x , out_vertices[candidate].x ) &&
+					is_near( in_vertex.y , out_vertices[candidate].y ) &&
+					is_near( in_vertex.z , out_vertices[candidate].z ) &&
+					is_near( in_uv.x     , out_uvs     [candidate].x ) &&
+					is_near( in_uv.y     , out_uvs     [candidate].y ) &&
+					is_near( in_normal.x , out_normals [candidate].x ) &&
+					is_near( in_normal.y , out_normals [candidate].y ) &&
+					is_near( in_normal.z , out_normals [candidate].z ))
+					best = candidate;
+			}
+		}
+		if (best == 0xFFFFFFFF)
+			return false;
+		result = best;
+		return true;
+	}
+};
+
 void indexVBO_TBN(
 	std::vector<glm::vec3> & in_vertices,
 	std::vector<glm::vec2> & in_uvs,
@@ -145,19 +377,24 @@ void indexVBO_TBN(
 	std::vector<glm::vec3> & in_tangents,
 	std::vector<glm::vec3> & in_bitangents,
 
-	std::vector<unsigned short> & out_indices,
+	std::vector<unsigned int> & out_indices,
 	std::vector<glm::vec3> & out_vertices,
 	std::vector<glm::vec2> & out_uvs,
 	std::vector<glm::vec3> & out_normals,
 	std::vector<glm::vec3> & out_tangents,
 	std::vector<glm::vec3> & out_bitangents
 ){
+	// Vertices already in out_XXXX can be reused too
+	WeldGrid grid(out_vertices.size() + in_vertices.size());
+	for ( unsigned int i=0; i<out_vertices.size(); i++ )
+		grid.add( i, out_vertices[i] );
+
 	// For each input vertex
 	for ( unsigned int i=0; i<in_vertices.size(); i++ ){
 
 		// Try to find a similar vertex in out_XXXX
-		unsigned short index;
-		bool found = getSimilarVertexIndex(in_vertices[i], in_uvs[i], in_normals[i],     out_vertices, out_uvs, out_normals, index);
+		unsigned int index;
+		bool found = grid.find(in_vertices[i], in_uvs[i], in_normals[i],     out_vertices, out_uvs, out_normals, index);
 
 		if ( found ){ // A similar vertex is already in the VBO, use it instead !
 			out_indices.push_back( index );
@@ -171,7 +408,79 @@ void indexVBO_TBN(
 			out_normals .push_back( in_normals[i]);
 			out_tangents .push_back( in_tangents[i]);
 			out_bitangents .push_back( in_bitangents[i]);
-			out_indices .push_back( (unsigned short)out_vertices.size() - 1 );
+			out_indices .push_back( (unsigned int)out_vertices.size() - 1 );
+			grid.add( (unsigned int)out_vertices.size() - 1, in_vertices[i] );
 		}
 	}
 }
+
+
+
+// 16-bit versions, for meshes small enough. Bigger meshes would silently
+// wrap around, so they are refused : use the unsigned int versions instead.
+static bool narrowIndices(const std::vector<unsigned int> & indices, size_t vertexCount, std::vector<unsigned short> & out_indices){
+	if (vertexCount > 65536){
+		printf("%u vertices don't fit in unsigned short indices, use unsigned int ones\n", (unsigned int)vertexCount);
+		return false;
+	}
+	out_indices.insert(out_indices.end(), indices.begin(), indices.end());
+	return true;
+}
+
+void indexVBO(
+	std::vector<glm::vec3> & in_vertices,
+	std::vector<glm::vec2> & in_uvs,
+	std::vector<glm::vec3> & in_normals,
+
+	std::vector<unsigned short> & out_indices,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals
+){
+	std::vector<unsigned int> indices;
+	indexVBO(in_vertices, in_uvs, in_normals, indices, out_vertices, out_uvs, out_normals);
+	if (!narrowIndices(indices, out_vertices.size(), out_indices)){
+		out_vertices.clear();
+		out_uvs.clear();
+		out_normals.clear();
+	}
+}
+
+void indexVBO_TBN(
+	std::vector<glm::vec3> & in_vertices,
+	std::vector<glm::vec2> & in_uvs,
+	std::vector<glm::vec3> & in_normals,
+	std::vector<glm::vec3> & in_tangents,
+	std::vector<glm::vec3> & in_bitangents,
+
+	std::vector<unsigned short> & out_indices,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals,
+	std::vector<glm::vec3> & out_tangents,
+	std::vector<glm::vec3> & out_bitangents
+){
+	std::vector<unsigned int> indices;
+	indexVBO_TBN(in_vertices, in_uvs, in_normals, in_tangents, in_bitangents, indices, out_vertices, out_uvs, out_normals, out_tangents, out_bitangents);
+	if (!narrowIndices(indices, out_vertices.size(), out_indices)){
+		out_vertices.clear();
+		out_uvs.clear();
+		out_normals.clear();
+		out_tangents.clear();
+		out_bitangents.clear();
+	}
+}
+
+size_t packIndices(const std::vector<unsigned int> & indices, size_t vertexCount, std::vector<unsigned char> & out){
+	if (vertexCount <= 65536){
+		out.resize(indices.size() * sizeof(unsigned short));
+		unsigned short * packed = (unsigned short *)out.data();
+		for (size_t i = 0; i < indices.size(); i++)
+			packed[i] = (unsigned short)indices[i];
+		return sizeof(unsigned short);
+	}
+	out.resize(indices.size() * sizeof(unsigned int));
+	if (!indices.empty())
+		memcpy(out.data(), indices.data(), out.size());
+	return sizeof(unsigned int);
+}
@@ -0,0 +1,424 @@
+#include <vector>
+#include <string.h>
+#include <math.h>
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include "vertexformat.hpp"
+
+// Sizes of the stored attributes, in bytes
+static const int floatPositionSize = 3 * sizeof(float);
+static const int halfPositionSize = 4 * sizeof(unsigned short);
+static const int floatUVSize = 2 * sizeof(float);
+static const int shortUVSize = 2 * sizeof(unsigned short);
+static const int floatNormalSize = 3 * sizeof(float);
+static const int octNormalSize = 2 * sizeof(short);
+static const int floatTangentSize = 3 * sizeof(float);
+static const int shortTangentSize = 4 * sizeof(short); // octahedral tangent + handedness, or QTangent
+
+static inline bool hasTangentFrame(unsigned int format){
+	return (format & (VERTEX_TANGENTS | VERTEX_QTANGENTS)) != 0;
+}
+
+VertexLayout makeVertexLayout(unsigned int format){
+	VertexLayout layout;
+	if (format & VERTEX_QTANGENTS)
+		format |= VERTEX_TANGENTS;
+	layout.format = format;
+
+	int offset = 0;
+	layout.positionOffset = offset;
+	offset += (format & VERTEX_HALF_POSITIONS) ? halfPositionSize : floatPositionSize;
+	layout.uvOffset = offset;
+	offset += (format & VERTEX_SHORT_UVS) ? shortUVSize : floatUVSize;
+	if (!(format & VERTEX_QTANGENTS)){
+		layout.normalOffset = offset;
+		offset += (format & VERTEX_OCT_NORMALS) ? octNormalSize : floatNormalSize;
+	}
+	if (hasTangentFrame(format)){
+		layout.tangentOffset = offset;
+		if (format & (VERTEX_OCT_NORMALS | VERTEX_QTANGENTS)){
+			offset += shortTangentSize;
+		}else{
+			offset += floatTangentSize;
+			layout.bitangentOffset = offset;
+			offset += floatTangentSize;
+		}
+	}
+	layout.stride = offset;
+	return layout;
+}
+
+// IEEE half float, rounded to nearest even. Values out of range become infinite.
+static unsigned short floatToHalf(float value){
+	unsigned int f;
+	memcpy(&f, &value, sizeof(f));
+	unsigned int sign = (f >> 16) & 0x8000;
+	unsigned int exponent = (f >> 23) & 0xFF;
+	unsigned int mantissa = f & 0x7FFFFF;
+
+	if (exponent == 0xFF) // infinity or NaN
+		return (unsigned short)(sign | 0x7C00 | (mantissa ? 0x200 : 0));
+	int e = (int)exponent - 127 + 15;
+	if (e >= 31)
+		return (unsigned short)(sign | 0x7C00);
+	if (e <= 0){
+		// Denormal half, or 0
+		if (e < -10)
+			return (unsigned short)sign;
+		mantissa |= 0x800000;
+		unsigned int shift = 14 - e;
+		unsigned int half = mantissa >> shift;
+		unsigned int rest = mantissa & ((1u << shift) - 1);
+		unsigned int halfway = 1u << (shift - 1);
+		if (rest > halfway || (rest == halfway && (half & 1)))
+			half++;
+		return (unsigned short)(sign | half);
+	}
+	unsigned int half = ((unsigned int)e << 10) | (mantissa >> 13);
+	unsigned int rest = mantissa & 0x1FFF;
+	if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+		half++; // may carry into the exponent, which is still right
+	return (unsigned short)(sign | half);
+}
+
+static float halfToFloat(unsigned short half){
+	unsigned int sign = (unsigned int)(half & 0x8000) << 16;
+	unsigned int exponent = (half >> 10) & 0x1F;
+	unsigned int mantissa = half & 0x3FF;
+	unsigned int f;
+	if (exponent == 0){
+		if (mantissa == 0){
+			f = sign;
+		}else{
+			// Denormal : normalize it
+			int e = -1;
+			do{
+				e++;
+				mantissa <<= 1;
+			}while (!(mantissa & 0x400));
+			f = sign | ((unsigned int)(127 - 15 - e) << 23) | ((mantissa & 0x3FF) << 13);
+		}
+	}else if (exponent == 31){
+		f = sign | 0x7F800000 | (mantissa << 13);
+	}else{
+		f = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+	}
+	float value;
+	memcpy(&value, &f, sizeof(value));
+	return value;
+}
+
+static inline short toSnorm16(float x){
+	x = x < -1.0f ? -1.0f : (x > 1.0f ? 1.0f : x);
+	return (short)floorf(x * 32767.0f + 0.5f);
+}
+
+static inline float fromSnorm16(short x){
+	float f = x / 32767.0f;
+	return f < -1.0f ? -1.0f : f;
+}
+
+static inline unsigned short toUnorm16(float x){
+	x = x < 0.0f ? 0.0f : (x > 1.0f ? 1.0f : x);
+	return (unsigned short)floorf(x * 65535.0f + 0.5f);
+}
+
+static inline float signNotZero(float x){
+	return x >= 0.0f ? 1.0f : -1.0f;
+}
+
+// Octahedral encoding : the unit sphere is projected on an octahedron, which
+// is unfolded on the [-1,1] square
+static glm::vec2 octEncode(const glm::vec3 & n){
+	glm::vec2 p = glm::vec2(n.x, n.y) / (fabsf(n.x) + fabsf(n.y) + fabsf(n.z));
+	if (n.z < 0.0f)
+		p = glm::vec2((1.0f - fabsf(p.y)) * signNotZero(p.x), (1.0f - fabsf(p.x)) * signNotZero(p.y));
+	return p;
+}
+
+static glm::vec3 octDecode(const glm::vec2 & p){
+	glm::vec3 n(p.x, p.y, 1.0f - fabsf(p.x) - fabsf(p.y));
+	float t = n.z < 0.0f ? -n.z : 0.0f;
+	n.x += n.x >= 0.0f ? -t : t;
+	n.y += n.y >= 0.0f ? -t : t;
+	return glm::normalize(n);
+}
+
+// Builds an orthonormal frame from the (not orthogonal, not normalized)
+// normal, tangent and bitangent. Returns the handedness : +1 or -1.
+static float orthonormalize(const glm::vec3 & normal, const glm::vec3 & tangent, const glm::vec3 & bitangent, glm::vec3 & n, glm::vec3 & t){
+	float length = glm::length(normal);
+	n = length > 0.0f ? normal / length : glm::vec3(0.0f, 0.0f, 1.0f);
+
+	// Gram-Schmidt orthogonalize
+	t = tangent - n * glm::dot(n, tangent);
+	length = glm::length(t);
+	if (length > 1e-20f){
+		t /= length;
+	}else{
+		// No usable tangent (degenerate UVs) : any direction in the plane will do
+		t = glm::normalize(glm::cross(n, fabsf(n.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f)));
+	}
+	return glm::dot(glm::cross(n, t), bitangent) < 0.0f ? -1.0f : 1.0f;
+}
+
+// The rotation that takes the X, Y, Z axes to t, cross(n, t), n, as a
+// quaternion (x, y, z, w) with w > 0; then negated if the frame is mirrored.
+static glm::vec4 encodeQTangent(const glm::vec3 & n, const glm::vec3 & t, float handedness){
+	glm::vec3 b = glm::cross(n, t);
+	float m00 = t.x, m01 = b.x, m02 = n.x;
+	float m10 = t.y, m11 = b.y, m12 = n.y;
+	float m20 = t.z, m21 = b.z, m22 = n.z;
+	glm::vec4 q;
+	float trace = m00 + m11 + m22;
+	if (trace > 0.0f){
+		float s = sqrtf(trace + 1.0f) * 2.0f;
+		q = glm::vec4((m21 - m12) / s, (m02 - m20) / s, (m10 - m01) / s, 0.25f * s);
+	}else if (m00 > m11 && m00 > m22){
+		float s = sqrtf(1.0f + m00 - m11 - m22) * 2.0f;
+		q = glm::vec4(0.25f * s, (m01 + m10) / s, (m02 + m20) / s, (m21 - m12) / s);
+	}else if (m11 > m22){
+		float s = sqrtf(1.0f + m11 - m00 - m22) * 2.0f;
+		q = glm::vec4((m01 + m10) / s, 0.25f * s, (m12 + m21) / s, (m02 - m20) / s);
+	}else{
+		float s = sqrtf(1.0f + m22 - m00 - m11) * 2.0f;
+		q = glm::vec4((m02 + m20) / s, (m12 + m21) / s, 0.25f * s, (m10 - m01) / s);
+	}
+	q = glm::normalize(q);
+	if (q.w < 0.0f)
+		q = -q;
+
+	// w must not round to 0 in a short, or the handedness would be lost
+	const float bias = 1.0f / 32767.0f;
+	if (q.w < bias){
+		float scale = sqrtf(1.0f - bias * bias);
+		q = glm::vec4(q.x * scale, q.y * scale, q.z * scale, bias);
+	}
+	return handedness < 0.0f ? -q : q;
+}
+
+static void decodeQTangent(glm::vec4 q, glm::vec3 & n, glm::vec3 & t, glm::vec3 & b){
+	float handedness = q.w < 0.0f ? -1.0f : 1.0f;
+	q = glm::normalize(q);
+	t = glm::vec3(1.0f - 2.0f * (q.y * q.y + q.z * q.z), 2.0f * (q.x * q.y + q.w * q.z), 2.0f * (q.x * q.z - q.w * q.y));
+	n = glm::vec3(2.0f * (q.x * q.z + q.w * q.y), 2.0f * (q.y * q.z - q.w * q.x), 1.0f - 2.0f * (q.x * q.x + q.y * q.y));
+	b = glm::cross(n, t) * handedness;
+}
+
+void packVertices(
+	unsigned int format, size_t count,
+	const glm::vec3 * vertices,
+	const glm::vec2 * uvs,
+	const glm::vec3 * normals,
+	const glm::vec3 * tangents,
+	const glm::vec3 * bitangents,
+	VertexLayout & layout,
+	std::vector<unsigned char> & out
+){
+	layout = makeVertexLayout(format);
+	format = layout.format;
+
+	// Bounds, so that the whole precision of the encodings is used
+	if (count > 0 && (format & VERTEX_HALF_POSITIONS)){
+		glm::vec3 minimum = vertices[0], maximum = vertices[0];
+		for (size_t i = 1; i < count; i++){
+			minimum = glm::min(minimum, vertices[i]);
+			maximum = glm::max(maximum, vertices[i]);
+		}
+		layout.positionCenter = (minimum + maximum) * 0.5f;
+		layout.positionExtent = (maximum - minimum) * 0.5f;
+		for (int k = 0; k < 3; k++){
+			if (!(layout.positionExtent[k] > 0.0f))
+				layout.positionExtent[k] = 1.0f;
+		}
+	}
+	if (count > 0 && (format & VERTEX_SHORT_UVS)){
+		glm::vec2 minimum = uvs[0], maximum = uvs[0];
+		for (size_t i = 1; i < count; i++){
+			minimum = glm::min(minimum, uvs[i]);
+			maximum = glm::max(maximum, uvs[i]);
+		}
+		layout.uvMin = minimum;
+		layout.uvScale = maximum - minimum;
+		for (int k = 0; k < 2; k++){
+			if (!(layout.uvScale[k] > 0.0f))
+				layout.uvScale[k] = 1.0f;
+		}
+	}
+
+	out.assign(count * layout.stride, 0);
+	for (size_t i = 0; i < count; i++){
+		unsigned char * vertex = out.data() + i * layout.stride;
+
+		if (format & VERTEX_HALF_POSITIONS){
+			glm::vec3 p = (vertices[i] - layout.positionCenter) / layout.positionExtent;
+			unsigned short stored[4] = {floatToHalf(p.x), floatToHalf(p.y), floatToHalf(p.z), floatToHalf(1.0f)};
+			memcpy(vertex + layout.positionOffset, stored, sizeof(stored));
+		}else{
+			memcpy(vertex + layout.positionOffset, &vertices[i], floatPositionSize);
+		}
+
+		if (format & VERTEX_SHORT_UVS){
+			glm::vec2 uv = (uvs[i] - layout.uvMin) / layout.uvScale;
+			unsigned short stored[2] = {toUnorm16(uv.x), toUnorm16(uv.y)};
+			memcpy(vertex + layout.uvOffset, stored, sizeof(stored));
+		}else{
+			memcpy(vertex + layout.uvOffset, &uvs[i], floatUVSize);
+		}
+
+		if (!hasTangentFrame(format) || !(format & (VERTEX_OCT_NORMALS | VERTEX_QTANGENTS))){
+			// Normal (and tangents) on their own
+			if (format & VERTEX_OCT_NORMALS){
+				float length = glm::length(normals[i]);
+				glm::vec2 p = octEncode(length > 0.0f ? normals[i] / length : glm::vec3(0.0f, 0.0f, 1.0f));
+				short stored[2] = {toSnorm16(p.x), toSnorm16(p.y)};
+				memcpy(vertex + layout.normalOffset, stored, sizeof(stored));
+			}else{
+				memcpy(vertex + layout.normalOffset, &normals[i], floatNormalSize);
+			}
+			if (hasTangentFrame(format)){
+				memcpy(vertex + layout.tangentOffset, &tangents[i], floatTangentSize);
+				memcpy(vertex + layout.bitangentOffset, &bitangents[i], floatTangentSize);
+			}
+			continue;
+		}
+
+		// Compact tangent frame
+		glm::vec3 n, t;
+		float handedness = orthonormalize(normals[i], tangents[i], bitangents[i], n, t);
+		if (format & VERTEX_QTANGENTS){
+			glm::vec4 q = encodeQTangent(n, t, handedness);
+			short stored[4] = {toSnorm16(q.x), toSnorm16(q.y), toSnorm16(q.z), toSnorm16(q.w)};
+			if (stored[3] == 0)
+				stored[3] = handedness < 0.0f ? -1 : 1;
+			memcpy(vertex + layout.tangentOffset, stored, sizeof(stored));
+		}else{
+			glm::vec2 pn = octEncode(n);
+			glm::vec2 pt = octEncode(t);
+			short storedNormal[2] = {toSnorm16(pn.x), toSnorm16(pn.y)};
+			short storedTangent[4] = {toSnorm16(pt.x), toSnorm16(pt.y), toSnorm16(handedness), 0};
+			memcpy(vertex + layout.normalOffset, storedNormal, sizeof(storedNormal));
+			memcpy(vertex + layout.tangentOffset, storedTangent, sizeof(storedTangent));
+		}
+	}
+}
+
+void unpackVertex(
+	const VertexLayout & layout, const void * data, size_t i,
+	glm::vec3 * position,
+	glm::vec2 * uv,
+	glm::vec3 * normal,
+	glm::vec3 * tangent,
+	glm::vec3 * bitangent
+){
+	const unsigned char * vertex = (const unsigned char *)data + i * layout.stride;
+	unsigned int format = layout.format;
+
+	if (position){
+		if (format & VERTEX_HALF_POSITIONS){
+			unsigned short stored[3];
+			memcpy(stored, vertex + layout.positionOffset, sizeof(stored));
+			glm::vec3 p(halfToFloat(stored[0]), halfToFloat(stored[1]), halfToFloat(stored[2]));
+			*position = layout.positionCenter + layout.positionExtent * p;
+		}else{
+			memcpy(position, vertex + layout.positionOffset, floatPositionSize);
+		}
+	}
+
+	if (uv){
+		if (format & VERTEX_SHORT_UVS){
+			unsigned short stored[2];
+			memcpy(stored, vertex + layout.uvOffset, sizeof(stored));
+			*uv = layout.uvMin + layout.uvScale * glm::vec2(stored[0] / 65535.0f, stored[1] / 65535.0f);
+		}else{
+			memcpy(uv, vertex + layout.uvOffset, floatUVSize);
+		}
+	}
+
+	if (!normal && !tangent && !bitangent)
+		return;
+
+	glm::vec3 n(0.0f), t(0.0f), b(0.0f);
+	if (format & VERTEX_QTANGENTS){
+		short stored[4];
+		memcpy(stored, vertex + layout.tangentOffset, sizeof(stored));
+		decodeQTangent(glm::vec4(fromSnorm16(stored[0]), fromSnorm16(stored[1]), fromSnorm16(stored[2]), fromSnorm16(stored[3])), n, t, b);
+	}else{
+		if (format & VERTEX_OCT_NORMALS){
+			short stored[2];
+			memcpy(stored, vertex + layout.normalOffset, sizeof(stored));
+			n = octDecode(glm::vec2(fromSnorm16(stored[0]), fromSnorm16(stored[1])));
+		}else{
+			memcpy(&n, vertex + layout.normalOffset, floatNormalSize);
+		}
+		if (hasTangentFrame(format)){
+			if (format & VERTEX_OCT_NORMALS){
+				short stored[3];
+				memcpy(stored, vertex + layout.tangentOffset, sizeof(stored));
+				t = octDecode(glm::vec2(fromSnorm16(stored[0]), fromSnorm16(stored[1])));
+				b = glm::cross(n, t) * (stored[2] < 0 ? -1.0f : 1.0f);
+			}else{
+				memcpy(&t, vertex + layout.tangentOffset, floatTangentSize);
+				memcpy(&b, vertex + layout.bitangentOffset, floatTangentSize);
+			}
+		}
+	}
+	if (normal)
+		*normal = n;
+	if (tangent)
+		*tangent = t;
+	if (bitangent)
+		*bitangent = b;
+}
+
+static void setupVertexAttribute(GLuint location, GLint size, GLenum type, GLboolean normalized, const VertexLayout & layout, int offset){
+	if (offset < 0){
+		glDisableVertexAttribArray(location);
+		return;
+	}
+	glEnableVertexAttribArray(location);
+	glVertexAttribPointer(
+		location,                         // attribute
+		size,                             // size
+		type,                             // type
+		normalized,                       // normalized?
+		layout.stride,                    // stride
+		(void*)(size_t)offset             // array buffer offset
+	);
+}
+
+void setupVertexAttributes(const VertexLayout & layout){
+	unsigned int format = layout.format;
+
+	if (format & VERTEX_HALF_POSITIONS)
+		setupVertexAttribute(VERTEX_ATTRIB_POSITION, 4, GL_HALF_FLOAT, GL_FALSE, layout, layout.positionOffset);
+	else
+		setupVertexAttribute(VERTEX_ATTRIB_POSITION, 3, GL_FLOAT, GL_FALSE, layout, layout.positionOffset);
+
+	if (format & VERTEX_SHORT_UVS)
+		setupVertexAttribute(VERTEX_ATTRIB_UV, 2, GL_UNSIGNED_SHORT, GL_TRUE, layout, layout.uvOffset);
+	else
+		setupVertexAttribute(VERTEX_ATTRIB_UV, 2, GL_FLOAT, GL_FALSE, layout, layout.uvOffset);
+
+	if (format & VERTEX_OCT_NORMALS)
+		setupVertexAttribute(VERTEX_ATTRIB_NORMAL, 2, GL_SHORT, GL_TRUE, layout, layout.normalOffset);
+	else
+		setupVertexAttribute(VERTEX_ATTRIB_NORMAL, 3, GL_FLOAT, GL_FALSE, layout, layout.normalOffset);
+
+	if (format & (VERTEX_OCT_NORMALS | VERTEX_QTANGENTS))
+		setupVertexAttribute(VERTEX_ATTRIB_TANGENT, 4, GL_SHORT, GL_TRUE, layout, layout.tangentOffset);
+	else
+		setupVertexAttribute(VERTEX_ATTRIB_TANGENT, 3, GL_FLOAT, GL_FALSE, layout, layout.tangentOffset);
+
+	setupVertexAttribute(VERTEX_ATTRIB_BITANGENT, 3, GL_FLOAT, GL_FALSE, layout, layout.bitangentOffset);
+}
+
+void setVertexLayoutUniforms(unsigned int programID, const VertexLayout & layout){
+	glUniform3fv(glGetUniformLocation(programID, "VertexPositionCenter"), 1, &layout.positionCenter[0]);
+	glUniform3fv(glGetUniformLocation(programID, "VertexPositionExtent"), 1, &layout.positionExtent[0]);
+	glUniform2fv(glGetUniformLocation(programID, "VertexUVMin"), 1, &layout.uvMin[0]);
+	glUniform2fv(glGetUniformLocation(programID, "VertexUVScale"), 1, &layout.uvScale[0]);
+}
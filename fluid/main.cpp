@@ -15,6 +15,7 @@
 
 #include <common/shader.hpp>
 #include <common/texture.hpp>
+#include <common/texturecache.hpp>
 #include <common/controls.hpp>
 
 const int gWidth = 1024;
@@ -175,12 +176,23 @@ private:
 
 struct Shader
 {
-    GLuint id;
+    GLuint id = 0;
     Shader() {}
-    Shader(std::string vertex, std::string fragment)
+    // Queued in batch : compiled along with the others, and checked when first used
+    Shader(ShaderBatch& batch, std::string vertex, std::string fragment)
+        : batch(&batch), index(batch.addFiles(vertex.c_str(), fragment.c_str()))
     {
-        id = LoadShaders(vertex.c_str(), fragment.c_str());
-        collectUniforms();
+    }
+
+    void use()
+    {
+        if (batch)
+        {
+            id = batch->program(index);
+            batch = nullptr;
+            collectUniforms();
+        }
+        glUseProgram(id);
     }
 
     void setUniform(const std::string& name, glm::vec2 vec)
@@ -209,6 +221,9 @@ struct Shader
     }
 
 private:
+    ShaderBatch* batch = nullptr;
+    unsigned int index = 0;
+
     void collectUniforms()
     {
         int count;
@@ -258,22 +273,22 @@ struct Fluid
 
     GLuint border;
 
-    Fluid(int fluidGridW, int fluidGridH, int dyeGridW, int dyeGridH) : fWidth(fluidGridW), fHeight(fluidGridH), dWidth(dyeGridW), dHeight(dyeGridH),
+    Fluid(int fluidGridW, int fluidGridH, int dyeGridW, int dyeGridH, ShaderBatch& shaders) : fWidth(fluidGridW), fHeight(fluidGridH), dWidth(dyeGridW), dHeight(dyeGridH),
                                                                         velocityTarget(fluidGridW, fluidGridH, GL_RG32F, GL_RG, GL_LINEAR),
                                                                         divergenceTarget(fluidGridW, fluidGridH, GL_RG32F, GL_RG, GL_NEAREST),
                                                                         pressureTarget(fWidth, fHeight, GL_RG32F, GL_RG, GL_NEAREST),
                                                                         vorticityTarget(fWidth, fHeight, GL_RG32F, GL_RG, GL_NEAREST),
                                                                         quantityTarget(dWidth, dHeight, GL_RGB32F, GL_RGB, GL_LINEAR),
-                                                                        advectionShader("shaders/vector.vs", "shaders/advection.fs"),
-                                                                        divergenceShader("shaders/field.vs", "shaders/divergence.fs"),
-                                                                        vorticityShader("shaders/field.vs", "shaders/vorticity.fs"),
-                                                                        vorticityForceShader("shaders/field.vs", "shaders/vorticityForce.fs"),
-                                                                        pressureShader("shaders/field.vs", "shaders/pressure.fs"),
-                                                                        pressureGradientShader("shaders/field.vs", "shaders/pressureGradient.fs"),
-                                                                        multiplyShader("shaders/vector.vs", "shaders/multiply.fs"),
-                                                                        disturbShader("shaders/vector.vs", "shaders/disturb.fs")
+                                                                        advectionShader(shaders, "shaders/vector.vs", "shaders/advection.fs"),
+                                                                        divergenceShader(shaders, "shaders/field.vs", "shaders/divergence.fs"),
+                                                                        vorticityShader(shaders, "shaders/field.vs", "shaders/vorticity.fs"),
+                                                                        vorticityForceShader(shaders, "shaders/field.vs", "shaders/vorticityForce.fs"),
+                                                                        pressureShader(shaders, "shaders/field.vs", "shaders/pressure.fs"),
+                                                                        pressureGradientShader(shaders, "shaders/field.vs", "shaders/pressureGradient.fs"),
+                                                                        multiplyShader(shaders, "shaders/vector.vs", "shaders/multiply.fs"),
+                                                                        disturbShader(shaders, "shaders/vector.vs", "shaders/disturb.fs")
     {
-        border = loadDDS("data/bg.dds");
+        border = TextureCache::global().acquire("data/bg.dds");
     }
 
     void pipeline(float dt)
@@ -282,12 +297,12 @@ struct Fluid
         glViewport(0, 0, fWidth, fHeight);
         glm::vec2 st(1.0f / fWidth, 1.0f / fHeight);
 
-        glUseProgram(vorticityShader.id);
+        vorticityShader.use();
         vorticityShader.setUniform("st", st);
         vorticityShader.setUniform("velocity", velocityTarget.bind(0));
         stage(vorticityTarget);
 
-        glUseProgram(vorticityForceShader.id);
+        vorticityForceShader.use();
         vorticityForceShader.setUniform("st", st);
         vorticityForceShader.setUniform("velocity", velocityTarget.bind(0));
         vorticityForceShader.setUniform("vorticity", vorticityTarget.bind(1));
@@ -295,7 +310,7 @@ struct Fluid
         vorticityForceShader.setUniform("dt", dt);
         stage(velocityTarget);
 
-        glUseProgram(divergenceShader.id);
+        divergenceShader.use();
         divergenceShader.setUniform("st", st);
         divergenceShader.setUniform("velocity", velocityTarget.bind(0));
         glActiveTexture(GL_TEXTURE0 + (GLuint)1);
@@ -303,12 +318,12 @@ struct Fluid
         divergenceShader.setUniform("border", (GLuint)1);
         stage(divergenceTarget);
 
-        glUseProgram(multiplyShader.id);
+        multiplyShader.use();
         multiplyShader.setUniform("val", pressureDissipation);
         multiplyShader.setUniform("field", pressureTarget.bind(0));
         stage(pressureTarget);
 
-        glUseProgram(pressureShader.id);
+        pressureShader.use();
         pressureShader.setUniform("st", st);
         pressureShader.setUniform("divergence", divergenceTarget.bind(0));
         for (int i = 0; i < jacobiIterations; ++i)
@@ -317,13 +332,13 @@ struct Fluid
             stage(pressureTarget);
         }
 
-        glUseProgram(pressureGradientShader.id);
+        pressureGradientShader.use();
         pressureGradientShader.setUniform("st", st);
         pressureGradientShader.setUniform("pressure", pressureTarget.bind(0));
         pressureGradientShader.setUniform("velocity", velocityTarget.bind(1));
         stage(velocityTarget);
 
-        glUseProgram(advectionShader.id);
+        advectionShader.use();
         advectionShader.setUniform("st", st);
         auto velocityID = velocityTarget.bind(0);
         advectionShader.setUniform("velocity", velocityID);
@@ -335,7 +350,7 @@ struct Fluid
         glViewport(0, 0, dWidth, dHeight);
         glm::vec2 dst(1.0 / dWidth, 1.0 / dHeight);
 
-        glUseProgram(advectionShader.id);
+        advectionShader.use();
         advectionShader.setUniform("velocity", velocityTarget.bind(0));
         advectionShader.setUniform("quantity", quantityTarget.bind(1));
         advectionShader.setUniform("dt", dt);
@@ -350,7 +365,7 @@ struct Fluid
         glViewport(0, 0, fWidth, fHeight);
         glm::vec2 st(1.0 / fWidth, 1.0 / fHeight);
 
-        glUseProgram(disturbShader.id);
+        disturbShader.use();
         disturbShader.setUniform("quantity", velocityTarget.bind(0));
         disturbShader.setUniform("aspect", (float)gWidth / (float)gHeight);
         disturbShader.setUniform("position", glm::vec2(x / (float)gWidth, 1.0 - y / (float)gHeight));
@@ -361,7 +376,7 @@ struct Fluid
         glViewport(0, 0, dWidth, dHeight);
         glm::vec2 dst(1.0 / dWidth, 1.0 / dHeight);
 
-        glUseProgram(disturbShader.id);
+        disturbShader.use();
         disturbShader.setUniform("quantity", quantityTarget.bind(0));
         disturbShader.setUniform("dir", color);
         stage(quantityTarget);
@@ -446,12 +461,12 @@ void renderTexture(GLuint textureID)
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, textureID);
 
-    glUseProgram(renderTextureShader.id);
+    renderTextureShader.use();
     renderTextureShader.setUniform("renderedTexture", (GLuint)0);
     drawQuad();
 }
 
-Fluid* fluidPtr;
+Fluid* fluidPtr = nullptr; // once the simulation started
 bool dragging = false;
 void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
 {
@@ -469,7 +484,7 @@ void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
 }
 void mouseCursorPositionCallback(GLFWwindow* window, double xpos, double ypos)
 {
-    if (dragging)
+    if (dragging && fluidPtr)
     {
         fluidPtr->randomDisturb(1);
     }
@@ -485,15 +500,17 @@ int main(void)
 
     initGL();
 
-    renderTextureShader = Shader("shaders/vector.vs", "shaders/screen.fs");
-    auto bg = loadDDS("data/bg.dds");
+    // All the programs compile together, and are checked when first used
+    ShaderBatch shaderBatch;
+    renderTextureShader = Shader(shaderBatch, "shaders/vector.vs", "shaders/screen.fs");
+    auto bg = TextureCache::global().acquire("data/bg.dds");
 
-    Fluid fluid{(int)(fluidGrid * (float)gWidth / (float)gHeight), fluidGrid, (int)(dyeGrid * (float)gWidth / (float)gHeight), dyeGrid};
-    fluid.randomDisturb(15);
-    fluidPtr = &fluid;
+    Fluid fluid{(int)(fluidGrid * (float)gWidth / (float)gHeight), fluidGrid, (int)(dyeGrid * (float)gWidth / (float)gHeight), dyeGrid, shaderBatch};
+    shaderBatch.submit();
 
     auto lastTime = glfwGetTime();
     int nbFrames = 0;
+    bool shadersReported = false;
     do
     {
         auto currentTime = glfwGetTime();
@@ -505,18 +522,44 @@ int main(void)
             lastTime += 1.0;
         }
 
-        fluid.pipeline(0.016f);
-        renderTexture(fluid.quantityTarget.texture);
-        //renderTexture(fluid.vorticityTarget.texture);
-        //renderTexture(fluid.velocityTarget.texture);
-        //renderTexture(bg);
+        // Nothing is drawn until every program is compiled : the window
+        // stays responsive, instead of waiting for the compiler in a draw
+        if (!fluidPtr && shaderBatch.isReady())
+        {
+            fluid.randomDisturb(15);
+            fluidPtr = &fluid;
+        }
+        if (fluidPtr)
+        {
+            fluid.pipeline(0.016f);
+            renderTexture(fluid.quantityTarget.texture);
+            //renderTexture(fluid.vorticityTarget.texture);
+            //renderTexture(fluid.velocityTarget.texture);
+            //renderTexture(bg);
+        }
+        else
+        {
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            glClear(GL_COLOR_BUFFER_BIT);
+        }
 
         glfwSwapInterval(1);
         glfwSwapBuffers(window);
         glfwPollEvents();
 
+        // What the programs cost at startup, once the first frame used them all
+        if (fluidPtr && !shadersReported)
+        {
+            printShaderStartupReport(shaderBatch);
+            shadersReported = true;
+        }
+
     } while (glfwGetKey(window, GLFW_KEY_ESCAPE) != GLFW_PRESS &&
              glfwWindowShouldClose(window) == 0);
+    // Both are the same texture, loaded once
+    TextureCache::global().release(fluid.border);
+    TextureCache::global().release(bg);
+    TextureCache::global().clear();
     glfwTerminate();
 
     return 0;
@@ -33,13 +33,32 @@ struct Config
 
 struct GLProgram
 {
-    GLuint id;
+    GLuint id = 0;
     std::map<std::string, GLuint> uniforms;
     GLProgram() {}
-    GLProgram(const std::string& vertexShader, const std::string& fragmentShader)
+    // Queued in batch : compiled along with the others, and checked when first bound
+    GLProgram(ShaderBatch& batch, const std::string& vertexShader, const std::string& fragmentShader)
+        : batch(&batch), index(batch.addCode(vertexShader, fragmentShader))
     {
-        id = LoadShadersCode(vertexShader, fragmentShader);
+    }
+
+    void bind()
+    {
+        if (batch)
+        {
+            id = batch->program(index);
+            batch = nullptr;
+            collectUniforms();
+        }
+        glUseProgram(id);
+    }
 
+private:
+    ShaderBatch* batch = nullptr;
+    unsigned int index = 0;
+
+    void collectUniforms()
+    {
         int count;
         glGetProgramiv(id, GL_ACTIVE_UNIFORMS, &count);
         for (int i = 0; i < count; i++)
@@ -52,11 +71,6 @@ struct GLProgram
             uniforms[name] = glGetUniformLocation(id, name);
         }
     }
-
-    void bind()
-    {
-        glUseProgram(id);
-    }
 };
 
 const std::string baseVertexShader = R"(
@@ -673,19 +687,22 @@ int main(void)
     // Dark blue background
     glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
 
-    clearProgram = GLProgram(baseVertexShader, clearShader);
-    splatProgram = GLProgram(baseVertexShader, splatShader);
-    advectionProgram = GLProgram(baseVertexShader, advectionShader);
-    divergenceProgram = GLProgram(baseVertexShader, divergenceShader);
-    curlProgram = GLProgram(baseVertexShader, curlShader);
-    vorticityProgram = GLProgram(baseVertexShader, vorticityShader);
-    pressureProgram = GLProgram(baseVertexShader, pressureShader);
-    gradienSubtractProgram = GLProgram(baseVertexShader, gradientSubtractShader);
-    displayProgram = GLProgram(baseVertexShader, displayShader);
+    // All the programs compile together, and are checked when first used
+    ShaderBatch shaderBatch;
+    clearProgram = GLProgram(shaderBatch, baseVertexShader, clearShader);
+    splatProgram = GLProgram(shaderBatch, baseVertexShader, splatShader);
+    advectionProgram = GLProgram(shaderBatch, baseVertexShader, advectionShader);
+    divergenceProgram = GLProgram(shaderBatch, baseVertexShader, divergenceShader);
+    curlProgram = GLProgram(shaderBatch, baseVertexShader, curlShader);
+    vorticityProgram = GLProgram(shaderBatch, baseVertexShader, vorticityShader);
+    pressureProgram = GLProgram(shaderBatch, baseVertexShader, pressureShader);
+    gradienSubtractProgram = GLProgram(shaderBatch, baseVertexShader, gradientSubtractShader);
+    displayProgram = GLProgram(shaderBatch, baseVertexShader, displayShader);
+    shaderBatch.submit();
 
     initFramebuffers();
-    multipleSplats(15);
-    //multipleSplats(1);
+    bool started = false;
+    bool shadersReported = false;
     do
     {
 
@@ -693,13 +710,29 @@ int main(void)
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
         glClear(GL_COLOR_BUFFER_BIT);
 
-        update();
+        // Nothing is drawn until every program is compiled : the window
+        // stays responsive, instead of waiting for the compiler in a draw
+        if (!started && shaderBatch.isReady())
+        {
+            multipleSplats(15);
+            //multipleSplats(1);
+            started = true;
+        }
+        if (started)
+            update();
         //render();
         // Swap buffers
         glfwSwapInterval(1);
         glfwSwapBuffers(window);
         glfwPollEvents();
 
+        // What the programs cost at startup, once the first frame used them all
+        if (started && !shadersReported)
+        {
+            printShaderStartupReport(shaderBatch);
+            shadersReported = true;
+        }
+
     } // Check if the ESC key was pressed or the window was closed
     while (glfwGetKey(window, GLFW_KEY_ESCAPE) != GLFW_PRESS &&
            glfwWindowShouldClose(window) == 0);
@@ -0,0 +1,327 @@
+// Measures the mesh pipeline :
+// - how fast OBJ files are parsed, on a synthetic file of about 100 MB
+//   (v/vt/vn triangles on a grid) and on the OBJ files given on the command line;
+// - indexVBO, against the std::map it used to be built on, on 1M vertices
+//   (copies of suzanne, each scaled a bit differently);
+// - simplifyMesh on a sphere with a UV seam : the seam must stay closed, and
+//   no triangle may turn upside down;
+// - how many triangles of suzanne cullMeshlets keeps, for a few fixed cameras.
+// Times are the fastest of 7 runs : the others only add the noise of
+// whatever else runs on the machine.
+
+// Include standard headers
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <utility>
+#include <math.h>
+
+// Include GLM
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <common/mappedfile.hpp>
+#include <common/objloader.hpp>
+#include <common/threadpool.hpp>
+#include <common/vboindexer.hpp>
+#include <common/meshsimplify.hpp>
+#include <common/meshcache.hpp>
+
+static double now(){
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+template <typename Run>
+static double bestTime(Run run, int runs = 7){
+	std::vector<double> times;
+	for (int i = 0; i < runs; i++){
+		double start = now();
+		run();
+		times.push_back(now() - start);
+	}
+	std::sort(times.begin(), times.end());
+	return times[0];
+}
+
+// A side x side grid of vertices, each with its UV and normal, in triangles
+// written as an exporter writes them : "f 1/1/1 2/2/2 3/3/3"
+static void makeGridOBJ(unsigned int side, std::string & obj){
+	char line[256];
+	for (unsigned int y = 0; y < side; y++){
+		for (unsigned int x = 0; x < side; x++){
+			float u = (float)x / (side - 1), v = (float)y / (side - 1);
+			snprintf(line, sizeof(line), "v %.6f %.6f %.6f\nvt %.6f %.6f\nvn %.6f %.6f %.6f\n",
+				u * 2.0f - 1.0f, 0.25f * u * v, v * 2.0f - 1.0f, u, v, -0.125f * v, 0.984251f, -0.125f * u);
+			obj += line;
+		}
+	}
+	for (unsigned int y = 0; y + 1 < side; y++){
+		for (unsigned int x = 0; x + 1 < side; x++){
+			unsigned int a = y * side + x + 1, b = a + 1, c = a + side, d = c + 1;
+			snprintf(line, sizeof(line), "f %u/%u/%u %u/%u/%u %u/%u/%u\nf %u/%u/%u %u/%u/%u %u/%u/%u\n",
+				a, a, a, c, c, c, b, b, b, b, b, b, c, c, c, d, d, d);
+			obj += line;
+		}
+	}
+}
+
+static void benchmarkOBJ(const char * name, const char * data, size_t size){
+	double megabytes = size / (1024.0 * 1024.0);
+	std::vector<glm::vec3> vertices, normals;
+	std::vector<glm::vec2> uvs;
+	std::vector<unsigned int> indices;
+	bool loaded = true;
+
+	double serialTime = bestTime([&](){
+		vertices.clear(); uvs.clear(); normals.clear();
+		loaded = loadOBJFromMemory(data, size, vertices, uvs, normals, 1) && loaded;
+	});
+	double threadedTime = bestTime([&](){
+		vertices.clear(); uvs.clear(); normals.clear();
+		loaded = loadOBJFromMemory(data, size, vertices, uvs, normals) && loaded;
+	});
+	double indexedTime = bestTime([&](){
+		indices.clear(); vertices.clear(); uvs.clear(); normals.clear();
+		loaded = loadOBJIndexedFromMemory(data, size, indices, vertices, uvs, normals, 1) && loaded;
+	});
+	if (!loaded){
+		printf("%s can't be parsed\n", name);
+		return;
+	}
+
+	printf("%s : %.2f MB, %u triangles\n", name, megabytes, (unsigned int)(indices.size() / 3));
+	printf("  loadOBJ, 1 thread          : %8.2f ms, %7.1f MB/s\n", serialTime * 1e3, megabytes / serialTime);
+	printf("  loadOBJ, all cores         : %8.2f ms, %7.1f MB/s\n", threadedTime * 1e3, megabytes / threadedTime);
+	printf("  loadOBJIndexed, 1 thread   : %8.2f ms, %7.1f MB/s\n", indexedTime * 1e3, megabytes / indexedTime);
+}
+
+// indexVBO as it was before the flat hash table : the reference to beat
+struct MapVertex{
+	glm::vec3 position;
+	glm::vec2 uv;
+	glm::vec3 normal;
+	bool operator<(const MapVertex that) const{
+		return memcmp((void*)this, (void*)&that, sizeof(MapVertex))>0;
+	};
+};
+
+static void indexVBO_map(
+	std::vector<glm::vec3> & in_vertices,
+	std::vector<glm::vec2> & in_uvs,
+	std::vector<glm::vec3> & in_normals,
+
+	std::vector<unsigned int> & out_indices,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals
+){
+	std::map<MapVertex,unsigned int> VertexToOutIndex;
+	for ( unsigned int i=0; i<in_vertices.size(); i++ ){
+		MapVertex packed = {in_vertices[i], in_uvs[i], in_normals[i]};
+		std::map<MapVertex,unsigned int>::iterator it = VertexToOutIndex.find(packed);
+		if ( it != VertexToOutIndex.end() ){
+			out_indices.push_back( it->second );
+		}else{
+			out_vertices.push_back( in_vertices[i]);
+			out_uvs     .push_back( in_uvs[i]);
+			out_normals .push_back( in_normals[i]);
+			unsigned int newindex = (unsigned int)out_vertices.size() - 1;
+			out_indices .push_back( newindex );
+			VertexToOutIndex[ packed ] = newindex;
+		}
+	}
+}
+
+static void benchmarkIndexVBO(const char * path, size_t targetCount){
+	std::vector<glm::vec3> meshVertices, meshNormals;
+	std::vector<glm::vec2> meshUVs;
+	if (!loadOBJ(path, meshVertices, meshUVs, meshNormals) || meshVertices.empty())
+		return;
+
+	// Copies of the mesh, each scaled differently, so that they don't share vertices
+	std::vector<glm::vec3> vertices, normals;
+	std::vector<glm::vec2> uvs;
+	size_t copies = (targetCount + meshVertices.size() - 1) / meshVertices.size();
+	for (size_t c = 0; c < copies; c++){
+		float scale = 1.0f + c * 0.001f;
+		for (size_t i = 0; i < meshVertices.size(); i++){
+			vertices.push_back(meshVertices[i] * scale);
+			uvs.push_back(meshUVs[i]);
+			normals.push_back(meshNormals[i]);
+		}
+	}
+
+	std::vector<unsigned int> mapIndices, tableIndices, parallelIndices;
+	std::vector<glm::vec3> mapVertices, tableVertices, parallelVertices, outNormals;
+	std::vector<glm::vec2> outUVs;
+	double mapTime = bestTime([&](){
+		mapIndices.clear(); mapVertices.clear(); outUVs.clear(); outNormals.clear();
+		indexVBO_map(vertices, uvs, normals, mapIndices, mapVertices, outUVs, outNormals);
+	}, 3);
+	double tableTime = bestTime([&](){
+		tableIndices.clear(); tableVertices.clear(); outUVs.clear(); outNormals.clear();
+		indexVBO(vertices, uvs, normals, tableIndices, tableVertices, outUVs, outNormals);
+	});
+	double parallelTime = bestTime([&](){
+		parallelIndices.clear(); parallelVertices.clear(); outUVs.clear(); outNormals.clear();
+		indexVBO_parallel(vertices, uvs, normals, parallelIndices, parallelVertices, outUVs, outNormals);
+	});
+
+	printf("indexVBO on %u copies of %s : %u vertices, %u unique\n",
+		(unsigned int)copies, path, (unsigned int)vertices.size(), (unsigned int)tableVertices.size());
+	printf("  std::map                   : %8.2f ms\n", mapTime * 1e3);
+	printf("  flat hash table            : %8.2f ms, %.1fx faster\n", tableTime * 1e3, mapTime / tableTime);
+	printf("  indexVBO_parallel          : %8.2f ms, %.1fx faster\n", parallelTime * 1e3, mapTime / parallelTime);
+	if (tableIndices != mapIndices || tableVertices != mapVertices || parallelIndices != mapIndices || parallelVertices != mapVertices)
+		printf("  The flat table doesn't give the same vertices as the map !\n");
+}
+
+// A UV sphere, with 2 vertices at each position of its seam (longitude 0),
+// as exporters write UV seams. The poles are single vertices.
+static void makeSeamSphere(unsigned int rings, unsigned int segments, std::vector<unsigned int> & indices, std::vector<glm::vec3> & vertices){
+	vertices.push_back(glm::vec3(0.0f, 1.0f, 0.0f));
+	for (unsigned int r = 1; r < rings; r++){
+		float theta = 3.14159265f * r / rings;
+		for (unsigned int s = 0; s <= segments; s++){
+			float phi = 6.2831853f * (s % segments) / segments;
+			vertices.push_back(glm::vec3(sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi)));
+		}
+	}
+	vertices.push_back(glm::vec3(0.0f, -1.0f, 0.0f));
+
+	unsigned int south = (unsigned int)vertices.size() - 1;
+	for (unsigned int r = 0; r < rings; r++){
+		for (unsigned int s = 0; s < segments; s++){
+			unsigned int a = r == 0 ? 0 : 1 + (r - 1) * (segments + 1) + s;
+			unsigned int b = r == 0 ? 0 : a + 1;
+			unsigned int c = r + 1 == rings ? south : 1 + r * (segments + 1) + s;
+			unsigned int d = r + 1 == rings ? south : c + 1;
+			unsigned int quad[6] = {a, b, c, b, d, c};
+			for (int k = 0; k < 6; k += 3){
+				if (quad[k] == quad[k + 1] || quad[k + 1] == quad[k + 2] || quad[k + 2] == quad[k])
+					continue; // at a pole
+				indices.push_back(quad[k]);
+				indices.push_back(quad[k + 1]);
+				indices.push_back(quad[k + 2]);
+			}
+		}
+	}
+	// Facing outwards
+	for (size_t i = 0; i < indices.size(); i += 3){
+		const glm::vec3 & p0 = vertices[indices[i]], & p1 = vertices[indices[i + 1]], & p2 = vertices[indices[i + 2]];
+		if (glm::dot(glm::cross(p1 - p0, p2 - p0), p0 + p1 + p2) < 0.0f)
+			std::swap(indices[i + 1], indices[i + 2]);
+	}
+}
+
+static void checkSeamSimplification(){
+	std::vector<unsigned int> indices, simplified;
+	std::vector<glm::vec3> vertices;
+	makeSeamSphere(64, 128, indices, vertices);
+
+	float error = 0.0f;
+	double start = now();
+	simplifyMesh(indices, vertices, indices.size() / 10, simplified, &error);
+	double simplifyTime = now() - start;
+
+	// Upside down triangles face the center of the sphere (those along the
+	// seam may be edge-on to it)
+	size_t flipped = 0;
+	for (size_t i = 0; i < simplified.size(); i += 3){
+		const glm::vec3 & p0 = vertices[simplified[i]], & p1 = vertices[simplified[i + 1]], & p2 = vertices[simplified[i + 2]];
+		flipped += glm::dot(glm::cross(p1 - p0, p2 - p0), p0 + p1 + p2) < 0.0f;
+	}
+
+	// Once the 2 sides of the seam are welded, every edge must have its opposite
+	std::vector<unsigned int> welded(vertices.size());
+	std::map<std::pair<float, std::pair<float, float> >, unsigned int> positions;
+	for (size_t v = 0; v < vertices.size(); v++){
+		std::pair<float, std::pair<float, float> > key(vertices[v].x, std::make_pair(vertices[v].y, vertices[v].z));
+		welded[v] = positions.insert(std::make_pair(key, (unsigned int)v)).first->second;
+	}
+	std::set<std::pair<unsigned int, unsigned int> > edges;
+	for (size_t i = 0; i < simplified.size(); i += 3){
+		for (int k = 0; k < 3; k++)
+			edges.insert(std::make_pair(welded[simplified[i + k]], welded[simplified[i + (k + 1) % 3]]));
+	}
+	size_t openEdges = 0;
+	for (std::set<std::pair<unsigned int, unsigned int> >::iterator it = edges.begin(); it != edges.end(); ++it)
+		openEdges += edges.count(std::make_pair(it->second, it->first)) == 0;
+
+	printf("simplifyMesh on a sphere with a UV seam : %u -> %u triangles in %.2f ms, error %f\n",
+		(unsigned int)(indices.size() / 3), (unsigned int)(simplified.size() / 3), simplifyTime * 1e3, error);
+	printf("  %u triangles upside down, %u open edges\n", (unsigned int)flipped, (unsigned int)openEdges);
+}
+
+static void benchmarkMeshletCulling(const char * path){
+	MappedFile file;
+	if (!file.open(path)){
+		printf("%s could not be opened\n", path);
+		return;
+	}
+	// As render2texture caches it, but in memory
+	unsigned int flags = MESH_CACHE_INDEXED | MESH_CACHE_MESHLETS;
+	std::vector<unsigned char> blob;
+	CachedMesh mesh;
+	if (!buildMeshCacheBlob((const char *)file.data(), file.size(), flags, blob) ||
+		!bindMeshCacheBlob(blob.data(), blob.size(), flags, mesh))
+		return;
+
+	struct Camera{
+		const char * name;
+		glm::vec3 position;
+	};
+	const Camera cameras[] = {
+		{"front, whole mesh in view", glm::vec3(0.0f, 0.0f, 5.0f)},
+		{"tutorial camera", glm::vec3(4.0f, 3.0f, 3.0f)},
+		{"behind", glm::vec3(0.0f, 0.0f, -5.0f)},
+		{"close up, partly out of view", glm::vec3(0.8f, 0.3f, 1.6f)},
+	};
+	glm::mat4 projection = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 100.0f);
+
+	printf("cullMeshlets on %s : %u triangles in %u meshlets\n", path, mesh.indexCount / 3, mesh.meshletCount);
+	std::vector<unsigned int> visible;
+	for (size_t c = 0; c < sizeof(cameras) / sizeof(cameras[0]); c++){
+		glm::mat4 mvp = projection * glm::lookAt(cameras[c].position, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+		size_t surviving = 0;
+		double cullTime = bestTime([&](){
+			surviving = cullMeshlets(mesh.meshlets, mesh.meshletCount, mvp, cameras[c].position, visible);
+		});
+		// What a perfect per-triangle backface test would keep, for comparison
+		size_t frontFacing = 0;
+		for (unsigned int i = 0; i < mesh.indexCount; i += 3){
+			glm::vec3 p0 = mesh.vertices[mesh.index(i)], p1 = mesh.vertices[mesh.index(i + 1)], p2 = mesh.vertices[mesh.index(i + 2)];
+			frontFacing += glm::dot(glm::cross(p1 - p0, p2 - p0), cameras[c].position - p0) > 0.0f;
+		}
+		printf("  %-29s: %5u triangles kept (%4.1f%%) in %3u meshlets, %u front-facing, %.2f us\n",
+			cameras[c].name, (unsigned int)surviving, 100.0 * surviving / (mesh.indexCount / 3),
+			(unsigned int)visible.size(), (unsigned int)frontFacing, cullTime * 1e6);
+	}
+}
+
+int main(int argc, char ** argv)
+{
+	std::string grid;
+	makeGridOBJ(700, grid);
+	benchmarkOBJ("Synthetic grid", grid.data(), grid.size());
+
+	for (int i = 1; i < argc; i++){
+		MappedFile file;
+		if (!file.open(argv[i])){
+			printf("%s could not be opened\n", argv[i]);
+			continue;
+		}
+		benchmarkOBJ(argv[i], (const char *)file.data(), file.size());
+	}
+
+	benchmarkIndexVBO("../basic_shading/data/suzanne.obj", 1000000);
+	checkSeamSimplification();
+	benchmarkMeshletCulling("../basic_shading/data/suzanne.obj");
+	return 0;
+}
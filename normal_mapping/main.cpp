@@ -25,6 +25,8 @@ using namespace glm;
 #include <common/controls.hpp>
 #include <common/objloader.hpp>
 #include <common/vboindexer.hpp>
+#include <common/meshcache.hpp>
+#include <common/vertexformat.hpp>
 #include <common/tangentspace.hpp>
 
 int main( void )
@@ -96,77 +98,46 @@ int main( void )
 	GLuint ModelMatrixID = glGetUniformLocation(programID, "M");
 	GLuint ModelView3x3MatrixID = glGetUniformLocation(programID, "MV3x3");
 
-	// Load the texture
-	GLuint DiffuseTexture = loadDDS("data/diffuse.DDS");
-	GLuint NormalTexture = loadBMP_custom("data/normal.bmp");
-	GLuint SpecularTexture = loadDDS("data/specular.DDS");
+	// Load the textures in the background : they are read on worker threads,
+	// and uploaded a few megabytes per frame. Until then, they are black.
+	TextureLoader textureLoader;
+	TextureHandle DiffuseHandle = textureLoader.load("data/diffuse.DDS");
+	TextureHandle NormalHandle = textureLoader.load("data/normal.bmp", MIPMAP_NORMAL_MAP);
+	TextureHandle SpecularHandle = textureLoader.load("data/specular.DDS");
 	
 	// Get a handle for our "myTextureSampler" uniform
 	GLuint DiffuseTextureID  = glGetUniformLocation(programID, "shaders/DiffuseTextureSampler");
 	GLuint NormalTextureID  = glGetUniformLocation(programID, "shaders/NormalTextureSampler");
 	GLuint SpecularTextureID  = glGetUniformLocation(programID, "shaders/SpecularTextureSampler");
 
-	// Read our .obj file
-	std::vector<glm::vec3> vertices;
-	std::vector<glm::vec2> uvs;
-	std::vector<glm::vec3> normals;
-	bool res = loadOBJ("data/cylinder.obj", vertices, uvs, normals);
-
-	std::vector<glm::vec3> tangents;
-	std::vector<glm::vec3> bitangents;
-	computeTangentBasis(
-		vertices, uvs, normals, // input
-		tangents, bitangents    // output
-	);
-
-	std::vector<unsigned short> indices;
-	std::vector<glm::vec3> indexed_vertices;
-	std::vector<glm::vec2> indexed_uvs;
-	std::vector<glm::vec3> indexed_normals;
-	std::vector<glm::vec3> indexed_tangents;
-	std::vector<glm::vec3> indexed_bitangents;
-	indexVBO_TBN(
-		vertices, uvs, normals, tangents, bitangents, 
-		indices, indexed_vertices, indexed_uvs, indexed_normals, indexed_tangents, indexed_bitangents
-	);
+	// Read our .obj file, with its tangent basis and already indexed, from its binary cache.
+	// The vertices are compact and interleaved, with the tangent frame as a QTangent.
+	CachedMesh mesh;
+	bool res = loadOBJCached("data/cylinder.obj", MESH_CACHE_INDEXED | MESH_CACHE_TANGENTS | MESH_CACHE_INTERLEAVED, mesh, VERTEX_FORMAT_COMPACT | VERTEX_QTANGENTS);
 
 	// Load it into a VBO
 
 	GLuint vertexbuffer;
 	glGenBuffers(1, &vertexbuffer);
 	glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-	glBufferData(GL_ARRAY_BUFFER, indexed_vertices.size() * sizeof(glm::vec3), &indexed_vertices[0], GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, mesh.vertexCount * mesh.layout.stride, mesh.interleaved, GL_STATIC_DRAW);
 
-	GLuint uvbuffer;
-	glGenBuffers(1, &uvbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, uvbuffer);
-	glBufferData(GL_ARRAY_BUFFER, indexed_uvs.size() * sizeof(glm::vec2), &indexed_uvs[0], GL_STATIC_DRAW);
+	// The VAO remembers where every attribute is in the buffer
+	setupVertexAttributes(mesh.layout);
 
-	GLuint normalbuffer;
-	glGenBuffers(1, &normalbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
-	glBufferData(GL_ARRAY_BUFFER, indexed_normals.size() * sizeof(glm::vec3), &indexed_normals[0], GL_STATIC_DRAW);
-
-	GLuint tangentbuffer;
-	glGenBuffers(1, &tangentbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, tangentbuffer);
-	glBufferData(GL_ARRAY_BUFFER, indexed_tangents.size() * sizeof(glm::vec3), &indexed_tangents[0], GL_STATIC_DRAW);
-
-	GLuint bitangentbuffer;
-	glGenBuffers(1, &bitangentbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, bitangentbuffer);
-	glBufferData(GL_ARRAY_BUFFER, indexed_bitangents.size() * sizeof(glm::vec3), &indexed_bitangents[0], GL_STATIC_DRAW);
-
-	// Generate a buffer for the indices as well
+	// Generate a buffer for the indices as well (also remembered by the VAO)
 	GLuint elementbuffer;
 	glGenBuffers(1, &elementbuffer);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned short), &indices[0], GL_STATIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.indexCount * mesh.indexSize, mesh.indices, GL_STATIC_DRAW);
 
 	// Get a handle for our "LightPosition" uniform
 	glUseProgram(programID);
 	GLuint LightID = glGetUniformLocation(programID, "LightPosition_worldspace");
 
+	// How the shader decodes positions and UVs
+	setVertexLayoutUniforms(programID, mesh.layout);
+
 	// For speed computation
 	double lastTime = glfwGetTime();
 	int nbFrames = 0;
@@ -183,6 +154,12 @@ int main( void )
 			lastTime += 1.0;
 		}
 
+		// Upload the next part of the textures still loading
+		textureLoader.update();
+		GLuint DiffuseTexture = textureLoader.texture(DiffuseHandle);
+		GLuint NormalTexture = textureLoader.texture(NormalHandle);
+		GLuint SpecularTexture = textureLoader.texture(SpecularHandle);
+
 		// Clear the screen
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -229,83 +206,14 @@ int main( void )
 		glUniform1i(SpecularTextureID, 2);
 
 
-		// 1rst attribute buffer : vertices
-		glEnableVertexAttribArray(0);
-		glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-		glVertexAttribPointer(
-			0,                  // attribute
-			3,                  // size
-			GL_FLOAT,           // type
-			GL_FALSE,           // normalized?
-			0,                  // stride
-			(void*)0            // array buffer offset
-		);
-
-		// 2nd attribute buffer : UVs
-		glEnableVertexAttribArray(1);
-		glBindBuffer(GL_ARRAY_BUFFER, uvbuffer);
-		glVertexAttribPointer(
-			1,                                // attribute
-			2,                                // size
-			GL_FLOAT,                         // type
-			GL_FALSE,                         // normalized?
-			0,                                // stride
-			(void*)0                          // array buffer offset
-		);
-
-		// 3rd attribute buffer : normals
-		glEnableVertexAttribArray(2);
-		glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
-		glVertexAttribPointer(
-			2,                                // attribute
-			3,                                // size
-			GL_FLOAT,                         // type
-			GL_FALSE,                         // normalized?
-			0,                                // stride
-			(void*)0                          // array buffer offset
-		);
-
-		// 4th attribute buffer : tangents
-		glEnableVertexAttribArray(3);
-		glBindBuffer(GL_ARRAY_BUFFER, tangentbuffer);
-		glVertexAttribPointer(
-			3,                                // attribute
-			3,                                // size
-			GL_FLOAT,                         // type
-			GL_FALSE,                         // normalized?
-			0,                                // stride
-			(void*)0                          // array buffer offset
-		);
-
-		// 5th attribute buffer : bitangents
-		glEnableVertexAttribArray(4);
-		glBindBuffer(GL_ARRAY_BUFFER, bitangentbuffer);
-		glVertexAttribPointer(
-			4,                                // attribute
-			3,                                // size
-			GL_FLOAT,                         // type
-			GL_FALSE,                         // normalized?
-			0,                                // stride
-			(void*)0                          // array buffer offset
-		);
-
-		// Index buffer
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
-
 		// Draw the triangles !
 		glDrawElements(
 			GL_TRIANGLES,      // mode
-			indices.size(),    // count
-			GL_UNSIGNED_SHORT, // type
+			mesh.indexCount,   // count
+			mesh.indexSize == 4 ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT, // type
 			(void*)0           // element array buffer offset
 		);
 
-		glDisableVertexAttribArray(0);
-		glDisableVertexAttribArray(1);
-		glDisableVertexAttribArray(2);
-		glDisableVertexAttribArray(3);
-		glDisableVertexAttribArray(4);
-
 
 		////////////////////////////////////////////////////////
 		// DEBUG ONLY !!!
@@ -326,10 +234,11 @@ int main( void )
 		// normals
 		glColor3f(0,0,1);
 		glBegin(GL_LINES);
-		for (unsigned int i=0; i<indices.size(); i++){
-			glm::vec3 p = indexed_vertices[indices[i]];
+		for (unsigned int i=0; i<mesh.indexCount; i++){
+			glm::vec3 p, o;
+			unpackVertex(mesh.layout, mesh.interleaved, mesh.index(i), &p, NULL, &o, NULL, NULL);
 			glVertex3fv(&p.x);
-			glm::vec3 o = glm::normalize(indexed_normals[indices[i]]);
+			o = glm::normalize(o);
 			p+=o*0.1f;
 			glVertex3fv(&p.x);
 		}
@@ -337,10 +246,11 @@ int main( void )
 		// tangents
 		glColor3f(1,0,0);
 		glBegin(GL_LINES);
-		for (unsigned int i=0; i<indices.size(); i++){
-			glm::vec3 p = indexed_vertices[indices[i]];
+		for (unsigned int i=0; i<mesh.indexCount; i++){
+			glm::vec3 p, o;
+			unpackVertex(mesh.layout, mesh.interleaved, mesh.index(i), &p, NULL, NULL, &o, NULL);
 			glVertex3fv(&p.x);
-			glm::vec3 o = glm::normalize(indexed_tangents[indices[i]]);
+			o = glm::normalize(o);
 			p+=o*0.1f;
 			glVertex3fv(&p.x);
 		}
@@ -348,10 +258,11 @@ int main( void )
 		// bitangents
 		glColor3f(0,1,0);
 		glBegin(GL_LINES);
-		for (unsigned int i=0; i<indices.size(); i++){
-			glm::vec3 p = indexed_vertices[indices[i]];
+		for (unsigned int i=0; i<mesh.indexCount; i++){
+			glm::vec3 p, o;
+			unpackVertex(mesh.layout, mesh.interleaved, mesh.index(i), &p, NULL, NULL, NULL, &o);
 			glVertex3fv(&p.x);
-			glm::vec3 o = glm::normalize(indexed_bitangents[indices[i]]);
+			o = glm::normalize(o);
 			p+=o*0.1f;
 			glVertex3fv(&p.x);
 		}
@@ -378,15 +289,15 @@ int main( void )
 
 	// Cleanup VBO and shader
 	glDeleteBuffers(1, &vertexbuffer);
-	glDeleteBuffers(1, &uvbuffer);
-	glDeleteBuffers(1, &normalbuffer);
-	glDeleteBuffers(1, &tangentbuffer);
-	glDeleteBuffers(1, &bitangentbuffer);
 	glDeleteBuffers(1, &elementbuffer);
 	glDeleteProgram(programID);
+	GLuint DiffuseTexture = textureLoader.texture(DiffuseHandle);
+	GLuint NormalTexture = textureLoader.texture(NormalHandle);
+	GLuint SpecularTexture = textureLoader.texture(SpecularHandle);
 	glDeleteTextures(1, &DiffuseTexture);
 	glDeleteTextures(1, &NormalTexture);
 	glDeleteTextures(1, &SpecularTexture);
+	textureLoader.release();
 	glDeleteVertexArrays(1, &VertexArrayID);
 
 	// Close OpenGL window and terminate GLFW
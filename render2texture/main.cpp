@@ -25,6 +25,11 @@ using namespace glm;
 #include <common/controls.hpp>
 #include <common/objloader.hpp>
 #include <common/vboindexer.hpp>
+#include <common/meshcache.hpp>
+#include <common/vertexformat.hpp>
+#include <common/assetarchive.hpp>
+#include <common/meshsimplify.hpp>
+#include <common/meshlet.hpp>
 
 int main( void )
 {
@@ -91,8 +96,13 @@ int main( void )
 	glGenVertexArrays(1, &VertexArrayID);
 	glBindVertexArray(VertexArrayID);
 
+	// Everything comes from data/assets.pak if asset_packer made it, from the
+	// separate files otherwise. The mesh points into the archive : keep it open.
+	AssetArchive assets;
+	assets.open("data/assets.pak");
+
 	// Create and compile our GLSL program from the shaders
-	GLuint programID = LoadShaders( "shaders/StandardShadingRTT.vertexshader", "shaders/StandardShadingRTT.fragmentshader" );
+	GLuint programID = assets.loadShaders( "shaders/StandardShadingRTT.vertexshader", "shaders/StandardShadingRTT.fragmentshader" );
 
 	// Get a handle for our "MVP" uniform
 	GLuint MatrixID = glGetUniformLocation(programID, "MVP");
@@ -100,50 +110,38 @@ int main( void )
 	GLuint ModelMatrixID = glGetUniformLocation(programID, "M");
 
 	// Load the texture
-	GLuint Texture = loadDDS("data/uvmap.DDS");
+	GLuint Texture = assets.loadTexture("data/uvmap.DDS");
 	
 	// Get a handle for our "myTextureSampler" uniform
 	GLuint TextureID  = glGetUniformLocation(programID, "myTextureSampler");
 
-	// Read our .obj file
-	std::vector<glm::vec3> vertices;
-	std::vector<glm::vec2> uvs;
-	std::vector<glm::vec3> normals;
-	bool res = loadOBJ("data/suzanne.obj", vertices, uvs, normals);
-
-	std::vector<unsigned short> indices;
-	std::vector<glm::vec3> indexed_vertices;
-	std::vector<glm::vec2> indexed_uvs;
-	std::vector<glm::vec3> indexed_normals;
-	indexVBO(vertices, uvs, normals, indices, indexed_vertices, indexed_uvs, indexed_normals);
+	// Read our .obj file, already indexed, with its levels of detail, its meshlets, and as compact interleaved vertices, from its binary cache
+	CachedMesh mesh;
+	bool res = assets.loadMesh("data/suzanne.obj", MESH_CACHE_INDEXED | MESH_CACHE_INTERLEAVED | MESH_CACHE_LODS | MESH_CACHE_MESHLETS, mesh, VERTEX_FORMAT_COMPACT);
 
 	// Load it into a VBO
 
 	GLuint vertexbuffer;
 	glGenBuffers(1, &vertexbuffer);
 	glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-	glBufferData(GL_ARRAY_BUFFER, indexed_vertices.size() * sizeof(glm::vec3), &indexed_vertices[0], GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, mesh.vertexCount * mesh.layout.stride, mesh.interleaved, GL_STATIC_DRAW);
 
-	GLuint uvbuffer;
-	glGenBuffers(1, &uvbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, uvbuffer);
-	glBufferData(GL_ARRAY_BUFFER, indexed_uvs.size() * sizeof(glm::vec2), &indexed_uvs[0], GL_STATIC_DRAW);
+	// The VAO remembers where every attribute is in the buffer
+	setupVertexAttributes(mesh.layout);
 
-	GLuint normalbuffer;
-	glGenBuffers(1, &normalbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
-	glBufferData(GL_ARRAY_BUFFER, indexed_normals.size() * sizeof(glm::vec3), &indexed_normals[0], GL_STATIC_DRAW);
-
-	// Generate a buffer for the indices as well
+	// Generate a buffer for the indices as well (also remembered by the VAO)
 	GLuint elementbuffer;
 	glGenBuffers(1, &elementbuffer);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned short), &indices[0], GL_STATIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.indexCount * mesh.indexSize, mesh.indices, GL_STATIC_DRAW);
 
 	// Get a handle for our "LightPosition" uniform
 	glUseProgram(programID);
 	GLuint LightID = glGetUniformLocation(programID, "LightPosition_worldspace");
 
+	// How the shader decodes positions and UVs
+	setVertexLayoutUniforms(programID, mesh.layout);
+
 
 	// ---------------------------------------------
 	// Render to Texture - specific code begins here
@@ -213,15 +211,24 @@ int main( void )
 		 1.0f,  1.0f, 0.0f,
 	};
 
+	// The quad has its own vertex array object, so that the mesh's one is left alone
+	GLuint quad_VertexArrayID;
+	glGenVertexArrays(1, &quad_VertexArrayID);
+
 	GLuint quad_vertexbuffer;
 	glGenBuffers(1, &quad_vertexbuffer);
 	glBindBuffer(GL_ARRAY_BUFFER, quad_vertexbuffer);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(g_quad_vertex_buffer_data), g_quad_vertex_buffer_data, GL_STATIC_DRAW);
 
 	// Create and compile our GLSL program from the shaders
-	GLuint quad_programID = LoadShaders( "shaders/Passthrough.vertexshader", "shaders/WobblyTexture.fragmentshader" );
+	GLuint quad_programID = assets.loadShaders( "shaders/Passthrough.vertexshader", "shaders/WobblyTexture.fragmentshader" );
 	GLuint texID = glGetUniformLocation(quad_programID, "renderedTexture");
 	GLuint timeID = glGetUniformLocation(quad_programID, "time");
+
+	// The draw ranges of the meshlets that survive culling, rebuilt each frame
+	std::vector<unsigned int> visibleMeshlets;
+	std::vector<GLsizei> meshletCounts;
+	std::vector<const void*> meshletOffsets;
     
 	
 	do{
@@ -257,56 +264,42 @@ int main( void )
 		// Set our "myTextureSampler" sampler to use Texture Unit 0
 		glUniform1i(TextureID, 0);
 
-		// 1rst attribute buffer : vertices
-		glEnableVertexAttribArray(0);
-		glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-		glVertexAttribPointer(
-			0,                  // attribute
-			3,                  // size
-			GL_FLOAT,           // type
-			GL_FALSE,           // normalized?
-			0,                  // stride
-			(void*)0            // array buffer offset
-		);
-
-		// 2nd attribute buffer : UVs
-		glEnableVertexAttribArray(1);
-		glBindBuffer(GL_ARRAY_BUFFER, uvbuffer);
-		glVertexAttribPointer(
-			1,                                // attribute
-			2,                                // size
-			GL_FLOAT,                         // type
-			GL_FALSE,                         // normalized?
-			0,                                // stride
-			(void*)0                          // array buffer offset
-		);
-
-		// 3rd attribute buffer : normals
-		glEnableVertexAttribArray(2);
-		glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
-		glVertexAttribPointer(
-			2,                                // attribute
-			3,                                // size
-			GL_FLOAT,                         // type
-			GL_FALSE,                         // normalized?
-			0,                                // stride
-			(void*)0                          // array buffer offset
-		);
-
-		// Index buffer
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
-
-		// Draw the triangles !
-		glDrawElements(
-			GL_TRIANGLES,      // mode
-			indices.size(),    // count
-			GL_UNSIGNED_SHORT, // type
-			(void*)0           // element array buffer offset
-		);
-
-		glDisableVertexAttribArray(0);
-		glDisableVertexAttribArray(1);
-		glDisableVertexAttribArray(2);
+		// Vertex attributes and index buffer
+		glBindVertexArray(VertexArrayID);
+
+		// The further the mesh, the coarser the level of detail, as long as
+		// the simplification stays under a pixel on screen
+		glm::vec3 cameraPosition = glm::vec3(glm::inverse(ViewMatrix)[3]);
+		glm::vec3 meshPosition = glm::vec3(ModelMatrix[3]);
+		size_t lod = selectLOD(mesh.lods, mesh.lodCount, ProjectionMatrix, glm::distance(cameraPosition, meshPosition), (float)windowHeight);
+
+		if (lod == 0 && mesh.meshletCount > 0){
+			// Full detail : only the meshlets that can be seen, in one call
+			glm::vec3 cameraInModel = glm::vec3(glm::inverse(ModelMatrix) * glm::vec4(cameraPosition, 1.0f));
+			cullMeshlets(mesh.meshlets, mesh.meshletCount, MVP, cameraInModel, visibleMeshlets);
+			meshletCounts.resize(visibleMeshlets.size());
+			meshletOffsets.resize(visibleMeshlets.size());
+			for (size_t i = 0; i < visibleMeshlets.size(); i++){
+				const Meshlet & meshlet = mesh.meshlets[visibleMeshlets[i]];
+				meshletCounts[i] = meshlet.indexCount;
+				meshletOffsets[i] = (const void*)((size_t)meshlet.firstIndex * mesh.indexSize);
+			}
+			glMultiDrawElements(
+				GL_TRIANGLES,
+				meshletCounts.data(),
+				mesh.indexSize == 4 ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT,
+				meshletOffsets.data(),
+				(GLsizei)visibleMeshlets.size()
+			);
+		}else{
+			// Draw the triangles !
+			glDrawElements(
+				GL_TRIANGLES,      // mode
+				mesh.lods[lod].indexCount, // count
+				mesh.indexSize == 4 ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT, // type
+				(void*)((size_t)mesh.lods[lod].firstIndex * mesh.indexSize) // element array buffer offset
+			);
+		}
 
 
 
@@ -330,6 +323,7 @@ int main( void )
 		glUniform1f(timeID, (float)(glfwGetTime()*10.0f) );
 
 		// 1rst attribute buffer : vertices
+		glBindVertexArray(quad_VertexArrayID);
 		glEnableVertexAttribArray(0);
 		glBindBuffer(GL_ARRAY_BUFFER, quad_vertexbuffer);
 		glVertexAttribPointer(
@@ -357,8 +351,6 @@ int main( void )
 
 	// Cleanup VBO and shader
 	glDeleteBuffers(1, &vertexbuffer);
-	glDeleteBuffers(1, &uvbuffer);
-	glDeleteBuffers(1, &normalbuffer);
 	glDeleteBuffers(1, &elementbuffer);
 	glDeleteProgram(programID);
 	glDeleteTextures(1, &Texture);
@@ -367,6 +359,7 @@ int main( void )
 	glDeleteTextures(1, &renderedTexture);
 	glDeleteRenderbuffers(1, &depthrenderbuffer);
 	glDeleteBuffers(1, &quad_vertexbuffer);
+	glDeleteVertexArrays(1, &quad_VertexArrayID);
 	glDeleteVertexArrays(1, &VertexArrayID);
 
 
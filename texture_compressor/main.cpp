@@ -0,0 +1,347 @@
+// Compresses images into .DDS files with their mipmaps, offline :
+//   texture_compressor input.bmp output.dds [bc1|bc3|bc5] [normal]
+// Without arguments, measures the compressor, the mipmap generator and the
+// decompressor on the textures of the tutorials, and checks one against the other.
+// The mipmaps are also made by the driver, with glGenerateMipmap in a hidden
+// window, to compare with : skipped if no GL context can be created.
+// The residency decisions of TextureStreamer are checked first, without a GPU :
+// the exit code is 1 if they are wrong.
+
+// Include standard headers
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <vector>
+
+// Include GLEW
+#include <GL/glew.h>
+
+// Include GLFW, for the context of the glGenerateMipmap baseline
+#include <GLFW/glfw3.h>
+
+#include <common/threadpool.hpp>
+#include <common/hash.hpp>
+#include <common/texture.hpp>
+#include <common/blockcompress.hpp>
+#include <common/texturestreamer.hpp>
+
+static double now(){
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static const char * formatNames[] = {"BC1", "BC3", "BC5"};
+
+static bool readImage(const char * path, TextureData & image){
+	size_t length = strlen(path);
+	bool dds = length >= 4 && (strcmp(path + length - 4, ".dds") == 0 || strcmp(path + length - 4, ".DDS") == 0);
+	return dds ? readDDS(path, image) : readBMP(path, image);
+}
+
+static size_t blockCount(const TextureData & texture){
+	size_t count = 0;
+	for (size_t level = 0; level < texture.levels.size(); level++)
+		count += (size_t)((texture.levels[level].width + 3) / 4) * ((texture.levels[level].height + 3) / 4);
+	return count;
+}
+
+static void benchmark(const char * path, BlockFormat format, bool normalMap){
+	TextureData image;
+	if (!readImage(path, image))
+		return;
+
+	TextureData compressed;
+	double psnr = 0.0;
+	double start = now();
+	if (!compressTexture(image, format, normalMap, compressed, 1, &psnr))
+		return;
+	double singleTime = now() - start;
+	start = now();
+	compressTexture(image, format, normalMap, compressed);
+	double threadedTime = now() - start;
+
+	// The decoder, as the GPU would see the texture, must find the same error
+	TextureData decoded;
+	decompressTexture(compressed, decoded);
+	int channels = format == BLOCK_BC1 ? 3 : format == BLOCK_BC3 ? 4 : 2;
+	const TextureLevel & level = image.levels[0];
+	size_t rowSize = level.size / level.height;
+	int pixelSize = image.format == GL_BGR || image.format == GL_RGB ? 3 : 4;
+	bool swapRB = image.format == GL_BGR || image.format == GL_BGRA;
+	double error = 0.0;
+	for (unsigned int y = 0; y < level.height; y++){
+		for (unsigned int x = 0; x < level.width; x++){
+			const unsigned char * in = image.levelData(0, 0) + y * rowSize + x * pixelSize;
+			const unsigned char * out = decoded.pixelData() + ((size_t)y * level.width + x) * 4;
+			int source[4] = {in[swapRB ? 2 : 0], in[1], in[swapRB ? 0 : 2], pixelSize == 4 ? in[3] : 255};
+			for (int c = 0; c < channels; c++)
+				error += (double)(out[c] - source[c]) * (out[c] - source[c]);
+		}
+	}
+	double decodedPSNR = 10.0 * log10(255.0 * 255.0 / (error / ((double)level.width * level.height * channels) + 1e-10));
+
+	size_t blocks = blockCount(compressed);
+	printf("  %s : %u blocks with mipmaps, PSNR %.2f dB (decoded : %.2f dB)\n", formatNames[format], (unsigned int)blocks, psnr, decodedPSNR);
+	printf("    1 thread   : %8.2f Mblocks/s (%.1f ms)\n", blocks / singleTime * 1e-6, singleTime * 1e3);
+	printf("    %u threads : %8.2f Mblocks/s (%.1f ms)\n", ThreadPool::global().size() + 1, blocks / threadedTime * 1e-6, threadedTime * 1e3);
+}
+
+// Builds the mipmaps of an image on the CPU, as loadBMP_custom does. The
+// hash of the pixels must be the same on every machine.
+static void benchmarkMipmaps(const char * path){
+	TextureData image;
+	if (!readImage(path, image))
+		return;
+	const unsigned int flags[] = {MIPMAP_SRGB, MIPMAP_SRGB | MIPMAP_KAISER, MIPMAP_NORMAL_MAP};
+	const char * names[] = {"sRGB box", "sRGB Kaiser", "normal box"};
+	for (size_t i = 0; i < sizeof(flags) / sizeof(flags[0]); i++){
+		TextureData mipmapped;
+		double start = now();
+		if (!generateMipmaps(image, flags[i], mipmapped, 1))
+			return;
+		double singleTime = now() - start;
+		start = now();
+		generateMipmaps(image, flags[i], mipmapped);
+		double threadedTime = now() - start;
+		size_t pixels = (size_t)image.levels[0].width * image.levels[0].height;
+		printf("  mipmaps, %-11s : %u levels, pixels hash %016llx\n", names[i], (unsigned int)mipmapped.levels.size(),
+			hash64(mipmapped.pixelData(), mipmapped.layerSize * mipmapped.layers));
+		printf("    1 thread   : %8.2f Mpixels/s (%.2f ms)\n", pixels / singleTime * 1e-6, singleTime * 1e3);
+		printf("    %u threads : %8.2f Mpixels/s (%.2f ms)\n", ThreadPool::global().size() + 1, pixels / threadedTime * 1e-6, threadedTime * 1e3);
+	}
+}
+
+// A hidden window, for its GL context. NULL if there is none.
+static GLFWwindow * createHiddenContext(){
+	if (!glfwInit())
+		return NULL;
+	glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE); // To make MacOS happy; should not be needed
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	GLFWwindow * window = glfwCreateWindow(64, 64, "texture_compressor", NULL, NULL);
+	if (!window){
+		glfwTerminate();
+		return NULL;
+	}
+	glfwMakeContextCurrent(window);
+	glewExperimental = true; // Needed for core profile
+	if (glewInit() != GLEW_OK){
+		glfwDestroyWindow(window);
+		glfwTerminate();
+		return NULL;
+	}
+	return window;
+}
+
+// The same mipmaps, ready to sample, both ways : generateMipmaps and
+// uploadTexture (as loadBMP_custom), or level 0 uploaded and glGenerateMipmap.
+// glFinish waits for the driver, which may build the levels lazily otherwise.
+// Best of a few runs : the first ones also pay for the driver warming up.
+static void benchmarkGPUMipmaps(const char * path){
+	TextureData image;
+	if (!readImage(path, image) || image.compressed)
+		return;
+	const TextureLevel & level = image.levels[0];
+	size_t pixels = (size_t)level.width * level.height;
+	const unsigned int flags[] = {MIPMAP_SRGB, MIPMAP_NORMAL_MAP};
+	const GLenum internalFormats[] = {GL_SRGB8_ALPHA8, GL_RGBA8};
+	const char * names[] = {"sRGB box", "normal box"};
+	for (size_t i = 0; i < sizeof(flags) / sizeof(flags[0]); i++){
+		double cpuTime = 1e30, gpuTime = 1e30;
+		for (int run = 0; run < 5; run++){
+			double start = now();
+			TextureData mipmapped;
+			if (!generateMipmaps(image, flags[i], mipmapped))
+				return;
+			GLuint texture = uploadTexture(mipmapped);
+			glFinish();
+			double time = now() - start;
+			cpuTime = time < cpuTime ? time : cpuTime;
+			glDeleteTextures(1, &texture);
+
+			start = now();
+			glGenTextures(1, &texture);
+			glBindTexture(GL_TEXTURE_2D, texture);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4); // BMP rows are padded to 4 bytes
+			glTexImage2D(GL_TEXTURE_2D, 0, internalFormats[i], level.width, level.height, 0, image.format, GL_UNSIGNED_BYTE, image.levelData(0, 0));
+			glGenerateMipmap(GL_TEXTURE_2D);
+			glFinish();
+			time = now() - start;
+			gpuTime = time < gpuTime ? time : gpuTime;
+			glDeleteTextures(1, &texture);
+		}
+		printf("  mipmaps and upload, %-10s : generateMipmaps %8.2f Mpixels/s (%.2f ms), glGenerateMipmap %8.2f Mpixels/s (%.2f ms)\n",
+			names[i], pixels / cpuTime * 1e-6, cpuTime * 1e3, pixels / gpuTime * 1e-6, gpuTime * 1e3);
+	}
+}
+
+// Drives MipResidency as TextureStreamer would, with textures of 1024x1024
+// RGBA texels whose tails are their 64x64 levels and below
+static bool checkMipResidency(){
+	std::vector<size_t> levelBytes;
+	for (unsigned int size = 1024; size > 0; size /= 2)
+		levelBytes.push_back((size_t)size * size * 4);
+	const unsigned int tail = 4;
+	bool passed = true;
+	auto check = [&](bool condition, const char * what){
+		if (!condition){
+			printf("  MipResidency FAILED : %s\n", what);
+			passed = false;
+		}
+	};
+	// Pages in or out whatever changed, as TextureStreamer::update does
+	auto applyChanges = [](MipResidency & residency){
+		std::vector<unsigned int> changes = residency.changes();
+		for (unsigned int id : changes)
+			residency.setResident(id, residency.targetLevel(id));
+	};
+
+	// Room for the tails, levels 1 to 3 of one texture and 2 to 3 of another :
+	// the most important texture gets level 1, the next one level 2, the last
+	// one only its tail, and level 0 fits nowhere
+	{
+		MipResidency residency(1 << 20, 30);
+		unsigned int ids[3];
+		for (int i = 0; i < 3; i++)
+			ids[i] = residency.add(levelBytes, tail);
+		size_t tailBytes = residency.chainBytes(ids[0], tail);
+		residency.setBudget(3 * tailBytes + (residency.chainBytes(ids[0], 1) - tailBytes) + (residency.chainBytes(ids[0], 2) - tailBytes));
+		const float priorities[3] = {1.0f, 3.0f, 2.0f};
+		for (int i = 0; i < 3; i++)
+			residency.request(ids[i], 0.0f, priorities[i]);
+		residency.update();
+		check(residency.targetLevel(ids[1]) == 1 && residency.targetLevel(ids[2]) == 2 && residency.targetLevel(ids[0]) == tail,
+			"levels don't go to the most important textures first");
+		check(residency.targetBytes() <= residency.budget(), "the targets are over budget");
+		check(residency.changes().size() == 2 && residency.changes()[0] == ids[1] && residency.changes()[1] == ids[2],
+			"the most important texture isn't paged in first");
+		applyChanges(residency);
+		check(residency.residentBytes() <= residency.budget(), "the resident levels are over budget");
+
+		// Over budget, the tails stay : only the finer levels go
+		residency.setBudget(0);
+		for (int i = 0; i < 3; i++)
+			residency.request(ids[i], 0.0f, priorities[i]);
+		residency.update();
+		for (int i = 0; i < 3; i++)
+			check(residency.targetLevel(ids[i]) == tail, "a texture lost its tail, or kept levels over budget");
+		check(residency.changes().size() == 2, "levels over budget aren't paged out");
+		applyChanges(residency);
+		check(residency.residentBytes() == 3 * tailBytes, "the tails aren't resident");
+	}
+
+	// A texture asked for at level 0 once, then only at level 3 : level 0
+	// stays for keepFrames frames. Another one, never asked for again, goes
+	// back to its tail at the same frame.
+	{
+		const unsigned int keepFrames = 30;
+		MipResidency residency(64 << 20, keepFrames);
+		unsigned int near = residency.add(levelBytes, tail);
+		unsigned int gone = residency.add(levelBytes, tail);
+		residency.request(near, 0.0f, 1.0f);
+		residency.request(gone, 0.0f, 1.0f);
+		residency.update();
+		applyChanges(residency);
+		check(residency.residentLevel(near) == 0 && residency.residentLevel(gone) == 0, "requested levels aren't paged in");
+		for (unsigned int frame = 1; frame < keepFrames; frame++){
+			residency.request(near, 3.0f, 1.0f);
+			residency.update();
+			applyChanges(residency);
+		}
+		check(residency.residentLevel(near) == 0 && residency.residentLevel(gone) == 0, "levels are paged out before keepFrames frames");
+		residency.request(near, 3.0f, 1.0f);
+		residency.update();
+		applyChanges(residency);
+		check(residency.residentLevel(near) == 3, "a coarser request isn't followed after keepFrames frames");
+		check(residency.residentLevel(gone) == tail, "an unused texture isn't paged out after keepFrames frames");
+	}
+
+	printf("MipResidency : %s\n", passed ? "budget, priorities, tails and keepFrames checked" : "FAILED");
+	return passed;
+}
+
+// Decodes a compressed texture, as when the driver can't. The hash of the
+// pixels checks the contents of the texture, without a GPU.
+static void benchmarkDecoding(const char * path){
+	TextureData texture;
+	if (!readDDS(path, texture))
+		return;
+	TextureData decoded;
+	double start = now();
+	if (!decompressTexture(texture, decoded, 1)){
+		printf("%s : can't decode this format\n", path);
+		return;
+	}
+	double singleTime = now() - start;
+	start = now();
+	decompressTexture(texture, decoded);
+	double threadedTime = now() - start;
+
+	size_t pixels = decoded.layerSize * decoded.layers / 4;
+	printf("%s : %u x %u, %u levels, pixels hash %016llx\n", path,
+		texture.levels[0].width, texture.levels[0].height, (unsigned int)texture.levels.size(),
+		hash64(decoded.pixelData(), decoded.layerSize * decoded.layers));
+	printf("  decoding, 1 thread   : %8.2f Mpixels/s (%.2f ms)\n", pixels / singleTime * 1e-6, singleTime * 1e3);
+	printf("  decoding, %u threads : %8.2f Mpixels/s (%.2f ms)\n", ThreadPool::global().size() + 1, pixels / threadedTime * 1e-6, threadedTime * 1e3);
+}
+
+int main(int argc, char ** argv)
+{
+	if (argc < 3){
+		if (!checkMipResidency())
+			return 1;
+		const char * images[] = {"../normal_mapping/data/normal.bmp"};
+		for (size_t i = 0; i < sizeof(images) / sizeof(images[0]); i++){
+			printf("%s\n", images[i]);
+			benchmark(images[i], BLOCK_BC1, false);
+			benchmark(images[i], BLOCK_BC3, false);
+			benchmark(images[i], BLOCK_BC5, true);
+			benchmarkMipmaps(images[i]);
+		}
+		GLFWwindow * window = createHiddenContext();
+		if (window){
+			printf("%s, %s\n", (const char *)glGetString(GL_RENDERER), (const char *)glGetString(GL_VERSION));
+			for (size_t i = 0; i < sizeof(images) / sizeof(images[0]); i++)
+				benchmarkGPUMipmaps(images[i]);
+			glfwDestroyWindow(window);
+			glfwTerminate();
+		}else{
+			printf("No GL context : glGenerateMipmap is not measured\n");
+		}
+		const char * textures[] = {"../basic_shading/data/uvmap.DDS", "../normal_mapping/data/diffuse.DDS", "../normal_mapping/data/specular.DDS"};
+		for (size_t i = 0; i < sizeof(textures) / sizeof(textures[0]); i++)
+			benchmarkDecoding(textures[i]);
+		return 0;
+	}
+
+	BlockFormat format = BLOCK_BC1;
+	bool normalMap = false;
+	for (int i = 3; i < argc; i++){
+		if (strcmp(argv[i], "bc1") == 0) format = BLOCK_BC1;
+		else if (strcmp(argv[i], "bc3") == 0) format = BLOCK_BC3;
+		else if (strcmp(argv[i], "bc5") == 0) format = BLOCK_BC5;
+		else if (strcmp(argv[i], "normal") == 0) normalMap = true;
+		else{
+			printf("Unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	TextureData image, compressed;
+	if (!readImage(argv[1], image))
+		return 1;
+	double psnr = 0.0;
+	double start = now();
+	if (!compressTexture(image, format, normalMap, compressed, 0, &psnr))
+		return 1;
+	double time = now() - start;
+	if (!writeDDS(argv[2], compressed))
+		return 1;
+	printf("%s : %u x %u, %u levels in %s, %.1f ms, PSNR %.2f dB\n", argv[2],
+		compressed.levels[0].width, compressed.levels[0].height, (unsigned int)compressed.levels.size(),
+		formatNames[format], time * 1e3, psnr);
+	return 0;
+}